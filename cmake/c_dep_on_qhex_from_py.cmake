@@ -23,3 +23,39 @@ function (c_dep_on_qhex_from_py c_filename)
     endforeach (basename)
 
 endfunction (c_dep_on_qhex_from_py)
+
+# c_dep_on_kernels_from_py(c_filename py_basename table kernel1 kernel2 ...)
+# For a script generating a family of kernels: ${kernel}.qhex is printed by
+# `${py_basename}.py qhex ${kernel}`, and ${table}.h, which includes them
+# all, by `${py_basename}.py table ${kernels}`.
+function (c_dep_on_kernels_from_py c_filename py_basename table)
+
+    set(script "${CMAKE_CURRENT_SOURCE_DIR}/${py_basename}.py")
+    set(outputs "${CMAKE_CURRENT_BINARY_DIR}/${table}.h")
+
+    foreach (kernel ${ARGN})
+        set(outputs ${outputs} "${CMAKE_CURRENT_BINARY_DIR}/${kernel}.qhex")
+        add_custom_command(
+            OUTPUT "${CMAKE_CURRENT_BINARY_DIR}/${kernel}.qhex"
+            COMMAND "${PYTHON_EXECUTABLE}" "${script}" qhex ${kernel}
+                            >"${CMAKE_CURRENT_BINARY_DIR}/${kernel}.qhex"
+            DEPENDS "${script}"
+        )
+    endforeach (kernel)
+
+    add_custom_command(
+        OUTPUT "${CMAKE_CURRENT_BINARY_DIR}/${table}.h"
+        COMMAND "${PYTHON_EXECUTABLE}" "${script}" table ${ARGN}
+                        >"${CMAKE_CURRENT_BINARY_DIR}/${table}.h"
+        DEPENDS "${script}"
+    )
+
+    get_source_file_property(deps "${c_filename}" OBJECT_DEPENDS)
+    if (NOT deps)
+        unset(deps)
+    endif ()
+    set_source_files_properties(
+        "${c_filename}" PROPERTIES OBJECT_DEPENDS "${deps};${outputs}"
+    )
+
+endfunction (c_dep_on_kernels_from_py)
@@ -0,0 +1,23 @@
+# qpu_estimate (target qhex_basename1 qhex_basename2 ...)
+# Adds target, which runs tools/qpu_estimate.py over the listed kernels in
+# ${CMAKE_CURRENT_BINARY_DIR} and fails if one of them falls behind
+# tools/qpu_estimate.baseline by more than QPU_ESTIMATE_TOLERANCE percent, or
+# is missing from it.
+function (qpu_estimate target)
+
+    unset (qhexes)
+    foreach (basename ${ARGN})
+        list (APPEND qhexes "${CMAKE_CURRENT_BINARY_DIR}/${basename}.qhex")
+    endforeach (basename)
+
+    add_custom_target (
+        ${target}
+        COMMAND "${PYTHON_EXECUTABLE}"
+                "${PROJECT_SOURCE_DIR}/tools/qpu_estimate.py"
+                --baseline "${PROJECT_SOURCE_DIR}/tools/qpu_estimate.baseline"
+                --tolerance ${QPU_ESTIMATE_TOLERANCE}
+                ${qhexes}
+        DEPENDS ${qhexes}
+    )
+
+endfunction (qpu_estimate)
@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Asynchronous calls.  They queue a request, copying the arguments, and a
+ * submission thread started on the first request runs them one by one
+ * through the synchronous entry points, so that they go through the same
+ * paths (QPU, CPU, staging, the launch) as direct calls.  The queue is a
+ * ring of ASYNC_QUEUE_DEPTH requests; submitting waits for a free slot.
+ *
+ * Consecutive requests found queued together are independent operations
+ * unless one writes what another reads or writes, so the thread takes up
+ * to SGEMM_QPU_MAX_THREADS of them at once and runs them as a batch, which
+ * packs them into one launch with merged cache operations: sgemm requests
+ * as problems of the batch, and scopy and vsAbs requests the backend would
+ * run on QPU as programs of a thread each.  It never waits for more
+ * requests to do so.
+ *
+ * lock guards the queue and the state of every request; callbacks are
+ * called without it.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/called.h"
+#include "local/backend.h"
+#include "local/error.h"
+#include "local/gemm.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#define ASYNC_QUEUE_DEPTH 16
+
+enum request_op {
+    REQUEST_SGEMM,
+    REQUEST_SCOPY,
+    REQUEST_VSABS
+};
+
+struct qmkl_request {
+    enum request_op op;
+    union {
+        struct {
+            CBLAS_LAYOUT layout;
+            CBLAS_TRANSPOSE transa, transb;
+            MKL_INT m, n, k;
+            float alpha;
+            const float *a;
+            MKL_INT lda;
+            const float *b;
+            MKL_INT ldb;
+            float beta;
+            float *c;
+            MKL_INT ldc;
+        } sgemm;
+        struct {
+            MKL_INT n;
+            const float *x;
+            MKL_INT incx;
+            float *y;
+            MKL_INT incy;
+        } scopy;
+        struct {
+            MKL_INT n;
+            const float *a;
+            float *y;
+        } vsabs;
+    } u;
+    int done;
+    qmkl_request_callback_t callback;
+    void *callback_arg;
+};
+
+static struct qmkl_request *queue[ASYNC_QUEUE_DEPTH];
+static unsigned queue_head = 0, queue_len = 0;
+static unsigned pending = 0; /* queued or running */
+static int started = 0, stopping = 0;
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_free = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_done = PTHREAD_COND_INITIALIZER;
+
+static void request_run(const struct qmkl_request *req)
+{
+    switch (req->op) {
+    case REQUEST_SGEMM:
+        cblas_sgemm(req->u.sgemm.layout, req->u.sgemm.transa,
+                req->u.sgemm.transb, req->u.sgemm.m, req->u.sgemm.n,
+                req->u.sgemm.k, req->u.sgemm.alpha, req->u.sgemm.a,
+                req->u.sgemm.lda, req->u.sgemm.b, req->u.sgemm.ldb,
+                req->u.sgemm.beta, req->u.sgemm.c, req->u.sgemm.ldc);
+        break;
+    case REQUEST_SCOPY:
+        cblas_scopy(req->u.scopy.n, req->u.scopy.x, req->u.scopy.incx,
+                req->u.scopy.y, req->u.scopy.incy);
+        break;
+    case REQUEST_VSABS:
+        vsAbs(req->u.vsabs.n, req->u.vsabs.a, req->u.vsabs.y);
+        break;
+    }
+}
+
+/* The request as a row-major problem, or 0 if it is not a valid sgemm. */
+static int request_problem(const struct qmkl_request *req,
+        struct sgemm_problem *p)
+{
+    if (REQUEST_SGEMM != req->op)
+        return 0;
+
+    switch (req->u.sgemm.layout) {
+    case CblasColMajor:
+        /* Column-major C is row-major C^T = op(B)^T op(A)^T. */
+        p->transa = req->u.sgemm.transb;
+        p->transb = req->u.sgemm.transa;
+        p->m = req->u.sgemm.n;
+        p->n = req->u.sgemm.m;
+        p->a = req->u.sgemm.b;
+        p->lda = req->u.sgemm.ldb;
+        p->b = req->u.sgemm.a;
+        p->ldb = req->u.sgemm.lda;
+        break;
+    case CblasRowMajor:
+        p->transa = req->u.sgemm.transa;
+        p->transb = req->u.sgemm.transb;
+        p->m = req->u.sgemm.m;
+        p->n = req->u.sgemm.n;
+        p->a = req->u.sgemm.a;
+        p->lda = req->u.sgemm.lda;
+        p->b = req->u.sgemm.b;
+        p->ldb = req->u.sgemm.ldb;
+        break;
+    default:
+        return 0;
+    }
+    p->k = req->u.sgemm.k;
+    p->alpha = req->u.sgemm.alpha;
+    p->beta = req->u.sgemm.beta;
+    p->c = req->u.sgemm.c;
+    p->ldc = req->u.sgemm.ldc;
+    return 1;
+}
+
+/* An array of a request: rows x cols with leading dimension ld at p. */
+struct extent {
+    const float *p;
+    MKL_INT rows, cols, ld;
+};
+
+/*
+ * A request as it runs in a batch: a problem or a program, with the arrays
+ * it reads or writes, the one it writes first.
+ */
+struct batched {
+    int is_program;
+    struct sgemm_problem problem;
+    struct qpu_program program;
+    struct extent arrays[3];
+    unsigned n_arrays;
+};
+
+static void extent_set(struct extent *e, const float *p, const MKL_INT rows,
+        const MKL_INT cols, const MKL_INT ld)
+{
+    e->p = p;
+    e->rows = rows;
+    e->cols = cols;
+    e->ld = ld;
+}
+
+/* The request as it would run in a batch, or 0 if it cannot. */
+static int request_batched(const struct qmkl_request *req, struct batched *b)
+{
+    const struct sgemm_problem * const p = &b->problem;
+
+    switch (req->op) {
+    case REQUEST_SGEMM:
+        if (!request_problem(req, &b->problem))
+            return 0;
+        b->is_program = 0;
+        extent_set(&b->arrays[0], p->c, p->m, p->n, p->ldc);
+        if (CblasNoTrans == p->transa)
+            extent_set(&b->arrays[1], p->a, p->m, p->k, p->lda);
+        else
+            extent_set(&b->arrays[1], p->a, p->k, p->m, p->lda);
+        if (CblasNoTrans == p->transb)
+            extent_set(&b->arrays[2], p->b, p->k, p->n, p->ldb);
+        else
+            extent_set(&b->arrays[2], p->b, p->n, p->k, p->ldb);
+        b->n_arrays = 3;
+        return 1;
+    case REQUEST_SCOPY:
+        if (!blas_scopy_program(req->u.scopy.n, req->u.scopy.x,
+                    req->u.scopy.incx, req->u.scopy.y, req->u.scopy.incy,
+                    &b->program))
+            return 0;
+        b->is_program = 1;
+        extent_set(&b->arrays[0], req->u.scopy.y, 1, req->u.scopy.n,
+                req->u.scopy.n);
+        extent_set(&b->arrays[1], req->u.scopy.x, 1, req->u.scopy.n,
+                req->u.scopy.n);
+        b->n_arrays = 2;
+        return 1;
+    case REQUEST_VSABS:
+        if (!vm_sabs_program(req->u.vsabs.n, req->u.vsabs.a, req->u.vsabs.y,
+                    &b->program))
+            return 0;
+        b->is_program = 1;
+        extent_set(&b->arrays[0], req->u.vsabs.y, 1, req->u.vsabs.n,
+                req->u.vsabs.n);
+        extent_set(&b->arrays[1], req->u.vsabs.a, 1, req->u.vsabs.n,
+                req->u.vsabs.n);
+        b->n_arrays = 2;
+        return 1;
+    }
+    return 0;
+}
+
+/* Whether the arrays x and y meet. */
+static int overlap(const struct extent *x, const struct extent *y)
+{
+    if (x->rows <= 0 || x->cols <= 0 || y->rows <= 0 || y->cols <= 0)
+        return 0;
+    return x->p < y->p + (size_t) (y->rows - 1) * y->ld + y->cols
+           && y->p < x->p + (size_t) (x->rows - 1) * x->ld + x->cols;
+}
+
+/* Whether p writes to an array q reads or writes. */
+static int writes_to(const struct batched *p, const struct batched *q)
+{
+    unsigned i;
+
+    for (i = 0; i < q->n_arrays; i ++)
+        if (overlap(&p->arrays[0], &q->arrays[i]))
+            return 1;
+    return 0;
+}
+
+/*
+ * Whether req can run in the same batch as the n requests batched, which it
+ * is then converted to b for.
+ */
+static int coalescable(const struct qmkl_request *req,
+        const struct batched *batched, const unsigned n, struct batched *b)
+{
+    unsigned i;
+
+    if (!request_batched(req, b))
+        return 0;
+    for (i = 0; i < n; i ++)
+        if (writes_to(b, &batched[i]) || writes_to(&batched[i], b))
+            return 0;
+    return 1;
+}
+
+static struct qmkl_request* queue_pop()
+{
+    struct qmkl_request * const req = queue[queue_head];
+
+    queue_head = (queue_head + 1) % ASYNC_QUEUE_DEPTH;
+    queue_len --;
+    return req;
+}
+
+static void* submission_thread(void *arg)
+{
+    struct qmkl_request *run[SGEMM_QPU_MAX_THREADS];
+    struct batched batched[SGEMM_QPU_MAX_THREADS];
+    struct sgemm_problem problems[SGEMM_QPU_MAX_THREADS];
+    struct qpu_program programs[SGEMM_QPU_MAX_THREADS];
+
+    UNUSED(arg);
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        qmkl_request_callback_t callback;
+        unsigned n_run = 1, n_problems = 0, n_programs = 0, i;
+
+        while (queue_len == 0 && !stopping)
+            pthread_cond_wait(&cond_queued, &lock);
+        if (queue_len == 0)
+            break;
+        run[0] = queue_pop();
+        if (request_batched(run[0], &batched[0]))
+            while (n_run < SGEMM_QPU_MAX_THREADS && queue_len != 0
+                    && coalescable(queue[queue_head], batched, n_run,
+                            &batched[n_run]))
+                run[n_run ++] = queue_pop();
+        pthread_cond_broadcast(&cond_free);
+        pthread_mutex_unlock(&lock);
+
+        if (n_run == 1)
+            request_run(run[0]);
+        else {
+            for (i = 0; i < n_run; i ++) {
+                if (batched[i].is_program)
+                    programs[n_programs ++] = batched[i].program;
+                else
+                    problems[n_problems ++] = batched[i].problem;
+            }
+            sgemm_batch(problems, n_problems, 13, programs, n_programs);
+        }
+
+        /*
+         * A request completes after its callback, so that it is not
+         * released while the callback runs.
+         */
+        pthread_mutex_lock(&lock);
+        for (i = 0; i < n_run; i ++) {
+            struct qmkl_request * const req = run[i];
+
+            while ((callback = req->callback) != NULL) {
+                req->callback = NULL;
+                pthread_mutex_unlock(&lock);
+                callback(req, req->callback_arg);
+                pthread_mutex_lock(&lock);
+            }
+            req->done = 1;
+            pending --;
+        }
+        pthread_cond_broadcast(&cond_done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static qmkl_request_t submit(const struct qmkl_request *args)
+{
+    struct qmkl_request *req = malloc(sizeof(*req));
+
+    if (req == NULL)
+        error_fatal("Failed to allocate an asynchronous request\n");
+    *req = *args;
+    req->done = 0;
+    req->callback = NULL;
+    req->callback_arg = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (!started) {
+        if (pthread_create(&thread, NULL, submission_thread, NULL))
+            error_fatal("Failed to start the submission thread\n");
+        started = 1;
+    }
+    while (queue_len == ASYNC_QUEUE_DEPTH)
+        pthread_cond_wait(&cond_free, &lock);
+    queue[(queue_head + queue_len) % ASYNC_QUEUE_DEPTH] = req;
+    queue_len ++;
+    pending ++;
+    pthread_cond_signal(&cond_queued);
+    pthread_mutex_unlock(&lock);
+
+    return req;
+}
+
+qmkl_request_t cblas_sgemm_async(
+    const CBLAS_LAYOUT layout,
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc)
+{
+    struct qmkl_request req;
+
+    req.op = REQUEST_SGEMM;
+    req.u.sgemm.layout = layout;
+    req.u.sgemm.transa = transa;
+    req.u.sgemm.transb = transb;
+    req.u.sgemm.m = m;
+    req.u.sgemm.n = n;
+    req.u.sgemm.k = k;
+    req.u.sgemm.alpha = alpha;
+    req.u.sgemm.a = a;
+    req.u.sgemm.lda = lda;
+    req.u.sgemm.b = b;
+    req.u.sgemm.ldb = ldb;
+    req.u.sgemm.beta = beta;
+    req.u.sgemm.c = c;
+    req.u.sgemm.ldc = ldc;
+    return submit(&req);
+}
+
+qmkl_request_t cblas_scopy_async(
+    const MKL_INT n,
+    const float *x,
+    const MKL_INT incx,
+    float *y,
+    const MKL_INT incy)
+{
+    struct qmkl_request req;
+
+    req.op = REQUEST_SCOPY;
+    req.u.scopy.n = n;
+    req.u.scopy.x = x;
+    req.u.scopy.incx = incx;
+    req.u.scopy.y = y;
+    req.u.scopy.incy = incy;
+    return submit(&req);
+}
+
+qmkl_request_t vsAbs_async(MKL_INT n, const float *a, float *y)
+{
+    struct qmkl_request req;
+
+    req.op = REQUEST_VSABS;
+    req.u.vsabs.n = n;
+    req.u.vsabs.a = a;
+    req.u.vsabs.y = y;
+    return submit(&req);
+}
+
+int qmkl_test(qmkl_request_t request)
+{
+    int done;
+
+    pthread_mutex_lock(&lock);
+    done = request->done;
+    pthread_mutex_unlock(&lock);
+
+    if (done)
+        free(request);
+    return done;
+}
+
+void qmkl_wait(qmkl_request_t request)
+{
+    pthread_mutex_lock(&lock);
+    while (!request->done)
+        pthread_cond_wait(&cond_done, &lock);
+    pthread_mutex_unlock(&lock);
+
+    free(request);
+}
+
+void qmkl_wait_all()
+{
+    pthread_mutex_lock(&lock);
+    while (pending != 0)
+        pthread_cond_wait(&cond_done, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+void qmkl_request_on_complete(qmkl_request_t request,
+        qmkl_request_callback_t callback, void *arg)
+{
+    int done;
+
+    pthread_mutex_lock(&lock);
+    done = request->done;
+    if (!done) {
+        request->callback = callback;
+        request->callback_arg = arg;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (done)
+        callback(request, arg);
+}
+
+void async_init()
+{
+    if (++called.async != 1)
+        return;
+}
+
+void async_finalize()
+{
+    if (--called.async != 0)
+        return;
+
+    if (!started)
+        return;
+
+    /* Requests still queued are run first. */
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&cond_queued);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    started = 0;
+    stopping = 0;
+}
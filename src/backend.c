@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "qmkl.h"
+#include "local/called.h"
+#include "local/backend.h"
+#include "local/error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const struct backend_ops backend_ops_qpu = {
+    .sgemm = blas_sgemm_qpu,
+    .scopy = blas_scopy_qpu,
+    .sabs = vm_sabs_qpu
+};
+
+static const struct backend_ops backend_ops_cpu = {
+    .sgemm = blas_sgemm_cpu,
+    .scopy = blas_scopy_cpu,
+    .sabs = vm_sabs_cpu
+};
+
+static const struct backend_ops backend_ops_auto = {
+    .sgemm = blas_sgemm_auto,
+    .scopy = blas_scopy_auto,
+    .sabs = vm_sabs_auto
+};
+
+static const struct backend_ops backend_ops_hybrid = {
+    .sgemm = blas_sgemm_hybrid,
+    .scopy = blas_scopy_auto,
+    .sabs = vm_sabs_auto
+};
+
+const struct backend_ops *backend_ops = &backend_ops_cpu;
+static enum qmkl_backend backend_cur = QMKL_BACKEND_CPU;
+static int qpu_available = 0;
+
+/*
+ * The mailbox lives on /dev/vcio and VCSM on /dev/vcsm or /dev/vcsm-cma.
+ * The emulator in src/emu is always there.
+ */
+static int qpu_probe()
+{
+#ifndef QMKL_EMULATOR
+    if (access("/dev/vcio", R_OK | W_OK))
+        return 0;
+    if (access("/dev/vcsm", R_OK | W_OK) && access("/dev/vcsm-cma", R_OK | W_OK))
+        return 0;
+#endif
+    return !0;
+}
+
+void backend_init()
+{
+    const char *env;
+
+    if (++called.backend != 1)
+        return;
+
+    env = getenv("QMKL_BACKEND");
+    if (env == NULL || !strcmp(env, "") || !strcmp(env, "auto")) {
+        qpu_available = qpu_probe();
+    } else if (!strcmp(env, "qpu") || !strcmp(env, "hybrid")) {
+        qpu_available = qpu_probe();
+        if (!qpu_available)
+            error_fatal("QMKL_BACKEND is %s but QPU is not accessible\n", env);
+    } else if (!strcmp(env, "cpu")) {
+        qpu_available = 0;
+    } else
+        error_fatal("Invalid QMKL_BACKEND: %s\n", env);
+
+    if (env != NULL && !strcmp(env, "qpu"))
+        qmkl_set_backend(QMKL_BACKEND_QPU);
+    else if (env != NULL && !strcmp(env, "hybrid"))
+        qmkl_set_backend(QMKL_BACKEND_HYBRID);
+    else
+        qmkl_set_backend(qpu_available ? QMKL_BACKEND_AUTO : QMKL_BACKEND_CPU);
+}
+
+void backend_finalize()
+{
+    if (--called.backend != 0)
+        return;
+
+    qpu_available = 0;
+}
+
+int backend_qpu_available()
+{
+    return qpu_available;
+}
+
+int qmkl_backend_available(const enum qmkl_backend backend)
+{
+    switch (backend) {
+    case QMKL_BACKEND_QPU:
+    case QMKL_BACKEND_AUTO:
+    case QMKL_BACKEND_HYBRID:
+        return qpu_available;
+    case QMKL_BACKEND_CPU:
+        return !0;
+    }
+    return 0;
+}
+
+int qmkl_set_backend(const enum qmkl_backend backend)
+{
+    if (!qmkl_backend_available(backend))
+        return -1;
+
+    switch (backend) {
+    case QMKL_BACKEND_QPU:
+        backend_ops = &backend_ops_qpu;
+        break;
+    case QMKL_BACKEND_CPU:
+        backend_ops = &backend_ops_cpu;
+        break;
+    case QMKL_BACKEND_AUTO:
+        backend_ops = &backend_ops_auto;
+        break;
+    case QMKL_BACKEND_HYBRID:
+        backend_ops = &backend_ops_hybrid;
+        break;
+    }
+    backend_cur = backend;
+    return 0;
+}
+
+enum qmkl_backend qmkl_get_backend()
+{
+    return backend_cur;
+}
+
+const char* qmkl_backend_name(const enum qmkl_backend backend)
+{
+    switch (backend) {
+    case QMKL_BACKEND_QPU:
+        return "qpu";
+    case QMKL_BACKEND_CPU:
+        return "cpu";
+    case QMKL_BACKEND_AUTO:
+        return "auto";
+    case QMKL_BACKEND_HYBRID:
+        return "hybrid";
+    }
+    return "unknown";
+}
@@ -10,6 +10,7 @@
 #include "qmkl.h"
 #include "local/common.h"
 #include "local/called.h"
+#include "local/backend.h"
 #include "local/error.h"
 #include <rpimemmgr.h>
 #include <stdio.h>
@@ -19,13 +20,15 @@
 static const unsigned code_scopy[] = {
 #include "scopy.qhex"
 };
+static struct qpu_code code_scopy_resident = {code_scopy, sizeof(code_scopy), 0};
 
 void blas_copy_init()
 {
     if (++called.blas_copy != 1)
         return;
 
-    unif_and_code_size_req(3 * (32 / 8), sizeof(code_scopy));
+    unif_size_req(QPU_PROGRAM_UNIF_LEN * (32 / 8));
+    code_resident_req(&code_scopy_resident);
 }
 
 void blas_copy_finalize()
@@ -34,16 +37,44 @@ void blas_copy_finalize()
         return;
 }
 
-void cblas_scopy(
+/* Sets prog to y = x for n the kernel can handle. */
+static void scopy_program(const MKL_INT n, const float *x, float *y,
+        struct qpu_program *prog)
+{
+    const size_t size = n * sizeof(*x);
+
+    prog->code = code_scopy_resident.gpu;
+    prog->unif[0] = n / (4096 / 4) - 1;
+    prog->unif[1] = get_ptr_gpu_from_ptr_cpu(x);
+    prog->unif[2] = get_ptr_gpu_from_ptr_cpu(y);
+    prog->unif_len = 5;
+
+    prog->n_clean = prog->n_invalidate = 0;
+    if (ptr_is_cpu_cached(x))
+        cache_region_1d(&prog->r[prog->n_clean ++], QMKL_CACHE_OP_CLEAN,
+                x, size);
+    if (ptr_is_cpu_cached(y)) {
+        cache_region_1d(&prog->r[prog->n_clean ++], QMKL_CACHE_OP_CLEAN,
+                y, size);
+        cache_region_1d(&prog->r[prog->n_clean + prog->n_invalidate ++],
+                QMKL_CACHE_OP_INVALIDATE, y, size);
+    }
+}
+
+void blas_scopy_qpu(
     const MKL_INT n,
     const float *x,
     const MKL_INT incx,
     float *y,
     const MKL_INT incy)
 {
-    MKL_UINT x_gpu = get_ptr_gpu_from_ptr_cpu(x);
-    MKL_UINT y_gpu = get_ptr_gpu_from_ptr_cpu(y);
-    uint32_t *p = NULL;
+    struct qpu_program prog;
+
+    /* Staging a copy through bounce buffers would only add copies. */
+    if (!ptr_is_gpu_accessible(x) || !ptr_is_gpu_accessible(y)) {
+        blas_scopy_cpu(n, x, incx, y, incy);
+        return;
+    }
 
     if (incx != 1)
         error_fatal("incx must be 1 for now\n");
@@ -54,15 +85,56 @@ void cblas_scopy(
     if (n < 8192)
         error_fatal("n must be greater than 8192\n");
 
-    p = unif_common_cpu;
-    unif_add_uint(n / (4096 / 4) - 1, &p);
-    unif_add_uint(x_gpu,              &p);
-    unif_add_uint(y_gpu,              &p);
+    scopy_program(n, x, y, &prog);
+    qpu_program_launch(&prog);
+}
+
+int blas_scopy_program(
+    const MKL_INT n,
+    const float *x,
+    const MKL_INT incx,
+    float *y,
+    const MKL_INT incy,
+    struct qpu_program *prog)
+{
+    if (blas_scopy_cpu == backend_ops->scopy || !backend_qpu_available())
+        return 0;
+    if (incx != 1 || incy != 1 || n % 4096 != 0 || n < 8192
+            || !ptr_is_gpu_accessible(x) || !ptr_is_gpu_accessible(y))
+        return 0;
+
+    scopy_program(n, x, y, prog);
+    return 1;
+}
+
+void blas_scopy_auto(
+    const MKL_INT n,
+    const float *x,
+    const MKL_INT incx,
+    float *y,
+    const MKL_INT incy)
+{
+    const int qpu_shape = incx == 1 && incy == 1 && n % 4096 == 0 && n >= 8192;
 
-    memcpy(code_common_cpu, code_scopy, sizeof(code_scopy));
+    if (n > 0 && (ptr_is_gpu_only(x) || ptr_is_gpu_only(y))) {
+        if (!qpu_shape || !ptr_is_gpu_accessible(x)
+                || !ptr_is_gpu_accessible(y)) {
+            xerbla_local(ptr_is_gpu_only(x) ? 2 : 4);
+            return;
+        }
+        blas_scopy_qpu(n, x, incx, y, incy);
+    } else if (backend_qpu_available() && qpu_shape)
+        blas_scopy_qpu(n, x, incx, y, incy);
+    else
+        blas_scopy_cpu(n, x, incx, y, incy);
+}
 
-    rpimemmgr_cache_op_multiple(2, QMKL_CACHE_OP_CLEAN, x, n * sizeof(*x),
-                                   QMKL_CACHE_OP_CLEAN, y, n * sizeof(*y));
-    launch_qpu_code_mailbox(1, 0, 5e3, unif_common_gpu, code_common_gpu);
-    rpimemmgr_cache_op(QMKL_CACHE_OP_INVALIDATE, y, n * sizeof(*y));
+void cblas_scopy(
+    const MKL_INT n,
+    const float *x,
+    const MKL_INT incx,
+    float *y,
+    const MKL_INT incy)
+{
+    backend_ops->scopy(n, x, incx, y, incy);
 }
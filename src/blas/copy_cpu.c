@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif /* _OPENMP */
+
+void blas_scopy_cpu(
+    const MKL_INT n,
+    const float *x,
+    const MKL_INT incx,
+    float *y,
+    const MKL_INT incy)
+{
+    int i;
+
+    if (n <= 0)
+        return;
+
+    if (incx == 1 && incy == 1) {
+#pragma omp parallel
+        {
+            int thread_num = 0, num_threads = 1;
+            MKL_INT offset, len;
+#ifdef _OPENMP
+            thread_num = omp_get_thread_num();
+            num_threads = omp_get_num_threads();
+#endif /* _OPENMP */
+            offset = (MKL_INT) ((int64_t) n * thread_num / num_threads);
+            len = (MKL_INT) ((int64_t) n * (thread_num + 1) / num_threads) - offset;
+            memcpy(y + offset, x + offset, len * sizeof(*x));
+        }
+        return;
+    }
+
+    /* Negative increments start from the other end, as in the reference BLAS. */
+    if (incx < 0)
+        x += (1 - n) * incx;
+    if (incy < 0)
+        y += (1 - n) * incy;
+
+#pragma omp parallel for private(i)
+    for (i = 0; i < n; i ++)
+        y[i * incy] = x[i * incx];
+}
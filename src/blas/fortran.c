@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Entry points of the reference BLAS (Fortran 77) ABI: arguments by
+ * reference and column-major.  Callers such as numpy allocate with malloc;
+ * the QPU paths stage such arrays through bounce buffers or leave the call
+ * to CPU.
+ */
+
+#include "qmkl.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static int trans_of(const char c, CBLAS_TRANSPOSE *trans)
+{
+    switch (c) {
+    case 'N': case 'n':
+        *trans = CblasNoTrans;
+        return 0;
+    case 'T': case 't':
+    case 'C': case 'c':
+        *trans = CblasTrans;
+        return 0;
+    }
+    return -1;
+}
+
+void sgemm_(
+    const char *transa,
+    const char *transb,
+    const MKL_INT *m,
+    const MKL_INT *n,
+    const MKL_INT *k,
+    const float *alpha,
+    const float *a,
+    const MKL_INT *lda,
+    const float *b,
+    const MKL_INT *ldb,
+    const float *beta,
+    float *c,
+    const MKL_INT *ldc)
+{
+    CBLAS_TRANSPOSE ta = CblasNoTrans, tb = CblasNoTrans;
+    int info = 0;
+
+    if (trans_of(*transa, &ta))
+        info = 1;
+    else if (trans_of(*transb, &tb))
+        info = 2;
+    else if (*m < 0)
+        info = 3;
+    else if (*n < 0)
+        info = 4;
+    else if (*k < 0)
+        info = 5;
+    else if (*lda < MAX(1, CblasNoTrans == ta ? *m : *k))
+        info = 8;
+    else if (*ldb < MAX(1, CblasNoTrans == tb ? *k : *n))
+        info = 10;
+    else if (*ldc < MAX(1, *m))
+        info = 13;
+    if (info) {
+        xerbla("SGEMM ", &info, 6);
+        return;
+    }
+
+    if (*m == 0 || *n == 0 || ((*alpha == 0 || *k == 0) && *beta == 1))
+        return;
+
+    cblas_sgemm(CblasColMajor, ta, tb, *m, *n, *k, *alpha, a, *lda,
+                b, *ldb, *beta, c, *ldc);
+}
+
+void scopy_(
+    const MKL_INT *n,
+    const float *x,
+    const MKL_INT *incx,
+    float *y,
+    const MKL_INT *incy)
+{
+    if (*n <= 0)
+        return;
+
+    cblas_scopy(*n, x, *incx, y, *incy);
+}
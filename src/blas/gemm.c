@@ -10,26 +10,134 @@
 #include "qmkl.h"
 #include "local/common.h"
 #include "local/called.h"
+#include "local/backend.h"
+#include "local/gemm.h"
 #include "local/error.h"
 #include <rpimemmgr.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static const unsigned code_sgemm_RNN[] = {
-#include "sgemm_RNN.qhex"
-};
-static const unsigned code_sgemm_RNT[] = {
-#include "sgemm_RNT.qhex"
-};
-static const unsigned code_sgemm_RTN[] = {
-#include "sgemm_RTN.qhex"
+/*
+ * How a kernel merges its tiles into C, from the most general to the most
+ * specialized.
+ */
+enum sgemm_epilogue {
+    SGEMM_EPILOGUE_AXPBY,           /* alpha * AB + beta * C */
+    SGEMM_EPILOGUE_BETA0,           /* alpha * AB, ignoring what is in C */
+    SGEMM_EPILOGUE_ALPHA1_BETA0,    /* AB, without loading C */
+    SGEMM_EPILOGUE_ALPHA1_BETA1     /* AB + C */
 };
-static const unsigned code_sgemm_RTT[] = {
-#include "sgemm_RTT.qhex"
+
+struct sgemm_kernel {
+    CBLAS_TRANSPOSE transa, transb;
+    unsigned tile_p, tile_r;
+    enum sgemm_epilogue epilogue;
+    struct qpu_code code;
 };
 
-static const int unif_len_1th = 14;
+/* code_sgemm_* and sgemm_kernels[], generated by sgemm.py table. */
+#include "sgemm_kernels.h"
+
+#define N_SGEMM_KERNELS (sizeof(sgemm_kernels) / sizeof(sgemm_kernels[0]))
+
+#define CACHE_LINE_SIZE 64
+
+static const int unif_len_1th = SGEMM_QPU_UNIF_LEN_1TH;
+
+static int sgemm_kernel_trans(const struct sgemm_kernel *kernel,
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb)
+{
+    return (CblasNoTrans != kernel->transa) == (CblasNoTrans != transa)
+        && (CblasNoTrans != kernel->transb) == (CblasNoTrans != transb);
+}
+
+static int sgemm_epilogue_fits(const enum sgemm_epilogue epilogue,
+        const float alpha, const float beta)
+{
+    switch (epilogue) {
+        case SGEMM_EPILOGUE_AXPBY:
+            return 1;
+        case SGEMM_EPILOGUE_BETA0:
+            return beta == 0;
+        case SGEMM_EPILOGUE_ALPHA1_BETA0:
+            return alpha == 1 && beta == 0;
+        case SGEMM_EPILOGUE_ALPHA1_BETA1:
+            return alpha == 1 && beta == 1;
+    }
+    return 0;
+}
+
+/*
+ * The kernel tile for the shape: the one padding C to the fewest elements.
+ * The half tiles (16x32, 32x16) run at about 6/7 of the FLOPs per cycle of
+ * the full ones (see tools/qpu_estimate.baseline), so their padded area is
+ * weighted by 7/6; on a tie the full tile, listed first, wins.
+ */
+void sgemm_qpu_tile(const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb, const MKL_INT m, const MKL_INT n,
+        unsigned *tile_p, unsigned *tile_r)
+{
+    uint64_t cost, best = UINT64_MAX;
+    unsigned i;
+
+    for (i = 0; i < N_SGEMM_KERNELS; i ++) {
+        const struct sgemm_kernel *kernel = &sgemm_kernels[i];
+        const unsigned tp = kernel->tile_p, tr = kernel->tile_r;
+
+        if (!sgemm_kernel_trans(kernel, transa, transb))
+            continue;
+        cost = (uint64_t) ((m + tp - 1) / tp * tp) * ((n + tr - 1) / tr * tr)
+            * (tp * tr < 16 * 64 ? 7 : 6);
+        if (cost < best) {
+            best = cost;
+            *tile_p = tp;
+            *tile_r = tr;
+        }
+    }
+}
+
+/* The kernel tile for the shape and the partition of C in it. */
+static void sgemm_qpu_partition(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const unsigned max_threads,
+    const int split_k,
+    struct sgemm_partition *part)
+{
+    unsigned tile_p, tile_r;
+
+    sgemm_qpu_tile(transa, transb, m, n, &tile_p, &tile_r);
+    sgemm_partition(part, m, n, k, tile_p, tile_r, max_threads, split_k);
+}
+
+unsigned sgemm_qpu_shape(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const unsigned max_threads,
+    const int split_k,
+    unsigned *tile_m,
+    unsigned *tile_n,
+    unsigned *tile_k)
+{
+    struct sgemm_partition part;
+    unsigned i, rows, j, cols, l;
+
+    sgemm_qpu_partition(transa, transb, m, n, k, max_threads, split_k, &part);
+
+    /* The first block and slice are the largest; blocks in whole tiles. */
+    sgemm_partition_block(&part, 0, &i, &rows, &j, &cols);
+    sgemm_partition_slice(&part, 0, &l, tile_k);
+    *tile_m = (rows + part.tile_p - 1) / part.tile_p * part.tile_p;
+    *tile_n = (cols + part.tile_r - 1) / part.tile_r * part.tile_r;
+    return sgemm_partition_threads(&part);
+}
 
 
 void blas_gemm_init()
@@ -37,23 +145,51 @@ void blas_gemm_init()
     if (++called.blas_gemm != 1)
         return;
 
-    unif_and_code_size_req(unif_len_1th * (32 / 8), sizeof(code_sgemm_RNN));
-    unif_and_code_size_req(unif_len_1th * (32 / 8), sizeof(code_sgemm_RNT));
-    unif_and_code_size_req(unif_len_1th * (32 / 8), sizeof(code_sgemm_RTN));
-    unif_and_code_size_req(unif_len_1th * (32 / 8), sizeof(code_sgemm_RTT));
+    unsigned i;
+
+    sgemm_dispatch_init();
+    unif_size_req(SGEMM_QPU_MAX_THREADS * unif_len_1th * (32 / 8));
+    for (i = 0; i < N_SGEMM_KERNELS; i ++)
+        code_resident_req(&sgemm_kernels[i].code);
 }
 
 void blas_gemm_finalize()
 {
     if (--called.blas_gemm != 0)
         return;
+
+    sgemm_hybrid_finalize();
+    sgemm_dispatch_finalize();
 }
 
-static void cblas_sgemm_RNN(
+/*
+ * The cache operation for C before a launch.  With beta = 0 the kernel
+ * ignores what is in memory, so the CPU caches are only invalidated, which
+ * drops dirty lines instead of writing them back, as long as the rows of C
+ * share no cache line with other data.
+ */
+enum qmkl_cache_op sgemm_qpu_c_cache_op(const float beta, const float *c,
+        const MKL_INT n, const MKL_INT ldc)
+{
+    if (beta == 0 && (uintptr_t) c % CACHE_LINE_SIZE == 0
+            && n * sizeof(*c) % CACHE_LINE_SIZE == 0
+            && ldc * sizeof(*c) % CACHE_LINE_SIZE == 0)
+        return QMKL_CACHE_OP_INVALIDATE;
+    return QMKL_CACHE_OP_CLEAN;
+}
+
+/*
+ * Adds the cleaning of op(A) (P x Q), op(B) (Q x R) and C (P x R) before a
+ * launch to r, and returns the number of regions added, at most 3.
+ * Uncached and GPU-only memory has nothing in the CPU caches.
+ */
+unsigned sgemm_qpu_clean_regions(
+    struct cache_region *r,
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
     const MKL_INT m,
     const MKL_INT n,
     const MKL_INT k,
-    const float alpha,
     const float *a,
     const MKL_INT lda,
     const float *b,
@@ -62,104 +198,44 @@ static void cblas_sgemm_RNN(
     float *c,
     const MKL_INT ldc)
 {
-    MKL_UINT a_gpu = get_ptr_gpu_from_ptr_cpu(a);
-    MKL_UINT b_gpu = get_ptr_gpu_from_ptr_cpu(b);
-    MKL_UINT c_gpu = get_ptr_gpu_from_ptr_cpu(c);
-    uint32_t *p = NULL;
-
     const unsigned P = m;
     const unsigned Q = k;
     const unsigned R = n;
-    const float ALPHA = alpha;
-    const float BETA = beta;
-
-    unsigned r_div = 6;
-    if (R < r_div*64) r_div = 4;
-    if (R < r_div*64) r_div = 3;
-    if (R < r_div*64) r_div = 2;
-    if (R < r_div*64) r_div = 1;
-
-    unsigned p_div = 12 / r_div;
-    for (; 2 <= p_div; --p_div) {
-        if (P >= p_div*16) break;
+    unsigned i = 0;
+
+    if (ptr_is_cpu_cached(a)) {
+        r[i].op = QMKL_CACHE_OP_CLEAN;
+        r[i].p = a;
+        r[i].height = CblasNoTrans == transa ? P : Q;
+        r[i].width = (CblasNoTrans == transa ? Q : P) * 4;
+        r[i].stride = lda * 4;
+        i ++;
     }
-
-    const unsigned n_threads = p_div * r_div;
-
-    memcpy(code_common_cpu, code_sgemm_RNN, sizeof(code_sgemm_RNN));
-    p = unif_common_cpu;
-    {
-        unsigned th, i, j;
-        for (th = 0; th < n_threads; th ++) {
-            unif_set_uint (p + th * unif_len_1th +  0, (unsigned) ((unsigned*) unif_common_gpu + th * unif_len_1th));
-            unif_set_uint (p + th * unif_len_1th +  7, lda * (32 / 8));
-            unif_set_uint (p + th * unif_len_1th +  8, ldb * (32 / 8));
-            unif_set_uint (p + th * unif_len_1th +  9, ldc * (32 / 8));
-            unif_set_float(p + th * unif_len_1th + 10, ALPHA);
-            unif_set_float(p + th * unif_len_1th + 11, BETA);
-            unif_set_uint (p + th * unif_len_1th + 12, th);
-            unif_set_uint (p + th * unif_len_1th + 13, n_threads);
-        }
-        th = 0;
-        const unsigned P_up = P / 16;
-        const unsigned h = (P_up + p_div - 1) / p_div;
-        const unsigned h_len = p_div - (h * p_div - P_up);
-        const unsigned R_up = R / 64;
-        const unsigned w = (R_up + r_div - 1) / r_div;
-        const unsigned w_len = r_div - (w * r_div - R_up);
-        unsigned h_acc = 0;
-        for (i = 0; i < p_div; i ++) {
-            unsigned hi = 0;
-            if (i == p_div-1) {
-                hi = P - h_acc;
-            } else {
-                hi = i < h_len ? 16 * h : 16 * (h-1);
-            }
-            unsigned w_acc = 0;
-            for (j = 0; j < r_div; j ++) {
-                unsigned wj = 0;
-                if (j == r_div-1) {
-                    wj = R - w_acc;
-                } else {
-                    wj = j < w_len ? 64 * w : 64 * (w-1);
-                }
-                unif_set_uint(p + th * unif_len_1th +  1, hi);
-                unif_set_uint(p + th * unif_len_1th +  2, Q);
-                unif_set_uint(p + th * unif_len_1th +  3, wj);
-                unif_set_uint(p + th * unif_len_1th +  4, (unsigned) ((unsigned*)a_gpu + h_acc * lda        ));
-                unif_set_uint(p + th * unif_len_1th +  5, (unsigned) ((unsigned*)b_gpu +               w_acc));
-                unif_set_uint(p + th * unif_len_1th +  6, (unsigned) ((unsigned*)c_gpu + h_acc * ldc + w_acc));
-                th ++;
-                w_acc += wj;
-            }
-            h_acc += hi;
-        }
+    if (ptr_is_cpu_cached(b)) {
+        r[i].op = QMKL_CACHE_OP_CLEAN;
+        r[i].p = b;
+        r[i].height = CblasNoTrans == transb ? Q : R;
+        r[i].width = (CblasNoTrans == transb ? R : Q) * 4;
+        r[i].stride = ldb * 4;
+        i ++;
+    }
+    if (ptr_is_cpu_cached(c)) {
+        r[i].op = sgemm_qpu_c_cache_op(beta, c, n, ldc);
+        r[i].p = c;
+        r[i].height = P;
+        r[i].width = R * 4;
+        r[i].stride = ldc * 4;
+        i ++;
     }
-    rpimemmgr_cache_op_2_multiple(3, QMKL_CACHE_OP_CLEAN, a, P, Q * 4, lda * 4,
-                                     QMKL_CACHE_OP_CLEAN, b, Q, R * 4, ldb * 4,
-                                     QMKL_CACHE_OP_CLEAN, c, P, R * 4, ldc * 4);
-    launch_qpu_code_mailbox(n_threads, 0, 5e3,
-                            (unsigned*) unif_common_gpu +  0 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  1 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  2 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  3 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  4 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  5 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  6 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  7 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  8 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  9 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 10 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 11 * unif_len_1th, code_common_gpu
-    );
-    rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, c, P, R * 4, ldc * 4);
+    return i;
 }
 
-static void cblas_sgemm_RNT(
+void sgemm_qpu_clean(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
     const MKL_INT m,
     const MKL_INT n,
     const MKL_INT k,
-    const float alpha,
     const float *a,
     const MKL_INT lda,
     const float *b,
@@ -168,36 +244,75 @@ static void cblas_sgemm_RNT(
     float *c,
     const MKL_INT ldc)
 {
-    MKL_UINT a_gpu = get_ptr_gpu_from_ptr_cpu(a);
-    MKL_UINT b_gpu = get_ptr_gpu_from_ptr_cpu(b);
-    MKL_UINT c_gpu = get_ptr_gpu_from_ptr_cpu(c);
-    uint32_t *p = NULL;
+    struct cache_region r[3];
 
-    const unsigned P = m;
-    const unsigned Q = k;
-    const unsigned R = n;
-    const float ALPHA = alpha;
-    const float BETA = beta;
-
-    unsigned r_div = 6;
-    if (R < r_div*64) r_div = 4;
-    if (R < r_div*64) r_div = 3;
-    if (R < r_div*64) r_div = 2;
-    if (R < r_div*64) r_div = 1;
+    cache_regions_flush(r, sgemm_qpu_clean_regions(r, transa, transb, m, n, k,
+                a, lda, b, ldb, beta, c, ldc));
+}
 
-    unsigned p_div = 12 / r_div;
-    for (; 2 <= p_div; --p_div) {
-        if (P >= p_div*16) break;
+MKL_UINT sgemm_qpu_code_gpu(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const float alpha,
+    const float beta)
+{
+    const struct sgemm_kernel *best = NULL;
+    unsigned i, tile_p, tile_r;
+
+    /* The most specialized epilogue for alpha and beta, in the tile. */
+    sgemm_qpu_tile(transa, transb, m, n, &tile_p, &tile_r);
+    for (i = 0; i < N_SGEMM_KERNELS; i ++) {
+        const struct sgemm_kernel *kernel = &sgemm_kernels[i];
+
+        if (sgemm_kernel_trans(kernel, transa, transb)
+                && kernel->tile_p == tile_p && kernel->tile_r == tile_r
+                && sgemm_epilogue_fits(kernel->epilogue, alpha, beta)
+                && (best == NULL || kernel->epilogue > best->epilogue))
+            best = kernel;
     }
+    return best->code.gpu;
+}
+
+/*
+ * Writes the uniforms of the threads of the partition.  With k_div > 1,
+ * slice l of k goes into the rows l * m to (l + 1) * m - 1 of C.
+ */
+static unsigned sgemm_qpu_unif_set_part(
+    uint32_t *unif_cpu,
+    const MKL_UINT unif_gpu,
+    const struct sgemm_partition *part,
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const float alpha,
+    const MKL_UINT a_gpu,
+    const MKL_INT lda,
+    const MKL_UINT b_gpu,
+    const MKL_INT ldb,
+    const float beta,
+    const MKL_UINT c_gpu,
+    const MKL_INT ldc)
+{
+    uint32_t *p = unif_cpu;
+
+    const float ALPHA = alpha;
+    const float BETA = beta;
 
-    const unsigned n_threads = p_div * r_div;
+    const unsigned n_threads = sgemm_partition_threads(part);
 
-    memcpy(code_common_cpu, code_sgemm_RNT, sizeof(code_sgemm_RNT));
-    p = unif_common_cpu;
     {
-        unsigned th, i, j;
+        unsigned th, slice, i, rows, j, cols, l, depth;
         for (th = 0; th < n_threads; th ++) {
-            unif_set_uint (p + th * unif_len_1th +  0, (unsigned) ((unsigned*) unif_common_gpu + th * unif_len_1th));
+            sgemm_partition_block(part, th, &i, &rows, &j, &cols);
+            slice = sgemm_partition_slice(part, th, &l, &depth);
+            unif_set_uint (p + th * unif_len_1th +  0, unif_gpu + th * unif_len_1th * (32 / 8));
+            unif_set_uint (p + th * unif_len_1th +  1, rows);
+            unif_set_uint (p + th * unif_len_1th +  2, depth);
+            unif_set_uint (p + th * unif_len_1th +  3, cols);
+            unif_set_uint (p + th * unif_len_1th +  4, a_gpu + (CblasNoTrans == transa ? i * lda + l : l * lda + i) * (32 / 8));
+            unif_set_uint (p + th * unif_len_1th +  5, b_gpu + (CblasNoTrans == transb ? l * ldb + j : j * ldb + l) * (32 / 8));
+            unif_set_uint (p + th * unif_len_1th +  6, c_gpu + ((slice * part->m + i) * ldc + j) * (32 / 8));
             unif_set_uint (p + th * unif_len_1th +  7, lda * (32 / 8));
             unif_set_uint (p + th * unif_len_1th +  8, ldb * (32 / 8));
             unif_set_uint (p + th * unif_len_1th +  9, ldc * (32 / 8));
@@ -206,66 +321,62 @@ static void cblas_sgemm_RNT(
             unif_set_uint (p + th * unif_len_1th + 12, th);
             unif_set_uint (p + th * unif_len_1th + 13, n_threads);
         }
-        th = 0;
-        const unsigned P_up = P / 16;
-        const unsigned h = (P_up + p_div - 1) / p_div;
-        const unsigned h_len = p_div - (h * p_div - P_up);
-        const unsigned R_up = R / 64;
-        const unsigned w = (R_up + r_div - 1) / r_div;
-        const unsigned w_len = r_div - (w * r_div - R_up);
-        unsigned h_acc = 0;
-        for (i = 0; i < p_div; i ++) {
-            unsigned hi = 0;
-            if (i == p_div-1) {
-                hi = P - h_acc;
-            } else {
-                hi = i < h_len ? 16 * h : 16 * (h-1);
-            }
-            unsigned w_acc = 0;
-            for (j = 0; j < r_div; j ++) {
-                unsigned wj = 0;
-                if (j == r_div-1) {
-                    wj = R - w_acc;
-                } else {
-                    wj = j < w_len ? 64 * w : 64 * (w-1);
-                }
-                unif_set_uint(p + th * unif_len_1th +  1, hi);
-                unif_set_uint(p + th * unif_len_1th +  2, Q);
-                unif_set_uint(p + th * unif_len_1th +  3, wj);
-                unif_set_uint(p + th * unif_len_1th +  4, (unsigned) ((unsigned*)a_gpu + h_acc * lda        ));
-                unif_set_uint(p + th * unif_len_1th +  5, (unsigned) ((unsigned*)b_gpu + w_acc * ldb        ));
-                unif_set_uint(p + th * unif_len_1th +  6, (unsigned) ((unsigned*)c_gpu + h_acc * ldc + w_acc));
-                th ++;
-                w_acc += wj;
-            }
-            h_acc += hi;
-        }
     }
-    rpimemmgr_cache_op_2_multiple(3, QMKL_CACHE_OP_CLEAN, a, P, Q * 4, lda * 4,
-                                     QMKL_CACHE_OP_CLEAN, b, R, Q * 4, ldb * 4,
-                                     QMKL_CACHE_OP_CLEAN, c, P, R * 4, ldc * 4);
-    launch_qpu_code_mailbox(n_threads, 0, 5e3,
-                            (unsigned*) unif_common_gpu +  0 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  1 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  2 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  3 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  4 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  5 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  6 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  7 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  8 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  9 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 10 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 11 * unif_len_1th, code_common_gpu
-    );
-    rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, c, P, R * 4, ldc * 4);
+
+    return n_threads;
 }
 
-static void cblas_sgemm_RTN(
+unsigned sgemm_qpu_unif_set(
+    uint32_t *unif_cpu,
+    const MKL_UINT unif_gpu,
+    const unsigned max_threads,
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
     const MKL_INT m,
     const MKL_INT n,
     const MKL_INT k,
     const float alpha,
+    const MKL_UINT a_gpu,
+    const MKL_INT lda,
+    const MKL_UINT b_gpu,
+    const MKL_INT ldb,
+    const float beta,
+    const MKL_UINT c_gpu,
+    const MKL_INT ldc)
+{
+    struct sgemm_partition part;
+
+    sgemm_qpu_partition(transa, transb, m, n, k, max_threads, 0, &part);
+    return sgemm_qpu_unif_set_part(unif_cpu, unif_gpu, &part, transa, transb,
+            alpha, a_gpu, lda, b_gpu, ldb, beta, c_gpu, ldc);
+}
+
+void sgemm_qpu_launch(const unsigned n_threads, const MKL_UINT unif_gpu,
+        const MKL_UINT code_gpu)
+{
+    uint32_t unif[SGEMM_QPU_MAX_THREADS], code[SGEMM_QPU_MAX_THREADS];
+    unsigned th;
+
+    /* Bus addresses are 32-bit, whatever the size of a host pointer. */
+    for (th = 0; th < n_threads; th ++) {
+        unif[th] = unif_gpu + th * unif_len_1th * (32 / 8);
+        code[th] = code_gpu;
+    }
+    launch_qpu_code_mailbox_array(n_threads, 0, 5e3, unif, code);
+}
+
+/*
+ * C = alpha * AB + beta * C for a partition with k_div > 1: the QPU threads
+ * compute the product of each slice of k into S, the slices one under
+ * another as the rows of a (k_div * m) x n matrix, and the CPU sums them
+ * into C, which QPU does not touch.  S is the scratch of the uniform arena
+ * of the call, which it holds until the sum is done.
+ */
+static void sgemm_qpu_split_k(
+    const struct sgemm_partition *part,
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const float alpha,
     const float *a,
     const MKL_INT lda,
     const float *b,
@@ -274,100 +385,59 @@ static void cblas_sgemm_RTN(
     float *c,
     const MKL_INT ldc)
 {
-    MKL_UINT a_gpu = get_ptr_gpu_from_ptr_cpu(a);
-    MKL_UINT b_gpu = get_ptr_gpu_from_ptr_cpu(b);
-    MKL_UINT c_gpu = get_ptr_gpu_from_ptr_cpu(c);
-    uint32_t *p = NULL;
-
-    const unsigned P = m;
-    const unsigned Q = k;
-    const unsigned R = n;
-    const float ALPHA = alpha;
-    const float BETA = beta;
+    const unsigned m = part->m, n = part->n, k_div = part->k_div;
+    /* Rows of S on whole cache lines, so that S can be invalidated. */
+    const unsigned lds = (n * sizeof(float) + CACHE_LINE_SIZE - 1)
+        / CACHE_LINE_SIZE * CACHE_LINE_SIZE / sizeof(float);
+    struct unif_arena * const arena = unif_arena_get();
+    float *s = unif_arena_scratch(arena, (size_t) k_div * m * lds * sizeof(*s));
+    struct cache_region r[3];
+    unsigned n_threads, n_regions, i, j, l;
+
+    n_threads = sgemm_qpu_unif_set_part(arena->cpu, arena->gpu, part,
+            transa, transb, 1, get_ptr_gpu_from_ptr_cpu(a), lda,
+            get_ptr_gpu_from_ptr_cpu(b), ldb, 0, get_ptr_gpu_from_ptr_cpu(s),
+            lds);
+
+    /* Clean A and B, and invalidate all of S rather than its first slice. */
+    n_regions = sgemm_qpu_clean_regions(r, transa, transb, m, n, part->k,
+            a, lda, b, ldb, 0, s, lds);
+    if (ptr_is_cpu_cached(s)) {
+        r[n_regions - 1].op = QMKL_CACHE_OP_INVALIDATE;
+        r[n_regions - 1].height = k_div * m;
+        r[n_regions - 1].width = lds * sizeof(*s);
+    }
+    cache_regions_flush(r, n_regions);
 
-    unsigned r_div = 6;
-    if (R < r_div*64) r_div = 4;
-    if (R < r_div*64) r_div = 3;
-    if (R < r_div*64) r_div = 2;
-    if (R < r_div*64) r_div = 1;
+    sgemm_qpu_launch(n_threads, arena->gpu,
+            sgemm_qpu_code_gpu(transa, transb, m, n, 1, 0));
+    if (ptr_is_cpu_cached(s))
+        rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, s, k_div * m,
+                lds * sizeof(*s), lds * sizeof(*s));
 
-    unsigned p_div = 12 / r_div;
-    for (; 2 <= p_div; --p_div) {
-        if (P >= p_div*16) break;
-    }
+    for (i = 0; i < m; i ++) {
+        float *ci = c + i * ldc;
 
-    const unsigned n_threads = p_div * r_div;
+        for (j = 0; j < n; j ++) {
+            float sum = s[i * lds + j];
 
-    memcpy(code_common_cpu, code_sgemm_RTN, sizeof(code_sgemm_RTN));
-    p = unif_common_cpu;
-    {
-        unsigned th, i, j;
-        for (th = 0; th < n_threads; th ++) {
-            unif_set_uint (p + th * unif_len_1th +  0, (unsigned) ((unsigned*) unif_common_gpu + th * unif_len_1th));
-            unif_set_uint (p + th * unif_len_1th +  7, lda * (32 / 8));
-            unif_set_uint (p + th * unif_len_1th +  8, ldb * (32 / 8));
-            unif_set_uint (p + th * unif_len_1th +  9, ldc * (32 / 8));
-            unif_set_float(p + th * unif_len_1th + 10, ALPHA);
-            unif_set_float(p + th * unif_len_1th + 11, BETA);
-            unif_set_uint (p + th * unif_len_1th + 12, th);
-            unif_set_uint (p + th * unif_len_1th + 13, n_threads);
-        }
-        th = 0;
-        const unsigned P_up = P / 16;
-        const unsigned h = (P_up + p_div - 1) / p_div;
-        const unsigned h_len = p_div - (h * p_div - P_up);
-        const unsigned R_up = R / 64;
-        const unsigned w = (R_up + r_div - 1) / r_div;
-        const unsigned w_len = r_div - (w * r_div - R_up);
-        unsigned h_acc = 0;
-        for (i = 0; i < p_div; i ++) {
-            unsigned hi = 0;
-            if (i == p_div-1) {
-                hi = P - h_acc;
-            } else {
-                hi = i < h_len ? 16 * h : 16 * (h-1);
-            }
-            unsigned w_acc = 0;
-            for (j = 0; j < r_div; j ++) {
-                unsigned wj = 0;
-                if (j == r_div-1) {
-                    wj = R - w_acc;
-                } else {
-                    wj = j < w_len ? 64 * w : 64 * (w-1);
-                }
-                unif_set_uint(p + th * unif_len_1th +  1, hi);
-                unif_set_uint(p + th * unif_len_1th +  2, Q);
-                unif_set_uint(p + th * unif_len_1th +  3, wj);
-                unif_set_uint(p + th * unif_len_1th +  4, (unsigned) ((unsigned*)a_gpu +               h_acc));
-                unif_set_uint(p + th * unif_len_1th +  5, (unsigned) ((unsigned*)b_gpu +               w_acc));
-                unif_set_uint(p + th * unif_len_1th +  6, (unsigned) ((unsigned*)c_gpu + h_acc * ldc + w_acc));
-                th ++;
-                w_acc += wj;
-            }
-            h_acc += hi;
+            for (l = 1; l < k_div; l ++)
+                sum += s[(l * m + i) * lds + j];
+            ci[j] = beta == 0 ? alpha * sum : alpha * sum + beta * ci[j];
         }
     }
-    rpimemmgr_cache_op_2_multiple(3, QMKL_CACHE_OP_CLEAN, a, Q, P * 4, lda * 4,
-                                     QMKL_CACHE_OP_CLEAN, b, Q, R * 4, ldb * 4,
-                                     QMKL_CACHE_OP_CLEAN, c, P, R * 4, ldc * 4);
-    launch_qpu_code_mailbox(n_threads, 0, 5e3,
-                            (unsigned*) unif_common_gpu +  0 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  1 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  2 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  3 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  4 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  5 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  6 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  7 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  8 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  9 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 10 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 11 * unif_len_1th, code_common_gpu
-    );
-    rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, c, P, R * 4, ldc * 4);
+    unif_arena_put(arena);
+}
+
+int sgemm_qpu_can_split_k(const float *a, const float *b, const float *c)
+{
+    return ptr_is_gpu_accessible(a) && ptr_is_gpu_accessible(b)
+           && ptr_is_cpu_cached(c);
 }
 
-static void cblas_sgemm_RTT(
+void blas_sgemm_qpu(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
     const MKL_INT m,
     const MKL_INT n,
     const MKL_INT k,
@@ -380,100 +450,34 @@ static void cblas_sgemm_RTT(
     float *c,
     const MKL_INT ldc)
 {
-    MKL_UINT a_gpu = get_ptr_gpu_from_ptr_cpu(a);
-    MKL_UINT b_gpu = get_ptr_gpu_from_ptr_cpu(b);
-    MKL_UINT c_gpu = get_ptr_gpu_from_ptr_cpu(c);
-    uint32_t *p = NULL;
-
-    const unsigned P = m;
-    const unsigned Q = k;
-    const unsigned R = n;
-    const float ALPHA = alpha;
-    const float BETA = beta;
-
-    unsigned p_div = 6;
-    if (P < p_div*64) p_div = 4;
-    if (P < p_div*64) p_div = 3;
-    if (P < p_div*64) p_div = 2;
-    if (P < p_div*64) p_div = 1;
-
-    unsigned r_div = 12 / p_div;
-    for (; 2 <= r_div; --r_div) {
-        if (R >= r_div*16) break;
+    struct sgemm_partition part;
+
+    /*
+     * Split k when C has too few tiles for the QPUs.  The CPU then writes
+     * C, so C must be memory it caches rather than GPU-only.
+     */
+    if (sgemm_qpu_can_split_k(a, b, c)) {
+        sgemm_qpu_partition(transa, transb, m, n, k, SGEMM_QPU_MAX_THREADS,
+                1, &part);
+        if (part.k_div > 1) {
+            sgemm_qpu_split_k(&part, transa, transb, alpha, a, lda, b, ldb,
+                    beta, c, ldc);
+            return;
+        }
     }
 
-    const unsigned n_threads = p_div * r_div;
-
-    memcpy(code_common_cpu, code_sgemm_RTT, sizeof(code_sgemm_RTT));
-    p = unif_common_cpu;
-    {
-        unsigned th, i, j;
-        for (th = 0; th < n_threads; th ++) {
-            unif_set_uint (p + th * unif_len_1th +  0, (unsigned) ((unsigned*) unif_common_gpu + th * unif_len_1th));
-            unif_set_uint (p + th * unif_len_1th +  7, lda * (32 / 8));
-            unif_set_uint (p + th * unif_len_1th +  8, ldb * (32 / 8));
-            unif_set_uint (p + th * unif_len_1th +  9, ldc * (32 / 8));
-            unif_set_float(p + th * unif_len_1th + 10, ALPHA);
-            unif_set_float(p + th * unif_len_1th + 11, BETA);
-            unif_set_uint (p + th * unif_len_1th + 12, th);
-            unif_set_uint (p + th * unif_len_1th + 13, n_threads);
-        }
-        th = 0;
-        const unsigned P_up = P / 64;
-        const unsigned h = (P_up + p_div - 1) / p_div;
-        const unsigned h_len = p_div - (h * p_div - P_up);
-        const unsigned R_up = R / 16;
-        const unsigned w = (R_up + r_div - 1) / r_div;
-        const unsigned w_len = r_div - (w * r_div - R_up);
-        unsigned h_acc = 0;
-        for (i = 0; i < p_div; i ++) {
-            unsigned hi = 0;
-            if (i == p_div-1) {
-                hi = P - h_acc;
-            } else {
-                hi = i < h_len ? 64 * h : 64 * (h-1);
-            }
-            unsigned w_acc = 0;
-            for (j = 0; j < r_div; j ++) {
-                unsigned wj = 0;
-                if (j == r_div-1) {
-                    wj = R - w_acc;
-                } else {
-                    wj = j < w_len ? 16 * w : 16 * (w-1);
-                }
-                unif_set_uint(p + th * unif_len_1th +  1, hi);
-                unif_set_uint(p + th * unif_len_1th +  2, Q);
-                unif_set_uint(p + th * unif_len_1th +  3, wj);
-                unif_set_uint(p + th * unif_len_1th +  4, (unsigned) ((unsigned*)a_gpu +               h_acc));
-                unif_set_uint(p + th * unif_len_1th +  5, (unsigned) ((unsigned*)b_gpu + w_acc * ldb        ));
-                unif_set_uint(p + th * unif_len_1th +  6, (unsigned) ((unsigned*)c_gpu + h_acc * ldc + w_acc));
-                th ++;
-                w_acc += wj;
-            }
-            h_acc += hi;
-        }
+    if (!ptr_is_gpu_accessible(a) || !ptr_is_gpu_accessible(b)
+            || !ptr_is_gpu_accessible(c)) {
+        sgemm_qpu_staged(transa, transb, m, n, k, alpha, a, lda, b, ldb,
+                beta, c, ldc);
+        return;
     }
-    rpimemmgr_cache_op_2_multiple(3, QMKL_CACHE_OP_CLEAN, a, Q, P * 4, lda * 4,
-                                     QMKL_CACHE_OP_CLEAN, b, R, Q * 4, ldb * 4,
-                                     QMKL_CACHE_OP_CLEAN, c, P, R * 4, ldc * 4);
-    launch_qpu_code_mailbox(n_threads, 0, 5e3,
-                            (unsigned*) unif_common_gpu +  0 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  1 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  2 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  3 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  4 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  5 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  6 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  7 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  8 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu +  9 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 10 * unif_len_1th, code_common_gpu,
-                            (unsigned*) unif_common_gpu + 11 * unif_len_1th, code_common_gpu
-    );
-    rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, c, P, R * 4, ldc * 4);
+
+    sgemm_qpu_direct(transa, transb, m, n, k, alpha, a, lda, b, ldb,
+            beta, c, ldc);
 }
 
-static void cblas_sgemm_R(
+void sgemm_qpu_direct(
     const CBLAS_TRANSPOSE transa,
     const CBLAS_TRANSPOSE transb,
     const MKL_INT m,
@@ -488,19 +492,25 @@ static void cblas_sgemm_R(
     float *c,
     const MKL_INT ldc)
 {
-    if (CblasNoTrans == transa) {
-        if (CblasNoTrans == transb) {
-            return cblas_sgemm_RNN(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
-        } else {
-            return cblas_sgemm_RNT(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
-        }
-    } else {
-        if (CblasNoTrans == transb) {
-            return cblas_sgemm_RTN(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
-        } else {
-            return cblas_sgemm_RTT(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
-        }
-    }
+    MKL_UINT a_gpu, b_gpu, c_gpu;
+    struct unif_arena *arena;
+    unsigned n_threads;
+
+    a_gpu = get_ptr_gpu_from_ptr_cpu(a);
+    b_gpu = get_ptr_gpu_from_ptr_cpu(b);
+    c_gpu = get_ptr_gpu_from_ptr_cpu(c);
+
+    arena = unif_arena_get();
+    n_threads = sgemm_qpu_unif_set(arena->cpu, arena->gpu,
+            SGEMM_QPU_MAX_THREADS, transa, transb, m, n, k, alpha, a_gpu, lda, b_gpu, ldb,
+            beta, c_gpu, ldc);
+
+    sgemm_qpu_clean(transa, transb, m, n, k, a, lda, b, ldb, beta, c, ldc);
+    sgemm_qpu_launch(n_threads, arena->gpu,
+            sgemm_qpu_code_gpu(transa, transb, m, n, alpha, beta));
+    unif_arena_put(arena);
+    if (ptr_is_cpu_cached(c))
+        rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, c, m, n * 4, ldc * 4);
 }
 
 void cblas_sgemm(
@@ -521,10 +531,13 @@ void cblas_sgemm(
 {
     switch (layout) {
     case CblasColMajor: {
-        error_fatal("layout must be RowMajor for now\n");
+        /* Column-major C is row-major C^T = op(B)^T op(A)^T. */
+        backend_ops->sgemm(transb, transa, n, m, k, alpha, b, ldb, a, lda, beta, c, ldc);
     } break;
     case CblasRowMajor: {
-        return cblas_sgemm_R(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        backend_ops->sgemm(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
     } break;
+    default:
+        xerbla_local(1);
     }
 }
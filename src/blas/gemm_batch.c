@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Batched SGEMM.  On QPU, the problems are packed into as few launches as
+ * possible: each problem takes some of the 12 thread slots, with its own
+ * uniforms and kernel, and the thread numbers are made global to the launch
+ * so that thread 0 waits for all of them.  Other single-thread programs
+ * that end the same way take a slot each in the first launch.  On CPU, the
+ * problems themselves are distributed over the OpenMP threads when there
+ * are enough of them.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include "local/gemm.h"
+#include "local/error.h"
+#include <rpimemmgr.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif /* _OPENMP */
+
+static const int unif_len_1th = SGEMM_QPU_UNIF_LEN_1TH;
+
+unsigned sgemm_batch_share(const MKL_INT n_problems)
+{
+    if (n_problems >= SGEMM_QPU_MAX_THREADS)
+        return 1;
+    if (n_problems <= 1)
+        return SGEMM_QPU_MAX_THREADS;
+    return SGEMM_QPU_MAX_THREADS / n_problems;
+}
+
+static int accessible(const struct sgemm_problem *p)
+{
+    return ptr_is_gpu_accessible(p->a) && ptr_is_gpu_accessible(p->b)
+           && ptr_is_gpu_accessible(p->c);
+}
+
+static void sgemm_batch_qpu(const struct sgemm_problem *problems,
+        const MKL_INT count, const struct qpu_program *programs,
+        const unsigned n_programs)
+{
+    uint32_t unif[SGEMM_QPU_MAX_THREADS], code[SGEMM_QPU_MAX_THREADS];
+    struct cache_region r[SGEMM_QPU_MAX_THREADS * 3];
+    struct unif_arena * const arena = unif_arena_get();
+    MKL_INT first = 0, last, i;
+    unsigned first_program = 0, last_program;
+
+    while (first < count || first_program < n_programs) {
+        const unsigned share = sgemm_batch_share(count - first
+                + n_programs - first_program);
+        unsigned n_threads = 0, n_regions = 0, th;
+
+        for (last_program = first_program; last_program < n_programs
+                && n_threads < SGEMM_QPU_MAX_THREADS; last_program ++) {
+            const struct qpu_program *prog = &programs[last_program];
+            MKL_UINT * const u = arena->cpu + n_threads * unif_len_1th;
+
+            for (i = 0; i < (MKL_INT) prog->unif_len - 2; i ++)
+                unif_set_uint(u + i, prog->unif[i]);
+            unif[n_threads] = arena->gpu + n_threads * unif_len_1th * (32 / 8);
+            code[n_threads] = prog->code;
+            n_threads ++;
+
+            for (i = 0; i < (MKL_INT) prog->n_clean; i ++)
+                r[n_regions ++] = prog->r[i];
+        }
+
+        for (last = first; last < count; last ++) {
+            const struct sgemm_problem *p = &problems[last];
+            unsigned tile_m, tile_n, tile_k, want, got;
+
+            if (p->m <= 0 || p->n <= 0)
+                continue;
+            /* k = 0 only scales C, which the CPU does. */
+            if (p->k <= 0) {
+                blas_sgemm_cpu(p->transa, p->transb, p->m, p->n, p->k,
+                        p->alpha, p->a, p->lda, p->b, p->ldb,
+                        p->beta, p->c, p->ldc);
+                continue;
+            }
+            /* Staged problems run after the launch, in launches of their own. */
+            if (!accessible(p))
+                continue;
+
+            want = sgemm_qpu_shape(p->transa, p->transb, p->m, p->n, p->k, share,
+                    0, &tile_m, &tile_n, &tile_k);
+            if (n_threads + want > SGEMM_QPU_MAX_THREADS)
+                break;
+
+            got = sgemm_qpu_unif_set(arena->cpu + n_threads * unif_len_1th,
+                    arena->gpu + n_threads * unif_len_1th * (32 / 8),
+                    share, p->transa, p->transb, p->m, p->n, p->k, p->alpha,
+                    get_ptr_gpu_from_ptr_cpu(p->a), p->lda,
+                    get_ptr_gpu_from_ptr_cpu(p->b), p->ldb,
+                    p->beta, get_ptr_gpu_from_ptr_cpu(p->c), p->ldc);
+            for (th = n_threads; th < n_threads + got; th ++) {
+                unif[th] = arena->gpu + th * unif_len_1th * (32 / 8);
+                code[th] = sgemm_qpu_code_gpu(p->transa, p->transb,
+                        p->m, p->n, p->alpha, p->beta);
+            }
+            n_threads += got;
+
+            n_regions += sgemm_qpu_clean_regions(r + n_regions,
+                    p->transa, p->transb, p->m, p->n, p->k,
+                    p->a, p->lda, p->b, p->ldb, p->beta, p->c, p->ldc);
+        }
+
+        /* The cache operations of all the problems of a launch are merged. */
+        if (n_threads != 0) {
+            cache_regions_flush(r, n_regions);
+            for (th = 0; th < n_threads; th ++) {
+                /* The programs come first. */
+                const unsigned at = th < last_program - first_program
+                        ? programs[first_program + th].unif_len - 2 : 12;
+
+                unif_set_uint(arena->cpu + th * unif_len_1th + at, th);
+                unif_set_uint(arena->cpu + th * unif_len_1th + at + 1,
+                        n_threads);
+            }
+            launch_qpu_code_mailbox_array(n_threads, 0, 5e3, unif, code);
+
+            n_regions = 0;
+            for (th = first_program; th < last_program; th ++)
+                for (i = 0; i < (MKL_INT) programs[th].n_invalidate; i ++)
+                    r[n_regions ++] = programs[th].r[programs[th].n_clean + i];
+            for (i = first; i < last; i ++) {
+                const struct sgemm_problem *p = &problems[i];
+                if (p->m > 0 && p->n > 0 && p->k > 0 && accessible(p)
+                        && ptr_is_cpu_cached(p->c)) {
+                    r[n_regions].op = QMKL_CACHE_OP_INVALIDATE;
+                    r[n_regions].p = p->c;
+                    r[n_regions].height = p->m;
+                    r[n_regions].width = p->n * 4;
+                    r[n_regions].stride = p->ldc * 4;
+                    n_regions ++;
+                }
+            }
+            cache_regions_flush(r, n_regions);
+        }
+
+        for (i = first; i < last; i ++) {
+            const struct sgemm_problem *p = &problems[i];
+            if (p->m > 0 && p->n > 0 && p->k > 0 && !accessible(p))
+                sgemm_qpu_staged(p->transa, p->transb, p->m, p->n, p->k,
+                        p->alpha, p->a, p->lda, p->b, p->ldb,
+                        p->beta, p->c, p->ldc);
+        }
+        first = last;
+        first_program = last_program;
+    }
+    unif_arena_put(arena);
+}
+
+static void sgemm_batch_cpu(const struct sgemm_problem *problems,
+        const MKL_INT count)
+{
+    MKL_INT i;
+
+#ifdef _OPENMP
+    /*
+     * One problem per thread at a time.  The nested parallel regions of
+     * blas_sgemm_cpu run on a single thread then.
+     */
+    if (count >= omp_get_max_threads()) {
+#pragma omp parallel for schedule(dynamic)
+        for (i = 0; i < count; i ++) {
+            const struct sgemm_problem *p = &problems[i];
+            blas_sgemm_cpu(p->transa, p->transb, p->m, p->n, p->k,
+                    p->alpha, p->a, p->lda, p->b, p->ldb,
+                    p->beta, p->c, p->ldc);
+        }
+        return;
+    }
+#endif /* _OPENMP */
+
+    for (i = 0; i < count; i ++) {
+        const struct sgemm_problem *p = &problems[i];
+        blas_sgemm_cpu(p->transa, p->transb, p->m, p->n, p->k,
+                p->alpha, p->a, p->lda, p->b, p->ldb,
+                p->beta, p->c, p->ldc);
+    }
+}
+
+/*
+ * Problems are moved in place so that the QPU ones come first.  As for
+ * cblas_sgemm, those with GPU-only operands are always QPU ones.
+ */
+static void sgemm_batch_auto(struct sgemm_problem *problems,
+        const MKL_INT count, const int c_arg,
+        const struct qpu_program *programs, const unsigned n_programs)
+{
+    MKL_INT n_qpu = 0, i;
+
+    for (i = 0; i < count; i ++) {
+        struct sgemm_problem * const p = &problems[i];
+
+        if (p->m <= 0 || p->n <= 0)
+            continue;
+        if (!sgemm_gpu_only(p->m, p->n, p->k, p->a, p->b, p->c, c_arg)
+                && (p->k < 2
+                    || sgemm_predict_batched(p->transa, p->transb,
+                            p->m, p->n, p->k, count)
+                       > sgemm_predict(SGEMM_ENGINE_CPU, p->transa, p->transb,
+                            p->m, p->n, p->k, 0)))
+            continue;
+
+        if (i != n_qpu) {
+            const struct sgemm_problem t = *p;
+            *p = problems[n_qpu];
+            problems[n_qpu] = t;
+        }
+        n_qpu ++;
+    }
+
+    sgemm_batch_qpu(problems, n_qpu, programs, n_programs);
+    sgemm_batch_cpu(problems + n_qpu, count - n_qpu);
+}
+
+void sgemm_batch(struct sgemm_problem *problems, const MKL_INT count,
+        const int c_arg, const struct qpu_program *programs,
+        const unsigned n_programs)
+{
+    MKL_INT i;
+
+    /* Rejected problems are left out as empty ones. */
+    if (QMKL_BACKEND_CPU != qmkl_get_backend())
+        for (i = 0; i < count; i ++)
+            if (sgemm_gpu_only(problems[i].m, problems[i].n, problems[i].k,
+                        problems[i].a, problems[i].b, problems[i].c, c_arg) < 0)
+                problems[i].m = 0;
+
+    switch (qmkl_get_backend()) {
+    case QMKL_BACKEND_QPU:
+        sgemm_batch_qpu(problems, count, programs, n_programs);
+        break;
+    case QMKL_BACKEND_CPU:
+        sgemm_batch_cpu(problems, count);
+        break;
+    default:
+        if (backend_qpu_available())
+            sgemm_batch_auto(problems, count, c_arg, programs, n_programs);
+        else
+            sgemm_batch_cpu(problems, count);
+        break;
+    }
+}
+
+void cblas_sgemm_batch(
+    const CBLAS_LAYOUT layout,
+    const CBLAS_TRANSPOSE *transa_array,
+    const CBLAS_TRANSPOSE *transb_array,
+    const MKL_INT *m_array,
+    const MKL_INT *n_array,
+    const MKL_INT *k_array,
+    const float *alpha_array,
+    const float **a_array,
+    const MKL_INT *lda_array,
+    const float **b_array,
+    const MKL_INT *ldb_array,
+    const float *beta_array,
+    float **c_array,
+    const MKL_INT *ldc_array,
+    const MKL_INT group_count,
+    const MKL_INT *group_size)
+{
+    struct sgemm_problem *problems;
+    MKL_INT count = 0, g, i, j;
+
+    if (CblasRowMajor != layout && CblasColMajor != layout) {
+        xerbla_local(1);
+        return;
+    }
+    if (group_count < 0) {
+        xerbla_local(15);
+        return;
+    }
+
+    for (g = 0; g < group_count; g ++) {
+        if (group_size[g] < 0) {
+            xerbla_local(16);
+            return;
+        }
+        count += group_size[g];
+    }
+    if (count == 0)
+        return;
+
+    problems = malloc((size_t) count * sizeof(*problems));
+    if (problems == NULL)
+        error_fatal("Failed to allocate sgemm batch\n");
+
+    for (g = 0, j = 0; g < group_count; g ++) {
+        for (i = 0; i < group_size[g]; i ++, j ++) {
+            problems[j].transa = transa_array[g];
+            problems[j].transb = transb_array[g];
+            problems[j].m = m_array[g];
+            problems[j].n = n_array[g];
+            problems[j].k = k_array[g];
+            problems[j].alpha = alpha_array[g];
+            problems[j].a = a_array[j];
+            problems[j].lda = lda_array[g];
+            problems[j].b = b_array[j];
+            problems[j].ldb = ldb_array[g];
+            problems[j].beta = beta_array[g];
+            problems[j].c = c_array[j];
+            problems[j].ldc = ldc_array[g];
+        }
+    }
+
+    /* Column-major C is row-major C^T = op(B)^T op(A)^T. */
+    if (CblasColMajor == layout) {
+        for (j = 0; j < count; j ++) {
+            struct sgemm_problem * const p = &problems[j];
+            const CBLAS_TRANSPOSE t = p->transa;
+            const float *x = p->a;
+            const MKL_INT m = p->m, ld = p->lda;
+
+            p->transa = p->transb;
+            p->transb = t;
+            p->m = p->n;
+            p->n = m;
+            p->a = p->b;
+            p->lda = p->ldb;
+            p->b = x;
+            p->ldb = ld;
+        }
+    }
+
+    sgemm_batch(problems, count, 13, NULL, 0);
+    free(problems);
+}
+
+void cblas_sgemm_batch_strided(
+    const CBLAS_LAYOUT layout,
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const MKL_INT stridea,
+    const float *b,
+    const MKL_INT ldb,
+    const MKL_INT strideb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc,
+    const MKL_INT stridec,
+    const MKL_INT batch_size)
+{
+    struct sgemm_problem *problems;
+    MKL_INT i;
+
+    /* Column-major C is row-major C^T = op(B)^T op(A)^T. */
+    if (CblasColMajor == layout) {
+        cblas_sgemm_batch_strided(CblasRowMajor, transb, transa, n, m, k, alpha,
+                b, ldb, strideb, a, lda, stridea, beta, c, ldc, stridec, batch_size);
+        return;
+    }
+    if (CblasRowMajor != layout) {
+        xerbla_local(1);
+        return;
+    }
+    if (batch_size < 0) {
+        xerbla_local(18);
+        return;
+    }
+    if (batch_size == 0)
+        return;
+
+    problems = malloc((size_t) batch_size * sizeof(*problems));
+    if (problems == NULL)
+        error_fatal("Failed to allocate sgemm batch\n");
+
+    for (i = 0; i < batch_size; i ++) {
+        problems[i].transa = transa;
+        problems[i].transb = transb;
+        problems[i].m = m;
+        problems[i].n = n;
+        problems[i].k = k;
+        problems[i].alpha = alpha;
+        problems[i].a = a + i * stridea;
+        problems[i].lda = lda;
+        problems[i].b = b + i * strideb;
+        problems[i].ldb = ldb;
+        problems[i].beta = beta;
+        problems[i].c = c + i * stridec;
+        problems[i].ldc = ldc;
+    }
+
+    sgemm_batch(problems, batch_size, 15, NULL, 0);
+    free(problems);
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Host SGEMM: C is computed in NC-wide column panels and KC-deep slices of
+ * k.  For each slice, op(B) is packed into NR-wide slivers shared by all
+ * threads, and each thread packs an MC x KC block of op(A) into MR-tall
+ * slivers and runs the MR x NR micro-kernel over it.  Packing absorbs the
+ * transposes, so RNN/RNT/RTN/RTT share the same kernel.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include "local/error.h"
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif /* _OPENMP */
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define MR 4
+#define NR 8
+/* MC x KC of A fits in L2 with room for B; KC x NR of B fits in L1. */
+#define MC 64
+#define KC 256
+#define NC 512
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void pack_a(const int mc, const int kc, const float *a,
+        const MKL_INT rs, const MKL_INT cs, float *ap)
+{
+    int i, ii, l;
+
+    for (i = 0; i < mc; i += MR) {
+        const int mr = MIN(MR, mc - i);
+        for (l = 0; l < kc; l ++) {
+            for (ii = 0; ii < mr; ii ++)
+                ap[ii] = a[(i + ii) * rs + l * cs];
+            for (; ii < MR; ii ++)
+                ap[ii] = 0;
+            ap += MR;
+        }
+    }
+}
+
+static void pack_b_sliver(const int nr, const int kc, const float *b,
+        const MKL_INT rs, const MKL_INT cs, float *bp)
+{
+    int jj, l;
+
+    for (l = 0; l < kc; l ++) {
+        for (jj = 0; jj < nr; jj ++)
+            bp[jj] = b[l * rs + jj * cs];
+        for (; jj < NR; jj ++)
+            bp[jj] = 0;
+        bp += NR;
+    }
+}
+
+/* ab[MR * NR] = (packed A sliver) * (packed B sliver) */
+static void kernel_ab(const int kc, const float *ap, const float *bp, float *ab)
+{
+    int l;
+
+#if defined(__ARM_NEON)
+    float32x4_t c00 = vdupq_n_f32(0), c01 = vdupq_n_f32(0);
+    float32x4_t c10 = vdupq_n_f32(0), c11 = vdupq_n_f32(0);
+    float32x4_t c20 = vdupq_n_f32(0), c21 = vdupq_n_f32(0);
+    float32x4_t c30 = vdupq_n_f32(0), c31 = vdupq_n_f32(0);
+
+    for (l = 0; l < kc; l ++) {
+        const float32x4_t a = vld1q_f32(ap);
+        const float32x2_t alo = vget_low_f32(a), ahi = vget_high_f32(a);
+        const float32x4_t b0 = vld1q_f32(bp), b1 = vld1q_f32(bp + 4);
+        c00 = vmlaq_lane_f32(c00, b0, alo, 0);
+        c01 = vmlaq_lane_f32(c01, b1, alo, 0);
+        c10 = vmlaq_lane_f32(c10, b0, alo, 1);
+        c11 = vmlaq_lane_f32(c11, b1, alo, 1);
+        c20 = vmlaq_lane_f32(c20, b0, ahi, 0);
+        c21 = vmlaq_lane_f32(c21, b1, ahi, 0);
+        c30 = vmlaq_lane_f32(c30, b0, ahi, 1);
+        c31 = vmlaq_lane_f32(c31, b1, ahi, 1);
+        ap += MR;
+        bp += NR;
+    }
+    vst1q_f32(ab +  0, c00); vst1q_f32(ab +  4, c01);
+    vst1q_f32(ab +  8, c10); vst1q_f32(ab + 12, c11);
+    vst1q_f32(ab + 16, c20); vst1q_f32(ab + 20, c21);
+    vst1q_f32(ab + 24, c30); vst1q_f32(ab + 28, c31);
+#elif defined(__AVX__)
+    __m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps();
+    __m256 c2 = _mm256_setzero_ps(), c3 = _mm256_setzero_ps();
+
+    for (l = 0; l < kc; l ++) {
+        const __m256 b = _mm256_load_ps(bp);
+        c0 = _mm256_add_ps(c0, _mm256_mul_ps(_mm256_broadcast_ss(ap + 0), b));
+        c1 = _mm256_add_ps(c1, _mm256_mul_ps(_mm256_broadcast_ss(ap + 1), b));
+        c2 = _mm256_add_ps(c2, _mm256_mul_ps(_mm256_broadcast_ss(ap + 2), b));
+        c3 = _mm256_add_ps(c3, _mm256_mul_ps(_mm256_broadcast_ss(ap + 3), b));
+        ap += MR;
+        bp += NR;
+    }
+    _mm256_store_ps(ab +  0, c0);
+    _mm256_store_ps(ab +  8, c1);
+    _mm256_store_ps(ab + 16, c2);
+    _mm256_store_ps(ab + 24, c3);
+#elif defined(__SSE__)
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+    __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+    __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+
+    for (l = 0; l < kc; l ++) {
+        const __m128 b0 = _mm_load_ps(bp), b1 = _mm_load_ps(bp + 4);
+        __m128 a;
+        a = _mm_load1_ps(ap + 0);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(a, b0));
+        c01 = _mm_add_ps(c01, _mm_mul_ps(a, b1));
+        a = _mm_load1_ps(ap + 1);
+        c10 = _mm_add_ps(c10, _mm_mul_ps(a, b0));
+        c11 = _mm_add_ps(c11, _mm_mul_ps(a, b1));
+        a = _mm_load1_ps(ap + 2);
+        c20 = _mm_add_ps(c20, _mm_mul_ps(a, b0));
+        c21 = _mm_add_ps(c21, _mm_mul_ps(a, b1));
+        a = _mm_load1_ps(ap + 3);
+        c30 = _mm_add_ps(c30, _mm_mul_ps(a, b0));
+        c31 = _mm_add_ps(c31, _mm_mul_ps(a, b1));
+        ap += MR;
+        bp += NR;
+    }
+    _mm_store_ps(ab +  0, c00); _mm_store_ps(ab +  4, c01);
+    _mm_store_ps(ab +  8, c10); _mm_store_ps(ab + 12, c11);
+    _mm_store_ps(ab + 16, c20); _mm_store_ps(ab + 20, c21);
+    _mm_store_ps(ab + 24, c30); _mm_store_ps(ab + 28, c31);
+#else
+    int i, j;
+
+    for (i = 0; i < MR * NR; i ++)
+        ab[i] = 0;
+    for (l = 0; l < kc; l ++) {
+        for (i = 0; i < MR; i ++)
+            for (j = 0; j < NR; j ++)
+                ab[i * NR + j] += ap[i] * bp[j];
+        ap += MR;
+        bp += NR;
+    }
+#endif
+}
+
+/* C[mr x nr] = alpha * A * B + beta * C; C is not read when beta is 0. */
+static void kernel(const int kc, const float *ap, const float *bp,
+        float *c, const MKL_INT ldc, const int mr, const int nr,
+        const float alpha, const float beta)
+{
+    float ab[MR * NR] __attribute__((aligned(32)));
+    int i, j;
+
+    kernel_ab(kc, ap, bp, ab);
+
+    if (beta == 0) {
+        for (i = 0; i < mr; i ++)
+            for (j = 0; j < nr; j ++)
+                c[i * ldc + j] = alpha * ab[i * NR + j];
+    } else if (beta == 1) {
+        for (i = 0; i < mr; i ++)
+            for (j = 0; j < nr; j ++)
+                c[i * ldc + j] += alpha * ab[i * NR + j];
+    } else {
+        for (i = 0; i < mr; i ++)
+            for (j = 0; j < nr; j ++)
+                c[i * ldc + j] = alpha * ab[i * NR + j] + beta * c[i * ldc + j];
+    }
+}
+
+static void scale_c(const MKL_INT m, const MKL_INT n, const float beta,
+        float *c, const MKL_INT ldc)
+{
+    int i;
+
+    if (beta == 1)
+        return;
+
+#pragma omp parallel for private(i)
+    for (i = 0; i < m; i ++) {
+        int j;
+        if (beta == 0) {
+            for (j = 0; j < n; j ++)
+                c[i * ldc + j] = 0;
+        } else {
+            for (j = 0; j < n; j ++)
+                c[i * ldc + j] *= beta;
+        }
+    }
+}
+
+static void* aligned_malloc(const size_t size)
+{
+    void *p;
+
+    if (posix_memalign(&p, 64, size))
+        error_fatal("Failed to allocate %zu bytes for packing\n", size);
+    return p;
+}
+
+void blas_sgemm_cpu(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc)
+{
+    /* Element (i, l) of op(A) is a[i * a_rs + l * a_cs]; likewise for B. */
+    const MKL_INT a_rs = CblasNoTrans == transa ? lda : 1;
+    const MKL_INT a_cs = CblasNoTrans == transa ? 1 : lda;
+    const MKL_INT b_rs = CblasNoTrans == transb ? ldb : 1;
+    const MKL_INT b_cs = CblasNoTrans == transb ? 1 : ldb;
+    int n_threads = 1;
+    int mc, row_panels, col_groups;
+    int jc, pc;
+    size_t a_size, b_size;
+    float *a_pack, *b_pack;
+
+    if (m <= 0 || n <= 0)
+        return;
+    if (alpha == 0 || k <= 0) {
+        scale_c(m, n, beta, c, ldc);
+        return;
+    }
+
+#ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+#endif /* _OPENMP */
+
+    /*
+     * Row panels are the unit of parallelism.  When there are fewer panels
+     * than threads, shrink them, and if m is still too small, also split
+     * the NR slivers of each panel into column groups.
+     */
+    mc = MC;
+    if ((m + mc - 1) / mc < n_threads) {
+        mc = (m + n_threads - 1) / n_threads;
+        mc = (mc + MR - 1) / MR * MR;
+    }
+    row_panels = (m + mc - 1) / mc;
+    col_groups = row_panels >= n_threads ? 1 : (n_threads + row_panels - 1) / row_panels;
+
+    /* The packs of the largest blocks of this call, in whole slivers. */
+    a_size = (size_t) (MIN(mc, m) + MR - 1) / MR * MR * MIN(KC, k);
+    b_size = (size_t) (MIN(NC, n) + NR - 1) / NR * NR * MIN(KC, k);
+    a_pack = aligned_malloc(n_threads * a_size * sizeof(*a_pack));
+    b_pack = aligned_malloc(b_size * sizeof(*b_pack));
+
+    for (jc = 0; jc < n; jc += NC) {
+        const int nc = MIN(NC, n - jc);
+        const int slivers = (nc + NR - 1) / NR;
+        const int groups = MIN(col_groups, slivers);
+
+        for (pc = 0; pc < k; pc += KC) {
+            const int kc = MIN(KC, k - pc);
+            const float beta_cur = pc == 0 ? beta : 1;
+
+#pragma omp parallel
+            {
+                int thread_num = 0, s, u;
+#ifdef _OPENMP
+                thread_num = omp_get_thread_num();
+#endif /* _OPENMP */
+                float * const ap = a_pack + thread_num * a_size;
+
+#pragma omp for
+                for (s = 0; s < slivers; s ++)
+                    pack_b_sliver(MIN(NR, nc - s * NR), kc,
+                            b + pc * b_rs + (jc + s * NR) * b_cs, b_rs, b_cs,
+                            b_pack + s * NR * kc);
+
+#pragma omp for schedule(dynamic)
+                for (u = 0; u < row_panels * groups; u ++) {
+                    const int ic = (u / groups) * mc;
+                    const int g = u % groups;
+                    const int mcur = MIN(mc, m - ic);
+                    const int s0 = slivers * g / groups;
+                    const int s1 = slivers * (g + 1) / groups;
+                    int ir;
+
+                    pack_a(mcur, kc, a + ic * a_rs + pc * a_cs, a_rs, a_cs, ap);
+                    for (s = s0; s < s1; s ++) {
+                        const int nr = MIN(NR, nc - s * NR);
+                        for (ir = 0; ir < mcur; ir += MR)
+                            kernel(kc, ap + ir * kc, b_pack + s * NR * kc,
+                                    c + (ic + ir) * ldc + jc + s * NR, ldc,
+                                    MIN(MR, mcur - ir), nr, alpha, beta_cur);
+                    }
+                }
+            }
+        }
+    }
+
+    free(b_pack);
+    free(a_pack);
+}
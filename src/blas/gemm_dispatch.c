@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Per-call choice between the QPU and CPU SGEMM for the auto backend.
+ *
+ * The time of each engine is predicted as
+ *     overhead + per_flop * padded work + per_byte * cache-maintained bytes
+ * where the padded work is what the engine really computes: for QPU, the
+ * largest per-thread block rounded up to the 16x64 kernel tile, for CPU,
+ * the whole C rounded up to the micro-kernel tile.  The coefficients are
+ * measured per transpose variant at first use, or loaded from the file
+ * named by QMKL_SGEMM_CALIBRATION (which is written if it does not exist).
+ * A third candidate runs both engines at once on a row split of C chosen by
+ * gemm_hybrid.c, and is predicted as the slower of its two parts.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include "local/gemm.h"
+#include "local/error.h"
+#include <rpimemmgr.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char * const engine_names[SGEMM_N_ENGINES] = {"qpu", "cpu"};
+static const char * const variant_names[4] = {"RNN", "RNT", "RTN", "RTT"};
+
+struct cost {
+    double overhead; /* [s] */
+    double per_flop; /* [s/flop] */
+    double per_byte; /* [s/byte] */
+};
+
+struct cost_table {
+    struct cost cost[SGEMM_N_ENGINES][4];
+    struct cost_table *retired; /* The table this one replaced. */
+};
+
+/*
+ * The table in use, never written once installed, so that predictions load
+ * it without a lock.  A replaced table may still be read, so it is kept
+ * until sgemm_dispatch_finalize.  install_lock serializes the installers
+ * only; it is held through a measurement just at first use, when there is
+ * no table to read yet.
+ */
+static struct cost_table *table = NULL;
+static pthread_mutex_t install_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace = 0;
+static __thread struct qmkl_sgemm_decision last_decision;
+
+void sgemm_dispatch_init()
+{
+    const char *env_trace = getenv("QMKL_SGEMM_TRACE");
+
+    trace = env_trace != NULL && strcmp(env_trace, "") && strcmp(env_trace, "0");
+}
+
+void sgemm_dispatch_finalize()
+{
+    struct cost_table *t, *next;
+
+    pthread_mutex_lock(&install_lock);
+    if (table != NULL) {
+        for (t = table->retired; t != NULL; t = next) {
+            next = t->retired;
+            free(t);
+        }
+        table->retired = NULL;
+    }
+    pthread_mutex_unlock(&install_lock);
+}
+
+static double get_time()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int variant(const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb)
+{
+    return (CblasNoTrans != transa) * 2 + (CblasNoTrans != transb);
+}
+
+double sgemm_work(const enum sgemm_engine engine,
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k,
+        const int split_k)
+{
+    unsigned tile_m, tile_n, tile_k;
+
+    switch (engine) {
+    case SGEMM_ENGINE_QPU:
+        /* The slowest thread. */
+        sgemm_qpu_shape(transa, transb, m, n, k, SGEMM_QPU_MAX_THREADS,
+                split_k, &tile_m, &tile_n, &tile_k);
+        return 2.0 * tile_m * tile_n * tile_k;
+    case SGEMM_ENGINE_CPU:
+    default:
+        return 2.0 * ((m + 3) / 4 * 4) * ((n + 7) / 8 * 8) * k;
+    }
+}
+
+/* QPU cleans A, B and C before the launch and invalidates C after it. */
+static double bytes(const enum sgemm_engine engine,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k)
+{
+    if (SGEMM_ENGINE_QPU != engine)
+        return 0;
+    return 4.0 * ((double) m * k + (double) k * n + 2.0 * m * n);
+}
+
+static const struct cost_table* calibrate_at_first_use();
+
+static struct cost cost_of(const enum sgemm_engine engine, const int v)
+{
+    const struct cost_table *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+
+    if (t == NULL)
+        t = calibrate_at_first_use();
+    return t->cost[engine][v];
+}
+
+double sgemm_predict(const enum sgemm_engine engine,
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k,
+        const int split_k)
+{
+    const struct cost c = cost_of(engine, variant(transa, transb));
+
+    return c.overhead
+           + c.per_flop * sgemm_work(engine, transa, transb, m, n, k, split_k)
+           + c.per_byte * bytes(engine, m, n, k);
+}
+
+double sgemm_predict_batched(
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k,
+        const MKL_INT n_problems)
+{
+    const struct cost c = cost_of(SGEMM_ENGINE_QPU, variant(transa, transb));
+    const unsigned share = sgemm_batch_share(n_problems);
+    unsigned tile_m, tile_n, tile_k, n_threads;
+
+    n_threads = sgemm_qpu_shape(transa, transb, m, n, k, share, 0,
+            &tile_m, &tile_n, &tile_k);
+    return c.overhead * share / SGEMM_QPU_MAX_THREADS
+           + c.per_flop * 2.0 * tile_m * tile_n * tile_k * n_threads / SGEMM_QPU_MAX_THREADS
+           + c.per_byte * bytes(SGEMM_ENGINE_QPU, m, n, k);
+}
+
+static void (* const sgemm_of[SGEMM_N_ENGINES])(
+        const CBLAS_TRANSPOSE, const CBLAS_TRANSPOSE,
+        const MKL_INT, const MKL_INT, const MKL_INT, const float,
+        const float*, const MKL_INT, const float*, const MKL_INT,
+        const float, float*, const MKL_INT) = {
+    blas_sgemm_qpu,
+    blas_sgemm_cpu
+};
+
+/* The best of a few runs; a, b and c are large enough for any shape here. */
+static double measure(const enum sgemm_engine engine,
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k,
+        const float *a, const float *b, float *c)
+{
+    const MKL_INT lda = CblasNoTrans == transa ? k : m;
+    const MKL_INT ldb = CblasNoTrans == transb ? n : k;
+    double best = 1e9;
+    int i;
+
+    for (i = 0; i < 3; i ++) {
+        const double start = get_time();
+        sgemm_of[engine](transa, transb, m, n, k, 1, a, lda, b, ldb, 0, c, n);
+        const double t = get_time() - start;
+        if (t < best)
+            best = t;
+    }
+    return best;
+}
+
+/* Cost of cleaning dirty lines, per byte. */
+static double measure_per_byte(float *p, const size_t len)
+{
+    double best = 1e9;
+    size_t i;
+    int j;
+
+    for (j = 0; j < 3; j ++) {
+        double t;
+        for (i = 0; i < len; i ++)
+            p[i] = i;
+        t = get_time();
+        rpimemmgr_cache_op(QMKL_CACHE_OP_CLEAN, p, len * sizeof(*p));
+        t = get_time() - t;
+        if (t < best)
+            best = t;
+    }
+    return best / (len * sizeof(*p));
+}
+
+/* Measures the cost table into t, without touching table. */
+static void calibrate(struct cost t[SGEMM_N_ENGINES][4])
+{
+    /* A small shape that is all overhead, and one that fills all 12 QPUs. */
+    const MKL_INT ms = 16, ns = 64, ks = 16;
+    const MKL_INT ml = 16 * 12, nl = 64 * 12, kl = 128;
+    const size_t len = nl * nl;
+    float *a, *b, *c;
+    double per_byte = 0;
+    int split_k, e, v;
+    size_t i;
+
+    a = mkl_malloc(len * sizeof(*a), 4096);
+    b = mkl_malloc(len * sizeof(*b), 4096);
+    c = mkl_malloc(len * sizeof(*c), 4096);
+    for (i = 0; i < len; i ++)
+        a[i] = b[i] = 1.0 / 1024;
+    split_k = sgemm_qpu_can_split_k(a, b, c);
+
+    if (backend_qpu_available())
+        per_byte = measure_per_byte(c, len);
+
+    for (e = 0; e < SGEMM_N_ENGINES; e ++) {
+        for (v = 0; v < 4; v ++) {
+            const CBLAS_TRANSPOSE transa = v & 2 ? CblasTrans : CblasNoTrans;
+            const CBLAS_TRANSPOSE transb = v & 1 ? CblasTrans : CblasNoTrans;
+            /* RTT tiles C in 64x16, so give it the transposed shapes. */
+            const MKL_INT m0 = v == 3 ? ns : ms, n0 = v == 3 ? ms : ns;
+            const MKL_INT m1 = v == 3 ? nl : ml, n1 = v == 3 ? ml : nl;
+            struct cost *cost = &t[e][v];
+            double t0, t1, w0, w1;
+
+            if (SGEMM_ENGINE_QPU == e && !backend_qpu_available()) {
+                /* Never chosen. */
+                cost->overhead = 1e9;
+                cost->per_flop = cost->per_byte = 0;
+                continue;
+            }
+
+            cost->per_byte = SGEMM_ENGINE_QPU == e ? per_byte : 0;
+            t0 = measure(e, transa, transb, m0, n0, ks, a, b, c)
+                 - cost->per_byte * bytes(e, m0, n0, ks);
+            t1 = measure(e, transa, transb, m1, n1, kl, a, b, c)
+                 - cost->per_byte * bytes(e, m1, n1, kl);
+            w0 = sgemm_work(e, transa, transb, m0, n0, ks, split_k);
+            w1 = sgemm_work(e, transa, transb, m1, n1, kl, split_k);
+
+            cost->per_flop = (t1 - t0) / (w1 - w0);
+            if (cost->per_flop < 0)
+                cost->per_flop = t1 / w1;
+            cost->overhead = t0 - cost->per_flop * w0;
+            if (cost->overhead < 0)
+                cost->overhead = 0;
+        }
+    }
+
+    mkl_free(c);
+    mkl_free(b);
+    mkl_free(a);
+}
+
+/* Publishes a copy of t as the table; install_lock is held. */
+static void install(const struct cost t[SGEMM_N_ENGINES][4])
+{
+    struct cost_table *next = malloc(sizeof(*next));
+
+    if (next == NULL)
+        error_fatal("Failed to allocate the sgemm cost table\n");
+    memcpy(next->cost, t, sizeof(next->cost));
+    next->retired = table;
+    __atomic_store_n(&table, next, __ATOMIC_RELEASE);
+}
+
+/* Reads a whole table from path into t, or returns -1. */
+static int calibration_read(const char *path, struct cost t[SGEMM_N_ENGINES][4])
+{
+    int seen[SGEMM_N_ENGINES][4];
+    char line[0x100], engine[8], name[8];
+    FILE *fp;
+    int e, v, n = 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    memset(seen, 0, sizeof(seen));
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        struct cost c;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%7s %7s %lf %lf %lf",
+                    engine, name, &c.overhead, &c.per_flop, &c.per_byte) != 5)
+            goto fail;
+        for (e = 0; e < SGEMM_N_ENGINES && strcmp(engine, engine_names[e]); e ++)
+            ;
+        for (v = 0; v < 4 && strcmp(name, variant_names[v]); v ++)
+            ;
+        if (e == SGEMM_N_ENGINES || v == 4)
+            goto fail;
+        t[e][v] = c;
+        if (!seen[e][v]) {
+            seen[e][v] = !0;
+            n ++;
+        }
+    }
+    fclose(fp);
+
+    return n == SGEMM_N_ENGINES * 4 ? 0 : -1;
+
+fail:
+    fclose(fp);
+    return -1;
+}
+
+static int calibration_write(const char *path,
+        const struct cost t[SGEMM_N_ENGINES][4])
+{
+    FILE *fp;
+    int e, v;
+
+    fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+
+    fprintf(fp, "# QMKL sgemm calibration\n");
+    fprintf(fp, "# engine variant overhead[s] per_flop[s] per_byte[s]\n");
+    for (e = 0; e < SGEMM_N_ENGINES; e ++)
+        for (v = 0; v < 4; v ++)
+            fprintf(fp, "%s %s %.6e %.6e %.6e\n",
+                    engine_names[e], variant_names[v], t[e][v].overhead,
+                    t[e][v].per_flop, t[e][v].per_byte);
+
+    return fclose(fp) ? -1 : 0;
+}
+
+/* Measures without the lock, so that other threads keep predicting. */
+void qmkl_sgemm_calibrate()
+{
+    struct cost t[SGEMM_N_ENGINES][4];
+
+    calibrate(t);
+    pthread_mutex_lock(&install_lock);
+    install(t);
+    pthread_mutex_unlock(&install_lock);
+}
+
+int qmkl_sgemm_calibration_load(const char *path)
+{
+    struct cost t[SGEMM_N_ENGINES][4];
+
+    if (calibration_read(path, t))
+        return -1;
+    pthread_mutex_lock(&install_lock);
+    install(t);
+    pthread_mutex_unlock(&install_lock);
+    return 0;
+}
+
+int qmkl_sgemm_calibration_save(const char *path)
+{
+    const struct cost_table *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+
+    if (t == NULL) {
+        qmkl_sgemm_calibrate();
+        t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+    }
+    return calibration_write(path, t->cost);
+}
+
+/* Threads that call before any table is installed wait for the first one. */
+static const struct cost_table* calibrate_at_first_use()
+{
+    const char *path = getenv("QMKL_SGEMM_CALIBRATION");
+    struct cost t[SGEMM_N_ENGINES][4];
+    const struct cost_table *installed;
+
+    pthread_mutex_lock(&install_lock);
+    if (table == NULL) {
+        if (path == NULL || calibration_read(path, t)) {
+            calibrate(t);
+            if (path != NULL && calibration_write(path, t))
+                fprintf(stderr, "QMKL: Failed to write sgemm calibration to %s\n", path);
+        }
+        install(t);
+    }
+    installed = table;
+    pthread_mutex_unlock(&install_lock);
+    return installed;
+}
+
+void qmkl_sgemm_last_decision(struct qmkl_sgemm_decision *decision)
+{
+    *decision = last_decision;
+}
+
+int sgemm_gpu_only(
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float *a,
+    const float *b,
+    const float *c,
+    const int c_arg)
+{
+    if (m <= 0 || n <= 0)
+        return 0;
+    if (k <= 0) {
+        if (!ptr_is_gpu_only(c))
+            return 0;
+        xerbla_local(c_arg);
+        return -1;
+    }
+    return ptr_is_gpu_only(a) || ptr_is_gpu_only(b) || ptr_is_gpu_only(c);
+}
+
+int sgemm_on_qpu(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float *a,
+    const float *b,
+    const float *c)
+{
+    int gpu_only;
+
+    switch (qmkl_get_backend()) {
+    case QMKL_BACKEND_QPU:
+        return !0;
+    case QMKL_BACKEND_CPU:
+        return 0;
+    default:
+        gpu_only = sgemm_gpu_only(m, n, k, a, b, c, 13);
+        if (gpu_only)
+            return gpu_only;
+        if (k < 2 || m <= 0 || n <= 0 || !backend_qpu_available())
+            return 0;
+        /* Such calls launch the 2D partition and never split k. */
+        return sgemm_predict(SGEMM_ENGINE_QPU, transa, transb, m, n, k, 0)
+               <= sgemm_predict(SGEMM_ENGINE_CPU, transa, transb, m, n, k, 0);
+    }
+}
+
+static void sgemm_dispatch(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc,
+    const int force_hybrid)
+{
+    static const char * const path_names[] = {"none", "qpu", "cpu", "hybrid"};
+    struct qmkl_sgemm_decision d;
+    const int gpu_only = sgemm_gpu_only(m, n, k, a, b, c, 13);
+    const int split_k = sgemm_qpu_can_split_k(a, b, c);
+    double start;
+
+    d.transa = transa;
+    d.transb = transb;
+    d.m = m;
+    d.n = n;
+    d.k = k;
+    d.m_qpu = 0;
+    d.predicted_qpu = sgemm_predict(SGEMM_ENGINE_QPU, transa, transb, m, n, k,
+                                    split_k);
+    d.predicted_qpu += cost_of(SGEMM_ENGINE_QPU, variant(transa, transb)).per_byte
+                       * sgemm_staged_bytes(transa, transb, m, n, k, a, b, c);
+    d.predicted_cpu = sgemm_predict(SGEMM_ENGINE_CPU, transa, transb, m, n, k, 0);
+    d.predicted_hybrid = 1e9;
+
+    /*
+     * The QPU kernels need k >= 2 and at least one tile of C to pay, but
+     * are correct down to k = 1, which GPU-only operands leave to them.
+     */
+    if (gpu_only < 0) {
+        d.path = QMKL_SGEMM_PATH_NONE;
+    } else if (gpu_only) {
+        d.path = QMKL_SGEMM_PATH_QPU;
+    } else if (k < 2 || m <= 0 || n <= 0 || !backend_qpu_available()) {
+        d.path = QMKL_SGEMM_PATH_CPU;
+    } else {
+        const MKL_INT m_qpu = sgemm_hybrid_split(transa, transb, m, n, k,
+                                                 a, b, c, ldc);
+        double t_qpu, t_cpu;
+
+        if (0 < m_qpu && m_qpu < m) {
+            t_qpu = sgemm_predict(SGEMM_ENGINE_QPU, transa, transb, m_qpu, n, k,
+                                  split_k);
+            t_cpu = sgemm_predict(SGEMM_ENGINE_CPU, transa, transb, m - m_qpu, n, k,
+                                  0);
+            d.m_qpu = m_qpu;
+            d.predicted_hybrid = t_qpu > t_cpu ? t_qpu : t_cpu;
+        }
+
+        if (force_hybrid && d.m_qpu)
+            d.path = QMKL_SGEMM_PATH_HYBRID;
+        else if (d.m_qpu && d.predicted_hybrid < d.predicted_qpu
+                         && d.predicted_hybrid < d.predicted_cpu)
+            d.path = QMKL_SGEMM_PATH_HYBRID;
+        else
+            d.path = d.predicted_qpu <= d.predicted_cpu ? QMKL_SGEMM_PATH_QPU
+                                                        : QMKL_SGEMM_PATH_CPU;
+    }
+
+    start = get_time();
+    switch (d.path) {
+    case QMKL_SGEMM_PATH_QPU:
+        blas_sgemm_qpu(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+    case QMKL_SGEMM_PATH_HYBRID:
+        sgemm_hybrid_run(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc,
+                         d.m_qpu);
+        break;
+    case QMKL_SGEMM_PATH_NONE:
+        break;
+    default:
+        blas_sgemm_cpu(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+    }
+    d.actual = get_time() - start;
+
+    if (trace)
+        fprintf(stderr, "QMKL: sgemm %s m=%d n=%d k=%d: %s "
+                "(predicted qpu %.3e s, cpu %.3e s, hybrid %.3e s with %d rows on qpu; "
+                "actual %.3e s)\n",
+                variant_names[variant(transa, transb)], m, n, k, path_names[d.path],
+                d.predicted_qpu, d.predicted_cpu, d.predicted_hybrid, d.m_qpu,
+                d.actual);
+
+    last_decision = d;
+}
+
+void blas_sgemm_auto(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc)
+{
+    sgemm_dispatch(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, 0);
+}
+
+/* As auto, but splits C between the engines whenever the shape allows it. */
+void blas_sgemm_hybrid(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc)
+{
+    sgemm_dispatch(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, !0);
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Hybrid SGEMM: QPU computes the leading rows of C and CPU the trailing rows,
+ * at the same time.  The QPU launch blocks the calling thread in the mailbox
+ * ioctl, so the CPU part runs on a worker thread, started on first use and
+ * kept until finalize, so that its OpenMP team is kept as well.  A call that
+ * finds the worker busy with another runs its parts in turn.
+ *
+ * The split point is a whole number of the tiles of the kernel the QPU part
+ * runs, so QPU sees no padding, and falls on a cache line boundary of C: QPU cleans and invalidates its
+ * rows while CPU writes its own, and a line shared by both would lose one
+ * side's results.  The ratio follows the measured throughput of each engine.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include "local/gemm.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CACHE_LINE_SIZE 64
+
+/* Smoothed throughput of each engine per transpose variant [flop/s]. */
+static double rate[SGEMM_N_ENGINES][4];
+static const double ema_weight = 0.25;
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct cpu_part {
+    CBLAS_TRANSPOSE transa, transb;
+    MKL_INT m, n, k;
+    float alpha;
+    const float *a;
+    MKL_INT lda;
+    const float *b;
+    MKL_INT ldb;
+    float beta;
+    float *c;
+    MKL_INT ldc;
+    double time;
+};
+
+/*
+ * The worker runs part when it is set and clears it when done.  lock
+ * guards the fields; busy is held by the call using the worker.
+ */
+static struct {
+    pthread_t thread;
+    int started, stopping;
+    struct cpu_part *part;
+    pthread_mutex_t lock, busy;
+    pthread_cond_t cond_part, cond_done;
+} worker = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+    .cond_part = PTHREAD_COND_INITIALIZER,
+    .cond_done = PTHREAD_COND_INITIALIZER
+};
+
+static double get_time()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int variant(const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb)
+{
+    return (CblasNoTrans != transa) * 2 + (CblasNoTrans != transb);
+}
+
+static double rate_of(const enum sgemm_engine engine,
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k, const int split_k)
+{
+    double r;
+
+    pthread_mutex_lock(&rate_lock);
+    r = rate[engine][variant(transa, transb)];
+    pthread_mutex_unlock(&rate_lock);
+
+    /* Start from the cost model until something has been measured. */
+    if (r == 0)
+        return sgemm_work(engine, transa, transb, m, n, k, split_k)
+               / sgemm_predict(engine, transa, transb, m, n, k, split_k);
+    return r;
+}
+
+static void rate_update(const enum sgemm_engine engine,
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k, const int split_k,
+        const double time)
+{
+    double *r = &rate[engine][variant(transa, transb)];
+    double measured;
+
+    if (time <= 0)
+        return;
+    measured = sgemm_work(engine, transa, transb, m, n, k, split_k) / time;
+    pthread_mutex_lock(&rate_lock);
+    *r = *r == 0 ? measured : *r + ema_weight * (measured - *r);
+    pthread_mutex_unlock(&rate_lock);
+}
+
+MKL_INT sgemm_hybrid_split(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float *a,
+    const float *b,
+    const float *c,
+    const MKL_INT ldc)
+{
+    const int split_k = sgemm_qpu_can_split_k(a, b, c);
+    unsigned tile_p, tile_r;
+    double r_qpu, r_cpu;
+    MKL_INT tile, m_qpu;
+
+    if (k < 2 || n <= 0)
+        return 0;
+    sgemm_qpu_tile(transa, transb, m, n, &tile_p, &tile_r);
+    tile = tile_p;
+    if (m <= tile)
+        return 0;
+
+    r_qpu = rate_of(SGEMM_ENGINE_QPU, transa, transb, m, n, k, split_k);
+    r_cpu = rate_of(SGEMM_ENGINE_CPU, transa, transb, m, n, k, 0);
+    m_qpu = (MKL_INT) (m * r_qpu / (r_qpu + r_cpu) / tile + 0.5) * tile;
+    if (m_qpu < tile)
+        m_qpu = tile;
+    if (m_qpu >= m)
+        m_qpu = (m - 1) / tile * tile;
+
+    for (;;) {
+        while (m_qpu > 0
+                && (uintptr_t) (c + m_qpu * ldc) % CACHE_LINE_SIZE != 0)
+            m_qpu -= tile;
+        if (m_qpu <= 0)
+            return 0;
+        /* The QPU part may take a larger tile; its rows stay whole ones. */
+        sgemm_qpu_tile(transa, transb, m_qpu, n, &tile_p, &tile_r);
+        if (m_qpu % tile_p == 0)
+            return m_qpu;
+        tile = tile_p;
+        m_qpu = m_qpu / tile * tile;
+    }
+}
+
+static void* cpu_part_run(void *arg)
+{
+    struct cpu_part *cp = arg;
+    const double start = get_time();
+
+    blas_sgemm_cpu(cp->transa, cp->transb, cp->m, cp->n, cp->k, cp->alpha,
+                   cp->a, cp->lda, cp->b, cp->ldb, cp->beta, cp->c, cp->ldc);
+    cp->time = get_time() - start;
+    return NULL;
+}
+
+static void* worker_run(void *arg)
+{
+    UNUSED(arg);
+
+    pthread_mutex_lock(&worker.lock);
+    for (;;) {
+        while (worker.part == NULL && !worker.stopping)
+            pthread_cond_wait(&worker.cond_part, &worker.lock);
+        if (worker.part == NULL)
+            break;
+        pthread_mutex_unlock(&worker.lock);
+        cpu_part_run(worker.part);
+        pthread_mutex_lock(&worker.lock);
+        worker.part = NULL;
+        pthread_cond_signal(&worker.cond_done);
+    }
+    pthread_mutex_unlock(&worker.lock);
+    return NULL;
+}
+
+/* Hands cp to the worker, or returns 0 if it is busy or cannot start. */
+static int worker_post(struct cpu_part *cp)
+{
+    int started;
+
+    if (pthread_mutex_trylock(&worker.busy))
+        return 0;
+
+    pthread_mutex_lock(&worker.lock);
+    if (!worker.started)
+        worker.started = !pthread_create(&worker.thread, NULL, worker_run,
+                NULL);
+    started = worker.started;
+    if (started) {
+        worker.part = cp;
+        pthread_cond_signal(&worker.cond_part);
+    }
+    pthread_mutex_unlock(&worker.lock);
+
+    if (!started)
+        pthread_mutex_unlock(&worker.busy);
+    return started;
+}
+
+static void worker_wait()
+{
+    pthread_mutex_lock(&worker.lock);
+    while (worker.part != NULL)
+        pthread_cond_wait(&worker.cond_done, &worker.lock);
+    pthread_mutex_unlock(&worker.lock);
+    pthread_mutex_unlock(&worker.busy);
+}
+
+void sgemm_hybrid_finalize()
+{
+    pthread_mutex_lock(&worker.lock);
+    if (!worker.started) {
+        pthread_mutex_unlock(&worker.lock);
+        return;
+    }
+    worker.stopping = 1;
+    pthread_cond_signal(&worker.cond_part);
+    pthread_mutex_unlock(&worker.lock);
+    pthread_join(worker.thread, NULL);
+
+    worker.started = 0;
+    worker.stopping = 0;
+}
+
+void sgemm_hybrid_run(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc,
+    const MKL_INT m_qpu)
+{
+    struct cpu_part cp;
+    int posted;
+    double start, t_qpu;
+
+    cp.transa = transa;
+    cp.transb = transb;
+    cp.m = m - m_qpu;
+    cp.n = n;
+    cp.k = k;
+    cp.alpha = alpha;
+    cp.a = CblasNoTrans == transa ? a + m_qpu * lda : a + m_qpu;
+    cp.lda = lda;
+    cp.b = b;
+    cp.ldb = ldb;
+    cp.beta = beta;
+    cp.c = c + m_qpu * ldc;
+    cp.ldc = ldc;
+
+    /* Without the worker, run the parts in turn rather than wait or fail. */
+    posted = worker_post(&cp);
+
+    start = get_time();
+    blas_sgemm_qpu(transa, transb, m_qpu, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    t_qpu = get_time() - start;
+
+    if (posted)
+        worker_wait();
+    else
+        cpu_part_run(&cp);
+
+    rate_update(SGEMM_ENGINE_QPU, transa, transb, m_qpu, n, k,
+            sgemm_qpu_can_split_k(a, b, c), t_qpu);
+    rate_update(SGEMM_ENGINE_CPU, transa, transb, m - m_qpu, n, k, 0, cp.time);
+}
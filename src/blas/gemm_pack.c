@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Packed SGEMM.  A packed operand is alpha * op(X) stored untransposed, so
+ * that the QPU kernels read it as NoTrans whatever the original transpose
+ * was, with each row padded to whole cache lines.  It is cleaned once when
+ * packed; CPU only reads it afterwards, so cblas_sgemm_compute never cleans
+ * it again.
+ *
+ * The buffer starts with a header of one cache line that records the shape,
+ * so that cblas_sgemm_compute can check it and find the leading dimension.
+ * Column-major calls are the row-major ones for C^T = op(B)^T op(A)^T, where
+ * a packed A serves as B and the other way round, transposed; the size
+ * covers both orientations.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include "local/gemm.h"
+#include "local/error.h"
+#include <rpimemmgr.h>
+#include <stdint.h>
+
+#define CACHE_LINE_SIZE 64
+#define PACK_MAGIC 0x514b5053 /* "SPKQ" */
+
+struct pack_header {
+    uint32_t magic;
+    CBLAS_IDENTIFIER identifier;
+    MKL_INT rows, cols, ld;
+};
+
+static MKL_INT pack_ld(const MKL_INT cols)
+{
+    const MKL_INT line = CACHE_LINE_SIZE / sizeof(float);
+
+    return (cols + line - 1) / line * line;
+}
+
+static float* pack_data(const float *dest)
+{
+    return (float*) ((const char*) dest + CACHE_LINE_SIZE);
+}
+
+size_t cblas_sgemm_pack_get_size(
+    const CBLAS_IDENTIFIER identifier,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k)
+{
+    MKL_INT rows, cols;
+
+    switch (identifier) {
+    case CblasAMatrix:
+        rows = m;
+        cols = k;
+        break;
+    case CblasBMatrix:
+        rows = k;
+        cols = n;
+        break;
+    default:
+        xerbla_local(1);
+        return 0;
+    }
+    if (rows < 0 || cols < 0) {
+        xerbla_local(2);
+        return 0;
+    }
+
+    if ((size_t) rows * pack_ld(cols) < (size_t) cols * pack_ld(rows))
+        return CACHE_LINE_SIZE + (size_t) cols * pack_ld(rows) * sizeof(float);
+    return CACHE_LINE_SIZE + (size_t) rows * pack_ld(cols) * sizeof(float);
+}
+
+void cblas_sgemm_pack(
+    const CBLAS_LAYOUT layout,
+    const CBLAS_IDENTIFIER identifier,
+    const CBLAS_TRANSPOSE trans,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *src,
+    const MKL_INT ld,
+    float *dest)
+{
+    struct pack_header *h = (struct pack_header*) dest;
+    float *data = pack_data(dest);
+    MKL_INT i, j;
+
+    if (CblasColMajor == layout) {
+        cblas_sgemm_pack(CblasRowMajor,
+                CblasAMatrix == identifier ? CblasBMatrix : CblasAMatrix,
+                trans, n, m, k, alpha, src, ld, dest);
+        return;
+    }
+    if (CblasRowMajor != layout) {
+        xerbla_local(1);
+        return;
+    }
+    if (CblasAMatrix != identifier && CblasBMatrix != identifier) {
+        xerbla_local(2);
+        return;
+    }
+
+    h->magic = PACK_MAGIC;
+    h->identifier = identifier;
+    h->rows = CblasAMatrix == identifier ? m : k;
+    h->cols = CblasAMatrix == identifier ? k : n;
+    h->ld = pack_ld(h->cols);
+
+#pragma omp parallel for private(j)
+    for (i = 0; i < h->rows; i ++) {
+        float * const row = data + i * h->ld;
+        if (CblasNoTrans == trans)
+            for (j = 0; j < h->cols; j ++)
+                row[j] = alpha * src[i * ld + j];
+        else
+            for (j = 0; j < h->cols; j ++)
+                row[j] = alpha * src[j * ld + i];
+        for (; j < h->ld; j ++)
+            row[j] = 0;
+    }
+
+    if (ptr_is_gpu_accessible(dest))
+        rpimemmgr_cache_op(QMKL_CACHE_OP_CLEAN, dest,
+                cblas_sgemm_pack_get_size(identifier, m, n, k));
+}
+
+/*
+ * Returns the packed data and its leading dimension, or NULL after reporting
+ * argument arg if x is not packed by cblas_sgemm_pack for a rows x cols
+ * operand.
+ */
+static const float* pack_open(const float *x, const CBLAS_IDENTIFIER identifier,
+        const MKL_INT rows, const MKL_INT cols, const int arg, MKL_INT *ld)
+{
+    const struct pack_header *h = (const struct pack_header*) x;
+
+    if (h->magic != PACK_MAGIC || h->identifier != identifier
+            || h->rows != rows || h->cols != cols) {
+        xerbla_local(arg);
+        return NULL;
+    }
+
+    *ld = h->ld;
+    return pack_data(x);
+}
+
+/*
+ * The row-major cblas_sgemm_compute; arg_a and arg_b are the argument
+ * numbers of a and b in the call of the user, which a column-major call
+ * swaps.
+ */
+static void sgemm_compute(
+    const MKL_INT transa,
+    const MKL_INT transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc,
+    const int arg_a,
+    const int arg_b)
+{
+    const int a_packed = CblasPacked == transa, b_packed = CblasPacked == transb;
+    const CBLAS_TRANSPOSE ta = a_packed ? CblasNoTrans : (CBLAS_TRANSPOSE) transa;
+    const CBLAS_TRANSPOSE tb = b_packed ? CblasNoTrans : (CBLAS_TRANSPOSE) transb;
+    const float *ap = a, *bp = b;
+    MKL_INT lda_p = lda, ldb_p = ldb;
+    struct cache_region r[3];
+    struct unif_arena *arena;
+    unsigned n_threads, n_regions, i, j;
+    int on_qpu;
+
+    if (a_packed && (ap = pack_open(a, CblasAMatrix, m, k, arg_a, &lda_p)) == NULL)
+        return;
+    if (b_packed && (bp = pack_open(b, CblasBMatrix, k, n, arg_b, &ldb_p)) == NULL)
+        return;
+
+    on_qpu = sgemm_on_qpu(ta, tb, m, n, k, ap, bp, c);
+    if (on_qpu < 0)
+        return;
+    /* alpha is in the packed operand. */
+    if (!on_qpu) {
+        blas_sgemm_cpu(ta, tb, m, n, k, 1, ap, lda_p, bp, ldb_p, beta, c, ldc);
+        return;
+    }
+    if (!ptr_is_gpu_accessible(ap) || !ptr_is_gpu_accessible(bp)
+            || !ptr_is_gpu_accessible(c)) {
+        blas_sgemm_qpu(ta, tb, m, n, k, 1, ap, lda_p, bp, ldb_p, beta, c, ldc);
+        return;
+    }
+
+    arena = unif_arena_get();
+    n_threads = sgemm_qpu_unif_set(arena->cpu, arena->gpu,
+            SGEMM_QPU_MAX_THREADS, ta, tb, m, n, k, 1,
+            get_ptr_gpu_from_ptr_cpu(ap), lda_p,
+            get_ptr_gpu_from_ptr_cpu(bp), ldb_p,
+            beta, get_ptr_gpu_from_ptr_cpu(c), ldc);
+
+    /* A packed operand was cleaned once when it was packed. */
+    n_regions = sgemm_qpu_clean_regions(r, ta, tb, m, n, k, ap, lda_p,
+            bp, ldb_p, beta, c, ldc);
+    for (i = j = 0; i < n_regions; i ++)
+        if (!(a_packed && r[i].p == ap) && !(b_packed && r[i].p == bp))
+            r[j ++] = r[i];
+    cache_regions_flush(r, j);
+
+    sgemm_qpu_launch(n_threads, arena->gpu,
+            sgemm_qpu_code_gpu(ta, tb, m, n, 1, beta));
+    unif_arena_put(arena);
+    if (ptr_is_cpu_cached(c))
+        rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, c, m, n * 4, ldc * 4);
+}
+
+void cblas_sgemm_compute(
+    const CBLAS_LAYOUT layout,
+    const MKL_INT transa,
+    const MKL_INT transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc)
+{
+    if (CblasColMajor == layout)
+        sgemm_compute(transb, transa, n, m, k, b, ldb, a, lda, beta, c, ldc,
+                9, 7);
+    else if (CblasRowMajor == layout)
+        sgemm_compute(transa, transb, m, n, k, a, lda, b, ldb, beta, c, ldc,
+                7, 9);
+    else
+        xerbla_local(1);
+}
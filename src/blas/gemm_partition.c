@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "local/gemm.h"
+#include <stdint.h>
+
+/*
+ * A thread of an sgemm launch computes its block of C in whole kernel
+ * tiles, so a block costs as many tiles as cover it, however little of its
+ * edge tiles lies within C, and the launch lasts as long as its slowest
+ * thread.  sgemm_partition thus tries every grid of p_div x r_div blocks
+ * within max_threads, each dimension split into blocks whose numbers of
+ * tiles differ by at most one, and keeps the one whose largest block is
+ * cheapest.  On a tie it keeps the one with fewer threads, which leaves
+ * QPUs to the other problems of a batch and contends less for the VPM DMA.
+ *
+ * When C has too few tiles to feed the QPUs, e.g. 16 x 100 with k in the
+ * thousands, the grid may also be repeated over k_div slices of k, each
+ * into a partial C of its own that the CPU then sums into C.  That costs
+ * a cache operation on the partial Cs and the sum, so it is only taken when
+ * the threads it adds save more.
+ */
+
+/*
+ * Cycles at 250 MHz of splitting k besides the sum: the invalidation of the
+ * partial Cs, an ioctl of some 10 us as the other cache operations, and the
+ * scratch they live in, which only grows, so that its allocation is left
+ * out.  An estimate, as is the next one.
+ */
+#define SGEMM_SPLIT_K_CYCLES 2500
+/*
+ * Cycles of the CPU summing an element of a partial C: the element was just
+ * invalidated, so it is read from SDRAM at about 1.5 GB/s (0.7 cycles), and
+ * the scalar load and add, some 4 cycles of the 1.2 GHz ARM, take another
+ * one; rounded up as the slices lie a whole partial C apart, a stride that
+ * defeats the prefetcher.
+ */
+#define SGEMM_SPLIT_K_ELEMENT_CYCLES 3
+
+/*
+ * Cycles of one tile of k: the main loop at about 16 FLOPs a cycle, and
+ * loading and storing the tile of C by DMA at about 4 bytes a cycle.
+ */
+static uint64_t sgemm_tile_cycles(const unsigned tile_p,
+        const unsigned tile_r, const unsigned k)
+{
+    const uint64_t area = (uint64_t) tile_p * tile_r;
+
+    return area * 2 * k / 16 + area * 2 * sizeof(float) / 4;
+}
+
+static unsigned sgemm_tiles(const unsigned len, const unsigned tile)
+{
+    const unsigned tiles = (len + tile - 1) / tile;
+
+    return tiles != 0 ? tiles : 1;
+}
+
+/*
+ * Block x of div along a dimension of len elements: the tiles are dealt
+ * out evenly, the leading blocks taking one more when they do not divide,
+ * so that the partial tile at the end, if any, is in a smaller block.
+ */
+static void sgemm_split(const unsigned len, const unsigned tile,
+        const unsigned div, const unsigned x,
+        unsigned *start, unsigned *size)
+{
+    const unsigned tiles = (len + tile - 1) / tile;
+    const unsigned q = tiles / div, rem = tiles % div;
+    const unsigned first = x * q + (x < rem ? x : rem);
+    const unsigned end = (first + q + (x < rem)) * tile;
+
+    *start = first * tile;
+    *size = (end < len ? end : len) - *start;
+}
+
+uint64_t sgemm_partition_cycles(const struct sgemm_partition *part)
+{
+    const unsigned tiles_p = sgemm_tiles(part->m, part->tile_p);
+    const unsigned tiles_r = sgemm_tiles(part->n, part->tile_r);
+
+    const unsigned depth = (part->k + part->k_div - 1) / part->k_div;
+    uint64_t cycles;
+
+    cycles = (uint64_t) ((tiles_p + part->p_div - 1) / part->p_div)
+        * ((tiles_r + part->r_div - 1) / part->r_div)
+        * sgemm_tile_cycles(part->tile_p, part->tile_r, depth);
+    if (part->k_div > 1)
+        cycles += SGEMM_SPLIT_K_CYCLES + (uint64_t) part->m * part->n
+            * part->k_div * SGEMM_SPLIT_K_ELEMENT_CYCLES;
+    return cycles;
+}
+
+void sgemm_partition(
+    struct sgemm_partition *part,
+    const unsigned m,
+    const unsigned n,
+    const unsigned k,
+    const unsigned tile_p,
+    const unsigned tile_r,
+    const unsigned max_threads,
+    const int split_k)
+{
+    const unsigned tiles_p = sgemm_tiles(m, tile_p);
+    const unsigned tiles_r = sgemm_tiles(n, tile_r);
+    /* Slices down to a single k, which the kernels run as any other. */
+    const unsigned max_k_div = split_k && k > 1 ? k : 1;
+    struct sgemm_partition grid;
+    uint64_t cost, best = UINT64_MAX;
+
+    grid.m = m;
+    grid.n = n;
+    grid.k = k;
+    grid.tile_p = tile_p;
+    grid.tile_r = tile_r;
+    *part = grid;
+    part->p_div = part->r_div = part->k_div = 1;
+
+    for (grid.p_div = 1; grid.p_div <= tiles_p && grid.p_div <= max_threads;
+            grid.p_div ++) {
+        for (grid.r_div = 1; grid.r_div <= tiles_r
+                && grid.p_div * grid.r_div <= max_threads; grid.r_div ++) {
+            for (grid.k_div = 1; grid.k_div <= max_k_div
+                    && sgemm_partition_threads(&grid) <= max_threads;
+                    grid.k_div ++) {
+                cost = sgemm_partition_cycles(&grid);
+                if (cost < best || (cost == best
+                            && sgemm_partition_threads(&grid)
+                               < sgemm_partition_threads(part))) {
+                    best = cost;
+                    *part = grid;
+                }
+            }
+        }
+    }
+}
+
+unsigned sgemm_partition_threads(const struct sgemm_partition *part)
+{
+    return part->p_div * part->r_div * part->k_div;
+}
+
+void sgemm_partition_block(
+    const struct sgemm_partition *part,
+    const unsigned th,
+    unsigned *i,
+    unsigned *rows,
+    unsigned *j,
+    unsigned *cols)
+{
+    const unsigned block = th % (part->p_div * part->r_div);
+
+    sgemm_split(part->m, part->tile_p, part->p_div, block / part->r_div,
+            i, rows);
+    sgemm_split(part->n, part->tile_r, part->r_div, block % part->r_div,
+            j, cols);
+}
+
+unsigned sgemm_partition_slice(
+    const struct sgemm_partition *part,
+    const unsigned th,
+    unsigned *l,
+    unsigned *depth)
+{
+    const unsigned slice = th / (part->p_div * part->r_div);
+
+    sgemm_split(part->k, 1, part->k_div, slice, l, depth);
+    return slice;
+}
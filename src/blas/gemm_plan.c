@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * SGEMM plans: the engine choice, partition, uniforms, code placement and
+ * bus addresses of a call are fixed at creation, so executing a plan on QPU
+ * is only the cache maintenance of A, B and C plus the launch.  Each plan
+ * owns its uniforms, so plans and plain cblas_sgemm calls do not overwrite
+ * each other; the kernels themselves are resident from qmkl_init().
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include "local/gemm.h"
+#include "local/error.h"
+#include <rpimemmgr.h>
+#include <stdlib.h>
+
+struct qmkl_sgemm_plan {
+    CBLAS_TRANSPOSE transa, transb;
+    MKL_INT m, n, k;
+    float alpha;
+    const float *a;
+    MKL_INT lda;
+    const float *b;
+    MKL_INT ldb;
+    float beta;
+    float *c;
+    MKL_INT ldc;
+
+    int on_qpu;
+    unsigned n_threads;
+    uint32_t *unif_cpu;
+    MKL_UINT unif_gpu, code_gpu;
+};
+
+qmkl_sgemm_plan_t qmkl_sgemm_plan_create(
+    const CBLAS_LAYOUT layout,
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc)
+{
+    struct qmkl_sgemm_plan *plan;
+    int on_qpu;
+
+    /* Column-major C is row-major C^T = op(B)^T op(A)^T. */
+    if (CblasColMajor == layout)
+        return qmkl_sgemm_plan_create(CblasRowMajor, transb, transa, n, m, k,
+                alpha, b, ldb, a, lda, beta, c, ldc);
+    if (CblasRowMajor != layout) {
+        xerbla_local(1);
+        return NULL;
+    }
+
+    /* The shape is fixed, so the engine is chosen once. */
+    on_qpu = sgemm_on_qpu(transa, transb, m, n, k, a, b, c);
+    if (on_qpu < 0)
+        return NULL;
+
+    plan = malloc(sizeof(*plan));
+    if (plan == NULL)
+        error_fatal("Failed to allocate sgemm plan\n");
+
+    plan->transa = transa;
+    plan->transb = transb;
+    plan->m = m;
+    plan->n = n;
+    plan->k = k;
+    plan->alpha = alpha;
+    plan->a = a;
+    plan->lda = lda;
+    plan->b = b;
+    plan->ldb = ldb;
+    plan->beta = beta;
+    plan->c = c;
+    plan->ldc = ldc;
+    plan->on_qpu = on_qpu;
+    plan->n_threads = 0;
+    plan->unif_cpu = NULL;
+    plan->unif_gpu = plan->code_gpu = 0;
+
+    /* Arrays QPU cannot access are staged on each execution instead. */
+    if (plan->on_qpu && ptr_is_gpu_accessible(a) && ptr_is_gpu_accessible(b)
+            && ptr_is_gpu_accessible(c)) {
+        plan->code_gpu = sgemm_qpu_code_gpu(transa, transb, m, n, alpha,
+                beta);
+        plan->unif_cpu = mkl_malloc_cache(
+                SGEMM_QPU_MAX_THREADS * SGEMM_QPU_UNIF_LEN_1TH * (32 / 8), 4096, 0);
+        plan->unif_gpu = get_ptr_gpu_from_ptr_cpu(plan->unif_cpu);
+        plan->n_threads = sgemm_qpu_unif_set(plan->unif_cpu, plan->unif_gpu,
+                SGEMM_QPU_MAX_THREADS, transa, transb, m, n, k, alpha,
+                get_ptr_gpu_from_ptr_cpu(a), lda,
+                get_ptr_gpu_from_ptr_cpu(b), ldb,
+                beta, get_ptr_gpu_from_ptr_cpu(c), ldc);
+    }
+
+    return plan;
+}
+
+void qmkl_sgemm_plan_execute(const qmkl_sgemm_plan_t plan)
+{
+    if (!plan->on_qpu) {
+        blas_sgemm_cpu(plan->transa, plan->transb, plan->m, plan->n, plan->k,
+                plan->alpha, plan->a, plan->lda, plan->b, plan->ldb,
+                plan->beta, plan->c, plan->ldc);
+        return;
+    }
+    if (plan->unif_cpu == NULL) {
+        blas_sgemm_qpu(plan->transa, plan->transb, plan->m, plan->n, plan->k,
+                plan->alpha, plan->a, plan->lda, plan->b, plan->ldb,
+                plan->beta, plan->c, plan->ldc);
+        return;
+    }
+
+    sgemm_qpu_clean(plan->transa, plan->transb, plan->m, plan->n, plan->k,
+            plan->a, plan->lda, plan->b, plan->ldb, plan->beta,
+            plan->c, plan->ldc);
+    sgemm_qpu_launch(plan->n_threads, plan->unif_gpu, plan->code_gpu);
+    if (ptr_is_cpu_cached(plan->c))
+        rpimemmgr_cache_op_2(QMKL_CACHE_OP_INVALIDATE, plan->c,
+                plan->m, plan->n * 4, plan->ldc * 4);
+}
+
+void qmkl_sgemm_plan_destroy(qmkl_sgemm_plan_t plan)
+{
+    if (plan == NULL)
+        return;
+
+    if (plan->unif_cpu != NULL)
+        mkl_free(plan->unif_cpu);
+    free(plan);
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * QPU SGEMM on arrays QPU cannot access, such as ones from malloc or mmap.
+ * They are streamed through bounce buffers within a window of GPU memory of
+ * a fixed size, in steps of one call of the kernels each:
+ *
+ *   for each block of columns of C:
+ *     for each block of k, accumulated into C with beta = 1 after the first:
+ *       copy the block of op(B) in
+ *       for each chunk of rows of C, whole kernel tiles each:
+ *         compute the chunk
+ *
+ * The block of B takes up to half of the window and two sets of chunk
+ * buffers for A and C the rest.  The sets alternate, so that while QPU
+ * computes step i, a copy thread copies the results of step i - 1 out and
+ * the operands of step i + 1 in; only when step i + 1 accumulates into the
+ * chunk of C of step i does it wait for the results.  The copy thread lives
+ * for the whole call and is handed each step through a condition variable.  C is not copied in
+ * for the first block of k when beta = 0, since the kernels for beta = 0
+ * ignore it.  Arrays QPU can access are used in place.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include "local/gemm.h"
+#include "local/error.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bytes of A and C per step at most, so that the copies overlap finely. */
+#define CHUNK_SIZE (1024 * 1024)
+#define DEFAULT_WINDOW (32 * 1024 * 1024)
+
+enum {
+    BOUNCE_B,
+    BOUNCE_A, /* and BOUNCE_A + 1 */
+    BOUNCE_C = BOUNCE_A + 2 /* and BOUNCE_C + 1 */
+};
+
+static size_t window = 0;
+
+struct stage {
+    CBLAS_TRANSPOSE transa, transb;
+    MKL_INT m, n, k;
+    const float *a;
+    MKL_INT lda;
+    const float *b;
+    MKL_INT ldb;
+    float beta;
+    float *c;
+    MKL_INT ldc;
+    int stage_a, stage_b, stage_c;
+    MKL_INT chunk_rows, block_cols;
+    MKL_INT n_chunks, n_blocks_k, n_steps;
+};
+
+struct step {
+    MKL_INT i0, rows, j0, cols, p0, depth;
+    const float *a;
+    MKL_INT lda;
+    float *c;
+    MKL_INT ldc;
+};
+
+struct pipe {
+    const struct stage *s;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int posted, stopping;
+    struct step *out, *in;
+    MKL_INT in_t;
+    unsigned in_buf;
+};
+
+static size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long size = strtoull(str, &end, 0);
+
+    switch (*end) {
+    case 'G': size *= 1024; /* fall through */
+    case 'M': size *= 1024; /* fall through */
+    case 'K': size *= 1024;
+        end ++;
+    }
+    if (end == str || *end != '\0' || size == 0)
+        error_fatal("Invalid QMKL_SGEMM_WINDOW: %s\n", str);
+    return size;
+}
+
+size_t qmkl_sgemm_get_window()
+{
+    if (window == 0) {
+        const char *env = getenv("QMKL_SGEMM_WINDOW");
+        window = env != NULL && *env != '\0' ? parse_size(env) : DEFAULT_WINDOW;
+    }
+    return window;
+}
+
+void qmkl_sgemm_set_window(const size_t size)
+{
+    window = size;
+    /* Buffers grown for a larger window would stay above the bound. */
+    bounce_buffers_free();
+}
+
+/*
+ * Parallel on the calling thread while QPU is idle; the copy thread copies
+ * alone, so that it does not build a team of threads each step.
+ */
+static void copy_2d(float *dst, const MKL_INT ldd, const float *src,
+        const MKL_INT lds, const MKL_INT rows, const MKL_INT cols,
+        const int parallel)
+{
+    MKL_INT i;
+
+#pragma omp parallel for if (parallel)
+    for (i = 0; i < rows; i ++)
+        memcpy(dst + i * ldd, src + i * lds, cols * sizeof(*src));
+}
+
+static void blocking(struct stage *s)
+{
+    const double floats = (double) qmkl_sgemm_get_window() / sizeof(float);
+    double rest = floats;
+    MKL_INT depth, per_row, limit, half, tile;
+    unsigned tile_p, tile_r;
+
+    s->block_cols = s->n;
+    s->n_blocks_k = 1;
+    if (s->stage_b && (double) s->k * s->n > floats / 2) {
+        /* All of k for as many columns as fit, else k in blocks too. */
+        s->block_cols = (MKL_INT) (floats / 2 / s->k) / 64 * 64;
+        if (s->block_cols < 64) {
+            s->block_cols = s->n < 64 ? s->n : 64;
+            s->n_blocks_k = (MKL_INT) (s->k / (floats / 2 / s->block_cols)) + 1;
+            if (s->n_blocks_k > s->k)
+                s->n_blocks_k = s->k;
+        }
+    }
+    depth = (s->k + s->n_blocks_k - 1) / s->n_blocks_k;
+    if (s->stage_b)
+        rest -= (double) depth * s->block_cols;
+
+    /* Chunks in whole tiles of the kernel for a block of columns. */
+    sgemm_qpu_tile(s->transa, s->transb, s->m, s->block_cols, &tile_p, &tile_r);
+    tile = tile_p;
+
+    if (!s->stage_a && !s->stage_c) {
+        s->chunk_rows = s->m;
+    } else {
+        per_row = s->stage_a * depth + s->stage_c * s->block_cols + 1;
+        s->chunk_rows = rest / 2 / per_row;
+        limit = CHUNK_SIZE / sizeof(float) / per_row;
+        if (s->chunk_rows > limit)
+            s->chunk_rows = limit;
+        /* At least two chunks if m allows, so that the copies overlap QPU. */
+        half = ((s->m + 1) / 2 + tile - 1) / tile * tile;
+        if (s->chunk_rows > half)
+            s->chunk_rows = half;
+        s->chunk_rows = s->chunk_rows / tile * tile;
+        if (s->chunk_rows < tile)
+            s->chunk_rows = tile;
+    }
+
+    s->n_chunks = (s->m + s->chunk_rows - 1) / s->chunk_rows;
+    s->n_steps = (s->n + s->block_cols - 1) / s->block_cols
+                 * s->n_blocks_k * s->n_chunks;
+}
+
+static void stage_set(struct stage *s,
+        const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        const MKL_INT m, const MKL_INT n, const MKL_INT k,
+        const float *a, const float *b, const float *c)
+{
+    s->transa = transa;
+    s->transb = transb;
+    s->m = m;
+    s->n = n;
+    s->k = k;
+    s->a = a;
+    s->b = b;
+    s->c = (float*) c;
+    s->stage_a = !ptr_is_gpu_accessible(a);
+    s->stage_b = !ptr_is_gpu_accessible(b);
+    s->stage_c = !ptr_is_gpu_accessible(c);
+    blocking(s);
+}
+
+double sgemm_staged_bytes(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float *a,
+    const float *b,
+    const float *c)
+{
+    struct stage s;
+
+    if (m <= 0 || n <= 0)
+        return 0;
+
+    /* A again for each block of columns, C in and out for each block of k. */
+    stage_set(&s, transa, transb, m, n, k, a, b, c);
+    return 4.0 * (s.stage_a * (double) m * k * ((n + s.block_cols - 1) / s.block_cols)
+                  + s.stage_b * (double) k * n
+                  + s.stage_c * 2.0 * m * n * s.n_blocks_k);
+}
+
+/* Step t is chunk t % n_chunks of block t / n_chunks of k and columns. */
+static void step_bounds(const struct stage *s, const MKL_INT t, struct step *st)
+{
+    const MKL_INT ic = t % s->n_chunks;
+    const MKL_INT pk = t / s->n_chunks % s->n_blocks_k;
+    const MKL_INT jb = t / s->n_chunks / s->n_blocks_k;
+
+    st->i0 = ic * s->chunk_rows;
+    st->rows = s->m - st->i0 < s->chunk_rows ? s->m - st->i0 : s->chunk_rows;
+    st->j0 = jb * s->block_cols;
+    st->cols = s->n - st->j0 < s->block_cols ? s->n - st->j0 : s->block_cols;
+    st->p0 = (MKL_INT) ((int64_t) s->k * pk / s->n_blocks_k);
+    st->depth = (MKL_INT) ((int64_t) s->k * (pk + 1) / s->n_blocks_k) - st->p0;
+}
+
+static void step_in(const struct stage *s, const MKL_INT t,
+        const unsigned buf, struct step *st, const int parallel)
+{
+    float *p;
+
+    step_bounds(s, t, st);
+
+    if (!s->stage_a) {
+        st->a = CblasNoTrans == s->transa ? s->a + st->i0 * s->lda + st->p0
+                                          : s->a + st->p0 * s->lda + st->i0;
+        st->lda = s->lda;
+    } else if (CblasNoTrans == s->transa) {
+        p = bounce_buffer(BOUNCE_A + buf, st->rows * st->depth * sizeof(*p));
+        copy_2d(p, st->depth, s->a + st->i0 * s->lda + st->p0, s->lda,
+                st->rows, st->depth, parallel);
+        st->a = p;
+        st->lda = st->depth;
+    } else {
+        /* The rows of op(A) are columns of A. */
+        p = bounce_buffer(BOUNCE_A + buf, st->depth * st->rows * sizeof(*p));
+        copy_2d(p, st->rows, s->a + st->p0 * s->lda + st->i0, s->lda,
+                st->depth, st->rows, parallel);
+        st->a = p;
+        st->lda = st->rows;
+    }
+
+    if (!s->stage_c) {
+        st->c = s->c + st->i0 * s->ldc + st->j0;
+        st->ldc = s->ldc;
+    } else {
+        p = bounce_buffer(BOUNCE_C + buf, st->rows * st->cols * sizeof(*p));
+        if (st->p0 != 0 || s->beta != 0)
+            copy_2d(p, st->cols, s->c + st->i0 * s->ldc + st->j0, s->ldc,
+                    st->rows, st->cols, parallel);
+        st->c = p;
+        st->ldc = st->cols;
+    }
+}
+
+static void step_out(const struct stage *s, const struct step *st,
+        const int parallel)
+{
+    if (s->stage_c)
+        copy_2d(s->c + st->i0 * s->ldc + st->j0, s->ldc, st->c, st->ldc,
+                st->rows, st->cols, parallel);
+}
+
+/* The block of op(B) for the k and columns of st. */
+static const float* block_b(const struct stage *s, const struct step *st,
+        MKL_INT *ldb)
+{
+    const MKL_INT rows = CblasNoTrans == s->transb ? st->depth : st->cols;
+    const MKL_INT cols = CblasNoTrans == s->transb ? st->cols : st->depth;
+    const float *src = CblasNoTrans == s->transb
+                       ? s->b + st->p0 * s->ldb + st->j0
+                       : s->b + st->j0 * s->ldb + st->p0;
+    float *p;
+
+    if (!s->stage_b) {
+        *ldb = s->ldb;
+        return src;
+    }
+
+    p = bounce_buffer(BOUNCE_B, rows * cols * sizeof(*p));
+    copy_2d(p, cols, src, s->ldb, rows, cols, 1);
+    *ldb = cols;
+    return p;
+}
+
+static void pipe_copy(const struct pipe *pp, const int parallel)
+{
+    if (pp->out != NULL)
+        step_out(pp->s, pp->out, parallel);
+    if (pp->in_t < pp->s->n_steps)
+        step_in(pp->s, pp->in_t, pp->in_buf, pp->in, parallel);
+}
+
+/* The copy thread: runs each posted step until the call stops it. */
+static void* pipe_run(void *arg)
+{
+    struct pipe *pp = arg;
+
+    pthread_mutex_lock(&pp->lock);
+    for (; ; ) {
+        while (!pp->posted && !pp->stopping)
+            pthread_cond_wait(&pp->cond, &pp->lock);
+        if (!pp->posted)
+            break;
+        pthread_mutex_unlock(&pp->lock);
+        pipe_copy(pp, 0);
+        pthread_mutex_lock(&pp->lock);
+        pp->posted = 0;
+        pthread_cond_broadcast(&pp->cond);
+    }
+    pthread_mutex_unlock(&pp->lock);
+    return NULL;
+}
+
+void sgemm_qpu_staged(
+    const CBLAS_TRANSPOSE transa,
+    const CBLAS_TRANSPOSE transb,
+    const MKL_INT m,
+    const MKL_INT n,
+    const MKL_INT k,
+    const float alpha,
+    const float *a,
+    const MKL_INT lda,
+    const float *b,
+    const MKL_INT ldb,
+    const float beta,
+    float *c,
+    const MKL_INT ldc)
+{
+    struct stage s;
+    struct step st[2], next;
+    struct pipe pp;
+    const float *b_s = NULL;
+    MKL_INT ldb_s = 0, t;
+    unsigned cur;
+    int pending = 0, threaded;
+
+    if (m <= 0 || n <= 0)
+        return;
+
+    stage_set(&s, transa, transb, m, n, k, a, b, c);
+    s.lda = lda;
+    s.ldb = ldb;
+    s.ldc = ldc;
+    s.beta = beta;
+
+    /* The bounce buffers are shared, so staged calls run one at a time. */
+    bounce_buffers_lock();
+    step_in(&s, 0, 0, &st[0], 1);
+    pp.s = &s;
+    pp.posted = 0;
+    pp.stopping = 0;
+    pthread_mutex_init(&pp.lock, NULL);
+    pthread_cond_init(&pp.cond, NULL);
+    /* Without the thread, the copies run in turn with QPU. */
+    threaded = s.n_steps > 1 && !pthread_create(&pp.thread, NULL, pipe_run, &pp);
+    for (t = 0, cur = 0; t < s.n_steps; t ++, cur ^= 1) {
+        int waits = 0;
+
+        if (s.stage_c && t + 1 < s.n_steps) {
+            step_bounds(&s, t + 1, &next);
+            waits = next.i0 == st[cur].i0 && next.j0 == st[cur].j0;
+        }
+        /* QPU is idle here, so the block of B can be replaced. */
+        if (t % s.n_chunks == 0)
+            b_s = block_b(&s, &st[cur], &ldb_s);
+
+        pthread_mutex_lock(&pp.lock);
+        pp.out = pending ? &st[cur ^ 1] : NULL;
+        pp.in = &st[cur ^ 1];
+        pp.in_t = waits ? s.n_steps : t + 1;
+        pp.in_buf = cur ^ 1;
+        pp.posted = threaded;
+        pthread_cond_broadcast(&pp.cond);
+        pthread_mutex_unlock(&pp.lock);
+
+        sgemm_qpu_direct(transa, transb, st[cur].rows, st[cur].cols,
+                st[cur].depth, alpha, st[cur].a, st[cur].lda, b_s, ldb_s,
+                st[cur].p0 == 0 ? beta : 1, st[cur].c, st[cur].ldc);
+
+        if (threaded) {
+            pthread_mutex_lock(&pp.lock);
+            while (pp.posted)
+                pthread_cond_wait(&pp.cond, &pp.lock);
+            pthread_mutex_unlock(&pp.lock);
+        } else
+            pipe_copy(&pp, 1);
+
+        if (waits) {
+            step_out(&s, &st[cur], 1);
+            step_in(&s, t + 1, cur ^ 1, &st[cur ^ 1], 1);
+        }
+        pending = !waits;
+    }
+    if (threaded) {
+        pthread_mutex_lock(&pp.lock);
+        pp.stopping = 1;
+        pthread_cond_broadcast(&pp.cond);
+        pthread_mutex_unlock(&pp.lock);
+        pthread_join(pp.thread, NULL);
+    }
+    pthread_cond_destroy(&pp.cond);
+    pthread_mutex_destroy(&pp.lock);
+    if (pending)
+        step_out(&s, &st[cur ^ 1], 1);
+    bounce_buffers_unlock();
+}
@@ -0,0 +1,1191 @@
+# GPU accelerated single precision matrix multiplication (single thread)
+#
+# Generates the whole family of QPU sgemm kernels.  Each thread computes
+# C = alpha * op(A) * op(B) + beta * C on its block of row-major C in tiles,
+# and the kernel is named after what it is specialised for:
+#
+#   sgemm_R<a><b>[_<rows>x<cols>][_<epilogue>]
+#
+#   <a>, <b>    N or T, whether A and B are transposed;
+#   <rows>x<cols>
+#               the tile, kept in the 64 registers of ra and rb; the default
+#               is 16x64, 16x32 for NT and 64x16 for TT, and NN and TN also
+#               come in 16x32 and TT in 32x16 for skinny C;
+#   <epilogue>  how a tile is merged into C:
+#                 (none)        alpha * AB + beta * C;
+#                 beta0         alpha * AB, without loading C at all, so
+#                               that what is in C never reaches the result;
+#                 alpha1_beta0  AB, likewise;
+#                 alpha1_beta1  AB + C.
+#
+# NN, TN and TT broadcast a column of op(A) (a row of op(B) for TT) element
+# by element against rows of the other matrix loaded through TMU1 in blocks
+# of 16; NT loads 16 values of k of both at a time.
+#
+#   python sgemm.py qhex <kernel>     prints the kernel
+#   python sgemm.py table <kernel>... prints the C table of the kernels
+#   python sgemm.py [<kernel>]        runs a random case on the QPUs
+import numpy as np
+import re
+import struct
+import sys
+import time
+import random
+
+from videocore.assembler import qpu, assemble, print_qbin, print_qhex
+from videocore.driver import Driver
+
+def mask(*idxs):
+    values = [1]*16
+    for idx in idxs:
+        values[idx] = 0
+    return values
+
+def log2(n):
+    return n.bit_length() - 1
+
+EPILOGUES = ['', 'beta0', 'alpha1_beta0', 'alpha1_beta1']
+TILES = {
+    'NN': [(16, 64), (16, 32)],
+    'TN': [(16, 64), (16, 32)],
+    'NT': [(16, 32)],
+    'TT': [(64, 16), (32, 16)],
+}
+
+class Kernel(object):
+
+    def __init__(self, name):
+        m = re.match(r'sgemm_R([NT][NT])(?:_(\d+)x(\d+))?(?:_(\w+))?$', name)
+        if m is None:
+            raise ValueError('bad kernel name: {}'.format(name))
+        self.name = name
+        self.trans = m.group(1)
+        self.trans_a = self.trans[0] == 'T'
+        self.trans_b = self.trans[1] == 'T'
+        if m.group(2):
+            self.tile = (int(m.group(2)), int(m.group(3)))
+        else:
+            self.tile = TILES[self.trans][0]
+        self.epilogue = m.group(4) or ''
+        if self.tile not in TILES[self.trans] \
+                or self.epilogue not in EPILOGUES:
+            raise ValueError('no such kernel: {}'.format(name))
+        # TT splits its tile into blocks of 16 rows, the others into blocks
+        # of 16 columns.
+        self.row_blocks = self.trans == 'TT'
+        self.nblocks = max(self.tile) // 16
+        self.alpha_one = self.epilogue.startswith('alpha1')
+        self.loads_c = not self.epilogue.endswith('beta0')
+
+@qpu
+def sgemm_gpu_code(asm, kernel):
+    k = kernel
+    nb = k.nblocks
+    TILE_P, TILE_R = k.tile
+
+    LOAD_SETUP_IDXS = [0]*4
+    STORE_SETUP_IDXS = [0]*4
+
+    if k.row_blocks:
+        A_CUR_IDX = 0;   B_CUR_IDX = 7
+        NCOLS_IDXS = [2]*4
+        NROWS_IDXS = [3, 4, 5, 6]
+    else:
+        B_CUR_IDX = 0;   A_CUR_IDX = 7
+        NROWS_IDXS = [2]*4
+        NCOLS_IDXS = [3, 4, 5, 6]
+    LOAD_BLOCKS_IDX = 0
+    K_IDX = 1;           STORE_BLOCKS_IDX = 1
+    I_IDX = 2
+    J_IDX = 3
+    P_IDX = 4
+    Q_IDX = 5
+    R_IDX = 6
+    LOAD_SETUP_IDXS[0] = 7;  ROW_IDX = 7
+    C_CUR_IDX = 8;       LOAD_SETUP_IDXS[1] = 8
+    A_BASE_IDX = 9;      LOAD_SETUP_IDXS[2] = 9
+    B_BASE_IDX = 10;     LOAD_SETUP_IDXS[3] = 10
+    C_BASE_IDX = 11;     STORE_SETUP_IDXS[0] = 11
+    A_STRIDE_IDX = 12;   STORE_SETUP_IDXS[1] = 12
+    B_STRIDE_IDX = 13;   STORE_SETUP_IDXS[2] = 13
+    C_STRIDE_IDX = 14;   STORE_SETUP_IDXS[3] = 14
+    COEF_ADDR_IDX = 15
+
+    # The operand loaded through TMU1 in blocks, and the one broadcast.
+    if k.row_blocks:
+        VEC_CUR_IDX, VEC_STRIDE_IDX = A_CUR_IDX, A_STRIDE_IDX
+        BC_CUR_IDX, BC_STRIDE_IDX = B_CUR_IDX, B_STRIDE_IDX
+    else:
+        VEC_CUR_IDX, VEC_STRIDE_IDX = B_CUR_IDX, B_STRIDE_IDX
+        BC_CUR_IDX, BC_STRIDE_IDX = A_CUR_IDX, A_STRIDE_IDX
+
+    # Semaphore
+    COMPLETED = 0
+
+    # NT and TT keep their accumulators transposed.
+    VPM_MODE = '32bit vertical' if k.trans_b else '32bit horizontal'
+
+    ra = [ ra0 , ra1 , ra2 , ra3 , ra4 , ra5 , ra6 , ra7,
+           ra8 , ra9 , ra10, ra11, ra12, ra13, ra14, ra15,
+           ra16, ra17, ra18, ra19, ra20, ra21, ra22, ra23,
+           ra24, ra25, ra26, ra27, ra28, ra29, ra30, ra31 ]
+    rb = [ rb0 , rb1 , rb2 , rb3 , rb4 , rb5 , rb6 , rb7,
+           rb8 , rb9 , rb10, rb11, rb12, rb13, rb14, rb15,
+           rb16, rb17, rb18, rb19, rb20, rb21, rb22, rb23,
+           rb24, rb25, rb26, rb27, rb28, rb29, rb30, rb31 ]
+
+    def tiles_head(dst, idx, tile):
+        # dst = (r2[idx]+tile-1), to be shifted by log2(tile)
+        rotate(broadcast, r2, -idx)
+        if tile <= 16:
+            iadd(dst, r5, tile-1)
+        else:
+            ldi(dst, tile-1)
+            iadd(dst, dst, r5)
+
+    def k_loop_broadcast():
+        # NN, TN and TT: per k, an element of the column of op(A) (row of op(B)
+        # for TT) in r3 is broadcast against a row of the other matrix, loaded
+        # through TMU1 in blocks of 16 elements; the next r3 comes through TMU0.
+        # Whether the broadcast elements are consecutive in memory.
+        bc_contiguous = k.trans_a and not k.row_blocks
+
+        def load_blocks():
+            # load TMU block 0,1,...
+            shl(r0, element_number, 2)
+            rotate(broadcast, r2, -VEC_CUR_IDX)
+            iadd(r0, r0, r5)     # r0 = cur + 4*e
+            mov(tmu1_s, r0)      # tmu1[e] = cur + 4*e + 16*4*0
+            for block in range(1, nb):
+                ldi(r1, 16*4*block)
+                iadd(tmu1_s, r0, r1) # tmu1[e] = cur + 4*e + 16*4*block
+
+        load_blocks()
+
+        if bc_contiguous:
+            shl(r0, element_number, 2)
+        else:
+            rotate(broadcast, r2, -BC_STRIDE_IDX)
+            imul24(r0, element_number, r5)
+        rotate(broadcast, r2, -BC_CUR_IDX)
+        iadd(r1, r0, r5)
+        rotate(broadcast, r2, -Q_IDX)
+        mov(r0, r5)
+        rotate(broadcast, r2, -K_IDX)
+        isub(r0, r0, r5)
+        if bc_contiguous:
+            rotate(broadcast, r2, -BC_STRIDE_IDX)
+            imul24(r0, r0, r5)
+        else:
+            shl(r0, r0, 2)
+        iadd(r0, r0, r1)
+        mov(tmu0_s, r0) # element (q-k) of lane e
+
+        rotate(broadcast, r2, -VEC_STRIDE_IDX)
+        ldi(null, mask(VEC_CUR_IDX), set_flags=True)
+        iadd(r2, r2, r5, cond='zs',
+
+             sig='load tmu0')
+        mov(r3, r4)
+        if bc_contiguous:
+            rotate(broadcast, r2, -BC_STRIDE_IDX)
+            iadd(r0, r0, r5)
+        else:
+            iadd(r0, r0, 4)
+        mov(tmu0_s, r0) # element (q-k+1) of lane e
+
+        L.k_loop
+
+        if k.row_blocks:
+            mov(broadcast, r3, sig='load tmu1') # load TMU sig for block 0
+            for block in range(nb):
+                o = 8*block
+                if block == 0:
+                    fmul(r0, r4, r5)
+                else:
+                    nop()                         .fmul(r0, r4, r5)
+                for i in range(0, 7):
+                    rotate(broadcast, r3, -(2*i+1))
+                    fadd(rb[i+o],  rb[i+o],  r0).fmul(r0, r4, r5)
+                    rotate(broadcast, r3, -(2*i+2))
+                    fadd(ra[i+o],  ra[i+o],  r0).fmul(r0, r4, r5)
+                rotate(broadcast, r3, -15)
+                fadd(rb[7+o],  rb[7+o],  r0)      .fmul(r0, r4, r5)
+                if block == nb - 1:
+                    fadd(ra[7+o],  ra[7+o],  r0)
+                else:
+                    # load TMU sig for the next block
+                    fadd(ra[7+o],  ra[7+o],  r0, sig='load tmu1').mov(broadcast, r3)
+        else:
+            mov(broadcast, r3, sig='load tmu1')                              # block 0 & 1
+            for pair in range(nb // 2):
+                o = 16*pair
+                mov(r1, r4, sig='load tmu1').fmul(r0, r4, r5)
+                fadd(rb[0+o],  rb[0+o],  r0).fmul(r0, r4, r5)
+                for i in range(7):
+                    rotate(broadcast, r3, -(2*i+1))
+                    fadd(rb[i+o+8],  rb[i+o+8],  r0).fmul(r0, r1, r5)
+                    fadd(ra[i+o+0],  ra[i+o+0],  r0).fmul(r0, r4, r5)
+                    rotate(broadcast, r3, -(2*i+2))
+                    fadd(ra[i+o+8],  ra[i+o+8],  r0).fmul(r0, r1, r5)
+                    fadd(rb[i+o+1],  rb[i+o+1],  r0).fmul(r0, r4, r5)
+                rotate(broadcast, r3, -15)
+                fadd(rb[7+o+8],  rb[7+o+8],  r0).fmul(r0, r1, r5)
+                fadd(ra[7+o],  ra[7+o],  r0).fmul(r0, r4, r5)
+                if pair == nb // 2 - 1:
+                    fadd(ra[7+o+8],  ra[7+o+8],  r0)
+                else:
+                    fadd(ra[7+o+8],  ra[7+o+8],  r0).mov(broadcast, r3, sig='load tmu1') # next blocks
+
+        load_blocks()
+
+        nop(sig='load tmu0')
+        mov(r3, r4)
+        if bc_contiguous:
+            shl(r0, element_number, 2)
+        else:
+            rotate(broadcast, r2, -BC_STRIDE_IDX)
+            imul24(r0, element_number, r5)
+        rotate(broadcast, r2, -BC_CUR_IDX)
+        iadd(r1, r0, r5)
+        rotate(broadcast, r2, -Q_IDX)
+        mov(r0, r5)
+        rotate(broadcast, r2, -K_IDX)
+        isub(r0, r0, r5)
+        iadd(r0, r0, 2)
+        if bc_contiguous:
+            rotate(broadcast, r2, -BC_STRIDE_IDX)
+            imul24(r0, r0, r5)
+            iadd(tmu0_s, r0, r1) # element (q-k+2) of lane e
+        else:
+            shl(r0, r0, 2)
+            iadd(tmu0_s, r1, r0) # element (q-k+2) of lane e
+
+        ldi(null, mask(K_IDX), set_flags=True)
+        isub(r2, r2, 1, cond='zs')
+
+        jzc(L.k_loop)
+        rotate(broadcast, r2, -VEC_STRIDE_IDX)
+        ldi(null, mask(VEC_CUR_IDX), set_flags=True)
+        iadd(r2, r2, r5, cond='zs')
+
+    def k_loop_nt():
+        # NT: 16 values of k of a row of A per lane through TMU0, and of 32 rows
+        # of B through TMU1 in lines of 4, kept in ra16-31 and rb16-31.
+
+        rotate(broadcast, r2, -A_STRIDE_IDX)
+        imul24(r0, element_number, r5)
+        rotate(broadcast, r2, -A_CUR_IDX)
+        iadd(r0, r0, r5)
+        mov(tmu0_s, r0) # r1[e] = A_cur + A_stride*e + (q-k)*4
+
+        L.k_loop
+
+        shl(r0, element_number, 2)               # r0[e] = e*4
+        rotate(broadcast, r2, -B_STRIDE_IDX)
+        mov(r1, r5)                              # r1 = B_stride
+        rotate(broadcast, r2, -B_CUR_IDX)
+        iadd(r0, r0, r5)                         # r0[e] = B_cur + e*4
+        mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*0
+        iadd(r0, r0, r1)
+        mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*1
+        iadd(r0, r0, r1)
+        mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*2
+        iadd(r0, r0, r1)
+        mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*3
+
+        nop(sig='load tmu0')
+        mov(r3, r4)
+        rotate(broadcast, r2, -A_STRIDE_IDX)
+        imul24(r0, element_number, r5)
+        rotate(broadcast, r2, -A_CUR_IDX)
+        iadd(r1, r0, r5)
+        rotate(broadcast, r2, -Q_IDX)
+        mov(r0, r5)
+        rotate(broadcast, r2, -K_IDX)
+        isub(r0, r0, r5)
+        iadd(r0, r0, 1)
+        shl(r0, r0, 2)
+        iadd(tmu0_s, r1, r0)
+
+        # line 0
+        for j in range(2):
+            bxor(rb[16+j], r0, r0, sig='load tmu1')  # load TMU sig
+            rotate(broadcast, r2, -K_IDX)
+            isub(null, element_number, r5, set_flags=True)
+            mov(rb[16+j], r4, cond='ns')
+            mov(broadcast, r4)
+            fmul(r0, r3, r5)
+            fadd(rb[j], rb[j], r0)
+            bxor(ra[16+j], r0, r0, sig='load tmu1')  # load TMU sig
+            rotate(broadcast, r2, -K_IDX)
+            isub(null, element_number, r5, set_flags=True)
+            mov(ra[16+j], r4, cond='ns')
+            mov(broadcast, r4)
+            fmul(r0, r3, r5)
+            fadd(ra[j], ra[j], r0)
+
+        # load TMU line
+        for l in range(1, 8):
+            shl(r0, element_number, 2)               # r0[e] = e*4
+            rotate(broadcast, r2, -B_STRIDE_IDX)
+            mov(r1, r5)                              # r1 = B_stride
+            rotate(broadcast, r2, -B_CUR_IDX)
+            iadd(r0, r0, r5)                         # r0[e] = B_cur + e*4
+            for i in range(l*4):
+                iadd(r0, r0, r1)
+            mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*(4*l+0)
+            iadd(r0, r0, r1)
+            mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*(4*l+1)
+            iadd(r0, r0, r1)
+            mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*(4*l+2)
+            iadd(r0, r0, r1)
+            mov(tmu1_s, r0)                          # tmu1[e] = B_cur + e*4 + B_stride*(4*l+3)
+
+            for j in range(2):
+                bxor(rb[16+2*l+j], r0, r0, sig='load tmu1')  # load TMU sig
+                rotate(broadcast, r2, -K_IDX)
+                isub(null, element_number, r5, set_flags=True)
+                mov(rb[16+2*l+j], r4, cond='ns')
+                mov(broadcast, r4)
+                fmul(r0, r3, r5)
+                fadd(rb[2*l+j], rb[2*l+j], r0)
+                bxor(ra[16+2*l+j], r0, r0, sig='load tmu1')  # load TMU sig
+                rotate(broadcast, r2, -K_IDX)
+                isub(null, element_number, r5, set_flags=True)
+                mov(ra[16+2*l+j], r4, cond='ns')
+                mov(broadcast, r4)
+                fmul(r0, r3, r5)
+                fadd(ra[2*l+j], ra[2*l+j], r0)
+
+        for i in range(1, 16):
+            nop(sig='load tmu0')
+            mov(r3, r4)
+            rotate(broadcast, r2, -A_STRIDE_IDX)
+            imul24(r0, element_number, r5)
+            rotate(broadcast, r2, -A_CUR_IDX)
+            iadd(r1, r0, r5)
+            rotate(broadcast, r2, -Q_IDX)
+            mov(r0, r5)
+            rotate(broadcast, r2, -K_IDX)
+            isub(r0, r0, r5)
+            iadd(r0, r0, 1)
+            iadd(r0, r0, i)
+            shl(r0, r0, 2)
+            iadd(tmu0_s, r1, r0)
+
+            mov(r1, rb[16])
+            nop()
+            rotate(broadcast, r1, -i)
+            mov(r1, ra[16])         .fmul(r0, r3, r5)
+            for j in range(0, 15):
+                fadd(rb[j],  rb[j],  r0)
+                rotate(broadcast, r1, -i)
+                mov(r1, rb[17+j])         .fmul(r0, r3, r5)
+                fadd(ra[j],  ra[j],  r0)
+                rotate(broadcast, r1, -i)
+                mov(r1, ra[17+j])         .fmul(r0, r3, r5)
+            fadd(rb[15],  rb[15],  r0)
+            rotate(broadcast, r1, -i)
+            fmul(r0, r3, r5)
+            fadd(ra[15],  ra[15],  r0)
+
+        ldi(r1, 64)
+        ldi(null, mask(B_CUR_IDX), set_flags=True)
+        iadd(r2, r2, r1, cond='zs')
+
+        ldi(r1, 16)
+        rotate(broadcast, r2, -K_IDX)
+        isub(r1, r5, r1)
+        imax(r1, r1, 0)
+
+        jzc(L.k_loop)
+        ldi(null, mask(K_IDX), set_flags=True) # delay slot
+        mov(r2, r1, cond='zs')                 # delay slot
+        nop()                                  # delay slot
+
+    def dma_load_setup(block):
+        return (0x80000000|    # setup_dma_load
+                0<<28|         # 32bit
+                0<<24|         # use the extended pitch setup register
+                1<<12|         # vpitch=1
+                0<<11|         # horizontal
+                (block*16)<<4| # Y=16*block
+                0)             # X=0
+
+    def dma_store_setup(block):
+        return (0x80000000|    # setup_dma_store
+                1<<14|         # horizontal
+                (16*block)<<7| # Y=16*block
+                0<<3|          # X=0
+                0)             # 32bit
+
+    def load_setup_params(block, ncols_in_r1):
+        # load setup params
+        if ncols_in_r1:
+            band(r1, r1, 0xF)
+        else:
+            rotate(broadcast, r3, -NCOLS_IDXS[block])
+            band(r1, r5, 0xF)
+        shl(r1, r1, 4)     # ncols<<4
+        rotate(broadcast, r3, -NROWS_IDXS[block])
+        band(r0, r5, 0xF)
+        bor(r1, r1, r0)    # ncols<<4|nrows
+        shl(r1, r1, 8)     # (ncols<<4|nrows)<<8
+        shl(r1, r1, 8)     # (ncols<<4|nrows)<<8<<8 = ncols<<20|nrows<<16
+        ldi(r0, dma_load_setup(block))
+        ldi(null, mask(LOAD_SETUP_IDXS[block]), set_flags=True)
+        bor(r3, r0, r1, cond='zs')
+
+    def store_setup_params(block, nrows_in_r1):
+        # store setup params
+        if nrows_in_r1:
+            shl(r1, r1, 7)     # nrows<<7
+        else:
+            rotate(broadcast, r3, -NROWS_IDXS[block])
+            shl(r1, r5, 7)     # nrows<<7
+        rotate(broadcast, r3, -NCOLS_IDXS[block])
+        bor(r1, r1, r5)    # nrows<<7|ncols
+        shl(r1, r1, 8)     # (nrows<<7|ncols)<<8
+        shl(r1, r1, 8)     # (nrows<<7|ncols)<<8<<8 = nrows<<23|ncols<<16
+        ldi(r0, dma_store_setup(block))
+        ldi(null, mask(STORE_SETUP_IDXS[block]), set_flags=True)
+        bor(r3, r0, r1, cond='zs')
+
+    def tile_lens(setup):
+        # The tile is cut to C at its last row and column of tiles:
+        # for NN, NT and TN
+        #   nrows = min(P-((P+15)/16-i)*16, 16)
+        #   ncols = min(R-(((R+TILE_R-1)/TILE_R-j)*nb+block)*16, 16)
+        #   blocks = min((R-((R+TILE_R-1)/TILE_R-j)*TILE_R+15)/16, nb)
+        # and the same with rows and columns swapped for TT.
+        if k.row_blocks:
+            EDGE_IDX, EDGE_LOOP_IDX, EDGE_LEN_IDX = R_IDX, J_IDX, NCOLS_IDXS[0]
+            DIM_IDX, DIM_LOOP_IDX, TILE = P_IDX, I_IDX, TILE_P
+            BLOCK_LEN_IDXS = NROWS_IDXS
+        else:
+            EDGE_IDX, EDGE_LOOP_IDX, EDGE_LEN_IDX = P_IDX, I_IDX, NROWS_IDXS[0]
+            DIM_IDX, DIM_LOOP_IDX, TILE = R_IDX, J_IDX, TILE_R
+            BLOCK_LEN_IDXS = NCOLS_IDXS
+
+        rotate(broadcast, r2, -EDGE_IDX)
+        iadd(r1, r5, 15)
+        shr(r1, r1, 4)
+        rotate(broadcast, r2, -EDGE_LOOP_IDX)
+        isub(r1, r1, r5)
+        shl(r1, r1, 4)
+        rotate(broadcast, r2, -EDGE_IDX)
+        isub(r1, r5, r1)
+        rotate(broadcast, r1, 0)
+        ldi(r1, 16)
+        imin(r1, r1, r5)
+        ldi(null, mask(EDGE_LEN_IDX), set_flags=True)
+        mov(r3, r1, cond='zs')
+
+        for block in range(nb):
+            ldi(r1, TILE-1)
+            rotate(broadcast, r2, -DIM_IDX)
+            iadd(r1, r1, r5)
+            shr(r1, r1, log2(TILE))
+            rotate(broadcast, r2, -DIM_LOOP_IDX)
+            isub(r1, r1, r5)
+            shl(r1, r1, log2(nb))
+            iadd(r1, r1, block)
+            shl(r1, r1, 4)
+            rotate(broadcast, r2, -DIM_IDX)
+            isub(r1, r5, r1)
+            rotate(broadcast, r1, 0)
+            ldi(r1, 16)
+            imin(r1, r1, r5)
+            ldi(null, mask(BLOCK_LEN_IDXS[block]), set_flags=True)
+            mov(r3, r1, cond='zs')
+
+            if not setup:
+                continue
+            if k.row_blocks:
+                store_setup_params(block, nrows_in_r1=True)
+                if k.loads_c:
+                    load_setup_params(block, ncols_in_r1=False)
+            else:
+                if k.loads_c:
+                    load_setup_params(block, ncols_in_r1=True)
+                store_setup_params(block, nrows_in_r1=False)
+
+        ldi(r1, TILE-1)
+        rotate(broadcast, r2, -DIM_IDX)
+        iadd(r1, r1, r5)
+        shr(r1, r1, log2(TILE))
+        rotate(broadcast, r2, -DIM_LOOP_IDX)
+        isub(r1, r1, r5)
+        shl(r1, r1, log2(TILE))
+        rotate(broadcast, r2, -DIM_IDX)
+        isub(r1, r5, r1)
+        iadd(r1, r1, 15)
+        shr(r1, r1, 4)
+        imin(r1, r1, nb)
+        ldi(null, mask(LOAD_BLOCKS_IDX, STORE_BLOCKS_IDX), set_flags=True)
+        mov(r3, r1, cond='zs')
+
+    def merge_block(block):
+        # Merges the accumulators of the block with C in the VPM and clears
+        # them for the next tile.
+        o = 8*block
+        if k.alpha_one:
+            if k.loads_c:
+                setup_vpm_read(mode=VPM_MODE, Y=16*block, X=0, nrows=16)
+            setup_vpm_write(mode=VPM_MODE, Y=16*block, X=0)
+            if k.loads_c:
+                nop()
+                nop()
+            for i in range(o, o+8):
+                if k.loads_c:
+                    fadd(vpm, rb[i], vpm).v8subs(rb[i], r0, r0)
+                    fadd(vpm, ra[i], vpm).v8subs(ra[i], r0, r0)
+                else:
+                    mov(vpm, rb[i]).v8subs(rb[i], r0, r0)
+                    mov(vpm, ra[i]).v8subs(ra[i], r0, r0)
+            return
+
+        # Load alpha and beta.
+        rotate(r0, r2, -COEF_ADDR_IDX)
+        mov(uniforms_address, r0)
+
+        if not k.loads_c:
+            setup_vpm_write(mode=VPM_MODE, Y=16*block, X=0)
+            nop()
+            mov(r1, uniform)        # r1=alpha
+            for i in range(o, o+8):
+                isub(rb[i], r0, r0).fmul(vpm, rb[i], r1)
+                isub(ra[i], r0, r0).fmul(vpm, ra[i], r1)
+            return
+
+        setup_vpm_read(mode=VPM_MODE, Y=16*block, X=0, nrows=16)
+        setup_vpm_write(mode=VPM_MODE, Y=16*block, X=0)
+
+        mov(r1, uniform)        # r1=alpha
+        mov(broadcast, uniform) # r5=beta
+
+        fmul(rb[o], rb[o], r1)
+        fmul(r0, vpm, r5)
+        for i in range(o, o+7):
+            fadd(vpm, rb[i], r0).fmul(ra[i], ra[i], r1)
+            mov(rb[i], 0.0).fmul(r0, vpm, r5)
+            fadd(vpm, ra[i], r0).fmul(rb[i+1], rb[i+1], r1)
+            mov(ra[i], 0.0).fmul(r0, vpm, r5)
+        fadd(vpm, rb[o+7], r0).fmul(ra[o+7], ra[o+7], r1)
+        mov(rb[o+7], 0.0).fmul(r0, vpm, r5)
+        fadd(vpm, ra[o+7], r0)
+        mov(ra[o+7], 0.0)
+
+    def block_offset(block):
+        # r0 = offset of the block from C_cur
+        if k.row_blocks:
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+            if block & (block-1) == 0:
+                shl(r0, r5, 4+log2(block))
+            else:
+                shl(r0, r5, 4)
+                imul24(r0, r0, block)
+        else:
+            ldi(r0, 4*16*block)
+
+    def row_address(block):
+        # r0 = address of row r1 of the block
+        if block == 0:
+            rotate(broadcast, r2, -C_CUR_IDX)
+            mov(r0, r5)
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+            imul24(r1, r1, r5)
+        elif k.row_blocks:
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+            shl(r0, r5, 4)
+            if block > 1:
+                imul24(r0, r0, block)
+            imul24(r1, r1, r5)
+            rotate(broadcast, r2, -C_CUR_IDX)
+            iadd(r0, r0, r5)
+        else:
+            ldi(r0, 16*4*block)
+            rotate(broadcast, r2, -C_CUR_IDX)
+            iadd(r0, r0, r5)
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+            imul24(r1, r1, r5)
+        iadd(r0, r0, r1)
+
+    def large_stride_dma(block, what):
+        # Loads or stores the block row by row, for C_stride too large for
+        # the DMA stride.
+        load = what == 'load'
+        BLOCKS_IDX = LOAD_BLOCKS_IDX if load else STORE_BLOCKS_IDX
+        skip = 'dma_for_large_stride_skip_{}_block_{}'.format(what, block)
+        loop = 'dma_for_large_stride_row_{}_block_{}_loop'.format(what, block)
+
+        if block > 0:
+            rotate(broadcast, r3, -BLOCKS_IDX)
+            mov(r0, r5, set_flags=True)
+            jzs(getattr(L, skip))
+            nop() # delay slot
+            nop() # delay slot
+            nop() # delay slot
+        ldi(null, mask(BLOCKS_IDX), set_flags=True)
+        isub(r3, r3, 1, cond='zs')
+        nop()
+
+        rotate(broadcast, r3, -NROWS_IDXS[block])
+        ldi(null, mask(ROW_IDX), set_flags=True)
+        mov(r3, r5, cond='zs')
+        nop()
+        getattr(L, loop)
+        if True:
+            if load:
+                rotate(broadcast, r3, -NCOLS_IDXS[block])
+                band(r1, r5, 0xF)
+                shl(r1, r1, 4)     # ncols<<4
+                bor(r1, r1, 1)     # ncols<<4|1
+                shl(r1, r1, 8)     # (ncols<<4|1)<<8
+                shl(r1, r1, 8)     # (ncols<<4|1)<<8<<8 = ncols<<20|1<<16
+                ldi(r0, dma_load_setup(block))
+            else:
+                mov(r1, 1)
+                shl(r1, r1, 7)     # 1<<7
+                rotate(broadcast, r3, -NCOLS_IDXS[block])
+                bor(r1, r1, r5)    # 1<<7|ncols
+                shl(r1, r1, 8)     # (1<<7|ncols)<<8
+                shl(r1, r1, 8)     # (1<<7|ncols)<<8<<8 = 1<<23|ncols<<16
+                ldi(r0, dma_store_setup(block))
+            bor(r0, r0, r1)
+            rotate(broadcast, r3, -NROWS_IDXS[block])
+            mov(r1, r5)
+            rotate(broadcast, r3, -ROW_IDX)
+            isub(r1, r1, r5)
+            if load:
+                shl(r1, r1, 4)
+                bor(vpmvcd_rd_setup, r0, r1)
+            else:
+                shl(r1, r1, 7)
+                bor(vpmvcd_wr_setup, r0, r1)
+            rotate(broadcast, r3, -NROWS_IDXS[block])
+            mov(r1, r5)
+            rotate(broadcast, r3, -ROW_IDX)
+            isub(r1, r1, r5)
+            row_address(block)
+            if load:
+                wait_dma_load()
+                start_dma_load(r0)
+            else:
+                wait_dma_store()
+                start_dma_store(r0)
+
+        ldi(null, mask(ROW_IDX), set_flags=True)
+        isub(r3, r3, 1, cond='zs')
+        jzc(getattr(L, loop))
+        nop() # delay slot
+        nop() # delay slot
+        nop() # delay slot
+        if load:
+            wait_dma_load()
+        else:
+            wait_dma_store()
+
+        if block > 0:
+            getattr(L, skip)
+
+    #==== Load constants ====
+    # Load constants to r2.
+    mov(r0, uniform)    # uniforms address
+    mov(r2, 1)
+    ldi(null, mask(P_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # p
+    ldi(null, mask(Q_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # q
+    ldi(null, mask(R_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # r
+    ldi(null, mask(A_BASE_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # Address of A[0,0]
+    ldi(null, mask(B_BASE_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # Address of B[0,0]
+    ldi(null, mask(C_BASE_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # Address of C[0,0]
+    ldi(null, mask(A_STRIDE_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # A stride
+    ldi(null, mask(B_STRIDE_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # B stride
+    ldi(null, mask(C_STRIDE_IDX), set_flags=True)
+    mov(r2, uniform, cond='zs')     # C stride
+    ldi(null, mask(COEF_ADDR_IDX), set_flags=True)
+    ldi(r1, 4*10)
+    iadd(r2, r0, r1, cond='zs')     # address of alpha and beta
+
+    #==== Variables ====
+
+    # A_base = address of A[0,0] + (p+TILE_P-1)/TILE_P*TILE_P*A_stride (*4 for TN, TT)
+    # B_base = address of B[0,0] + (r+TILE_R-1)/TILE_R*TILE_R*4        (*B_stride for NT, TT)
+    # C_base = address of C[0,0] + (p+TILE_P-1)/TILE_P*TILE_P*C_stride
+    #                            + (r+TILE_R-1)/TILE_R*TILE_R*4
+
+    # A_cur = A_base - i*TILE_P*A_stride (*4)
+    # B_cur = B_base - j*TILE_R*4        (*B_stride)
+    # C_cur = C_base - i*TILE_P*C_stride - j*TILE_R*4
+
+    if k.row_blocks:
+        tiles_head(r0, P_IDX, TILE_P)
+        shr(r0, r0, log2(TILE_P))
+        shl(r0, r0, log2(TILE_P))       # r0=(p+TILE_P-1)/TILE_P*TILE_P
+        tiles_head(r1, R_IDX, TILE_R)
+        shr(r1, r1, log2(TILE_R))
+        shl(r1, r1, log2(TILE_R))       # r1=(r+15)/16*16
+        imul24(r3, r0, 4)               # r3=(p+TILE_P-1)/TILE_P*TILE_P*4
+        ldi(null, mask(A_BASE_IDX), set_flags=True)
+        iadd(r2, r2, r3, cond='zs')
+        rotate(broadcast, r2, -B_STRIDE_IDX)
+        imul24(r3, r5, r1)              # r3=(r+15)/16*16*B_stride
+        ldi(null, mask(B_BASE_IDX), set_flags=True)
+        iadd(r2, r2, r3, cond='zs')
+        rotate(broadcast, r2, -C_STRIDE_IDX)
+        imul24(r0, r0, r5)              # r0=(p+TILE_P-1)/TILE_P*TILE_P*C_stride
+        imul24(r1, r1, 4)               # r1=(r+15)/16*16*4
+        ldi(null, mask(C_BASE_IDX), set_flags=True)
+        iadd(r2, r2, r0, cond='zs', set_flags=False)
+        iadd(r2, r2, r1, cond='zs')
+    else:
+        tiles_head(r0, P_IDX, TILE_P)
+        shr(r0, r0, log2(TILE_P))
+        shl(r0, r0, log2(TILE_P))       # r0=(p+15)/16*16
+        tiles_head(r1, R_IDX, TILE_R)
+        shr(r1, r1, log2(TILE_R))
+        if k.trans_b:
+            shl(r1, r1, log2(TILE_R))   # r1=(r+TILE_R-1)/TILE_R*TILE_R
+        else:
+            shl(r1, r1, log2(TILE_R)+2) # r1=(r+TILE_R-1)/TILE_R*TILE_R*4
+        if k.trans_a:
+            shl(r3, r0, 2)              # r3=(p+15)/16*16*4
+        else:
+            rotate(broadcast, r2, -A_STRIDE_IDX)
+            imul24(r3, r5, r0)          # r3=(p+15)/16*16*A_stride
+        ldi(null, mask(A_BASE_IDX), set_flags=True)
+        iadd(r2, r2, r3, cond='zs')
+        if k.trans_b:
+            rotate(broadcast, r2, -B_STRIDE_IDX)
+            imul24(r3, r1, r5)          # r3=(r+TILE_R-1)/TILE_R*TILE_R*B_stride
+            ldi(null, mask(B_BASE_IDX), set_flags=True)
+            iadd(r2, r2, r3, cond='zs')
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+            shl(r1, r1, 2)              # r1=(r+TILE_R-1)/TILE_R*TILE_R*4
+        else:
+            ldi(null, mask(B_BASE_IDX), set_flags=True)
+            iadd(r2, r2, r1, cond='zs')
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+        imul24(r3, r5, r0)              # r3=(p+15)/16*16*C_stride
+        ldi(null, mask(C_BASE_IDX), set_flags=True)
+        iadd(r2, r2, r3, cond='zs', set_flags=False)
+        iadd(r2, r2, r1, cond='zs')
+
+    # Disable swapping of two TMUs.
+    mov(tmu_noswap, 1)
+
+    # Initialize column vectors.
+    for i in range(32):
+        mov(ra[i],  0.0).mov(rb[i],  0.0)
+
+    #==== i-loop ====
+
+    # Initialize i.
+    # i=(p+TILE_P-1)/TILE_P.
+    tiles_head(r0, P_IDX, TILE_P)
+    ldi(null, mask(I_IDX), set_flags=True)
+    shr(r2, r0, log2(TILE_P), cond='zs')
+
+    L.i_loop
+
+    #==== j-loop ====
+
+    # Initialize j.
+    # j=(r+TILE_R-1)/TILE_R.
+    tiles_head(r0, R_IDX, TILE_R)
+    ldi(null, mask(J_IDX), set_flags=True)
+    shr(r2, r0, log2(TILE_R), cond='zs')
+
+    if k.row_blocks:
+        L.j_loop
+
+        rotate(broadcast, r2, -I_IDX)
+        shl(r0, r5, log2(TILE_P)+2)             # r0=TILE_P*i*4
+        rotate(broadcast, r2, -A_BASE_IDX)
+        ldi(null, mask(A_CUR_IDX), set_flags=True)
+        isub(r2, r5, r0, cond='zs')
+
+        rotate(broadcast, r2, -I_IDX)
+        shl(r0, r5, log2(TILE_P))               # r0=TILE_P*i
+        rotate(broadcast, r2, -C_STRIDE_IDX)
+        imul24(r0, r0, r5)                      # r0=TILE_P*i*C_stride
+        rotate(broadcast, r2, -J_IDX)
+        shl(r1, r5, 6)                          # r1=16*j*4
+        rotate(broadcast, r2, -C_BASE_IDX)
+        ldi(null, mask(C_CUR_IDX), set_flags=True)
+        isub(r2, r5, r0, cond='zs', set_flags=False)
+        isub(r2, r2, r1, cond='zs')
+
+        rotate(broadcast, r2, -J_IDX)
+        shl(r0, r5, 4)                          # r0=16*j
+        rotate(broadcast, r2, -B_STRIDE_IDX)
+        imul24(r0, r0, r5)                      # r0=16*j*B_stride
+        rotate(broadcast, r2, -B_BASE_IDX)
+        ldi(null, mask(B_CUR_IDX), set_flags=True)
+        isub(r2, r5, r0, cond='zs')
+
+        # r1[e] = B_cur + B_stride*e   (e=element number)
+        nop()
+        rotate(broadcast, r2, -B_STRIDE_IDX)
+        imul24(r0, element_number, r5)
+        rotate(broadcast, r2, -B_CUR_IDX)
+        iadd(r1, r0, r5)
+    else:
+        rotate(broadcast, r2, -I_IDX)
+        if k.trans_a:
+            shl(r0, r5, 6)                      # r0=16*i*4
+        else:
+            shl(r0, r5, 4)                      # r0=16*i
+            rotate(broadcast, r2, -A_STRIDE_IDX)
+            imul24(r0, r0, r5)                  # r0=16*i*A_stride
+        rotate(broadcast, r2, -A_BASE_IDX)
+        ldi(null, mask(A_CUR_IDX), set_flags=True)
+        isub(r2, r5, r0, cond='zs')
+
+        L.j_loop
+
+        rotate(broadcast, r2, -I_IDX)
+        shl(r0, r5, 4)                          # r0=16*i
+        rotate(broadcast, r2, -C_STRIDE_IDX)
+        imul24(r0, r0, r5)                      # r0=16*i*C_stride
+        rotate(broadcast, r2, -J_IDX)
+        shl(r1, r5, log2(TILE_R)+2)             # r1=4*TILE_R*j
+        rotate(broadcast, r2, -C_BASE_IDX)
+        ldi(null, mask(C_CUR_IDX), set_flags=True)
+        isub(r2, r5, r0, cond='zs', set_flags=False)
+        isub(r2, r2, r1, cond='zs')
+
+        if k.trans_b:
+            rotate(broadcast, r2, -J_IDX)
+            shl(r0, r5, log2(TILE_R))           # r0=TILE_R*j
+            rotate(broadcast, r2, -B_STRIDE_IDX)
+            imul24(r0, r0, r5)                  # r0=TILE_R*j*B_stride
+            rotate(broadcast, r2, -B_BASE_IDX)
+            ldi(null, mask(B_CUR_IDX), set_flags=True)
+            isub(r2, r5, r0, cond='zs')
+        else:
+            rotate(broadcast, r2, -B_BASE_IDX)
+            ldi(null, mask(B_CUR_IDX), set_flags=True)
+            isub(r2, r5, r1, cond='zs')
+
+    #==== k-loop ====
+    # r2[1] = q (k=q)
+    nop()
+    rotate(broadcast, r2, -Q_IDX)
+    ldi(null, mask(K_IDX), set_flags=True)
+    mov(r2, r5, cond='zs')
+
+    if k.trans == 'NT':
+        k_loop_nt()
+    else:
+        k_loop_broadcast()
+
+    #==== end of k-loop ====
+
+    nop(sig='load tmu0')
+    if k.trans != 'NT':
+        for block in range(nb):
+            nop(sig='load tmu1')
+
+    rotate(broadcast, r2, -C_STRIDE_IDX)
+    ldi(r0, 8192)
+    isub(r0, r0, r5, set_flags=True)
+    jns(L.dma_for_large_stride)
+    nop() # delay slot
+    nop() # delay slot
+    nop() # delay slot
+    if True:
+        tile_lens(setup=True)
+
+        def setup_dma_load_block(block):
+            rotate(broadcast, r3, -LOAD_SETUP_IDXS[block]) # will be delay slot
+            nop()                                          # will be delay slot
+            mov(vpmvcd_rd_setup, r5)
+
+        def setup_dma_store_block(block):
+            # stride = C_stride - 4 * ncols
+            rotate(broadcast, r3, -NCOLS_IDXS[block]) # will be delay slot
+            imul24(r1, r5, 4)                         # will be delay slot
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+            isub(r1, r5, r1)
+            setup_dma_store_stride(r1)
+
+            rotate(broadcast, r3, -STORE_SETUP_IDXS[block])
+            mov(vpmvcd_wr_setup, r5)
+
+        def issue_load(block):
+            label = 'skip_load_block_{}'.format(block)
+            rotate(broadcast, r3, -LOAD_BLOCKS_IDX)
+            mov(r0, r5, set_flags=True)
+            jzs(getattr(L, label))
+            wait_dma_load()  # Wait for load of the previous block  # delay slot
+            setup_dma_load_block(block)                  # delay slot (head 2 instruction)
+            block_offset(block)
+            rotate(broadcast, r2, -C_CUR_IDX)
+            iadd(vpm_ld_addr, r5, r0)
+            ldi(null, mask(LOAD_BLOCKS_IDX), set_flags=True)
+            isub(r3, r3, 1, cond='zs')
+            getattr(L, label)
+
+        def issue_store(block):
+            label = 'skip_store_block_{}'.format(block)
+            if block > 0:
+                rotate(broadcast, r3, -STORE_BLOCKS_IDX)
+                mov(r0, r5, set_flags=True)
+                jzs(getattr(L, label))
+                wait_dma_store() # Wait for store of the previous block  # delay slot
+            setup_dma_store_block(block)                  # delay slot (head 2 instruction)
+            if block > 0:
+                block_offset(block)
+                rotate(broadcast, r2, -C_CUR_IDX)
+                iadd(vpm_st_addr, r5, r0)
+            else:
+                rotate(broadcast, r2, -C_CUR_IDX)
+                start_dma_store(r5)
+            ldi(null, mask(STORE_BLOCKS_IDX), set_flags=True)
+            isub(r3, r3, 1, cond='zs')
+            if block > 0:
+                getattr(L, label)
+
+        mutex_acquire()
+
+        if k.loads_c:
+            # Set stride for DMA to load and store C.
+            rotate(broadcast, r2, -C_STRIDE_IDX)
+            setup_dma_load_stride(r5, tmp_reg=r1)
+
+            # Issue load of block 0
+            setup_dma_load_block(0)
+            rotate(broadcast, r2, -C_CUR_IDX)
+            start_dma_load(r5)
+            rotate(broadcast, r3, -LOAD_BLOCKS_IDX)
+            ldi(null, mask(LOAD_BLOCKS_IDX), set_flags=True)
+            isub(r3, r5, 1, cond='zs')
+
+            issue_load(1)
+
+        # Block b is merged while b+1 is loaded and b-1 stored.
+        for block in range(nb):
+            merge_block(block)
+            issue_store(block)
+            if not k.loads_c:
+                continue
+            if block+2 < nb:
+                issue_load(block+2)
+            elif block+1 < nb:
+                wait_dma_load()  # Wait for load of the last block
+
+        wait_dma_store() # Wait for store of the last block
+        mutex_release()
+
+        jmp(L.dma_done)
+        nop() # delay slot
+        nop() # delay slot
+        nop() # delay slot
+
+    L.dma_for_large_stride
+    if True:
+        mov(r3, 1)
+
+        tile_lens(setup=False)
+
+        mutex_acquire()
+
+        for block in range(nb):
+            if k.loads_c:
+                large_stride_dma(block, 'load')
+            merge_block(block)
+            large_stride_dma(block, 'store')
+
+        mutex_release()
+
+    L.dma_done
+
+    rotate(broadcast, r2, -J_IDX)
+    isub(r0, r5, 1)
+    jzc(L.j_loop)   # Jump iz Z-flags are clear
+    ldi(null, mask(J_IDX), set_flags=True)  # delay slot
+    mov(r2, r0, cond='zs')                  # delay slot
+    nop()                                   # delay slot
+
+    rotate(broadcast, r2, -I_IDX)
+    isub(r0, r5, 1)
+    jzc(L.i_loop)
+    ldi(null, mask(I_IDX), set_flags=True)  # delay slot
+    mov(r2, r0, cond='zs')                  # delay slot
+    nop()                                   # delay slot
+
+    sema_up(COMPLETED)  # Notify completion to the thread 0
+
+    rotate(broadcast, r2, -COEF_ADDR_IDX)
+    mov(uniforms_address, r5)
+    nop(); nop()
+    mov(null, uniform)
+    mov(null, uniform)
+    mov(null, uniform, set_flags=True)  # thread index
+
+    jzc(L.skip_fin)
+    nop()                 # delay slot
+    nop()                 # delay slot
+    # Only thread 0 enters here.
+    iadd(r0, uniform, -1) # delay slot
+    L.sem_down
+    jzc(L.sem_down)
+    sema_down(COMPLETED)  # delay slot  # Wait completion of all threads.
+    nop()                 # delay slot
+    iadd(r0, r0, -1)      # delay slot
+
+    interrupt()
+
+    L.skip_fin
+
+    exit(interrupt=False)
+
+def kernel_table(names):
+    # The C table of the kernels, included by gemm.c.
+    lines = ['/* Generated by sgemm.py table. */', '']
+    for name in names:
+        lines += ['static const unsigned code_{}[] = {{'.format(name),
+                  '#include "{}.qhex"'.format(name),
+                  '};']
+    lines += ['', 'static struct sgemm_kernel sgemm_kernels[] = {']
+    for name in names:
+        k = Kernel(name)
+        lines.append('    {{{}, {}, {}, {}, SGEMM_EPILOGUE_{}, '
+                     '{{code_{}, sizeof(code_{}), 0}}}},'.format(
+                         'CblasTrans' if k.trans_a else 'CblasNoTrans',
+                         'CblasTrans' if k.trans_b else 'CblasNoTrans',
+                         k.tile[0], k.tile[1],
+                         (k.epilogue or 'axpby').upper(), name, name))
+    lines += ['};']
+    return '\n'.join(lines)
+
+def main(name):
+    k = Kernel(name)
+    tile_p, tile_r = k.tile
+    with Driver() as drv:
+        p = random.randint(64 * 12, 1024)
+        q = random.randint(2, 512)
+        r = random.randint(64 * 12, 1024)
+
+        assert(q >= 2)
+
+        p_div = 2
+        r_div = 6
+        n_threads = p_div * r_div
+
+        # Allocate matrices.
+        C = drv.alloc((p, r), 'float32')
+        A = drv.alloc((q, p) if k.trans_a else (p, q), 'float32')
+        B = drv.alloc((r, q) if k.trans_b else (q, r), 'float32')
+
+        # Initialize matrices.
+        np.random.seed(0)
+        alpha = 1.0 if k.alpha_one else random.uniform(-2, 2)
+        beta = {'beta0': 0.0, 'alpha1_beta0': 0.0, 'alpha1_beta1': 1.0}.get(
+                k.epilogue, random.uniform(-2, 2))
+        A[:] = np.random.randn(*A.shape)
+        B[:] = np.random.randn(*B.shape)
+        C[:] = np.random.randn(p, r)
+
+        # Reference
+        RA = A.T.copy() if k.trans_a else A.copy()
+        RB = B.T.copy() if k.trans_b else B.copy()
+        RC = C.copy()
+        start = time.time()
+        R = alpha*RA.dot(RB) + beta*RC
+        elapsed_ref = time.time() - start
+
+        # Allocate uniforms.
+        uniforms = drv.alloc((n_threads, 14), 'uint32')
+        uniforms[:, 0] = uniforms.addresses()[:, 0]
+
+        th = 0
+        p_up = p // tile_p
+        h = (p_up + p_div - 1) // p_div
+        h_len = p_div - (h * p_div - p_up)
+        r_up = r // tile_r
+        w = (r_up + r_div - 1) // r_div
+        w_len = r_div - (w * r_div - r_up)
+        h_acc = 0
+        for i in range(p_div):
+            hi = 0
+            if i == p_div-1:
+                hi = p - h_acc
+            else:
+                hi = tile_p * h if i < h_len else tile_p * (h-1)
+            w_acc = 0;
+            for j in range(r_div):
+                wj = 0
+                if j == r_div-1:
+                    wj = r - w_acc
+                else:
+                    wj = tile_r * w if j < w_len else tile_r * (w-1)
+                uniforms[th, 1] = hi
+                uniforms[th, 2] = q
+                uniforms[th, 3] = wj
+                uniforms[th, 4] = (A.addresses()[0, h_acc] if k.trans_a
+                                   else A.addresses()[h_acc, 0])
+                uniforms[th, 5] = (B.addresses()[w_acc, 0] if k.trans_b
+                                   else B.addresses()[0, w_acc])
+                uniforms[th, 6] = C.addresses()[h_acc, w_acc]
+                th += 1
+                w_acc += wj;
+            h_acc += hi;
+        uniforms[:, 7] = A.strides[0]
+        uniforms[:, 8] = B.strides[0]
+        uniforms[:, 9] = C.strides[0]
+        uniforms[:, 10] = struct.unpack('L', struct.pack('f', alpha))[0]
+        uniforms[:, 11] = struct.unpack('L', struct.pack('f', beta))[0]
+        uniforms[:, 12] = np.arange(n_threads)
+        uniforms[:, 13] = n_threads
+
+        # Allocate GPU program.
+        code = drv.program(lambda asm: sgemm_gpu_code(asm, k))
+
+        # GPU
+        start = time.time()
+        drv.execute(
+            n_threads=n_threads,
+            program=code,
+            uniforms=uniforms
+        )
+        elapsed_gpu = time.time() - start
+
+        def Gflops(sec):
+            return (2*p*q*r + 3*p*r)/sec * 1e-9
+
+        print('==== {name} example ({p}x{q} times {q}x{r}) ===='.format(
+                name=name, p=p, q=q, r=r))
+        print('threads: {}'.format(n_threads))
+        print('numpy: {:.4f} sec, {:.4f} Gflops'.format(
+                elapsed_ref, Gflops(elapsed_ref)))
+        print('GPU: {:.4f} sec, {:.4f} Gflops'.format(
+                elapsed_gpu, Gflops(elapsed_gpu)))
+        print('minimum absolute error: {:.4e}'.format(
+                float(np.min(np.abs(R - C)))))
+        print('maximum absolute error: {:.4e}'.format(
+                float(np.max(np.abs(R - C)))))
+        print('minimum relative error: {:.4e}'.format(
+                float(np.min(np.abs((R - C) / R)))))
+        print('maximum relative error: {:.4e}'.format(
+                float(np.max(np.abs((R - C) / R)))))
+
+if __name__ == '__main__':
+    if len(sys.argv) >= 3 and sys.argv[1] == 'table':
+        print(kernel_table(sys.argv[2:]))
+    elif len(sys.argv) >= 3:
+        kernel = Kernel(sys.argv[2])
+        {'qbin':print_qbin, 'qhex':print_qhex}[sys.argv[1]](
+                lambda asm: sgemm_gpu_code(asm, kernel))
+    else:
+        main(sys.argv[1] if len(sys.argv) >= 2 else 'sgemm_RNN')
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/* The part of the VCSM user interface QMKL uses, for the emulator. */
+
+#ifndef _EMU_USER_VCSM_H_
+#define _EMU_USER_VCSM_H_
+
+    typedef enum {
+        VCSM_CACHE_TYPE_NONE = 0,
+        VCSM_CACHE_TYPE_HOST,
+        VCSM_CACHE_TYPE_VC,
+        VCSM_CACHE_TYPE_HOST_AND_VC
+    } VCSM_CACHE_TYPE_T;
+
+#endif /* _EMU_USER_VCSM_H_ */
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * The part of libmailbox QMKL uses, for the emulator: launches run on the
+ * QPUs of src/emu/qpu.c.
+ */
+
+#ifndef _EMU_MAILBOX_H_
+#define _EMU_MAILBOX_H_
+
+#include <stdint.h>
+
+    int mailbox_open(void);
+    int mailbox_close(const int fd);
+    uint32_t mailbox_qpu_enable(const int fd, const uint32_t enable);
+    uint32_t mailbox_qpu_execute(const int fd, const uint32_t num_qpus,
+            const uint32_t control, const uint32_t noflush,
+            const uint32_t timeout);
+
+#endif /* _EMU_MAILBOX_H_ */
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * The part of librpimemmgr QMKL uses, for the emulator: "GPU memory" is host
+ * memory with made-up bus addresses, and cache operations do nothing.
+ */
+
+#ifndef _EMU_RPIMEMMGR_H_
+#define _EMU_RPIMEMMGR_H_
+
+#include <interface/vcsm/user-vcsm.h>
+#include <stdint.h>
+#include <stddef.h>
+
+    struct rpimemmgr {
+        int initialized;
+    };
+
+    int rpimemmgr_init(struct rpimemmgr *sp);
+    int rpimemmgr_finalize(struct rpimemmgr *sp);
+    int rpimemmgr_alloc_vcsm(const size_t size, const size_t align,
+            const VCSM_CACHE_TYPE_T cache_type, void **usraddr,
+            uint32_t *busaddr, struct rpimemmgr *sp);
+    int rpimemmgr_free_by_usraddr(const void *usraddr, struct rpimemmgr *sp);
+
+    int rpimemmgr_cache_op(const int op, const void *p, const size_t size);
+    int rpimemmgr_cache_op_multiple(const int n, ...);
+    int rpimemmgr_cache_op_2(const int op, const void *p, const size_t height,
+            const size_t width, const size_t stride);
+    int rpimemmgr_cache_op_2_multiple(const int n, ...);
+
+    void unif_set_uint(uint32_t *p, const uint32_t u);
+    void unif_set_float(uint32_t *p, const float f);
+    void unif_add_uint(const uint32_t u, uint32_t **p);
+    void unif_add_float(const float f, uint32_t **p);
+
+#endif /* _EMU_RPIMEMMGR_H_ */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * libmailbox stand-in for the emulator.  Launches run on the QPUs of qpu.c,
+ * with the timeout turned into cycles of a 250 MHz V3D issuing an
+ * instruction every four clocks.  When QMKL_EMU_STATS is set, closing the
+ * mailbox prints the counts of every QPU that has run.
+ */
+
+#include "qpu.h"
+#include <mailbox.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAILBOX_FD 0x51505500
+#define CYCLES_PER_MS (250000 / 4)
+
+int mailbox_open(void)
+{
+    return MAILBOX_FD;
+}
+
+int mailbox_close(const int fd)
+{
+    unsigned i;
+
+    if (fd != MAILBOX_FD)
+        return -1;
+    if (getenv("QMKL_EMU_STATS") == NULL)
+        return 0;
+
+    for (i = 0; i < EMU_NUM_QPUS; i ++) {
+        struct emu_qpu_stats s;
+
+        emu_qpu_stats(i, &s);
+        if (s.instructions == 0)
+            continue;
+        fprintf(stderr, "QMKL emulator: QPU %2u: %llu instructions, "
+                "stalled %llu cycles on TMU, %llu on DMA, "
+                "%llu on semaphores and the mutex\n", i,
+                (unsigned long long) s.instructions,
+                (unsigned long long) s.stall_tmu,
+                (unsigned long long) s.stall_dma,
+                (unsigned long long) s.stall_sync);
+    }
+    return 0;
+}
+
+uint32_t mailbox_qpu_enable(const int fd, const uint32_t enable)
+{
+    (void) enable;
+    return fd != MAILBOX_FD;
+}
+
+uint32_t mailbox_qpu_execute(const int fd, const uint32_t num_qpus,
+        const uint32_t control, const uint32_t noflush,
+        const uint32_t timeout)
+{
+    (void) noflush;
+    if (fd != MAILBOX_FD || num_qpus == 0 || num_qpus > EMU_NUM_QPUS)
+        return 0x80000000;
+    if (emu_qpu_execute(num_qpus, control,
+                (uint64_t) timeout * CYCLES_PER_MS))
+        return 0x80000000;
+    return 0;
+}
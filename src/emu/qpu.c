@@ -0,0 +1,1135 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Instruction-level emulator of the VideoCore IV QPUs, for running the
+ * assembled QMKL kernels off a Pi.  It covers what general-purpose programs
+ * use: both ALUs with the condition codes, flags, pack and unpack, the
+ * register files and accumulators, small and load immediates (per-element
+ * ones too), rotation, branches, uniforms, the SFU, direct memory lookups by
+ * the TMUs, generic VPM access, VDR and VDW DMA, the semaphores and the
+ * mutex.  Graphics-only parts (the TLB, varyings, texture lookups, the
+ * scoreboard) fault.
+ *
+ * QPUs are stepped in turns of one cycle, in which each issues at most one
+ * instruction.  An instruction that would block (on a TMU result, on a DMA,
+ * on a semaphore or the mutex) is retried in a later cycle without having had
+ * any effect.  Latencies are rough constants, so the cycle and stall counts
+ * show where time goes rather than how long it would take on a Pi.  Memory
+ * is read and written at once, so missing cache maintenance on the host is
+ * not caught.
+ *
+ * Launches are serialised by launch_qpu_code.c, so the state here is global.
+ */
+
+#include "qpu.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TMU_FIFO_DEPTH 8
+#define TMU_LATENCY 9
+#define DMA_LATENCY 16
+#define DMA_WORDS_PER_CYCLE 4
+#define VPM_ROWS 256
+
+enum sig {
+    SIG_BREAK, SIG_NONE, SIG_THREAD_SWITCH, SIG_END,
+    SIG_WAIT_SCOREBOARD, SIG_UNLOCK_SCOREBOARD, SIG_LAST_THREAD_SWITCH,
+    SIG_LOAD_COVERAGE, SIG_LOAD_COLOR, SIG_LOAD_COLOR_END,
+    SIG_LOAD_TMU0, SIG_LOAD_TMU1, SIG_LOAD_ALPHA,
+    SIG_SMALL_IMM, SIG_LOAD_IMM, SIG_BRANCH
+};
+
+enum step {
+    STEP_ISSUED,
+    STEP_STALL_TMU,   /* until q->ready */
+    STEP_STALL_DMA,   /* until q->ready */
+    STEP_STALL_SYNC,  /* until another QPU moves */
+    STEP_FAULT
+};
+
+enum file { FILE_A, FILE_B };
+
+typedef uint32_t vec_t[16];
+
+struct tmu {
+    vec_t data[TMU_FIFO_DEPTH];
+    uint64_t ready[TMU_FIFO_DEPTH];
+    unsigned head, len;
+};
+
+struct qpu {
+    unsigned num;
+    uint32_t pc, unif;
+    vec_t ra[32], rb[32], acc[6];
+    uint8_t z[16], n[16], c[16];
+    uint32_t branch_target;
+    int branch_delay; /* instructions left until the branch, counting this */
+    int end_delay;    /* instructions left after the end signal, or -1 */
+    int ended;
+    struct tmu tmu[2];
+    uint32_t vpm_rd_setup, vpm_wr_setup;
+    unsigned vpm_rd_left;
+    uint32_t vdr_setup, vdr_pitch, vdw_setup, vdw_stride;
+    uint64_t vdr_done, vdw_done;
+    uint64_t ready; /* the first cycle it can issue in */
+    uint64_t sync_wait; /* sync_events + 1 when it stalled on them, or 0 */
+};
+
+static struct qpu qpus[EMU_NUM_QPUS];
+static struct emu_qpu_stats stats[EMU_NUM_QPUS];
+static uint32_t vpm[VPM_ROWS * 16];
+static unsigned sems[16];
+static int mutex_owner;
+static unsigned host_ints; /* raised in the launch */
+static uint64_t sync_events; /* semaphore and mutex changes */
+
+static enum step fault(const struct qpu *q, const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "QMKL emulator: QPU %u at 0x%08x: ", q->num, q->pc);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    return STEP_FAULT;
+}
+
+static float to_float(const uint32_t u)
+{
+    union {uint32_t u; float f;} v;
+
+    /* Denormals are flushed to zero. */
+    v.u = (u & 0x7f800000) ? u : u & 0x80000000;
+    return v.f;
+}
+
+static uint32_t from_float(const float f)
+{
+    union {uint32_t u; float f;} v;
+
+    v.f = f;
+    return (v.u & 0x7f800000) ? v.u : v.u & 0x80000000;
+}
+
+static float half_to_float(const uint32_t h)
+{
+    const int e = (h >> 10) & 0x1f;
+    const float m = (h & 0x3ff) / 1024.0f;
+    const float f = e == 0 ? 0.0f
+                    : e == 0x1f ? (m ? NAN : INFINITY)
+                    : ldexpf(1.0f + m, e - 15);
+
+    return (h & 0x8000) ? -f : f;
+}
+
+static uint32_t float_to_half(const float f)
+{
+    const uint32_t s = signbit(f) ? 0x8000 : 0;
+    const float a = fabsf(f);
+    uint32_t m;
+    int e;
+
+    if (isnan(a))
+        return s | 0x7e00;
+    if (a < ldexpf(1.0f, -14))
+        return s;
+    /* a = m / 2048 * 2^e with m in [1024, 2048]. */
+    m = (uint32_t) lrintf(ldexpf(frexpf(a, &e), 11));
+    if (m == 2048) {
+        m = 1024;
+        e ++;
+    }
+    if (e + 14 >= 0x1f)
+        return s | 0x7c00;
+    return s | (uint32_t) (e + 14) << 10 | (m - 1024);
+}
+
+static uint32_t small_imm(const unsigned s)
+{
+    if (s < 16)
+        return s;
+    if (s < 32)
+        return (uint32_t) ((int32_t) s - 32);
+    if (s < 40)
+        return from_float(ldexpf(1.0f, s - 32));
+    return from_float(ldexpf(1.0f, s - 48));
+}
+
+static int is_float_add(const unsigned op)
+{
+    return 1 <= op && op <= 7;
+}
+
+static uint32_t unpack(const uint32_t v, const unsigned mode, const int fp)
+{
+    switch (mode) {
+    case 0:
+        return v;
+    case 1:
+        return fp ? from_float(half_to_float(v & 0xffff))
+                  : (uint32_t) (int32_t) (int16_t) (v & 0xffff);
+    case 2:
+        return fp ? from_float(half_to_float(v >> 16))
+                  : (uint32_t) (int32_t) (int16_t) (v >> 16);
+    case 3:
+        return (v >> 24) * 0x01010101u;
+    default:
+        {
+            const uint32_t b = (v >> ((mode - 4) * 8)) & 0xff;
+
+            return fp ? from_float(b / 255.0f) : b;
+        }
+    }
+}
+
+static uint32_t byte_sat(const int32_t v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static uint32_t int16_sat(const int32_t v)
+{
+    return (uint32_t) (v < -32768 ? -32768 : v > 32767 ? 32767 : v) & 0xffff;
+}
+
+/* Regfile A pack (pm = 0) of v into the old value of the register. */
+static uint32_t pack_a(const uint32_t old, const uint32_t v,
+        const unsigned mode, const int fp)
+{
+    switch (mode) {
+    case 0:
+    case 8:
+        return v;
+    case 1:
+    case 2:
+    case 9:
+    case 10:
+        {
+            const int shift = (mode == 1 || mode == 9) ? 0 : 16;
+            const uint32_t h = fp ? float_to_half(to_float(v))
+                               : mode >= 9 ? int16_sat(v) : v & 0xffff;
+
+            return (old & ~(0xffffu << shift)) | h << shift;
+        }
+    case 3:
+        return (v & 0xff) * 0x01010101u;
+    case 11:
+        return byte_sat(v) * 0x01010101u;
+    default:
+        {
+            const int shift = ((mode & 7) - 4) * 8;
+            const uint32_t b = mode >= 12 ? byte_sat(v) : v & 0xff;
+
+            return (old & ~(0xffu << shift)) | b << shift;
+        }
+    }
+}
+
+/* Mul ALU pack (pm = 1) of the float v as a colour, other bytes cleared. */
+static uint32_t pack_mul(const uint32_t v, const unsigned mode)
+{
+    const float f = to_float(v);
+    const uint32_t b = f > 0.0f ? (f < 1.0f ? (uint32_t) lrintf(f * 255.0f)
+                                            : 255) : 0;
+
+    if (mode == 3)
+        return b * 0x01010101u;
+    return b << (mode - 4) * 8;
+}
+
+static int cond_holds(const struct qpu *q, const unsigned cond,
+        const unsigned i)
+{
+    switch (cond) {
+    case 0: return 0;
+    case 1: return 1;
+    case 2: return q->z[i];
+    case 3: return !q->z[i];
+    case 4: return q->n[i];
+    case 5: return !q->n[i];
+    case 6: return q->c[i];
+    default: return !q->c[i];
+    }
+}
+
+static int first_lane(const struct qpu *q, const unsigned cond)
+{
+    unsigned i;
+
+    for (i = 0; i < 16; i ++)
+        if (cond_holds(q, cond, i))
+            return i;
+    return -1;
+}
+
+static void set_flags(struct qpu *q, const uint32_t *v, const uint32_t *carry,
+        const int fp, const unsigned cond)
+{
+    unsigned i;
+
+    for (i = 0; i < 16; i ++) {
+        /* As floats, denormals are zero and NaNs neither zero nor negative. */
+        const int zero = fp ? (v[i] & 0x7f800000) == 0 : v[i] == 0;
+        const int nan = fp && (v[i] & 0x7fffffff) > 0x7f800000;
+
+        if (cond != 1 && !cond_holds(q, cond, i))
+            continue;
+        q->z[i] = zero;
+        q->n[i] = (v[i] >> 31) && !zero && !nan;
+        q->c[i] = carry[i];
+    }
+}
+
+static uint32_t* mem(const struct qpu *q, const uint32_t addr,
+        const size_t size, const char *what)
+{
+    uint32_t *p = emu_bus_to_cpu(addr & ~3u, size);
+
+    if (p == NULL)
+        fault(q, "%s at 0x%08x outside GPU memory", what, addr);
+    return p;
+}
+
+/* The elements of a generic VPM access to addr. */
+static void vpm_access(const uint32_t setup, const unsigned addr, uint32_t **p)
+{
+    unsigned i;
+
+    for (i = 0; i < 16; i ++) {
+        if (setup & (1 << 11))
+            p[i] = &vpm[(addr % VPM_ROWS) * 16 + i];
+        else
+            p[i] = &vpm[((addr & 0xf0) + i) % VPM_ROWS * 16 + (addr & 15)];
+    }
+}
+
+static unsigned vpm_stride(const uint32_t setup)
+{
+    const unsigned s = (setup >> 12) & 0x3f;
+
+    return s ? s : 64;
+}
+
+/* Whether reading raddr of file would block, and on what. */
+static enum step read_blocks(struct qpu *q, const unsigned raddr,
+        const enum file file, const uint64_t cycle)
+{
+    const uint64_t done = file == FILE_A ? q->vdr_done : q->vdw_done;
+
+    switch (raddr) {
+    case 48:
+        if (q->vpm_rd_left == 0)
+            return fault(q, "VPM read without a read setup");
+        return STEP_ISSUED;
+    case 50:
+        if (done > cycle) {
+            q->ready = done;
+            return STEP_STALL_DMA;
+        }
+        return STEP_ISSUED;
+    case 51:
+        return mutex_owner == -1 ? STEP_ISSUED : STEP_STALL_SYNC;
+    default:
+        return STEP_ISSUED;
+    }
+}
+
+static enum step write_blocks(struct qpu *q, const unsigned waddr,
+        const enum file file, const unsigned cond, const uint64_t cycle)
+{
+    const uint64_t done = file == FILE_A ? q->vdr_done : q->vdw_done;
+
+    if (cond == 0)
+        return STEP_ISSUED;
+    if (waddr == 50 && done > cycle) {
+        q->ready = done;
+        return STEP_STALL_DMA;
+    }
+    if (56 <= waddr && q->tmu[(waddr - 56) / 4].len == TMU_FIFO_DEPTH)
+        return fault(q, "more than %d outstanding TMU requests",
+                TMU_FIFO_DEPTH);
+    return STEP_ISSUED;
+}
+
+static enum step read(struct qpu *q, const unsigned raddr,
+        const enum file file, const uint64_t cycle, uint32_t *v)
+{
+    unsigned i;
+
+    if (raddr < 32) {
+        memcpy(v, file == FILE_A ? q->ra[raddr] : q->rb[raddr],
+                sizeof(vec_t));
+        return STEP_ISSUED;
+    }
+    switch (raddr) {
+    case 32:
+        {
+            const uint32_t *u = mem(q, q->unif, 4, "uniform");
+
+            if (u == NULL)
+                return STEP_FAULT;
+            for (i = 0; i < 16; i ++)
+                v[i] = *u;
+            q->unif += 4;
+            return STEP_ISSUED;
+        }
+    case 38:
+        for (i = 0; i < 16; i ++)
+            v[i] = file == FILE_A ? i : q->num;
+        return STEP_ISSUED;
+    case 48:
+        {
+            uint32_t *p[16];
+
+            vpm_access(q->vpm_rd_setup, q->vpm_rd_setup & 0xff, p);
+            for (i = 0; i < 16; i ++)
+                v[i] = *p[i];
+            q->vpm_rd_setup = (q->vpm_rd_setup & ~0xffu)
+                    | ((q->vpm_rd_setup + vpm_stride(q->vpm_rd_setup)) & 0xff);
+            q->vpm_rd_left --;
+            return STEP_ISSUED;
+        }
+    case 49:
+        for (i = 0; i < 16; i ++)
+            v[i] = (file == FILE_A ? q->vdr_done : q->vdw_done) > cycle;
+        return STEP_ISSUED;
+    case 51:
+        mutex_owner = q->num;
+        /* Fall through. */
+    case 39:
+    case 50:
+        memset(v, 0, sizeof(vec_t));
+        return STEP_ISSUED;
+    default:
+        return fault(q, "unsupported read address %u of regfile %c", raddr,
+                file == FILE_A ? 'A' : 'B');
+    }
+}
+
+static enum step tmu_request(struct qpu *q, struct tmu *t, const uint32_t *v,
+        const unsigned cond, const uint64_t cycle)
+{
+    const unsigned slot = (t->head + t->len) % TMU_FIFO_DEPTH;
+    unsigned i;
+
+    for (i = 0; i < 16; i ++) {
+        t->data[slot][i] = 0;
+        if (cond_holds(q, cond, i)) {
+            const uint32_t *p = mem(q, v[i], 4, "TMU lookup");
+
+            if (p == NULL)
+                return STEP_FAULT;
+            t->data[slot][i] = *p;
+        }
+    }
+    t->ready[slot] = cycle + TMU_LATENCY;
+    t->len ++;
+    return STEP_ISSUED;
+}
+
+static enum step vdr_start(struct qpu *q, const uint32_t addr,
+        const uint64_t cycle)
+{
+    const uint32_t s = q->vdr_setup;
+    const unsigned mpitch = (s >> 24) & 0xf;
+    const unsigned rowlen = ((s >> 20) & 0xf) ? (s >> 20) & 0xf : 16;
+    const unsigned nrows = ((s >> 16) & 0xf) ? (s >> 16) & 0xf : 16;
+    const unsigned vpitch = ((s >> 12) & 0xf) ? (s >> 12) & 0xf : 16;
+    const unsigned y = (s >> 4) & 0x7f, x = s & 0xf;
+    const uint32_t pitch = mpitch ? 8u << mpitch : q->vdr_pitch;
+    unsigned r, w;
+
+    if (!(s >> 31))
+        return fault(q, "VDR started without a setup");
+    if ((s >> 28) & 7)
+        return fault(q, "unsupported VDR width mode %u", (s >> 28) & 7);
+    for (r = 0; r < nrows; r ++) {
+        const uint32_t *p = mem(q, addr + r * pitch, rowlen * 4, "VDR");
+
+        if (p == NULL)
+            return STEP_FAULT;
+        for (w = 0; w < rowlen; w ++) {
+            unsigned i;
+
+            if (s & (1 << 11))
+                i = (y + w) * 16 + ((x + r * vpitch) & 15);
+            else
+                i = (y + r * vpitch) * 16 + x + w;
+            vpm[i % (VPM_ROWS * 16)] = p[w];
+        }
+    }
+    q->vdr_done = cycle + DMA_LATENCY + nrows * rowlen / DMA_WORDS_PER_CYCLE;
+    return STEP_ISSUED;
+}
+
+static enum step vdw_start(struct qpu *q, const uint32_t addr,
+        const uint64_t cycle)
+{
+    const uint32_t s = q->vdw_setup;
+    const unsigned units = ((s >> 23) & 0x7f) ? (s >> 23) & 0x7f : 128;
+    const unsigned depth = ((s >> 16) & 0x7f) ? (s >> 16) & 0x7f : 128;
+    const unsigned y = (s >> 7) & 0x7f, x = (s >> 3) & 0xf;
+    unsigned u, d;
+
+    if ((s >> 30) != 2)
+        return fault(q, "VDW started without a setup");
+    if (s & 7)
+        return fault(q, "unsupported VDW width mode %u", s & 7);
+    for (u = 0; u < units; u ++) {
+        uint32_t *p = mem(q, addr + u * (depth * 4 + q->vdw_stride),
+                depth * 4, "VDW");
+
+        if (p == NULL)
+            return STEP_FAULT;
+        for (d = 0; d < depth; d ++) {
+            unsigned i;
+
+            if (s & (1 << 14))
+                i = (y + u) * 16 + x + d;
+            else
+                i = (y + d) * 16 + ((x + u) & 15);
+            p[d] = vpm[i % (VPM_ROWS * 16)];
+        }
+    }
+    q->vdw_done = cycle + DMA_LATENCY + units * depth / DMA_WORDS_PER_CYCLE;
+    return STEP_ISSUED;
+}
+
+/*
+ * Writes v to waddr of file where cond holds.  Registers that are not
+ * vectors take the value of the first such element.
+ */
+static enum step write(struct qpu *q, const unsigned waddr,
+        const enum file file, const unsigned cond, const uint32_t *v,
+        const uint64_t cycle)
+{
+    const int lane = first_lane(q, cond);
+    unsigned i;
+
+    if (lane < 0)
+        return STEP_ISSUED;
+    if (waddr < 32 || (32 <= waddr && waddr < 36)) {
+        uint32_t *r = waddr < 32 ? (file == FILE_A ? q->ra[waddr]
+                                                   : q->rb[waddr])
+                                 : q->acc[waddr - 32];
+
+        if (cond == 1) {
+            memcpy(r, v, sizeof(vec_t));
+            return STEP_ISSUED;
+        }
+        for (i = 0; i < 16; i ++)
+            if (cond_holds(q, cond, i))
+                r[i] = v[i];
+        return STEP_ISSUED;
+    }
+    switch (waddr) {
+    case 36: /* tmu_noswap: TMUs are never swapped here. */
+    case 39:
+        return STEP_ISSUED;
+    case 38: /* host_int: a launch ends when all programs have. */
+        host_ints ++;
+        return STEP_ISSUED;
+    case 37:
+        for (i = 0; i < 16; i ++) {
+            const unsigned src = file == FILE_A ? i & ~3u : 0;
+
+            if (cond_holds(q, cond, src))
+                q->acc[5][i] = v[src];
+        }
+        return STEP_ISSUED;
+    case 40:
+        if (file == FILE_B)
+            break;
+        q->unif = v[lane];
+        return STEP_ISSUED;
+    case 48:
+        {
+            uint32_t *p[16];
+
+            vpm_access(q->vpm_wr_setup, q->vpm_wr_setup & 0xff, p);
+            for (i = 0; i < 16; i ++)
+                if (cond_holds(q, cond, i))
+                    *p[i] = v[i];
+            q->vpm_wr_setup = (q->vpm_wr_setup & ~0xffu)
+                    | ((q->vpm_wr_setup + vpm_stride(q->vpm_wr_setup)) & 0xff);
+            return STEP_ISSUED;
+        }
+    case 49:
+        {
+            const uint32_t s = v[lane];
+
+            if (file == FILE_A) {
+                if ((s >> 28) == 9)
+                    q->vdr_pitch = s & 0x1fff;
+                else if (s >> 31)
+                    q->vdr_setup = s;
+                else if ((s >> 30) == 0) {
+                    q->vpm_rd_setup = s;
+                    q->vpm_rd_left = ((s >> 20) & 0xf) ? (s >> 20) & 0xf : 16;
+                } else
+                    break;
+            } else {
+                if ((s >> 30) == 3) {
+                    if (s & (1 << 16))
+                        return fault(q, "unsupported VDW block mode");
+                    q->vdw_stride = s & 0x1fff;
+                } else if ((s >> 30) == 2)
+                    q->vdw_setup = s;
+                else if ((s >> 30) == 0)
+                    q->vpm_wr_setup = s;
+                else
+                    break;
+            }
+            if ((s >> 30) == 0 && ((s >> 8) & 3) != 2)
+                return fault(q, "unsupported VPM access size %u",
+                        (s >> 8) & 3);
+            return STEP_ISSUED;
+        }
+    case 50:
+        return file == FILE_A ? vdr_start(q, v[lane], cycle)
+                              : vdw_start(q, v[lane], cycle);
+    case 51:
+        if (mutex_owner != (int) q->num)
+            return fault(q, "release of a mutex it does not hold");
+        mutex_owner = -1;
+        sync_events ++;
+        return STEP_ISSUED;
+    case 52:
+    case 53:
+    case 54:
+    case 55:
+        for (i = 0; i < 16; i ++) {
+            const float f = to_float(v[i]);
+            float r;
+
+            if (!cond_holds(q, cond, i))
+                continue;
+            switch (waddr) {
+            case 52: r = 1.0f / f; break;
+            case 53: r = 1.0f / sqrtf(f); break;
+            case 54: r = exp2f(f); break;
+            default: r = log2f(f); break;
+            }
+            q->acc[4][i] = from_float(r);
+        }
+        return STEP_ISSUED;
+    case 56:
+    case 60:
+        return tmu_request(q, &q->tmu[(waddr - 56) / 4], v, cond, cycle);
+    }
+    return fault(q, "unsupported write address %u of regfile %c", waddr,
+            file == FILE_A ? 'A' : 'B');
+}
+
+/* Applies the expression e to each lane i. */
+#define LANES(e) do { for (i = 0; i < 16; i ++) { e; } } while (0)
+
+static uint32_t fmin2(const float a, const float b)
+{
+    return from_float(a < b ? a : b);
+}
+
+static uint32_t fmax2(const float a, const float b)
+{
+    return from_float(a > b ? a : b);
+}
+
+static uint32_t fminabs(const float a, const float b)
+{
+    return from_float(fabsf(a) < fabsf(b) ? fabsf(a) : fabsf(b));
+}
+
+static uint32_t fmaxabs(const float a, const float b)
+{
+    return from_float(fabsf(a) > fabsf(b) ? fabsf(a) : fabsf(b));
+}
+
+static uint32_t ftoi(const float f)
+{
+    return (f > -2147483648.0f && f < 2147483648.0f)
+           ? (uint32_t) (int32_t) f : 0;
+}
+
+static uint32_t v8(const unsigned op, const uint32_t a, const uint32_t b)
+{
+    uint32_t r = 0;
+    unsigned j;
+
+    for (j = 0; j < 32; j += 8) {
+        const int x = (a >> j) & 0xff, y = (b >> j) & 0xff;
+        int v;
+
+        switch (op) {
+        case 3: v = (x * y + 127) / 255; break;
+        case 4: v = x < y ? x : y; break;
+        case 5: v = x > y ? x : y; break;
+        case 6: v = x + y; break;
+        case 7: v = x - y; break;
+        default: v = 0; break;
+        }
+        r |= byte_sat(v) << j;
+    }
+    return r;
+}
+
+static void add_op(const unsigned op, const uint32_t *a, const uint32_t *b,
+        uint32_t *r, uint32_t *carry)
+{
+    unsigned i;
+
+    memset(carry, 0, sizeof(vec_t));
+    switch (op) {
+    case 1: LANES(r[i] = from_float(to_float(a[i]) + to_float(b[i]))); break;
+    case 2: LANES(r[i] = from_float(to_float(a[i]) - to_float(b[i]))); break;
+    case 3: LANES(r[i] = fmin2(to_float(a[i]), to_float(b[i]))); break;
+    case 4: LANES(r[i] = fmax2(to_float(a[i]), to_float(b[i]))); break;
+    case 5: LANES(r[i] = fminabs(to_float(a[i]), to_float(b[i]))); break;
+    case 6: LANES(r[i] = fmaxabs(to_float(a[i]), to_float(b[i]))); break;
+    case 7: LANES(r[i] = ftoi(to_float(a[i]))); break;
+    case 8: LANES(r[i] = from_float((float) (int32_t) a[i])); break;
+    case 12: LANES(r[i] = a[i] + b[i]; carry[i] = r[i] < a[i]); break;
+    case 13: LANES(r[i] = a[i] - b[i]; carry[i] = a[i] < b[i]); break;
+    case 14: LANES(r[i] = a[i] >> (b[i] & 31)); break;
+    case 15: LANES(r[i] = (uint32_t) ((int32_t) a[i] >> (b[i] & 31))); break;
+    case 16:
+        LANES(r[i] = (b[i] & 31) ? a[i] >> (b[i] & 31)
+                                   | a[i] << (32 - (b[i] & 31)) : a[i]);
+        break;
+    case 17: LANES(r[i] = a[i] << (b[i] & 31)); break;
+    case 18:
+        LANES(r[i] = (int32_t) a[i] < (int32_t) b[i] ? a[i] : b[i]);
+        break;
+    case 19:
+        LANES(r[i] = (int32_t) a[i] > (int32_t) b[i] ? a[i] : b[i]);
+        break;
+    case 20: LANES(r[i] = a[i] & b[i]); break;
+    case 21: LANES(r[i] = a[i] | b[i]); break;
+    case 22: LANES(r[i] = a[i] ^ b[i]); break;
+    case 23: LANES(r[i] = ~a[i]); break;
+    case 24: LANES(r[i] = a[i] ? __builtin_clz(a[i]) : 32); break;
+    case 30: LANES(r[i] = v8(6, a[i], b[i])); break;
+    case 31: LANES(r[i] = v8(7, a[i], b[i])); break;
+    default: memset(r, 0, sizeof(vec_t)); break;
+    }
+}
+
+static void mul_op(const unsigned op, const uint32_t *a, const uint32_t *b,
+        uint32_t *r)
+{
+    unsigned i;
+
+    switch (op) {
+    case 0: memset(r, 0, sizeof(vec_t)); break;
+    case 1: LANES(r[i] = from_float(to_float(a[i]) * to_float(b[i]))); break;
+    case 2: LANES(r[i] = (a[i] & 0xffffff) * (b[i] & 0xffffff)); break;
+    default:
+        /* mov and rotations are v8min of a value with itself. */
+        LANES(r[i] = (op == 4 || op == 5) && a[i] == b[i] ? a[i]
+                                                          : v8(op, a[i], b[i]));
+        break;
+    }
+}
+
+static enum step alu(struct qpu *q, const uint64_t ins, const unsigned sig,
+        const uint64_t cycle)
+{
+    const unsigned unpack_mode = (ins >> 57) & 7, pm = (ins >> 56) & 1;
+    const unsigned pack_mode = (ins >> 52) & 0xf;
+    const unsigned cond_add = (ins >> 49) & 7, cond_mul = (ins >> 46) & 7;
+    const unsigned sf = (ins >> 45) & 1, ws = (ins >> 44) & 1;
+    const unsigned waddr_add = (ins >> 38) & 0x3f, waddr_mul = (ins >> 32) & 0x3f;
+    const unsigned op_mul = (ins >> 29) & 7, op_add = (ins >> 24) & 0x1f;
+    const unsigned raddr_a = (ins >> 18) & 0x3f, raddr_b = (ins >> 12) & 0x3f;
+    const unsigned muxes[4] = {
+        (ins >> 9) & 7, (ins >> 6) & 7, (ins >> 3) & 7, ins & 7
+    };
+    const enum file file_add = ws ? FILE_B : FILE_A;
+    const enum file file_mul = ws ? FILE_A : FILE_B;
+    const int imm = sig == SIG_SMALL_IMM;
+    const unsigned rotation = imm && raddr_b >= 48
+                              ? (raddr_b == 48 ? q->acc[5][0] & 15
+                                               : raddr_b - 48) : 0;
+    struct tmu *t = NULL;
+    vec_t a, b, in[4], r_add, r_mul, carry, none;
+    const uint32_t *src[4];
+    enum step s;
+    unsigned i, j;
+
+    switch (sig) {
+    case SIG_BREAK:
+    case SIG_NONE:
+    case SIG_THREAD_SWITCH:
+    case SIG_END:
+    case SIG_LAST_THREAD_SWITCH:
+    case SIG_SMALL_IMM:
+        break;
+    case SIG_LOAD_TMU0:
+    case SIG_LOAD_TMU1:
+        t = &q->tmu[sig - SIG_LOAD_TMU0];
+        if (t->len == 0)
+            return fault(q, "TMU load without a request");
+        if (t->ready[t->head] > cycle) {
+            q->ready = t->ready[t->head];
+            return STEP_STALL_TMU;
+        }
+        break;
+    default:
+        return fault(q, "unsupported signal %u", sig);
+    }
+
+    /* Whatever can block is checked before anything takes effect. */
+    if ((s = read_blocks(q, raddr_a, FILE_A, cycle)) != STEP_ISSUED)
+        return s;
+    if (!imm && (s = read_blocks(q, raddr_b, FILE_B, cycle)) != STEP_ISSUED)
+        return s;
+    if ((s = write_blocks(q, waddr_add, file_add, cond_add, cycle))
+            != STEP_ISSUED)
+        return s;
+    if ((s = write_blocks(q, waddr_mul, file_mul, cond_mul, cycle))
+            != STEP_ISSUED)
+        return s;
+
+    if ((s = read(q, raddr_a, FILE_A, cycle, a)) != STEP_ISSUED)
+        return s;
+    if (imm) {
+        const uint32_t v = raddr_b < 48 ? small_imm(raddr_b) : 0;
+
+        for (i = 0; i < 16; i ++)
+            b[i] = v;
+    }
+    else if (raddr_b == raddr_a && (raddr_b == 32 || raddr_b == 48))
+        memcpy(b, a, sizeof(b));
+    else if ((s = read(q, raddr_b, FILE_B, cycle, b)) != STEP_ISSUED)
+        return s;
+
+    for (j = 0; j < 4; j ++) {
+        const unsigned m = muxes[j];
+        const int fp = j < 2 ? is_float_add(op_add) : op_mul == 1;
+        const uint32_t * const v = m < 6 ? q->acc[m] : m == 6 ? a : b;
+
+        src[j] = v;
+        if (unpack_mode && ((!pm && m == 6) || (pm && m == 4))) {
+            for (i = 0; i < 16; i ++)
+                in[j][i] = unpack(v[i], unpack_mode, fp);
+            src[j] = in[j];
+        }
+        if (j >= 2 && rotation) {
+            vec_t tmp;
+
+            if (m > 3)
+                return fault(q, "rotation of an input other than r0-r3");
+            for (i = 0; i < 16; i ++)
+                tmp[i] = src[j][(i - rotation) & 15];
+            memcpy(in[j], tmp, sizeof(tmp));
+            src[j] = in[j];
+        }
+    }
+
+    add_op(op_add, src[0], src[1], r_add, carry);
+    mul_op(op_mul, src[2], src[3], r_mul);
+
+    if (pm && pack_mode) {
+        if (pack_mode < 3)
+            return fault(q, "unsupported mul pack mode %u", pack_mode);
+        for (i = 0; i < 16; i ++)
+            r_mul[i] = pack_mul(r_mul[i], pack_mode);
+    }
+    if (!pm && pack_mode) {
+        const int to_a_add = file_add == FILE_A && waddr_add < 32;
+        const int to_a_mul = file_mul == FILE_A && waddr_mul < 32;
+
+        for (i = 0; i < 16; i ++) {
+            if (to_a_add)
+                r_add[i] = pack_a(q->ra[waddr_add][i], r_add[i], pack_mode,
+                        is_float_add(op_add) && op_add != 7);
+            if (to_a_mul)
+                r_mul[i] = pack_a(q->ra[waddr_mul][i], r_mul[i], pack_mode,
+                        op_mul == 1);
+        }
+    }
+
+    if ((s = write(q, waddr_add, file_add, cond_add, r_add, cycle))
+            != STEP_ISSUED)
+        return s;
+    if ((s = write(q, waddr_mul, file_mul, cond_mul, r_mul, cycle))
+            != STEP_ISSUED)
+        return s;
+
+    /* After the writes, whose conditions are on the flags from before. */
+    if (sf) {
+        if (op_add)
+            set_flags(q, r_add, carry, is_float_add(op_add) && op_add != 7,
+                    cond_add);
+        else if (op_mul) {
+            memset(none, 0, sizeof(none));
+            set_flags(q, r_mul, none, op_mul == 1, cond_mul);
+        }
+    }
+
+    if (t != NULL) {
+        memcpy(q->acc[4], t->data[t->head], sizeof(vec_t));
+        t->head = (t->head + 1) % TMU_FIFO_DEPTH;
+        t->len --;
+    }
+    if (sig == SIG_END)
+        q->end_delay = 2;
+    return STEP_ISSUED;
+}
+
+static enum step load_imm(struct qpu *q, const uint64_t ins,
+        const uint64_t cycle)
+{
+    const unsigned mode = (ins >> 57) & 7;
+    const unsigned pack_mode = (ins >> 52) & 0xf;
+    const unsigned cond_add = (ins >> 49) & 7, cond_mul = (ins >> 46) & 7;
+    const unsigned sf = (ins >> 45) & 1, ws = (ins >> 44) & 1;
+    const unsigned waddr_add = (ins >> 38) & 0x3f, waddr_mul = (ins >> 32) & 0x3f;
+    const uint32_t imm = ins & 0xffffffff;
+    const enum file file_add = ws ? FILE_B : FILE_A;
+    const enum file file_mul = ws ? FILE_A : FILE_B;
+    vec_t v, none;
+    enum step s;
+    unsigned i;
+
+    if (pack_mode)
+        return fault(q, "unsupported pack of a load immediate");
+    if (mode == 4) {
+        const unsigned n = imm & 15;
+
+        if ((imm & 16) ? sems[n] == 0 : sems[n] == 15)
+            return STEP_STALL_SYNC;
+    } else if (mode != 0 && mode != 1 && mode != 3)
+        return fault(q, "unsupported load immediate mode %u", mode);
+    if ((s = write_blocks(q, waddr_add, file_add, cond_add, cycle))
+            != STEP_ISSUED)
+        return s;
+    if ((s = write_blocks(q, waddr_mul, file_mul, cond_mul, cycle))
+            != STEP_ISSUED)
+        return s;
+
+    if (mode == 4) {
+        if (imm & 16)
+            sems[imm & 15] --;
+        else
+            sems[imm & 15] ++;
+        sync_events ++;
+    }
+    for (i = 0; i < 16; i ++) {
+        const unsigned e = ((imm >> (16 + i)) & 1) << 1 | ((imm >> i) & 1);
+
+        switch (mode) {
+        case 1: v[i] = (e & 2) ? (uint32_t) e - 4 : e; break;
+        case 3: v[i] = e; break;
+        default: v[i] = imm; break;
+        }
+    }
+    if ((s = write(q, waddr_add, file_add, cond_add, v, cycle))
+            != STEP_ISSUED)
+        return s;
+    if ((s = write(q, waddr_mul, file_mul, cond_mul, v, cycle))
+            != STEP_ISSUED)
+        return s;
+    if (sf) {
+        memset(none, 0, sizeof(none));
+        set_flags(q, v, none, 0, cond_add ? cond_add : cond_mul);
+    }
+    return STEP_ISSUED;
+}
+
+/* Whether all (or any) of the flags f are set (or clear). */
+static int all_or_any(const uint8_t *f, const int all, const int set)
+{
+    unsigned i, count = 0;
+
+    for (i = 0; i < 16; i ++)
+        count += (f[i] != 0) == set;
+    return all ? count == 16 : count != 0;
+}
+
+static enum step branch(struct qpu *q, const uint64_t ins,
+        const uint64_t cycle)
+{
+    const unsigned cond = (ins >> 52) & 0xf;
+    const unsigned rel = (ins >> 51) & 1, reg = (ins >> 50) & 1;
+    const unsigned raddr_a = (ins >> 45) & 0x1f, ws = (ins >> 44) & 1;
+    const unsigned waddr_add = (ins >> 38) & 0x3f, waddr_mul = (ins >> 32) & 0x3f;
+    const uint32_t imm = ins & 0xffffffff;
+    const uint8_t *flags = cond < 4 ? q->z : cond < 8 ? q->n : q->c;
+    vec_t link;
+    enum step s;
+    unsigned i;
+    int taken;
+
+    if (q->branch_delay)
+        return fault(q, "branch in the delay slots of a branch");
+    if (cond == 15)
+        taken = 1;
+    else if (cond >= 12)
+        return fault(q, "reserved branch condition %u", cond);
+    else
+        taken = all_or_any(flags, !(cond & 2), !(cond & 1));
+
+    if ((s = write_blocks(q, waddr_add, ws ? FILE_B : FILE_A, 1, cycle))
+            != STEP_ISSUED)
+        return s;
+    if ((s = write_blocks(q, waddr_mul, ws ? FILE_A : FILE_B, 1, cycle))
+            != STEP_ISSUED)
+        return s;
+    for (i = 0; i < 16; i ++)
+        link[i] = q->pc + 4 * 8;
+    if ((s = write(q, waddr_add, ws ? FILE_B : FILE_A, 1, link, cycle))
+            != STEP_ISSUED)
+        return s;
+    if ((s = write(q, waddr_mul, ws ? FILE_A : FILE_B, 1, link, cycle))
+            != STEP_ISSUED)
+        return s;
+
+    if (taken) {
+        q->branch_target = imm + (rel ? q->pc + 4 * 8 : 0)
+                           + (reg ? q->ra[raddr_a][0] : 0);
+        q->branch_delay = 4;
+    }
+    return STEP_ISSUED;
+}
+
+static enum step step(struct qpu *q, const uint64_t cycle)
+{
+    const uint32_t *p = mem(q, q->pc, 8, "instruction fetch");
+    uint64_t ins;
+    enum step s;
+
+    if (p == NULL)
+        return STEP_FAULT;
+    ins = p[0] | (uint64_t) p[1] << 32;
+    switch (ins >> 60) {
+    case SIG_BRANCH:
+        s = branch(q, ins, cycle);
+        break;
+    case SIG_LOAD_IMM:
+        s = load_imm(q, ins, cycle);
+        break;
+    default:
+        s = alu(q, ins, ins >> 60, cycle);
+        break;
+    }
+    if (s != STEP_ISSUED)
+        return s;
+
+    q->pc += 8;
+    if (q->branch_delay && -- q->branch_delay == 0)
+        q->pc = q->branch_target;
+    if (q->end_delay >= 0 && q->end_delay -- == 0)
+        q->ended = 1;
+    stats[q->num].instructions ++;
+    return STEP_ISSUED;
+}
+
+void emu_qpu_stats(const unsigned i, struct emu_qpu_stats *s)
+{
+    *s = stats[i];
+}
+
+int emu_qpu_execute(const unsigned num_qpus, const uint32_t control,
+        const uint64_t max_cycles)
+{
+    const uint32_t *list = emu_bus_to_cpu(control, num_qpus * 2 * 4);
+    int blocked[EMU_NUM_QPUS];
+    unsigned live = num_qpus, i;
+    uint64_t cycle;
+
+    if (list == NULL || num_qpus > EMU_NUM_QPUS) {
+        fprintf(stderr, "QMKL emulator: invalid control list at 0x%08x\n",
+                control);
+        return 1;
+    }
+    memset(qpus, 0, sizeof(qpus));
+    memset(sems, 0, sizeof(sems));
+    mutex_owner = -1;
+    host_ints = 0;
+    for (i = 0; i < num_qpus; i ++) {
+        qpus[i].num = i;
+        qpus[i].unif = list[i * 2 + 0];
+        qpus[i].pc = list[i * 2 + 1];
+        qpus[i].end_delay = -1;
+    }
+
+    for (cycle = 0; live != 0; cycle ++) {
+        uint64_t next = UINT64_MAX;
+        int issued = 0;
+
+        if (cycle > max_cycles) {
+            fprintf(stderr, "QMKL emulator: QPUs still running after %llu "
+                    "cycles\n", (unsigned long long) max_cycles);
+            return 1;
+        }
+        for (i = 0; i < num_qpus; i ++) {
+            struct qpu * const q = &qpus[i];
+
+            blocked[i] = 0;
+            if (q->ended)
+                continue;
+            if (q->ready > cycle) {
+                next = q->ready < next ? q->ready : next;
+                continue;
+            }
+            /* Nothing it waits for has changed since it last tried. */
+            if (q->sync_wait == sync_events + 1) {
+                stats[i].stall_sync ++;
+                blocked[i] = 1;
+                continue;
+            }
+            q->sync_wait = 0;
+            switch (step(q, cycle)) {
+            case STEP_ISSUED:
+                issued = 1;
+                if (q->ended)
+                    live --;
+                break;
+            case STEP_STALL_TMU:
+                stats[i].stall_tmu += q->ready - cycle;
+                next = q->ready < next ? q->ready : next;
+                break;
+            case STEP_STALL_DMA:
+                stats[i].stall_dma += q->ready - cycle;
+                next = q->ready < next ? q->ready : next;
+                break;
+            case STEP_STALL_SYNC:
+                stats[i].stall_sync ++;
+                blocked[i] = 1;
+                q->sync_wait = sync_events + 1;
+                break;
+            case STEP_FAULT:
+                return 1;
+            }
+        }
+        if (issued || live == 0)
+            continue;
+        if (next == UINT64_MAX) {
+            fprintf(stderr, "QMKL emulator: QPUs deadlocked on semaphores "
+                    "or the mutex\n");
+            return 1;
+        }
+        /* Nothing happens until next: skip to it. */
+        for (i = 0; i < num_qpus; i ++)
+            if (blocked[i])
+                stats[i].stall_sync += next - cycle - 1;
+        cycle = next - 1;
+    }
+    /* The mailbox call may return at the first one. */
+    if (host_ints != 1) {
+        fprintf(stderr, "QMKL emulator: a launch raised %u host interrupts "
+                "instead of one\n", host_ints);
+        return 1;
+    }
+    return 0;
+}
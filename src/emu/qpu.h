@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef _EMU_QPU_H_
+#define _EMU_QPU_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EMU_NUM_QPUS 12
+
+    /*
+     * Host address of the size bytes at bus address bus in the memory of
+     * rpimemmgr.c, or NULL if they are not all in it.
+     */
+    void* emu_bus_to_cpu(const uint32_t bus, const size_t size);
+
+    /*
+     * Counts of QPU i over every launch so far.  A cycle is one instruction
+     * slot; a QPU that cannot issue in one is stalled on the TMU, on the VPM
+     * DMA or on a semaphore or the mutex.
+     */
+    struct emu_qpu_stats {
+        uint64_t instructions;
+        uint64_t stall_tmu, stall_dma, stall_sync;
+    };
+
+    void emu_qpu_stats(const unsigned i, struct emu_qpu_stats *stats);
+
+    /*
+     * Runs the programs of the control list at control, num_qpus pairs of
+     * uniforms and code bus addresses, on QPUs 0 to num_qpus-1 until they
+     * have all ended.  Returns 0, or non-zero after printing why if a program
+     * faults, the QPUs deadlock or they run for more than max_cycles, or if
+     * they raise other than one host interrupt.
+     */
+    int emu_qpu_execute(const unsigned num_qpus, const uint32_t control,
+            const uint64_t max_cycles);
+
+#endif /* _EMU_QPU_H_ */
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * librpimemmgr stand-in for the emulator.  The GPU memory is a memory file
+ * of ARENA_SIZE bytes, only backed when touched, and offset o in it has bus
+ * address BUS_BASE + o, the uncached alias as for VCSM memory.  Allocations
+ * are whole pages, first fit in a list sorted by offset.
+ *
+ * The file is mapped twice: once for the CPU, where VCSM_CACHE_TYPE_VC
+ * allocations are inaccessible as the CPU must never touch them, and once
+ * for the QPUs, which see all of it.
+ */
+
+#define _GNU_SOURCE
+#include "qpu.h"
+#include <rpimemmgr.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ARENA_SIZE ((size_t) 512 << 20)
+#define BUS_BASE 0xc0000000u
+#define PAGE_SIZE 4096
+
+struct block {
+    size_t offset, size;
+};
+
+static int arena_fd = -1;
+static unsigned char *arena = NULL, *arena_qpu = NULL;
+static unsigned users = 0;
+static struct block *blocks = NULL;
+static size_t n_blocks = 0, max_blocks = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void* emu_bus_to_cpu(const uint32_t bus, const size_t size)
+{
+    const size_t offset = bus - BUS_BASE;
+
+    if (arena_qpu == NULL || bus < BUS_BASE || offset >= ARENA_SIZE
+            || size > ARENA_SIZE - offset)
+        return NULL;
+    return arena_qpu + offset;
+}
+
+int rpimemmgr_init(struct rpimemmgr *sp)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&lock);
+    if (users == 0) {
+        arena_fd = memfd_create("qmkl-emu-gpu-memory", 0);
+        if (arena_fd < 0 || ftruncate(arena_fd, ARENA_SIZE))
+            ret = -1;
+        if (ret == 0) {
+            arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_NORESERVE, arena_fd, 0);
+            arena_qpu = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_NORESERVE, arena_fd, 0);
+            if (arena == MAP_FAILED || arena_qpu == MAP_FAILED)
+                ret = -1;
+        }
+        if (ret != 0) {
+            if (arena != NULL && arena != MAP_FAILED)
+                munmap(arena, ARENA_SIZE);
+            if (arena_qpu != NULL && arena_qpu != MAP_FAILED)
+                munmap(arena_qpu, ARENA_SIZE);
+            if (arena_fd >= 0)
+                close(arena_fd);
+            arena = arena_qpu = NULL;
+            arena_fd = -1;
+        }
+    }
+    if (ret == 0) {
+        users ++;
+        sp->initialized = 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+int rpimemmgr_finalize(struct rpimemmgr *sp)
+{
+    if (!sp->initialized)
+        return -1;
+    sp->initialized = 0;
+
+    pthread_mutex_lock(&lock);
+    if (-- users == 0) {
+        munmap(arena, ARENA_SIZE);
+        munmap(arena_qpu, ARENA_SIZE);
+        close(arena_fd);
+        arena = arena_qpu = NULL;
+        arena_fd = -1;
+        free(blocks);
+        blocks = NULL;
+        n_blocks = max_blocks = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int rpimemmgr_alloc_vcsm(const size_t size, const size_t align,
+        const VCSM_CACHE_TYPE_T cache_type, void **usraddr,
+        uint32_t *busaddr, struct rpimemmgr *sp)
+{
+    const size_t a = align > PAGE_SIZE ? align : PAGE_SIZE;
+    const size_t len = size ? (size + PAGE_SIZE - 1) & ~(size_t) (PAGE_SIZE - 1)
+                            : PAGE_SIZE;
+    size_t i, start = 0;
+
+    if (!sp->initialized || (a & (a - 1)))
+        return -1;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i <= n_blocks; i ++) {
+        const size_t end = i < n_blocks ? blocks[i].offset : ARENA_SIZE;
+
+        start = (start + a - 1) & ~(a - 1);
+        if (start <= end && len <= end - start)
+            break;
+        if (i < n_blocks)
+            start = blocks[i].offset + blocks[i].size;
+    }
+    if (i > n_blocks) {
+        pthread_mutex_unlock(&lock);
+        fprintf(stderr, "QMKL emulator: out of GPU memory for %zu bytes\n",
+                size);
+        return -1;
+    }
+    if (n_blocks == max_blocks) {
+        struct block *b;
+
+        max_blocks = max_blocks ? max_blocks * 2 : 64;
+        b = realloc(blocks, max_blocks * sizeof(*blocks));
+        if (b == NULL) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        blocks = b;
+    }
+    memmove(&blocks[i + 1], &blocks[i], (n_blocks - i) * sizeof(*blocks));
+    blocks[i].offset = start;
+    blocks[i].size = len;
+    n_blocks ++;
+    if (VCSM_CACHE_TYPE_VC == cache_type)
+        mprotect(arena + start, len, PROT_NONE);
+    pthread_mutex_unlock(&lock);
+
+    *usraddr = arena + start;
+    *busaddr = BUS_BASE + start;
+    return 0;
+}
+
+int rpimemmgr_free_by_usraddr(const void *usraddr, struct rpimemmgr *sp)
+{
+    size_t i;
+
+    if (!sp->initialized)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < n_blocks; i ++)
+        if (arena + blocks[i].offset == usraddr)
+            break;
+    if (i == n_blocks) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    /* Give the pages back, as freeing VCSM memory would. */
+    mprotect(arena + blocks[i].offset, blocks[i].size, PROT_READ | PROT_WRITE);
+    fallocate(arena_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            blocks[i].offset, blocks[i].size);
+    memmove(&blocks[i], &blocks[i + 1], (n_blocks - i - 1) * sizeof(*blocks));
+    n_blocks --;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/* The QPUs see host memory as it is: there are no caches to maintain. */
+
+int rpimemmgr_cache_op(const int op, const void *p, const size_t size)
+{
+    (void) op;
+    (void) p;
+    (void) size;
+    return 0;
+}
+
+int rpimemmgr_cache_op_multiple(const int n, ...)
+{
+    (void) n;
+    return 0;
+}
+
+int rpimemmgr_cache_op_2(const int op, const void *p, const size_t height,
+        const size_t width, const size_t stride)
+{
+    (void) op;
+    (void) p;
+    (void) height;
+    (void) width;
+    (void) stride;
+    return 0;
+}
+
+int rpimemmgr_cache_op_2_multiple(const int n, ...)
+{
+    (void) n;
+    return 0;
+}
+
+void unif_set_uint(uint32_t *p, const uint32_t u)
+{
+    *p = u;
+}
+
+void unif_set_float(uint32_t *p, const float f)
+{
+    memcpy(p, &f, sizeof(*p));
+}
+
+void unif_add_uint(const uint32_t u, uint32_t **p)
+{
+    unif_set_uint((*p) ++, u);
+}
+
+void unif_add_float(const float f, uint32_t **p)
+{
+    unif_set_float((*p) ++, f);
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef _LOCAL_BACKEND_H_
+#define _LOCAL_BACKEND_H_
+
+#include "qmkl.h"
+
+    struct qpu_program;
+
+    /* Row-major entry points implemented by each backend. */
+    struct backend_ops {
+        void (*sgemm)(
+            const CBLAS_TRANSPOSE transa,
+            const CBLAS_TRANSPOSE transb,
+            const MKL_INT m,
+            const MKL_INT n,
+            const MKL_INT k,
+            const float alpha,
+            const float *a,
+            const MKL_INT lda,
+            const float *b,
+            const MKL_INT ldb,
+            const float beta,
+            float *c,
+            const MKL_INT ldc);
+        void (*scopy)(
+            const MKL_INT n,
+            const float *x,
+            const MKL_INT incx,
+            float *y,
+            const MKL_INT incy);
+        void (*sabs)(const MKL_INT n, const float *a, float *y);
+    };
+
+    extern const struct backend_ops *backend_ops;
+
+    int backend_qpu_available();
+
+    void blas_sgemm_qpu(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    void blas_sgemm_cpu(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    void blas_sgemm_auto(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    void blas_sgemm_hybrid(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+
+    void blas_scopy_qpu(const MKL_INT n, const float *x, const MKL_INT incx,
+            float *y, const MKL_INT incy);
+    void blas_scopy_cpu(const MKL_INT n, const float *x, const MKL_INT incx,
+            float *y, const MKL_INT incy);
+    void blas_scopy_auto(const MKL_INT n, const float *x, const MKL_INT incx,
+            float *y, const MKL_INT incy);
+    /*
+     * Set prog to the call and return 1 if the backend would run it on QPU
+     * in a launch of its own, which it can then share, or return 0.
+     */
+    int blas_scopy_program(const MKL_INT n, const float *x, const MKL_INT incx,
+            float *y, const MKL_INT incy, struct qpu_program *prog);
+
+    void vm_sabs_qpu(const MKL_INT n, const float *a, float *y);
+    void vm_sabs_cpu(const MKL_INT n, const float *a, float *y);
+    void vm_sabs_auto(const MKL_INT n, const float *a, float *y);
+    int vm_sabs_program(const MKL_INT n, const float *a, float *y,
+            struct qpu_program *prog);
+
+#endif /* _LOCAL_BACKEND_H_ */
@@ -11,7 +11,8 @@
 #define _LOCAL_CALLED_H_
 
     extern struct called {
-        int main, memory, launch_qpu_code, blas_gemm, blas_copy, vm_abs;
+        int main, backend, memory, launch_qpu_code, blas_gemm, blas_copy, vm_abs,
+            async;
     } called;
 
 #endif /* _LOCAL_CALLED_H_ */
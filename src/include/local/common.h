@@ -11,12 +11,109 @@
 #define _LOCAL_COMMON_H_
 
 #include "qmkl/types.h"
+#include "qmkl/memory.h"
 #include <sys/types.h>
 
-    extern MKL_UINT *unif_common_cpu, *code_common_cpu;
-    extern MKL_UINT unif_common_gpu, code_common_gpu;
+    void unif_size_req(const size_t unif_size_req);
 
-    void unif_and_code_size_req(const size_t unif_size_req, const size_t code_size_req);
+    /*
+     * Uncached memory for the uniforms of one QPU launch, of the largest
+     * size requested in init.  A call on QPU gets an arena for itself, so
+     * that threads set uniforms concurrently and only the launches are
+     * serialized, and puts it back after the launch.
+     */
+    struct unif_arena {
+        MKL_UINT *cpu;
+        MKL_UINT gpu;
+        void *scratch;
+        size_t scratch_size;
+        struct unif_arena *next;
+    };
+
+    struct unif_arena* unif_arena_get();
+    void unif_arena_put(struct unif_arena *arena);
+    /*
+     * CPU-cached, GPU-accessible scratch of at least size bytes for the call
+     * holding the arena, such as the partial Cs of a split-k sgemm, so that
+     * such calls run concurrently too.  It stays with the arena and only
+     * grows until unif_arenas_scratch_free, which frees the scratch of the
+     * arenas not in use.
+     */
+    void* unif_arena_scratch(struct unif_arena *arena, const size_t size);
+    void unif_arenas_scratch_free();
+
+    /*
+     * A QPU program kept resident in GPU memory from qmkl_init() to
+     * qmkl_finalize().  Modules request it in their init; gpu is filled in
+     * once the code region is allocated and stays 0 without QPU.
+     */
+    struct qpu_code {
+        const unsigned *bin;
+        size_t size;
+        MKL_UINT gpu;
+    };
+
+    void code_resident_req(struct qpu_code *code);
+
+    /* Whether ptr_cpu is in memory from mkl_malloc, which QPU can access. */
+    int ptr_is_gpu_accessible(const void * const ptr_cpu);
+    /* Whether ptr_cpu is in memory the CPU caches, which needs cache ops. */
+    int ptr_is_cpu_cached(const void * const ptr_cpu);
+    /*
+     * Whether ptr_cpu is in GPU-only memory, cached in the VideoCore L2
+     * only, which the CPU must neither read nor write.
+     */
+    int ptr_is_gpu_only(const void * const ptr_cpu);
+
+    /* A 2D region for rpimemmgr_cache_op_2, collected to merge the calls. */
+    struct cache_region {
+        enum qmkl_cache_op op;
+        const void *p;
+        unsigned height, width, stride;
+    };
+
+    /*
+     * Runs the cache operations for the regions with as few calls as the
+     * variadic interface of rpimemmgr allows.
+     */
+#define CACHE_REGIONS_PER_CALL 6
+    void cache_regions_flush(const struct cache_region *r, unsigned n);
+    /* Sets r to op on the size contiguous bytes at p. */
+    void cache_region_1d(struct cache_region *r, const enum qmkl_cache_op op,
+            const void *p, const size_t size);
+
+    /*
+     * A call on a single QPU thread whose kernel ends like the sgemm ones,
+     * so that it can share a launch with other programs: the last two of its
+     * uniforms are the number of its thread in the launch and the number of
+     * threads, and every thread signals semaphore 0 while only thread 0
+     * waits for all of them and raises the host interrupt.  Its kernel holds
+     * the VPM mutex while it uses the VPM.  The regions are n_clean to clean
+     * before the launch, then n_invalidate to invalidate after it.
+     */
+#define QPU_PROGRAM_UNIF_LEN 5
+    struct qpu_program {
+        MKL_UINT code;
+        MKL_UINT unif[QPU_PROGRAM_UNIF_LEN];
+        unsigned unif_len;
+        struct cache_region r[3];
+        unsigned n_clean, n_invalidate;
+    };
+
+    /* Runs prog in a launch of its own. */
+    void qpu_program_launch(const struct qpu_program *prog);
+
+    /*
+     * GPU-accessible buffer number slot of at least size bytes, for staging
+     * arrays QPU cannot access.  It is kept for later calls and its contents
+     * are undefined.
+     */
+#define N_BOUNCE_BUFFERS 8
+    void* bounce_buffer(const unsigned slot, const size_t size);
+    void bounce_buffers_free();
+    /* Held while bounce buffers are in use; bounce_buffers_free takes it. */
+    void bounce_buffers_lock();
+    void bounce_buffers_unlock();
 
 #define UNUSED(x) ((void) x)
 
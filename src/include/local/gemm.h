@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef _LOCAL_GEMM_H_
+#define _LOCAL_GEMM_H_
+
+#include "qmkl.h"
+#include "local/common.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+    /* Uniforms per QPU thread of the sgemm kernels. */
+#define SGEMM_QPU_UNIF_LEN_1TH 14
+#define SGEMM_QPU_MAX_THREADS 12
+
+    /*
+     * A split of C (m x n) among the QPU threads of a launch into p_div
+     * blocks of rows times r_div blocks of columns, of whole tile_p x tile_r
+     * kernel tiles but at the end of C, for each of k_div slices of k.
+     * Thread th computes slice th / (p_div * r_div), and of it the block of
+     * rows b / r_div and of columns b % r_div, b being th % (p_div * r_div).
+     * With k_div > 1, each slice goes into a partial C to be summed.
+     */
+    struct sgemm_partition {
+        unsigned m, n, k;
+        unsigned tile_p, tile_r;
+        unsigned p_div, r_div, k_div;
+    };
+
+    /*
+     * The partition into at most max_threads threads that ends first, of
+     * one slice of k unless split_k.
+     */
+    void sgemm_partition(
+        struct sgemm_partition *part,
+        const unsigned m,
+        const unsigned n,
+        const unsigned k,
+        const unsigned tile_p,
+        const unsigned tile_r,
+        const unsigned max_threads,
+        const int split_k);
+    /* Predicted cycles of the slowest thread and of summing the slices. */
+    uint64_t sgemm_partition_cycles(const struct sgemm_partition *part);
+    unsigned sgemm_partition_threads(const struct sgemm_partition *part);
+    /* Rows [*i, *i + *rows) and columns [*j, *j + *cols) of thread th. */
+    void sgemm_partition_block(
+        const struct sgemm_partition *part,
+        const unsigned th,
+        unsigned *i,
+        unsigned *rows,
+        unsigned *j,
+        unsigned *cols);
+    /* Returns the slice of thread th, which is [*l, *l + *depth) of k. */
+    unsigned sgemm_partition_slice(
+        const struct sgemm_partition *part,
+        const unsigned th,
+        unsigned *l,
+        unsigned *depth);
+
+    /*
+     * The tile_p x tile_r tile of the kernel the QPU runs m x n of C in, for
+     * the transposes.
+     */
+    void sgemm_qpu_tile(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        unsigned *tile_p,
+        unsigned *tile_r);
+    /*
+     * Returns the number of QPU threads (at most max_threads) the shape is
+     * split into, also over k if split_k, the size of the largest block of
+     * C a thread computes, padded to the kernel tile, and the largest slice
+     * of k.
+     */
+    unsigned sgemm_qpu_shape(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const unsigned max_threads,
+        const int split_k,
+        unsigned *tile_m,
+        unsigned *tile_n,
+        unsigned *tile_k);
+    /*
+     * Whether blas_sgemm_qpu may split k for these arrays: the CPU sums the
+     * slices into C, so A and B must be GPU-accessible and C CPU-cached.
+     */
+    int sgemm_qpu_can_split_k(const float *a, const float *b, const float *c);
+
+    /*
+     * Bus address of the resident kernel for the transposes, in the tile
+     * sgemm_qpu_shape and sgemm_qpu_unif_set use for m x n, with the most
+     * specialized epilogue for alpha and beta.
+     */
+    MKL_UINT sgemm_qpu_code_gpu(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const float alpha,
+        const float beta);
+    /*
+     * Writes the uniforms for at most max_threads threads to unif_cpu, whose
+     * bus address is unif_gpu, and returns the number of threads.
+     */
+    unsigned sgemm_qpu_unif_set(
+        uint32_t *unif_cpu,
+        const MKL_UINT unif_gpu,
+        const unsigned max_threads,
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const MKL_UINT a_gpu,
+        const MKL_INT lda,
+        const MKL_UINT b_gpu,
+        const MKL_INT ldb,
+        const float beta,
+        const MKL_UINT c_gpu,
+        const MKL_INT ldc);
+    /*
+     * Adds the cache operations before a launch to r and returns their
+     * number, at most 3; sgemm_qpu_clean runs them at once.
+     */
+    unsigned sgemm_qpu_clean_regions(
+        struct cache_region *r,
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    void sgemm_qpu_clean(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    /* The cache operation for C before a launch: invalidate for beta = 0. */
+    enum qmkl_cache_op sgemm_qpu_c_cache_op(const float beta, const float *c,
+            const MKL_INT n, const MKL_INT ldc);
+    void sgemm_qpu_launch(const unsigned n_threads, const MKL_UINT unif_gpu,
+            const MKL_UINT code_gpu);
+    /* blas_sgemm_qpu for arrays of which some are not GPU-accessible. */
+    void sgemm_qpu_staged(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    /*
+     * blas_sgemm_qpu for GPU-accessible arrays in one launch that never
+     * splits k, as for the steps of sgemm_qpu_staged, whose memory stays
+     * within the window.
+     */
+    void sgemm_qpu_direct(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    /* Bytes sgemm_qpu_staged copies in and out for these arrays. */
+    double sgemm_staged_bytes(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float *a,
+        const float *b,
+        const float *c);
+
+    enum sgemm_engine {
+        SGEMM_ENGINE_QPU,
+        SGEMM_ENGINE_CPU,
+        SGEMM_N_ENGINES
+    };
+
+    /* Reads QMKL_SGEMM_TRACE. */
+    void sgemm_dispatch_init();
+    /* Frees the cost tables replaced since; no sgemm may be predicting. */
+    void sgemm_dispatch_finalize();
+    /*
+     * Flops the engine really executes for the shape, including padding,
+     * QPU splitting k if split_k.
+     */
+    double sgemm_work(const enum sgemm_engine engine,
+            const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+            const MKL_INT m, const MKL_INT n, const MKL_INT k,
+            const int split_k);
+    /* Predicted time [s] from the calibrated cost table. */
+    double sgemm_predict(const enum sgemm_engine engine,
+            const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+            const MKL_INT m, const MKL_INT n, const MKL_INT k,
+            const int split_k);
+    /*
+     * Whether a problem must run whole on QPU, as the CPU can neither read
+     * nor write GPU-only memory: !0 if an operand it touches is GPU-only, or
+     * -1, reported through xerbla as argument c_arg, if C is GPU-only but
+     * k = 0, which QPU cannot run.
+     */
+    int sgemm_gpu_only(
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float *a,
+        const float *b,
+        const float *c,
+        const int c_arg);
+    /*
+     * Engine for a call that runs whole on one engine, such as a plan: QPU
+     * or CPU as the backend says, or the one predicted faster for auto,
+     * which takes QPU whenever an operand is GPU-only.  -1 if the call
+     * cannot run at all, as reported through xerbla.
+     */
+    int sgemm_on_qpu(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float *a,
+        const float *b,
+        const float *c);
+    /*
+     * Predicted QPU time [s] of one of n_problems problems packed into the
+     * same launches: its share of the launch overhead and of the QPUs.
+     */
+    double sgemm_predict_batched(
+            const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+            const MKL_INT m, const MKL_INT n, const MKL_INT k,
+            const MKL_INT n_problems);
+
+    /*
+     * Returns the number of leading rows of C to compute on QPU while CPU
+     * computes the rest, or 0 if C cannot be split.
+     */
+    MKL_INT sgemm_hybrid_split(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float *a,
+        const float *b,
+        const float *c,
+        const MKL_INT ldc);
+    void sgemm_hybrid_run(
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc,
+        const MKL_INT m_qpu);
+    /* Stops the worker thread sgemm_hybrid_run starts. */
+    void sgemm_hybrid_finalize();
+
+    /* One row-major problem of a batch. */
+    struct sgemm_problem {
+        CBLAS_TRANSPOSE transa, transb;
+        MKL_INT m, n, k;
+        float alpha;
+        const float *a;
+        MKL_INT lda;
+        const float *b;
+        MKL_INT ldb;
+        float beta;
+        float *c;
+        MKL_INT ldc;
+    };
+
+    /* Threads of a launch given to each problem when n_problems remain. */
+    unsigned sgemm_batch_share(const MKL_INT n_problems);
+    /*
+     * Runs the problems on the backend, packing them into shared launches
+     * on QPU, so no C may overlap the arrays of another problem.  They may
+     * be reordered and changed in place.  A problem that cannot run, as its
+     * C is GPU-only but k = 0, is reported through xerbla as argument c_arg
+     * and skipped.  The programs, which only exist where QPU runs them and
+     * must not overlap the problems either, share the first launch.
+     */
+    void sgemm_batch(struct sgemm_problem *problems, const MKL_INT count,
+            const int c_arg, const struct qpu_program *programs,
+            const unsigned n_programs);
+
+#endif /* _LOCAL_GEMM_H_ */
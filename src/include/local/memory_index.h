@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef _LOCAL_MEMORY_INDEX_H_
+#define _LOCAL_MEMORY_INDEX_H_
+
+#include <interface/vcsm/user-vcsm.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+    /*
+     * Insertion, removal and memory_index_block, which gives the size (in
+     * whole pages) and cache type of the allocation at ptr_cpu or 0, must be
+     * serialized by the caller.
+     */
+    void memory_index_insert(const void *ptr_cpu, const size_t size,
+            const uint32_t ptr_gpu, const VCSM_CACHE_TYPE_T cache_type);
+    void memory_index_remove(const void *ptr_cpu);
+    size_t memory_index_block(const void *ptr_cpu, VCSM_CACHE_TYPE_T *cache_type);
+    /*
+     * Bus address of any pointer into an allocation, or 0, and the cache type
+     * of the allocation if cache_type is not NULL.  Takes no lock.
+     */
+    uint32_t memory_index_lookup(const void *ptr_cpu, VCSM_CACHE_TYPE_T *cache_type);
+    void memory_index_finalize();
+
+#endif /* _LOCAL_MEMORY_INDEX_H_ */
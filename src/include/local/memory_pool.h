@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef _LOCAL_MEMORY_POOL_H_
+#define _LOCAL_MEMORY_POOL_H_
+
+#include <interface/vcsm/user-vcsm.h>
+#include <sys/types.h>
+
+    /*
+     * VCSM allocations themselves, in memory.c.  memory_vcsm_free gives the
+     * size and cache type of the allocation where they are not NULL.
+     */
+    void* memory_vcsm_alloc(const size_t size, const int alignment,
+            const VCSM_CACHE_TYPE_T cache_type);
+    void memory_vcsm_free(void *ptr_cpu, size_t *size,
+            VCSM_CACHE_TYPE_T *cache_type);
+
+    /*
+     * A block from the pools, or NULL if the size or alignment is too large
+     * for them; *block_size is the size of the block.  memory_pool_free
+     * returns -1 if p is not from the pools, and memory_pool_block 0.
+     */
+    void* memory_pool_alloc(const size_t size, const int alignment,
+            const VCSM_CACHE_TYPE_T cache_type, size_t *block_size);
+    int memory_pool_free(void *p, size_t *block_size,
+            VCSM_CACHE_TYPE_T *cache_type);
+    size_t memory_pool_block(const void *p, VCSM_CACHE_TYPE_T *cache_type);
+    /* Releases the slabs with no blocks in use. */
+    void memory_pool_trim();
+    /* Releases all slabs; blocks still in use become invalid. */
+    void memory_pool_finalize();
+
+#endif /* _LOCAL_MEMORY_POOL_H_ */
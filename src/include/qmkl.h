@@ -14,10 +14,12 @@
     void qmkl_finalize() __attribute__((destructor));
 
 #include "qmkl/types.h"
+#include "qmkl/backend.h"
 #include "qmkl/memory.h"
 #include "qmkl/launch_qpu_code.h"
 #include "qmkl/blas.h"
 #include "qmkl/vm.h"
+#include "qmkl/async.h"
 #include "qmkl/error.h"
 
 #endif /* _QMKL_H_ */
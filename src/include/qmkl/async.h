@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef _QMKL_ASYNC_H_
+#define _QMKL_ASYNC_H_
+
+#include "qmkl/types.h"
+#include "qmkl/blas.h"
+
+    void async_init();
+    void async_finalize();
+
+    /*
+     * Calls that return at once with a request, run in order by a submission
+     * thread of QMKL as the synchronous ones would, so that the caller can
+     * work on the CPU meanwhile.  The arrays must not be touched until the
+     * request completes.  Submitting blocks while the queue is full.
+     * Consecutive requests queued together that do not write what another
+     * of them reads or writes may share a QPU launch.
+     *
+     * qmkl_test() returns 1 and releases the request if it is complete, or 0;
+     * qmkl_wait() waits for it and releases it, and qmkl_wait_all() waits for
+     * all requests without releasing them.  A callback set with
+     * qmkl_request_on_complete() runs on the submission thread when the call
+     * has finished, before the request counts as complete, or at once if it
+     * is already complete; the request must still be released.
+     */
+    typedef struct qmkl_request* qmkl_request_t;
+    typedef void (*qmkl_request_callback_t)(qmkl_request_t request, void *arg);
+
+    qmkl_request_t cblas_sgemm_async(
+        const CBLAS_LAYOUT layout,
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    qmkl_request_t cblas_scopy_async(
+        const MKL_INT n,
+        const float *x,
+        const MKL_INT incx,
+        float *y,
+        const MKL_INT incy);
+    qmkl_request_t vsAbs_async(MKL_INT n, const float *a, float *y);
+
+    int qmkl_test(qmkl_request_t request);
+    void qmkl_wait(qmkl_request_t request);
+    void qmkl_wait_all();
+    void qmkl_request_on_complete(qmkl_request_t request,
+            qmkl_request_callback_t callback, void *arg);
+
+#endif /* _QMKL_ASYNC_H_ */
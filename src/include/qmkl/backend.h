@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef _QMKL_BACKEND_H_
+#define _QMKL_BACKEND_H_
+
+    /*
+     * The backend is chosen at qmkl_init() from the QMKL_BACKEND environment
+     * variable ("qpu", "cpu" or "auto"; "auto" if unset), and can be switched
+     * later with qmkl_set_backend().  QMKL_BACKEND=cpu never touches the QPU,
+     * the mailbox or VCSM, so the library also works off a Pi.  The auto
+     * backend picks QPU or CPU per call from the shape and, for sgemm, a
+     * calibrated cost model; it falls back to cpu if the QPU is unavailable.
+     * The hybrid backend is auto with sgemm always split between QPU and CPU
+     * when C is large enough.
+     */
+    enum qmkl_backend {
+        QMKL_BACKEND_QPU,
+        QMKL_BACKEND_CPU,
+        QMKL_BACKEND_AUTO,
+        QMKL_BACKEND_HYBRID
+    };
+
+    void backend_init();
+    void backend_finalize();
+
+    int qmkl_backend_available(const enum qmkl_backend backend);
+    int qmkl_set_backend(const enum qmkl_backend backend);
+    enum qmkl_backend qmkl_get_backend();
+    const char* qmkl_backend_name(const enum qmkl_backend backend);
+
+#endif /* _QMKL_BACKEND_H_ */
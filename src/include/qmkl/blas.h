@@ -20,6 +20,11 @@
 #define CblasNoTrans   (1 << 0)
 #define CblasTrans     (1 << 1)
 #define CblasConjTrans (1 << 2)
+#define CblasPacked    (1 << 3)
+
+#define CBLAS_IDENTIFIER MKL_UINT
+#define CblasAMatrix (1 << 0)
+#define CblasBMatrix (1 << 1)
 
     void blas_gemm_init();
     void blas_gemm_finalize();
@@ -42,6 +47,154 @@
         float *c,
         const MKL_INT ldc);
 
+    /*
+     * The auto backend runs each sgemm on the engine with the smaller
+     * predicted time, or on both with C split by rows.  The decision for the
+     * calling thread's last sgemm is kept for inspection, and the cost table
+     * can be re-measured, saved and loaded (see QMKL_SGEMM_CALIBRATION in
+     * README).
+     */
+    enum qmkl_sgemm_path {
+        QMKL_SGEMM_PATH_NONE,
+        QMKL_SGEMM_PATH_QPU,
+        QMKL_SGEMM_PATH_CPU,
+        QMKL_SGEMM_PATH_HYBRID
+    };
+
+    struct qmkl_sgemm_decision {
+        enum qmkl_sgemm_path path;
+        MKL_INT m, n, k;
+        CBLAS_TRANSPOSE transa, transb;
+        MKL_INT m_qpu; /* Rows of C on QPU for the hybrid path. */
+        double predicted_qpu, predicted_cpu, predicted_hybrid; /* [s] */
+        double actual; /* [s] */
+    };
+
+    void qmkl_sgemm_last_decision(struct qmkl_sgemm_decision *decision);
+    void qmkl_sgemm_calibrate();
+    int qmkl_sgemm_calibration_load(const char *path);
+    int qmkl_sgemm_calibration_save(const char *path);
+
+    /*
+     * An sgemm bound to its shape, transposes, scalars and buffers.  The
+     * partition, uniforms and code are prepared once at creation, so that
+     * executing the plan costs only the cache maintenance and the launch.
+     * The contents of a, b and c may change between executions.
+     */
+    typedef struct qmkl_sgemm_plan* qmkl_sgemm_plan_t;
+
+    qmkl_sgemm_plan_t qmkl_sgemm_plan_create(
+        const CBLAS_LAYOUT layout,
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+    void qmkl_sgemm_plan_execute(const qmkl_sgemm_plan_t plan);
+    void qmkl_sgemm_plan_destroy(qmkl_sgemm_plan_t plan);
+
+    /*
+     * Batches of independent sgemm, as in MKL.  Problem j of group g uses the
+     * parameters at index g and the matrices a_array[j], b_array[j] and
+     * c_array[j], where j counts through all the groups.  On QPU, the
+     * problems share launches instead of one launch each.
+     */
+    void cblas_sgemm_batch(
+        const CBLAS_LAYOUT layout,
+        const CBLAS_TRANSPOSE *transa_array,
+        const CBLAS_TRANSPOSE *transb_array,
+        const MKL_INT *m_array,
+        const MKL_INT *n_array,
+        const MKL_INT *k_array,
+        const float *alpha_array,
+        const float **a_array,
+        const MKL_INT *lda_array,
+        const float **b_array,
+        const MKL_INT *ldb_array,
+        const float *beta_array,
+        float **c_array,
+        const MKL_INT *ldc_array,
+        const MKL_INT group_count,
+        const MKL_INT *group_size);
+    /* Problem i uses a + i * stridea, b + i * strideb and c + i * stridec. */
+    void cblas_sgemm_batch_strided(
+        const CBLAS_LAYOUT layout,
+        const CBLAS_TRANSPOSE transa,
+        const CBLAS_TRANSPOSE transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *a,
+        const MKL_INT lda,
+        const MKL_INT stridea,
+        const float *b,
+        const MKL_INT ldb,
+        const MKL_INT strideb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc,
+        const MKL_INT stridec,
+        const MKL_INT batch_size);
+
+    /*
+     * Packed sgemm, as in MKL.  cblas_sgemm_pack stores alpha * op(A) (or
+     * alpha * op(B)) into dest, which has cblas_sgemm_pack_get_size bytes
+     * and should come from mkl_malloc.  The packed operand is laid out for
+     * the QPU kernels and cleaned once, so cblas_sgemm_compute with
+     * CblasPacked for it does no cache maintenance on it.  dest must not be
+     * written other than by cblas_sgemm_pack.  cblas_sgemm_compute reports
+     * an operand not packed for its shape through xerbla and leaves C as is.
+     */
+    size_t cblas_sgemm_pack_get_size(
+        const CBLAS_IDENTIFIER identifier,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k);
+    void cblas_sgemm_pack(
+        const CBLAS_LAYOUT layout,
+        const CBLAS_IDENTIFIER identifier,
+        const CBLAS_TRANSPOSE trans,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float alpha,
+        const float *src,
+        const MKL_INT ld,
+        float *dest);
+    void cblas_sgemm_compute(
+        const CBLAS_LAYOUT layout,
+        const MKL_INT transa,
+        const MKL_INT transb,
+        const MKL_INT m,
+        const MKL_INT n,
+        const MKL_INT k,
+        const float *a,
+        const MKL_INT lda,
+        const float *b,
+        const MKL_INT ldb,
+        const float beta,
+        float *c,
+        const MKL_INT ldc);
+
+    /*
+     * Arrays QPU cannot access, such as ones from malloc or an mmap'd file,
+     * are streamed through a window of GPU memory of at most this many bytes
+     * (rounded up to whole kernel tiles), so that operands larger than the
+     * GPU memory work too.  The default is 32 MiB, or QMKL_SGEMM_WINDOW in
+     * bytes with an optional K, M or G suffix.
+     */
+    void qmkl_sgemm_set_window(const size_t size);
+    size_t qmkl_sgemm_get_window();
+
     void cblas_scopy(
         const MKL_INT n,
         const float *x,
@@ -49,4 +202,26 @@
         float *y,
         const MKL_INT incy);
 
+    /* The reference BLAS ABI, for callers built against it. */
+    void sgemm_(
+        const char *transa,
+        const char *transb,
+        const MKL_INT *m,
+        const MKL_INT *n,
+        const MKL_INT *k,
+        const float *alpha,
+        const float *a,
+        const MKL_INT *lda,
+        const float *b,
+        const MKL_INT *ldb,
+        const float *beta,
+        float *c,
+        const MKL_INT *ldc);
+    void scopy_(
+        const MKL_INT *n,
+        const float *x,
+        const MKL_INT *incx,
+        float *y,
+        const MKL_INT *incy);
+
 #endif /* _QMKL_BLAS_H_ */
@@ -15,5 +15,8 @@
     void launch_qpu_code_init();
     void launch_qpu_code_finalize();
     void launch_qpu_code_mailbox(uint32_t num_qpus, uint32_t noflush, uint32_t timeout, ...);
+    /* As above, with the uniforms and code address of QPU i in unif[i] and code[i]. */
+    void launch_qpu_code_mailbox_array(uint32_t num_qpus, uint32_t noflush, uint32_t timeout,
+            const uint32_t *unif, const uint32_t *code);
 
 #endif /* _LAUNCH_QPU_CODE_H_ */
@@ -19,12 +19,67 @@
         QMKL_CACHE_OP_CLEAN
     };
 
+    /*
+     * How a buffer from qmkl_malloc_flags is used.  mkl_malloc returns
+     * host-cached memory, which QMKL cleans and invalidates around every QPU
+     * call.  Uncached memory, which the CPU reads and writes directly, and
+     * GPU-only memory, cached in the VideoCore L2 only for buffers the CPU
+     * never touches (such as activations passed from one sgemm to the next),
+     * skip that cache maintenance.
+     */
+    enum qmkl_mem_flags {
+        QMKL_MEM_HOST_CACHED,
+        QMKL_MEM_UNCACHED,
+        QMKL_MEM_GPU_ONLY
+    };
+
     void memory_init();
     void memory_finalize();
     void* mkl_malloc_cache(size_t alloc_size, int alignment,
             const VCSM_CACHE_TYPE_T cache_type);
     void* mkl_malloc(size_t alloc_size, int alignment);
+    void* qmkl_malloc_flags(size_t alloc_size, int alignment,
+            const enum qmkl_mem_flags flags);
     void mkl_free(void *a_ptr);
+    /*
+     * Blocks of 1 MiB or more from mkl_calloc are zeroed by the QPU copy
+     * kernel, so that they do not fill the CPU caches with dirty lines that
+     * the first QPU call on them cleans.  mkl_realloc keeps the cache type
+     * of the block.
+     */
+    void* mkl_calloc(size_t num, size_t size, int alignment);
+    void* mkl_realloc(void *ptr, size_t size);
+    /*
+     * Blocks of up to 256 KiB come from pools of VCSM slabs, which stay
+     * allocated after mkl_free for later blocks.  This releases the slabs
+     * with no blocks in use, and the staging and scratch buffers of sgemm.
+     */
+    void mkl_free_buffers();
+
+    /*
+     * Accounting of the buffers from mkl_malloc, as in MKL, by the blocks that
+     * hold them: pooled blocks, whole pages of VCSM, or host memory without
+     * QPU (counted as VCSM_CACHE_TYPE_HOST).  qmkl_mem_stat_cache is
+     * mkl_mem_stat for one cache type.  Peak tracking starts disabled;
+     * mkl_peak_mem_usage returns the peak, or -1 for MKL_PEAK_MEM while it
+     * is disabled.
+     */
+#define MKL_PEAK_MEM_DISABLE 0
+#define MKL_PEAK_MEM_ENABLE 1
+#define MKL_PEAK_MEM_RESET (-1)
+#define MKL_PEAK_MEM 2
+    MKL_INT64 mkl_mem_stat(int *AllocatedBuffers);
+    MKL_INT64 qmkl_mem_stat_cache(const VCSM_CACHE_TYPE_T cache_type,
+            int *AllocatedBuffers);
+    MKL_INT64 mkl_peak_mem_usage(int mode);
+    /*
+     * Bus address of ptr_cpu, which may point anywhere into memory from
+     * mkl_malloc.  get_ptr_gpu_from_ptr_cpu exits for other pointers; the
+     * checked one returns -1 (and 0 as *ptr_gpu) for them, or without QPU.
+     * Both take no lock.
+     */
     uint32_t get_ptr_gpu_from_ptr_cpu(const void * const ptr_cpu);
+    int get_ptr_gpu_from_ptr_cpu_checked(const void * const ptr_cpu,
+            uint32_t *ptr_gpu);
 
 #endif /* _QMKL_MEMORY_H_ */
@@ -8,15 +8,24 @@
  */
 
 #include "qmkl.h"
+#include "local/common.h"
 #include "local/called.h"
+#include "local/backend.h"
 #include "local/error.h"
 #include <mailbox.h>
+#include <rpimemmgr.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 
 static int fd_mb = -1;
 static uint32_t *ml_control_cpu = NULL;
 static uint32_t ml_control_gpu = 0;
+/*
+ * QPUs run one launch at a time, and the control list is shared: threads
+ * prepare their launches concurrently and take turns here.
+ */
+static pthread_mutex_t launch_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define MAX_QPUS 4 * 3
 
@@ -29,6 +38,9 @@ void launch_qpu_code_init()
 
     memory_init();
 
+    if (!backend_qpu_available())
+        return;
+
     fd_mb = mailbox_open();
     if (fd_mb == -1)
         error_fatal("Failed to open Mailbox\n");
@@ -48,6 +60,11 @@ void launch_qpu_code_finalize()
     if (--called.launch_qpu_code != 0)
         return;
 
+    if (!backend_qpu_available()) {
+        memory_finalize();
+        return;
+    }
+
     mkl_free(ml_control_cpu);
 
     ret = mailbox_qpu_enable(fd_mb, 0);
@@ -57,6 +74,7 @@ void launch_qpu_code_finalize()
     ret = mailbox_close(fd_mb);
     if (ret)
         error_fatal("Failed to close Mailbox\n");
+    fd_mb = -1;
 
     memory_finalize();
 }
@@ -67,9 +85,12 @@ void launch_qpu_code_mailbox(uint32_t num_qpus, uint32_t noflush, uint32_t timeo
     va_list ap;
     uint32_t ret;
 
+    if (fd_mb == -1)
+        error_fatal("QPU is not available\n");
     if (num_qpus > MAX_QPUS)
         error_fatal("Too many QPUs: %d (max:%d)\n", num_qpus, MAX_QPUS);
 
+    pthread_mutex_lock(&launch_lock);
     va_start(ap, timeout);
     for (i = 0; i < num_qpus; i ++) {
         ml_control_cpu[i * 2 + 0] = va_arg(ap, uint32_t); /* unif addr for QPU i */
@@ -78,6 +99,46 @@ void launch_qpu_code_mailbox(uint32_t num_qpus, uint32_t noflush, uint32_t timeo
     va_end(ap);
 
     ret = mailbox_qpu_execute(fd_mb, num_qpus, ml_control_gpu, noflush, timeout);
+    pthread_mutex_unlock(&launch_lock);
+    if (ret)
+        xerbla_local(ret);
+}
+
+void launch_qpu_code_mailbox_array(uint32_t num_qpus, uint32_t noflush, uint32_t timeout,
+        const uint32_t *unif, const uint32_t *code)
+{
+    unsigned i;
+    uint32_t ret;
+
+    if (fd_mb == -1)
+        error_fatal("QPU is not available\n");
+    if (num_qpus > MAX_QPUS)
+        error_fatal("Too many QPUs: %d (max:%d)\n", num_qpus, MAX_QPUS);
+
+    pthread_mutex_lock(&launch_lock);
+    for (i = 0; i < num_qpus; i ++) {
+        ml_control_cpu[i * 2 + 0] = unif[i];
+        ml_control_cpu[i * 2 + 1] = code[i];
+    }
+
+    ret = mailbox_qpu_execute(fd_mb, num_qpus, ml_control_gpu, noflush, timeout);
+    pthread_mutex_unlock(&launch_lock);
     if (ret)
         xerbla_local(ret);
 }
+
+void qpu_program_launch(const struct qpu_program *prog)
+{
+    struct unif_arena * const arena = unif_arena_get();
+    unsigned i;
+
+    for (i = 0; i < prog->unif_len - 2; i ++)
+        unif_set_uint(arena->cpu + i, prog->unif[i]);
+    unif_set_uint(arena->cpu + i ++, 0);
+    unif_set_uint(arena->cpu + i, 1);
+
+    cache_regions_flush(prog->r, prog->n_clean);
+    launch_qpu_code_mailbox(1, 0, 5e3, arena->gpu, prog->code);
+    unif_arena_put(arena);
+    cache_regions_flush(prog->r + prog->n_clean, prog->n_invalidate);
+}
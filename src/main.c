@@ -10,22 +10,38 @@
 #include "qmkl.h"
 #include "local/common.h"
 #include "local/called.h"
+#include "local/backend.h"
 #include "local/error.h"
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 
 struct called called = {
     .main = 0,
+    .backend = 0,
     .memory = 0,
     .launch_qpu_code = 0,
     .blas_gemm = 0,
     .blas_copy = 0,
-    .vm_abs = 0
+    .vm_abs = 0,
+    .async = 0
 };
 
-static size_t unif_size = 0, code_size = 0;
-MKL_UINT *unif_common_cpu = NULL, *code_common_cpu = NULL;
-MKL_UINT unif_common_gpu = 0, code_common_gpu = 0;
+#define MAX_RESIDENT_CODES 32
+/* Scratch grows in steps of this size. */
+#define SCRATCH_GRANULE (64 * 1024)
+
+static size_t unif_size = 0;
+/*
+ * Uniform arenas not in use by a call.  There are as many as calls have run
+ * on QPU at once, and they are kept until qmkl_finalize().
+ */
+static struct unif_arena *arenas_free = NULL;
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct qpu_code *resident_codes[MAX_RESIDENT_CODES];
+static unsigned n_resident_codes = 0;
+static void *code_resident_cpu = NULL;
 void (*exit_handler)(int why) = exit;
 
 void qmkl_init()
@@ -33,12 +49,16 @@ void qmkl_init()
     if (++called.main != 1)
         return;
 
+    backend_init();
     memory_init();
     launch_qpu_code_init();
     blas_gemm_init();
     blas_copy_init();
     vm_abs_init();
+    async_init();
 
+    if (called.backend <= 0)
+        error_fatal("called.backend is 0 or negative: %d\n", called.backend);
     if (called.memory <= 0)
         error_fatal("called.memory is 0 or negative: %d\n", called.memory);
     if (called.launch_qpu_code <= 0)
@@ -49,14 +69,34 @@ void qmkl_init()
         error_fatal("called.blas_copy is 0 or negative: %d\n", called.blas_copy);
     if (called.vm_abs <= 0)
         error_fatal("called.vm_abs is 0 or negative: %d\n", called.vm_abs);
+    if (called.async <= 0)
+        error_fatal("called.async is 0 or negative: %d\n", called.async);
 
-    if (unif_size != 0) {
-        unif_common_cpu = mkl_malloc_cache(unif_size, 4096, 0);
-        unif_common_gpu = get_ptr_gpu_from_ptr_cpu(unif_common_cpu);
-    }
-    if (code_size != 0) {
-        code_common_cpu = mkl_malloc_cache(code_size, 4096, 0);
-        code_common_gpu = get_ptr_gpu_from_ptr_cpu(code_common_cpu);
+    /* The CPU backend does not need the QPU-visible buffers. */
+    if (!backend_qpu_available())
+        return;
+
+    /* One arena is enough for a single thread. */
+    if (unif_size != 0)
+        unif_arena_put(unif_arena_get());
+    if (n_resident_codes != 0) {
+        size_t size = 0;
+        MKL_UINT code_resident_gpu;
+        unsigned i;
+
+        /* All programs in one uncached region, each from a cache line. */
+        for (i = 0; i < n_resident_codes; i ++)
+            size += (resident_codes[i]->size + 63) & ~63;
+        code_resident_cpu = mkl_malloc_cache(size, 4096, 0);
+        code_resident_gpu = get_ptr_gpu_from_ptr_cpu(code_resident_cpu);
+
+        size = 0;
+        for (i = 0; i < n_resident_codes; i ++) {
+            memcpy((char*) code_resident_cpu + size, resident_codes[i]->bin,
+                    resident_codes[i]->size);
+            resident_codes[i]->gpu = code_resident_gpu + size;
+            size += (resident_codes[i]->size + 63) & ~63;
+        }
     }
 }
 
@@ -65,15 +105,32 @@ void qmkl_finalize()
     if (--called.main != 0)
         return;
 
-    mkl_free(code_common_cpu);
-    mkl_free(unif_common_cpu);
+    /* Pending requests still use the resident codes and uniforms. */
+    async_finalize();
+
+    if (code_resident_cpu != NULL)
+        mkl_free(code_resident_cpu);
+    code_resident_cpu = NULL;
+    while (arenas_free != NULL) {
+        struct unif_arena * const arena = arenas_free;
+        arenas_free = arena->next;
+        if (arena->scratch != NULL)
+            mkl_free(arena->scratch);
+        mkl_free(arena->cpu);
+        free(arena);
+    }
+    while (n_resident_codes != 0)
+        resident_codes[--n_resident_codes]->gpu = 0;
 
     vm_abs_finalize();
     blas_copy_finalize();
     blas_gemm_finalize();
     launch_qpu_code_finalize();
     memory_finalize();
+    backend_finalize();
 
+    if (called.async != 0)
+        error_fatal("called.async is not 0: %d\n", called.async);
     if (called.vm_abs != 0)
         error_fatal("called.vm_abs is not 0: %d\n", called.vm_abs);
     if (called.blas_copy != 0)
@@ -84,12 +141,75 @@ void qmkl_finalize()
         error_fatal("called.launch_qpu_code is not 0: %d\n", called.launch_qpu_code);
     if (called.memory != 0)
         error_fatal("called.memory is not 0: %d\n", called.memory);
+    if (called.backend != 0)
+        error_fatal("called.backend is not 0: %d\n", called.backend);
 }
 
-void unif_and_code_size_req(const size_t unif_size_req, const size_t code_size_req)
+void unif_size_req(const size_t unif_size_req)
 {
     if (unif_size_req > unif_size)
         unif_size = unif_size_req;
-    if (code_size_req > code_size)
-        code_size = code_size_req;
+}
+
+void code_resident_req(struct qpu_code *code)
+{
+    if (n_resident_codes == MAX_RESIDENT_CODES)
+        error_fatal("Too many resident QPU programs (max:%d)\n", MAX_RESIDENT_CODES);
+    resident_codes[n_resident_codes++] = code;
+}
+
+struct unif_arena* unif_arena_get()
+{
+    struct unif_arena *arena;
+
+    pthread_mutex_lock(&arenas_lock);
+    arena = arenas_free;
+    if (arena != NULL)
+        arenas_free = arena->next;
+    pthread_mutex_unlock(&arenas_lock);
+    if (arena != NULL)
+        return arena;
+
+    arena = malloc(sizeof(*arena));
+    if (arena == NULL)
+        error_fatal("Failed to allocate a uniform arena\n");
+    arena->cpu = mkl_malloc_cache(unif_size, 4096, 0);
+    arena->gpu = get_ptr_gpu_from_ptr_cpu(arena->cpu);
+    arena->scratch = NULL;
+    arena->scratch_size = 0;
+    return arena;
+}
+
+void unif_arena_put(struct unif_arena *arena)
+{
+    pthread_mutex_lock(&arenas_lock);
+    arena->next = arenas_free;
+    arenas_free = arena;
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+void* unif_arena_scratch(struct unif_arena *arena, const size_t size)
+{
+    if (arena->scratch_size < size) {
+        if (arena->scratch != NULL)
+            mkl_free(arena->scratch);
+        arena->scratch_size = (size + SCRATCH_GRANULE - 1) / SCRATCH_GRANULE
+                              * SCRATCH_GRANULE;
+        arena->scratch = mkl_malloc(arena->scratch_size, 4096);
+    }
+    return arena->scratch;
+}
+
+void unif_arenas_scratch_free()
+{
+    struct unif_arena *arena;
+
+    pthread_mutex_lock(&arenas_lock);
+    for (arena = arenas_free; arena != NULL; arena = arena->next) {
+        if (arena->scratch != NULL)
+            mkl_free(arena->scratch);
+        arena->scratch = NULL;
+        arena->scratch_size = 0;
+    }
+    pthread_mutex_unlock(&arenas_lock);
 }
@@ -8,12 +8,51 @@
  */
 
 #include "qmkl.h"
+#include "local/common.h"
 #include "local/called.h"
+#include "local/backend.h"
 #include "local/error.h"
+#include "local/memory_pool.h"
+#include "local/memory_index.h"
 #include <rpimemmgr.h>
+#include <malloc.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static struct rpimemmgr mgr;
+/*
+ * rpimemmgr keeps its allocations in a tree that is not thread-safe.  The
+ * lock also serializes updates of the memory index, which translates
+ * addresses without it.
+ */
+static pthread_mutex_t mgr_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Bounce buffers only grow, in steps of this size, until freed. */
+#define BOUNCE_GRANULE (64 * 1024)
+
+static struct {
+    void *p;
+    size_t size;
+} bounce[N_BOUNCE_BUFFERS];
+static pthread_mutex_t bounce_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Buffers from mkl_malloc and their bytes by cache type, counted by the
+ * blocks that hold them: a pooled block, whole pages of VCSM, or the usable
+ * size of host memory without QPU, which counts as VCSM_CACHE_TYPE_HOST.
+ */
+#define N_CACHE_TYPES 4
+static struct {
+    MKL_INT64 bytes;
+    int buffers;
+} stats[N_CACHE_TYPES];
+static MKL_INT64 bytes_total = 0, bytes_peak = 0;
+static int peak_enabled = 0;
+
+/* Blocks at least this large are zeroed by QPU in mkl_calloc. */
+#define CALLOC_QPU_MIN (1024 * 1024)
 
 void memory_init()
 {
@@ -22,6 +61,12 @@ void memory_init()
     if (++called.memory != 1)
         return;
 
+    backend_init();
+
+    /* Without QPU, memory is plain host memory. */
+    if (!backend_qpu_available())
+        return;
+
     ret = rpimemmgr_init(&mgr);
     if (ret)
         error_fatal("Failed to initialize rpimemmgr\n");
@@ -34,48 +79,406 @@ void memory_finalize()
     if (--called.memory != 0)
         return;
 
-    ret = rpimemmgr_finalize(&mgr);
-    if (ret)
-        error_fatal("Failed to finalize rpimemmgr\n");
+    bounce_buffers_free();
+
+    if (backend_qpu_available()) {
+        memory_pool_finalize();
+        ret = rpimemmgr_finalize(&mgr);
+        if (ret)
+            error_fatal("Failed to finalize rpimemmgr\n");
+        memory_index_finalize();
+    }
+
+    backend_finalize();
 }
 
-void* mkl_malloc_cache(size_t alloc_size, int alignment,
+void* memory_vcsm_alloc(const size_t size, const int alignment,
         const VCSM_CACHE_TYPE_T cache_type)
 {
     void *ptr_cpu;
+    uint32_t ptr_gpu;
     int ret;
 
-    ret = rpimemmgr_alloc_vcsm(alloc_size, alignment, cache_type,
-            &ptr_cpu, NULL, &mgr);
+    pthread_mutex_lock(&mgr_lock);
+    ret = rpimemmgr_alloc_vcsm(size, alignment, cache_type, &ptr_cpu, &ptr_gpu, &mgr);
+    if (!ret)
+        memory_index_insert(ptr_cpu, size, ptr_gpu, cache_type);
+    pthread_mutex_unlock(&mgr_lock);
     if (ret)
         error_fatal("Failed to allocate memory with rpimemmgr\n");
 
     return ptr_cpu;
 }
 
+void memory_vcsm_free(void *ptr_cpu, size_t *size,
+        VCSM_CACHE_TYPE_T *cache_type)
+{
+    VCSM_CACHE_TYPE_T t;
+    size_t sz;
+    int ret;
+
+    pthread_mutex_lock(&mgr_lock);
+    sz = memory_index_block(ptr_cpu, &t);
+    memory_index_remove(ptr_cpu);
+    ret = rpimemmgr_free_by_usraddr(ptr_cpu, &mgr);
+    pthread_mutex_unlock(&mgr_lock);
+    if (ret)
+        error_fatal("Failed to free memory with rpimemmgr\n");
+
+    if (size != NULL)
+        *size = sz;
+    if (cache_type != NULL)
+        *cache_type = t;
+}
+
+static void account(const VCSM_CACHE_TYPE_T cache_type, const MKL_INT64 bytes,
+        const int buffers)
+{
+    const unsigned t = (unsigned) cache_type % N_CACHE_TYPES;
+    const MKL_INT64 total = __atomic_add_fetch(&bytes_total, bytes, __ATOMIC_RELAXED);
+    MKL_INT64 peak;
+
+    __atomic_add_fetch(&stats[t].bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats[t].buffers, buffers, __ATOMIC_RELAXED);
+
+    if (bytes <= 0 || !__atomic_load_n(&peak_enabled, __ATOMIC_RELAXED))
+        return;
+    peak = __atomic_load_n(&bytes_peak, __ATOMIC_RELAXED);
+    while (total > peak && !__atomic_compare_exchange_n(&bytes_peak, &peak, total,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Size of the block of ptr_cpu, which must be from mkl_malloc. */
+static size_t block_size(const void *ptr_cpu, VCSM_CACHE_TYPE_T *cache_type)
+{
+    size_t size;
+
+    *cache_type = VCSM_CACHE_TYPE_HOST;
+    if (!backend_qpu_available())
+        return malloc_usable_size((void*) ptr_cpu);
+
+    size = memory_pool_block(ptr_cpu, cache_type);
+    if (size == 0) {
+        pthread_mutex_lock(&mgr_lock);
+        size = memory_index_block(ptr_cpu, cache_type);
+        pthread_mutex_unlock(&mgr_lock);
+    }
+    if (size == 0)
+        error_fatal("%p is not from mkl_malloc\n", ptr_cpu);
+    return size;
+}
+
+void* mkl_malloc_cache(size_t alloc_size, int alignment,
+        const VCSM_CACHE_TYPE_T cache_type)
+{
+    void *ptr_cpu;
+    size_t size;
+    int ret;
+
+    if (!backend_qpu_available()) {
+        if (alignment < (int) sizeof(void*))
+            alignment = sizeof(void*);
+        ret = posix_memalign(&ptr_cpu, alignment, alloc_size);
+        if (ret)
+            error_fatal("Failed to allocate host memory\n");
+        account(VCSM_CACHE_TYPE_HOST, malloc_usable_size(ptr_cpu), 1);
+        return ptr_cpu;
+    }
+
+    ptr_cpu = memory_pool_alloc(alloc_size, alignment, cache_type, &size);
+    if (ptr_cpu == NULL) {
+        ptr_cpu = memory_vcsm_alloc(alloc_size, alignment, cache_type);
+        size = alloc_size == 0 ? 4096 : (alloc_size + 4095) / 4096 * 4096;
+    }
+    account(cache_type, size, 1);
+
+    return ptr_cpu;
+}
+
 /* WARNING: Cached!!! */
 void* mkl_malloc(size_t alloc_size, int alignment)
 {
     return mkl_malloc_cache(alloc_size, alignment, VCSM_CACHE_TYPE_HOST);
 }
 
+void* qmkl_malloc_flags(size_t alloc_size, int alignment,
+        const enum qmkl_mem_flags flags)
+{
+    switch (flags) {
+    case QMKL_MEM_HOST_CACHED:
+        return mkl_malloc_cache(alloc_size, alignment, VCSM_CACHE_TYPE_HOST);
+    case QMKL_MEM_UNCACHED:
+        return mkl_malloc_cache(alloc_size, alignment, VCSM_CACHE_TYPE_NONE);
+    case QMKL_MEM_GPU_ONLY:
+        return mkl_malloc_cache(alloc_size, alignment, VCSM_CACHE_TYPE_VC);
+    }
+    error_fatal("Invalid memory flags: %d\n", flags);
+}
+
 void mkl_free(void *a_ptr)
 {
-    int ret;
+    VCSM_CACHE_TYPE_T cache_type;
+    size_t size;
 
-    ret = rpimemmgr_free_by_usraddr(a_ptr, &mgr);
-    if (ret)
-        error_fatal("Failed to free memory with rpimemmgr\n");
+    if (a_ptr == NULL)
+        return;
+
+    if (!backend_qpu_available()) {
+        account(VCSM_CACHE_TYPE_HOST, -(MKL_INT64) malloc_usable_size(a_ptr), -1);
+        free(a_ptr);
+        return;
+    }
+
+    if (memory_pool_free(a_ptr, &size, &cache_type))
+        memory_vcsm_free(a_ptr, &size, &cache_type);
+    account(cache_type, -(MKL_INT64) size, -1);
+}
+
+/*
+ * The first 8192 floats by CPU, and then QPU copies the zeros in front over
+ * the rest, doubling them each time, in the multiples of 4096 floats that
+ * the copy kernel takes.  The block is host-cached, so a memset would leave
+ * all of it dirty in the CPU caches, evicting the data of the caller, and
+ * the first QPU call on it would write those lines back when it cleans it;
+ * QPU writes memory directly.  memory_bench compares the two.
+ */
+static void zero(void *ptr_cpu, const size_t size)
+{
+    const size_t unit = 4096 * sizeof(float);
+    size_t done = 2 * unit, len;
+
+    if (size < CALLOC_QPU_MIN || QMKL_BACKEND_CPU == qmkl_get_backend()
+            || !ptr_is_gpu_accessible(ptr_cpu)) {
+        memset(ptr_cpu, 0, size);
+        return;
+    }
+
+    memset(ptr_cpu, 0, done);
+    while (size - done >= 2 * unit) {
+        len = size - done < done ? (size - done) / unit * unit : done;
+        blas_scopy_qpu(len / sizeof(float), ptr_cpu, 1,
+                (float*) ((char*) ptr_cpu + done), 1);
+        done += len;
+    }
+    memset((char*) ptr_cpu + done, 0, size - done);
+}
+
+void* mkl_calloc(size_t num, size_t size, int alignment)
+{
+    void *ptr_cpu;
+
+    if (size != 0 && num > SIZE_MAX / size)
+        return NULL;
+
+    ptr_cpu = mkl_malloc(num * size, alignment);
+    zero(ptr_cpu, num * size);
+    return ptr_cpu;
+}
+
+/*
+ * Kept in place if the block still fits and is not more than twice as
+ * large; otherwise moved to a block with the alignment the old address has,
+ * up to a page.
+ */
+void* mkl_realloc(void *ptr, size_t size)
+{
+    VCSM_CACHE_TYPE_T cache_type;
+    const uintptr_t addr = (uintptr_t) ptr;
+    size_t old;
+    int alignment;
+    void *p;
+
+    if (ptr == NULL)
+        return mkl_malloc(size, 64);
+    if (size == 0) {
+        mkl_free(ptr);
+        return NULL;
+    }
+
+    old = block_size(ptr, &cache_type);
+    if (size <= old && size >= old / 2)
+        return ptr;
+
+    alignment = (addr & -addr) < 4096 ? (int) (addr & -addr) : 4096;
+    p = mkl_malloc_cache(size, alignment, cache_type);
+    memcpy(p, ptr, size < old ? size : old);
+    mkl_free(ptr);
+    return p;
+}
+
+MKL_INT64 mkl_mem_stat(int *AllocatedBuffers)
+{
+    unsigned t;
+
+    *AllocatedBuffers = 0;
+    for (t = 0; t < N_CACHE_TYPES; t ++)
+        *AllocatedBuffers += __atomic_load_n(&stats[t].buffers, __ATOMIC_RELAXED);
+    return __atomic_load_n(&bytes_total, __ATOMIC_RELAXED);
+}
+
+MKL_INT64 qmkl_mem_stat_cache(const VCSM_CACHE_TYPE_T cache_type,
+        int *AllocatedBuffers)
+{
+    const unsigned t = (unsigned) cache_type % N_CACHE_TYPES;
+
+    *AllocatedBuffers = __atomic_load_n(&stats[t].buffers, __ATOMIC_RELAXED);
+    return __atomic_load_n(&stats[t].bytes, __ATOMIC_RELAXED);
+}
+
+MKL_INT64 mkl_peak_mem_usage(int mode)
+{
+    switch (mode) {
+    case MKL_PEAK_MEM_ENABLE:
+        if (!__atomic_exchange_n(&peak_enabled, 1, __ATOMIC_RELAXED))
+            __atomic_store_n(&bytes_peak,
+                    __atomic_load_n(&bytes_total, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        return __atomic_load_n(&bytes_peak, __ATOMIC_RELAXED);
+    case MKL_PEAK_MEM_DISABLE:
+        __atomic_store_n(&peak_enabled, 0, __ATOMIC_RELAXED);
+        return __atomic_load_n(&bytes_peak, __ATOMIC_RELAXED);
+    case MKL_PEAK_MEM:
+        if (!__atomic_load_n(&peak_enabled, __ATOMIC_RELAXED))
+            return -1;
+        return __atomic_load_n(&bytes_peak, __ATOMIC_RELAXED);
+    case MKL_PEAK_MEM_RESET:
+        return __atomic_exchange_n(&bytes_peak,
+                __atomic_load_n(&bytes_total, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+    return -1;
+}
+
+void mkl_free_buffers()
+{
+    bounce_buffers_free();
+    unif_arenas_scratch_free();
+    if (backend_qpu_available())
+        memory_pool_trim();
+}
+
+int get_ptr_gpu_from_ptr_cpu_checked(const void * const ptr_cpu,
+        uint32_t *ptr_gpu)
+{
+    *ptr_gpu = backend_qpu_available() ? memory_index_lookup(ptr_cpu, NULL) : 0;
+
+    return *ptr_gpu != 0 ? 0 : -1;
 }
 
 uint32_t get_ptr_gpu_from_ptr_cpu(const void * const ptr_cpu)
 {
     uint32_t ptr_gpu;
 
-    ptr_gpu = rpimemmgr_usraddr_to_busaddr((void*) ptr_cpu, &mgr);
-
-    if (!ptr_gpu)
-        error_fatal("Failed to get ptr_gpu from ptr_cpu\n");
+    if (!backend_qpu_available())
+        error_fatal("QPU is not available\n");
+    if (get_ptr_gpu_from_ptr_cpu_checked(ptr_cpu, &ptr_gpu))
+        error_fatal("%p is not in memory from mkl_malloc\n", ptr_cpu);
 
     return ptr_gpu;
 }
+
+int ptr_is_gpu_accessible(const void * const ptr_cpu)
+{
+    uint32_t ptr_gpu;
+
+    return get_ptr_gpu_from_ptr_cpu_checked(ptr_cpu, &ptr_gpu) == 0;
+}
+
+int ptr_is_cpu_cached(const void * const ptr_cpu)
+{
+    VCSM_CACHE_TYPE_T cache_type;
+
+    /* Other memory is cached, and is staged through bounce buffers anyway. */
+    if (!backend_qpu_available() || !memory_index_lookup(ptr_cpu, &cache_type))
+        return 1;
+
+    return VCSM_CACHE_TYPE_HOST == cache_type
+           || VCSM_CACHE_TYPE_HOST_AND_VC == cache_type;
+}
+
+int ptr_is_gpu_only(const void * const ptr_cpu)
+{
+    VCSM_CACHE_TYPE_T cache_type;
+
+    return backend_qpu_available() && memory_index_lookup(ptr_cpu, &cache_type)
+           && VCSM_CACHE_TYPE_VC == cache_type;
+}
+
+void cache_region_1d(struct cache_region *r, const enum qmkl_cache_op op,
+        const void *p, const size_t size)
+{
+    r->op = op;
+    r->p = p;
+    r->height = 1;
+    r->width = size;
+    r->stride = size;
+}
+
+#define REGION(i) r[i].op, r[i].p, r[i].height, r[i].width, r[i].stride
+
+void cache_regions_flush(const struct cache_region *r, unsigned n)
+{
+    for (; n >= CACHE_REGIONS_PER_CALL;
+            r += CACHE_REGIONS_PER_CALL, n -= CACHE_REGIONS_PER_CALL)
+        rpimemmgr_cache_op_2_multiple(6, REGION(0), REGION(1), REGION(2),
+                REGION(3), REGION(4), REGION(5));
+
+    switch (n) {
+    case 5:
+        rpimemmgr_cache_op_2_multiple(5, REGION(0), REGION(1), REGION(2),
+                REGION(3), REGION(4));
+        break;
+    case 4:
+        rpimemmgr_cache_op_2_multiple(4, REGION(0), REGION(1), REGION(2),
+                REGION(3));
+        break;
+    case 3:
+        rpimemmgr_cache_op_2_multiple(3, REGION(0), REGION(1), REGION(2));
+        break;
+    case 2:
+        rpimemmgr_cache_op_2_multiple(2, REGION(0), REGION(1));
+        break;
+    case 1:
+        rpimemmgr_cache_op_2(REGION(0));
+        break;
+    }
+}
+
+#undef REGION
+
+void bounce_buffers_lock()
+{
+    pthread_mutex_lock(&bounce_lock);
+}
+
+void bounce_buffers_unlock()
+{
+    pthread_mutex_unlock(&bounce_lock);
+}
+
+void bounce_buffers_free()
+{
+    unsigned i;
+
+    bounce_buffers_lock();
+    for (i = 0; i < N_BOUNCE_BUFFERS; i ++) {
+        if (bounce[i].p != NULL)
+            mkl_free(bounce[i].p);
+        bounce[i].p = NULL;
+        bounce[i].size = 0;
+    }
+    bounce_buffers_unlock();
+}
+
+void* bounce_buffer(const unsigned slot, const size_t size)
+{
+    if (slot >= N_BOUNCE_BUFFERS)
+        error_fatal("Invalid bounce buffer: %u\n", slot);
+
+    if (bounce[slot].size < size) {
+        if (bounce[slot].p != NULL)
+            mkl_free(bounce[slot].p);
+        bounce[slot].size = (size + BOUNCE_GRANULE - 1) / BOUNCE_GRANULE * BOUNCE_GRANULE;
+        bounce[slot].p = mkl_malloc(bounce[slot].size, 4096);
+    }
+    return bounce[slot].p;
+}
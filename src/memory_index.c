@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Index of the live VCSM allocations by user address, for translating any
+ * pointer into them to a bus address by a binary search instead of a call
+ * into rpimemmgr.
+ *
+ * Lookups take no lock: the index is a sorted array under a sequence lock.
+ * The writer, serialized by its caller, makes the sequence odd while it
+ * changes the array, and readers retry if the sequence was odd or changed
+ * while they searched.  An array outgrown is kept until
+ * memory_index_finalize(), since readers may still be searching it; the
+ * arrays double in size, so that they take at most twice the last one.
+ */
+
+#include "local/memory_index.h"
+#include "local/error.h"
+#include <stdlib.h>
+
+#define PAGE_SIZE 4096
+
+struct range {
+    uintptr_t usr;
+    size_t size;
+    uint32_t bus;
+    VCSM_CACHE_TYPE_T cache_type;
+};
+
+struct ranges {
+    struct ranges *retired;
+    size_t cap;
+    struct range r[];
+};
+
+static struct ranges *ranges = NULL;
+static size_t n_ranges = 0;
+static unsigned seq = 0;
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static void write_begin()
+{
+    STORE(seq, seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end()
+{
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Index of the first range whose usr is above p. */
+static size_t upper(const struct ranges *rs, const size_t n, const uintptr_t p)
+{
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (LOAD(rs->r[mid].usr) <= p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void memory_index_insert(const void *ptr_cpu, const size_t size,
+        const uint32_t ptr_gpu, const VCSM_CACHE_TYPE_T cache_type)
+{
+    const uintptr_t usr = (uintptr_t) ptr_cpu;
+    /* VCSM maps whole pages, and at least one. */
+    const size_t pages = size == 0 ? PAGE_SIZE
+                                   : (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    size_t i, j;
+
+    if (ranges == NULL || n_ranges == ranges->cap) {
+        const size_t cap = ranges == NULL ? 64 : ranges->cap * 2;
+        struct ranges *grown = malloc(sizeof(*grown) + cap * sizeof(grown->r[0]));
+
+        if (grown == NULL)
+            error_fatal("Failed to allocate the memory index\n");
+        grown->retired = ranges;
+        grown->cap = cap;
+        for (j = 0; j < n_ranges; j ++)
+            grown->r[j] = ranges->r[j];
+        __atomic_store_n(&ranges, grown, __ATOMIC_RELEASE);
+    }
+
+    write_begin();
+    i = upper(ranges, n_ranges, usr);
+    for (j = n_ranges; j > i; j --) {
+        STORE(ranges->r[j].usr, ranges->r[j - 1].usr);
+        STORE(ranges->r[j].size, ranges->r[j - 1].size);
+        STORE(ranges->r[j].bus, ranges->r[j - 1].bus);
+        STORE(ranges->r[j].cache_type, ranges->r[j - 1].cache_type);
+    }
+    STORE(ranges->r[i].usr, usr);
+    STORE(ranges->r[i].size, pages);
+    STORE(ranges->r[i].bus, ptr_gpu);
+    STORE(ranges->r[i].cache_type, cache_type);
+    STORE(n_ranges, n_ranges + 1);
+    write_end();
+}
+
+/* Index of the range that starts at usr, or n_ranges. */
+static size_t find(const uintptr_t usr)
+{
+    const size_t i = ranges == NULL ? 0 : upper(ranges, n_ranges, usr);
+
+    if (i == 0 || ranges->r[i - 1].usr != usr)
+        return n_ranges;
+    return i - 1;
+}
+
+size_t memory_index_block(const void *ptr_cpu, VCSM_CACHE_TYPE_T *cache_type)
+{
+    const size_t i = find((uintptr_t) ptr_cpu);
+
+    if (i == n_ranges)
+        return 0;
+    *cache_type = ranges->r[i].cache_type;
+    return ranges->r[i].size;
+}
+
+void memory_index_remove(const void *ptr_cpu)
+{
+    const size_t i = find((uintptr_t) ptr_cpu) + 1;
+    size_t j;
+
+    if (i > n_ranges)
+        return;
+
+    write_begin();
+    for (j = i - 1; j + 1 < n_ranges; j ++) {
+        STORE(ranges->r[j].usr, ranges->r[j + 1].usr);
+        STORE(ranges->r[j].size, ranges->r[j + 1].size);
+        STORE(ranges->r[j].bus, ranges->r[j + 1].bus);
+        STORE(ranges->r[j].cache_type, ranges->r[j + 1].cache_type);
+    }
+    STORE(n_ranges, n_ranges - 1);
+    write_end();
+}
+
+uint32_t memory_index_lookup(const void *ptr_cpu, VCSM_CACHE_TYPE_T *cache_type)
+{
+    const uintptr_t p = (uintptr_t) ptr_cpu;
+    VCSM_CACHE_TYPE_T t = VCSM_CACHE_TYPE_NONE;
+    unsigned s;
+    uint32_t bus;
+
+    do {
+        const struct ranges *rs;
+        size_t i, n;
+
+        while ((s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE)) & 1)
+            ;
+        rs = __atomic_load_n(&ranges, __ATOMIC_ACQUIRE);
+        bus = 0;
+        if (rs != NULL) {
+            /* The array may have been outgrown since it was loaded. */
+            n = LOAD(n_ranges);
+            i = upper(rs, n < rs->cap ? n : rs->cap, p);
+            if (i != 0 && p - LOAD(rs->r[i - 1].usr) < LOAD(rs->r[i - 1].size)) {
+                bus = LOAD(rs->r[i - 1].bus) + (uint32_t) (p - LOAD(rs->r[i - 1].usr));
+                t = LOAD(rs->r[i - 1].cache_type);
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (LOAD(seq) != s);
+
+    if (cache_type != NULL)
+        *cache_type = t;
+    return bus;
+}
+
+void memory_index_finalize()
+{
+    struct ranges *rs, *retired;
+
+    for (rs = ranges; rs != NULL; rs = retired) {
+        retired = rs->retired;
+        free(rs);
+    }
+    ranges = NULL;
+    n_ranges = 0;
+}
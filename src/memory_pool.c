@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Pools of small blocks for mkl_malloc, so that temporaries do not cost a
+ * VCSM allocation (an ioctl, rounded up to pages) each.  Blocks are of power
+ * of two sizes, carved out of slabs of SLAB_SIZE bytes from VCSM, and each
+ * cache type has its own slabs.  A slab serves one size class: it hands out
+ * freed blocks first, from a stack of their indices kept with the slab, and
+ * then ones never used.  The pools never read or write the blocks, which
+ * may be GPU-only or last written by the QPU.  Slabs stay allocated until
+ * memory_pool_trim() releases the empty ones.
+ *
+ * A block is aligned to its size up to a page, since slabs are page-aligned,
+ * and is inside the VCSM allocation of its slab, so that the bus address of
+ * any pointer into it is found as for other VCSM memory.
+ *
+ * Locking: slabs_lock guards the table of slabs sorted by address, and the
+ * lock of a size class its slabs with free blocks and their contents.  Both
+ * are taken in this order, and allocation creates slabs without holding the
+ * lock of the class.
+ */
+
+#include "local/memory_pool.h"
+#include "local/error.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_SIZE (1024 * 1024)
+#define PAGE_SIZE 4096
+#define MIN_SHIFT 6 /* a cache line */
+#define MAX_SHIFT 18 /* larger blocks are allocated from VCSM directly */
+#define N_CLASSES (MAX_SHIFT - MIN_SHIFT + 1)
+#define N_CACHE_TYPES 4
+
+struct slab {
+    char *base;
+    VCSM_CACHE_TYPE_T cache_type;
+    unsigned shift;
+    size_t used, bump;
+    uint16_t *free; /* indices of the freed blocks */
+    size_t n_free;
+    struct slab *prev, *next; /* in the list of the class, if not full */
+    struct size_class *cls;
+};
+
+struct size_class {
+    pthread_mutex_t lock;
+    struct slab *avail;
+};
+
+static struct size_class classes[N_CACHE_TYPES][N_CLASSES];
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+
+static struct slab **slabs = NULL;
+static size_t n_slabs = 0, slabs_cap = 0;
+static pthread_rwlock_t slabs_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void classes_init()
+{
+    unsigned t, i;
+
+    for (t = 0; t < N_CACHE_TYPES; t ++) {
+        for (i = 0; i < N_CLASSES; i ++) {
+            pthread_mutex_init(&classes[t][i].lock, NULL);
+            classes[t][i].avail = NULL;
+        }
+    }
+}
+
+static int slab_full(const struct slab *s)
+{
+    return s->n_free == 0 && s->bump == SLAB_SIZE;
+}
+
+static void slab_link(struct slab *s)
+{
+    s->prev = NULL;
+    s->next = s->cls->avail;
+    if (s->next != NULL)
+        s->next->prev = s;
+    s->cls->avail = s;
+}
+
+static void slab_unlink(struct slab *s)
+{
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        s->cls->avail = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    s->prev = s->next = NULL;
+}
+
+/* Index of the first slab whose base is above p. */
+static size_t slabs_upper(const void *p)
+{
+    size_t lo = 0, hi = n_slabs;
+
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if ((uintptr_t) slabs[mid]->base <= (uintptr_t) p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void slabs_insert(struct slab *s)
+{
+    size_t i;
+
+    pthread_rwlock_wrlock(&slabs_lock);
+    if (n_slabs == slabs_cap) {
+        slabs_cap = slabs_cap ? slabs_cap * 2 : 64;
+        slabs = realloc(slabs, slabs_cap * sizeof(*slabs));
+        if (slabs == NULL)
+            error_fatal("Failed to allocate the table of memory pool slabs\n");
+    }
+    i = slabs_upper(s->base);
+    memmove(slabs + i + 1, slabs + i, (n_slabs - i) * sizeof(*slabs));
+    slabs[i] = s;
+    n_slabs ++;
+    pthread_rwlock_unlock(&slabs_lock);
+}
+
+/* Called with slabs_lock held for writing. */
+static void slabs_remove(struct slab *s)
+{
+    const size_t i = slabs_upper(s->base) - 1;
+
+    memmove(slabs + i, slabs + i + 1, (n_slabs - i - 1) * sizeof(*slabs));
+    n_slabs --;
+}
+
+static struct slab* slab_new(const VCSM_CACHE_TYPE_T cache_type,
+        const unsigned shift)
+{
+    struct slab *s = malloc(sizeof(*s));
+
+    if (s == NULL)
+        error_fatal("Failed to allocate a memory pool slab\n");
+    s->free = malloc((SLAB_SIZE >> shift) * sizeof(*s->free));
+    if (s->free == NULL)
+        error_fatal("Failed to allocate a memory pool slab\n");
+    s->base = memory_vcsm_alloc(SLAB_SIZE, PAGE_SIZE, cache_type);
+    s->cache_type = cache_type;
+    s->shift = shift;
+    s->used = 0;
+    s->bump = 0;
+    s->n_free = 0;
+    s->prev = s->next = NULL;
+    s->cls = &classes[cache_type][shift - MIN_SHIFT];
+    slabs_insert(s);
+    return s;
+}
+
+void* memory_pool_alloc(const size_t size, const int alignment,
+        const VCSM_CACHE_TYPE_T cache_type, size_t *block_size)
+{
+    const size_t need = size > (size_t) alignment ? size : (size_t) alignment;
+    struct size_class *cls;
+    struct slab *s;
+    unsigned shift = MIN_SHIFT;
+    void *p;
+
+    if (alignment > PAGE_SIZE || need > ((size_t) 1 << MAX_SHIFT)
+            || (unsigned) cache_type >= N_CACHE_TYPES)
+        return NULL;
+
+    pthread_once(&classes_once, classes_init);
+    while (((size_t) 1 << shift) < need)
+        shift ++;
+    cls = &classes[cache_type][shift - MIN_SHIFT];
+
+    pthread_mutex_lock(&cls->lock);
+    while ((s = cls->avail) == NULL) {
+        pthread_mutex_unlock(&cls->lock);
+        s = slab_new(cache_type, shift);
+        pthread_mutex_lock(&cls->lock);
+        slab_link(s);
+    }
+
+    if (s->n_free != 0) {
+        p = s->base + ((size_t) s->free[-- s->n_free] << shift);
+    } else {
+        p = s->base + s->bump;
+        s->bump += (size_t) 1 << shift;
+    }
+    s->used ++;
+    if (slab_full(s))
+        slab_unlink(s);
+    pthread_mutex_unlock(&cls->lock);
+
+    *block_size = (size_t) 1 << shift;
+    return p;
+}
+
+/* Called with slabs_lock held. */
+static struct slab* slab_of(const void *p)
+{
+    const size_t i = slabs_upper(p);
+
+    if (i != 0 && (uintptr_t) p < (uintptr_t) slabs[i - 1]->base + SLAB_SIZE)
+        return slabs[i - 1];
+    return NULL;
+}
+
+size_t memory_pool_block(const void *p, VCSM_CACHE_TYPE_T *cache_type)
+{
+    struct slab *s;
+    size_t size = 0;
+
+    pthread_rwlock_rdlock(&slabs_lock);
+    s = slab_of(p);
+    if (s != NULL) {
+        *cache_type = s->cache_type;
+        size = (size_t) 1 << s->shift;
+    }
+    pthread_rwlock_unlock(&slabs_lock);
+
+    return size;
+}
+
+int memory_pool_free(void *p, size_t *block_size,
+        VCSM_CACHE_TYPE_T *cache_type)
+{
+    struct slab *s;
+
+    pthread_rwlock_rdlock(&slabs_lock);
+    s = slab_of(p);
+    if (s == NULL) {
+        pthread_rwlock_unlock(&slabs_lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&s->cls->lock);
+    if (slab_full(s))
+        slab_link(s);
+    s->free[s->n_free ++] = (uint16_t) (((char*) p - s->base) >> s->shift);
+    s->used --;
+    *block_size = (size_t) 1 << s->shift;
+    *cache_type = s->cache_type;
+    pthread_mutex_unlock(&s->cls->lock);
+    pthread_rwlock_unlock(&slabs_lock);
+
+    return 0;
+}
+
+static void release(const int all)
+{
+    unsigned t, i;
+
+    if (slabs == NULL)
+        return;
+
+    pthread_rwlock_wrlock(&slabs_lock);
+    for (t = 0; t < N_CACHE_TYPES; t ++) {
+        for (i = 0; i < N_CLASSES; i ++) {
+            struct size_class * const cls = &classes[t][i];
+            struct slab *s, *next;
+
+            pthread_mutex_lock(&cls->lock);
+            for (s = cls->avail; s != NULL; s = next) {
+                next = s->next;
+                if (s->used != 0)
+                    continue;
+                slab_unlink(s);
+                slabs_remove(s);
+                memory_vcsm_free(s->base, NULL, NULL);
+                free(s->free);
+                free(s);
+            }
+            if (all)
+                cls->avail = NULL;
+            pthread_mutex_unlock(&cls->lock);
+        }
+    }
+    if (all) {
+        /* Full slabs and ones still in use. */
+        for (i = 0; i < n_slabs; i ++) {
+            memory_vcsm_free(slabs[i]->base, NULL, NULL);
+            free(slabs[i]->free);
+            free(slabs[i]);
+        }
+        free(slabs);
+        slabs = NULL;
+        n_slabs = slabs_cap = 0;
+    }
+    pthread_rwlock_unlock(&slabs_lock);
+}
+
+void memory_pool_trim()
+{
+    release(0);
+}
+
+void memory_pool_finalize()
+{
+    release(1);
+}
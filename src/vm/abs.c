@@ -10,6 +10,7 @@
 #include "qmkl.h"
 #include "local/common.h"
 #include "local/called.h"
+#include "local/backend.h"
 #include "local/error.h"
 #include <rpimemmgr.h>
 #include <stdio.h>
@@ -18,13 +19,17 @@
 static const unsigned code_sabs[] = {
 #include "sAbs.qhex"
 };
+static struct qpu_code code_sabs_resident = {code_sabs, sizeof(code_sabs), 0};
+
+static const int vector_length = 3 * 16 * 16;
 
 void vm_abs_init()
 {
     if (++called.vm_abs != 1)
         return;
 
-    unif_and_code_size_req(3 * (32 / 8), sizeof(code_sabs));
+    unif_size_req(QPU_PROGRAM_UNIF_LEN * (32 / 8));
+    code_resident_req(&code_sabs_resident);
 }
 
 void vm_abs_finalize()
@@ -33,27 +38,85 @@ void vm_abs_finalize()
         return;
 }
 
-void vsAbs(MKL_INT n, const float *a, float *y)
+/* Sets prog to y = |a| for n the kernel can handle. */
+static void sabs_program(const MKL_INT n, const float *a, float *y,
+        struct qpu_program *prog)
 {
-    unsigned a_gpu = get_ptr_gpu_from_ptr_cpu(a);
-    unsigned y_gpu = get_ptr_gpu_from_ptr_cpu(y);
-    unsigned *p;
-    const int vector_length = 3 * 16 * 16;
+    const size_t size = n * sizeof(*a);
+
+    prog->code = code_sabs_resident.gpu;
+    prog->unif[0] = n / vector_length - 1;
+    prog->unif[1] = get_ptr_gpu_from_ptr_cpu(a);
+    prog->unif[2] = get_ptr_gpu_from_ptr_cpu(y);
+    prog->unif_len = 5;
+
+    prog->n_clean = prog->n_invalidate = 0;
+    if (ptr_is_cpu_cached(a))
+        cache_region_1d(&prog->r[prog->n_clean ++], QMKL_CACHE_OP_CLEAN,
+                a, size);
+    if (ptr_is_cpu_cached(y)) {
+        cache_region_1d(&prog->r[prog->n_clean ++], QMKL_CACHE_OP_CLEAN,
+                y, size);
+        cache_region_1d(&prog->r[prog->n_clean + prog->n_invalidate ++],
+                QMKL_CACHE_OP_INVALIDATE, y, size);
+    }
+}
+
+void vm_sabs_qpu(const MKL_INT n, const float *a, float *y)
+{
+    struct qpu_program prog;
+
+    /* Staging through bounce buffers would cost more than the CPU does. */
+    if (!ptr_is_gpu_accessible(a) || !ptr_is_gpu_accessible(y)) {
+        vm_sabs_cpu(n, a, y);
+        return;
+    }
 
     if (n <= vector_length)
         error_fatal("n must be greater than %d\n", vector_length);
     if (n % vector_length != 0)
         error_fatal("n must be a multiple of %d\n", vector_length);
 
-    p = unif_common_cpu;
-    unif_add_uint(n / vector_length - 1, &p);
-    unif_add_uint(a_gpu,                 &p);
-    unif_add_uint(y_gpu,                 &p);
+    sabs_program(n, a, y, &prog);
+    qpu_program_launch(&prog);
+}
 
-    memcpy(code_common_cpu, code_sabs, sizeof(code_sabs));
+int vm_sabs_program(const MKL_INT n, const float *a, float *y,
+        struct qpu_program *prog)
+{
+    if (vm_sabs_cpu == backend_ops->sabs || !backend_qpu_available())
+        return 0;
+    if (n <= vector_length || n % vector_length != 0
+            || !ptr_is_gpu_accessible(a) || !ptr_is_gpu_accessible(y))
+        return 0;
 
-    rpimemmgr_cache_op_multiple(2, QMKL_CACHE_OP_CLEAN, a, n * sizeof(*a),
-                                   QMKL_CACHE_OP_CLEAN, y, n * sizeof(*y));
-    launch_qpu_code_mailbox(1, 0, 5e3, unif_common_gpu, code_common_gpu);
-    rpimemmgr_cache_op(QMKL_CACHE_OP_INVALIDATE, y, n * sizeof(*y));
+    sabs_program(n, a, y, prog);
+    return 1;
+}
+
+/*
+ * Shapes the QPU kernel cannot handle go to CPU, except with a GPU-only
+ * array, which the CPU can neither read nor write, so that the call is
+ * rejected instead.
+ */
+void vm_sabs_auto(const MKL_INT n, const float *a, float *y)
+{
+    const int qpu_shape = n > vector_length && n % vector_length == 0;
+
+    if (n > 0 && (ptr_is_gpu_only(a) || ptr_is_gpu_only(y))) {
+        if (!qpu_shape || !ptr_is_gpu_accessible(a)
+                || !ptr_is_gpu_accessible(y)) {
+            xerbla_local(ptr_is_gpu_only(a) ? 2 : 3);
+            return;
+        }
+        vm_sabs_qpu(n, a, y);
+    } else if (backend_qpu_available() && qpu_shape)
+        vm_sabs_qpu(n, a, y);
+    else
+        vm_sabs_cpu(n, a, y);
+}
+
+void vsAbs(MKL_INT n, const float *a, float *y)
+{
+    backend_ops->sabs(n, a, y);
 }
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "qmkl.h"
+#include "local/common.h"
+#include "local/backend.h"
+#include <math.h>
+
+void vm_sabs_cpu(const MKL_INT n, const float *a, float *y)
+{
+    int i;
+
+#pragma omp parallel for private(i)
+    for (i = 0; i < n; i ++)
+        y[i] = fabsf(a[i]);
+}
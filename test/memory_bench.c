@@ -1,6 +1,7 @@
 #include "config.h"
 #include <unistd.h>
 #include <stdlib.h>
+#include <math.h>
 #include <CUnit/Basic.h>
 #include <CUnit/Console.h>
 #include <sys/time.h>
@@ -166,12 +167,133 @@ static void suite_sumall() {
     CU_add_test(suite, "GPU -> x", test_sumall_gpu);
 }
 
+/*
+ * A zeroed block that QPU reads next, from mkl_calloc, which zeroes it by
+ * the QPU copy kernel, or from mkl_malloc and memset, whose dirty lines the
+ * QPU call cleans first.
+ */
+static double calloc_then_qpu(const int by_calloc, float *dst)
+{
+    double start, end;
+    float *p;
+
+    invalidate_cpu_l2c();
+    start = get_time();
+    if (by_calloc)
+        p = mkl_calloc(N, sizeof(float), 4096);
+    else {
+        p = mkl_malloc(N * sizeof(float), 4096);
+        memset(p, 0, N * sizeof(float));
+    }
+    cblas_scopy(N, p, 1, dst, 1);
+    end = get_time();
+
+    mkl_free(p);
+    return end - start;
+}
+
+static void test_calloc() {
+    float *dst = gpu_malloc(N * sizeof(float));
+    const double qpu = calloc_then_qpu(1, dst);
+    const double cpu = calloc_then_qpu(0, dst);
+    float actual = 0;
+    size_t i;
+
+    for (i = 0; i < N; ++i)
+        actual += fabsf(dst[i]);
+    printf("\nzero(4MB) and scopy: mkl_calloc %lf sec, memset %lf sec\n",
+           qpu, cpu);
+    CU_ASSERT_DOUBLE_EQUAL(actual, 0, 0.001);
+    gpu_free(dst);
+}
+
+static void suite_calloc() {
+    CU_pSuite suite = CU_add_suite(
+        "calloc",
+        NULL,
+        NULL
+    );
+
+    CU_add_test(suite, "0 -> GPU, then QPU", test_calloc);
+}
+
+/*
+ * An sgemm whose result feeds the next one, with the intermediate from
+ * mkl_malloc or from GPU-only memory, which needs no cache maintenance.
+ */
+#define CHAIN_DIM 512
+#define CHAIN_LOOPS 16
+
+static double sgemm_chain(const enum qmkl_mem_flags flags, float *out)
+{
+    const size_t len = CHAIN_DIM * CHAIN_DIM;
+    float *a = mkl_malloc(len * sizeof(*a), 4096);
+    float *t = qmkl_malloc_flags(len * sizeof(*t), 4096, flags);
+    size_t i;
+    int loop;
+    double start, end;
+
+    srand(0xDEADBEEF);
+    for (i = 0; i < len; ++i)
+        a[i] = rand_float_in_range(-1.0, 1.0) / CHAIN_DIM;
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                CHAIN_DIM, CHAIN_DIM, CHAIN_DIM, 1.0, a, CHAIN_DIM,
+                a, CHAIN_DIM, 0.0, t, CHAIN_DIM);
+
+    start = get_time();
+    for (loop = 0; loop < CHAIN_LOOPS; ++loop) {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    CHAIN_DIM, CHAIN_DIM, CHAIN_DIM, 1.0, a, CHAIN_DIM,
+                    a, CHAIN_DIM, 0.0, t, CHAIN_DIM);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    CHAIN_DIM, CHAIN_DIM, CHAIN_DIM, 1.0, t, CHAIN_DIM,
+                    a, CHAIN_DIM, 0.0, out, CHAIN_DIM);
+    }
+    end = get_time();
+
+    mkl_free(t);
+    mkl_free(a);
+    return (end - start) / CHAIN_LOOPS;
+}
+
+static void test_cache_maintenance_sgemm_chain() {
+    const size_t len = CHAIN_DIM * CHAIN_DIM;
+    float *out_host = mkl_malloc(len * sizeof(*out_host), 4096);
+    float *out_gpu = mkl_malloc(len * sizeof(*out_gpu), 4096);
+    const double host = sgemm_chain(QMKL_MEM_HOST_CACHED, out_host);
+    const double gpu = sgemm_chain(QMKL_MEM_GPU_ONLY, out_gpu);
+    float diff = 0;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+        diff = fmaxf(diff, fabsf(out_host[i] - out_gpu[i]));
+    printf("\nsgemm chain (%dx%d): host-cached %lf sec, GPU-only %lf sec, "
+           "saved %lf sec (%.1f%%)\n",
+           CHAIN_DIM, CHAIN_DIM, host, gpu, host - gpu,
+           (host - gpu) / host * 100);
+    CU_ASSERT_DOUBLE_EQUAL(diff, 0, 0.001);
+    mkl_free(out_gpu);
+    mkl_free(out_host);
+}
+
+static void suite_cache_maintenance() {
+    CU_pSuite suite = CU_add_suite(
+        "cache maintenance",
+        NULL,
+        NULL
+    );
+
+    CU_add_test(suite, "sgemm chain", test_cache_maintenance_sgemm_chain);
+}
+
 int main() {
     CU_initialize_registry();
 
     suite_memcpy();
     suite_memset();
     suite_sumall();
+    suite_calloc();
+    suite_cache_maintenance();
 
     isatty(fileno(stdout)) ? CU_console_run_tests() : CU_basic_run_tests();
     const unsigned int result = CU_get_number_of_failures();
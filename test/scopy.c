@@ -95,7 +95,7 @@ static void mf_scopy_neon(const MKL_INT n, const float *x, float *y)
 int main()
 {
     const int n = 4096 * 1024;
-    float *x, *y, *y_ref;
+    float *x, *y, *y_ref, *y_host;
 #ifdef __ARM_NEON
     float *y_neon;
 #endif /* __ARM_NEON */
@@ -120,7 +120,7 @@ int main()
     printf("n = %d\n", n);
     printf("==== scopy example (y = x) ====\n");
 
-    printf("GPU: "); fflush(stdout);
+    printf("GPU (%s backend): ", qmkl_backend_name(qmkl_get_backend())); fflush(stdout);
     gettimeofday(&start, NULL);
     cblas_scopy(n, x, 1, y, 1);
     gettimeofday(&end, NULL);
@@ -142,6 +142,30 @@ int main()
         }
     }
 
+    if (qmkl_get_backend() != QMKL_BACKEND_CPU) {
+        const enum qmkl_backend backend = qmkl_get_backend();
+
+        y_host = malloc(n * sizeof(*y_host));
+        qmkl_set_backend(QMKL_BACKEND_CPU);
+        printf("QMKL cpu backend (%d threads): ", omp_get_max_threads()); fflush(stdout);
+        gettimeofday(&start, NULL);
+        cblas_scopy(n, x, 1, y_host, 1);
+        gettimeofday(&end, NULL);
+        printf("%g [s], %g [flop/s]\n", (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6, n / ((end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6));
+        qmkl_set_backend(backend);
+
+        if (memcmp(y_host, y_ref, n * sizeof(*y))) {
+            int i;
+            for (i = 0; i < n; i ++) {
+                if (y_host[i] != y_ref[i]) {
+                    printf("QMKL cpu backend and CPU differ at i=%d (%f vs. %f)\n", i, y_host[i], y_ref[i]);
+                    break;
+                }
+            }
+        }
+        free(y_host);
+    }
+
 #ifdef __ARM_NEON
     printf("CPU with NEON (%d threads): ", omp_get_max_threads()); fflush(stdout);
     gettimeofday(&start, NULL);
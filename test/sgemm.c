@@ -266,7 +266,7 @@ int main()
     const unsigned P = 96;
     const unsigned Q = 363;
     const unsigned R = 3072;
-    float *A, *A_ref, *B, *B_ref, *C, *C_ref;
+    float *A, *A_ref, *B, *B_ref, *C, *C_ref, *C_host;
 #ifdef __ARM_NEON
     float *C_neon;
 #endif /* __ARM_NEON */
@@ -297,6 +297,8 @@ int main()
     memcpy(A_ref, A, P * Q * (32 / 8));
     memcpy(B_ref, B, Q * R * (32 / 8));
     memcpy(C_ref, C, P * R * (32 / 8));
+    C_host = malloc(P * R * (32 / 8));
+    memcpy(C_host, C, P * R * (32 / 8));
 #ifdef __ARM_NEON
     C_neon = malloc(P * R * (32 / 8));
     memcpy(C_neon, C, P * R * (32 / 8));
@@ -309,11 +311,17 @@ int main()
     printf("BETA = %f\n", BETA);
     printf("==== sgemm example (ALPHA * %dx%d * %dx%d + BETA * %dx%d) ====\n", P, Q, Q, R, P, R);
 
-    printf("GPU: "); fflush(stdout);
+    printf("GPU (%s backend): ", qmkl_backend_name(qmkl_get_backend())); fflush(stdout);
     gettimeofday(&start, NULL);
     cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, P, R, Q, ALPHA, A, Q, B, R, BETA, C, R);
     gettimeofday(&end, NULL);
     printf("%g [s], %g [flop/s]\n", (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6, (2 * P * Q * R + 3 * P * R) / ((end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6));
+    if (qmkl_get_backend() == QMKL_BACKEND_AUTO || qmkl_get_backend() == QMKL_BACKEND_HYBRID) {
+        const char *path_names[] = {"none", "qpu", "cpu", "hybrid"};
+        struct qmkl_sgemm_decision d;
+        qmkl_sgemm_last_decision(&d);
+        printf("%s chose %s (predicted qpu %g [s], cpu %g [s], hybrid %g [s] with %d rows on qpu)\n", qmkl_backend_name(qmkl_get_backend()), path_names[d.path], d.predicted_qpu, d.predicted_cpu, d.predicted_hybrid, d.m_qpu);
+    }
 
     printf("CPU (%d threads): ", omp_get_max_threads()); fflush(stdout);
     gettimeofday(&start, NULL);
@@ -326,6 +334,38 @@ int main()
     printf("Minimum relative error: %g\n", mf_minimum_relative_error(C_ref, C, P, R));
     printf("Maximum relative error: %g\n", mf_maximum_relative_error(C_ref, C, P, R));
 
+    if (qmkl_get_backend() != QMKL_BACKEND_CPU) {
+        const enum qmkl_backend backend = qmkl_get_backend();
+
+        qmkl_set_backend(QMKL_BACKEND_CPU);
+        printf("QMKL cpu backend (%d threads): ", omp_get_max_threads()); fflush(stdout);
+        gettimeofday(&start, NULL);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, P, R, Q, ALPHA, A_ref, Q, B_ref, R, BETA, C_host, R);
+        gettimeofday(&end, NULL);
+        printf("%g [s], %g [flop/s]\n", (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6, (2 * P * Q * R + 3 * P * R) / ((end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6));
+        qmkl_set_backend(backend);
+
+        printf("Minimum absolute error: %g\n", mf_minimum_absolute_error(C_ref, C_host, P, R));
+        printf("Maximum absolute error: %g\n", mf_maximum_absolute_error(C_ref, C_host, P, R));
+        printf("Minimum relative error: %g\n", mf_minimum_relative_error(C_ref, C_host, P, R));
+        printf("Maximum relative error: %g\n", mf_maximum_relative_error(C_ref, C_host, P, R));
+    }
+
+    if (qmkl_get_backend() != QMKL_BACKEND_CPU) {
+        /* With BETA = 0, C is invalidated rather than cleaned, and not scaled. */
+        double with_beta, without_beta;
+
+        gettimeofday(&start, NULL);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, P, R, Q, ALPHA, A, Q, B, R, 1, C, R);
+        gettimeofday(&end, NULL);
+        with_beta = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+        gettimeofday(&start, NULL);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, P, R, Q, ALPHA, A, Q, B, R, 0, C, R);
+        gettimeofday(&end, NULL);
+        without_beta = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+        printf("GPU with BETA = 1: %g [s], with BETA = 0: %g [s] (%g [s] saved)\n", with_beta, without_beta, with_beta - without_beta);
+    }
+
 #ifdef __ARM_NEON
     printf("CPU with NEON (%d threads): ", omp_get_max_threads()); fflush(stdout);
     gettimeofday(&start, NULL);
@@ -340,6 +380,7 @@ int main()
 
     free(C_neon);
 #endif /* __ARM_NEON */
+    free(C_host);
     free(C_ref);
     free(B_ref);
     free(A_ref);
@@ -1,14 +1,19 @@
 #include "config.h"
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #ifdef HAVE_PNG
 #include <png.h>
 #endif
 #include <sys/time.h>
 #include <omp.h>
+#include <pthread.h>
 #include <CUnit/Basic.h>
 #include <CUnit/Console.h>
 #include "mkl.h"
+#include "local/gemm.h"
 
 static double get_time() {
     struct timeval t;
@@ -46,6 +51,18 @@ static void suite_sgemm_RNT();
 static void suite_sgemm_RTN();
 static void suite_sgemm_RTT();
 static void suite_sgemm_with_mempool();
+static void suite_sgemm_layouts();
+static void suite_sgemm_plan();
+static void suite_sgemm_batch();
+static void suite_sgemm_pack();
+static void suite_sgemm_async();
+static void suite_sgemm_threads();
+static void suite_sgemm_kernels();
+static void suite_sgemm_partition();
+static void suite_sgemm_split_k();
+static void suite_sgemm_calibration();
+static void suite_sgemm_hybrid();
+static void suite_sgemm_gpu_only();
 
 int main() {
     CU_initialize_registry();
@@ -55,6 +72,18 @@ int main() {
     suite_sgemm_RTN();
     suite_sgemm_RTT();
     suite_sgemm_with_mempool();
+    suite_sgemm_layouts();
+    suite_sgemm_plan();
+    suite_sgemm_batch();
+    suite_sgemm_pack();
+    suite_sgemm_async();
+    suite_sgemm_threads();
+    suite_sgemm_kernels();
+    suite_sgemm_partition();
+    suite_sgemm_split_k();
+    suite_sgemm_calibration();
+    suite_sgemm_hybrid();
+    suite_sgemm_gpu_only();
 
     isatty(fileno(stdout)) ? CU_console_run_tests() : CU_basic_run_tests();
     const unsigned int result = CU_get_number_of_failures();
@@ -728,8 +757,34 @@ void test_sgemm_RTT_benchmark() {
     mkl_free(A);
 }
 
+static float sgemm_ref_max_abs_error(const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+                                     const int M, const int N, const int K, const float alpha,
+                                     const float* A, const float* B, const float beta,
+                                     const float* C_orig, const float* C) {
+    const int lda = transa == CblasNoTrans ? K : M;
+    const int ldb = transb == CblasNoTrans ? N : K;
+    float maximum_abs_error = 0;
+    int i, j, k;
+#pragma omp parallel for private(i, j, k) reduction(max: maximum_abs_error)
+    for (i = 0; i < M; ++i) {
+        for (j = 0; j < N; ++j) {
+            float acc = 0;
+            for (k = 0; k < K; ++k)
+                acc += (transa == CblasNoTrans ? A[i*lda+k] : A[k*lda+i])
+                     * (transb == CblasNoTrans ? B[k*ldb+j] : B[j*ldb+k]);
+            const float ref = alpha * acc + beta * C_orig[i*N+j];
+            if (maximum_abs_error < fabsf(ref - C[i*N+j]))
+                maximum_abs_error = fabsf(ref - C[i*N+j]);
+        }
+    }
+    return maximum_abs_error;
+}
+
 static void test_sgemm_with_mempool_ones();
 static void test_sgemm_with_mempool_randoms();
+static void test_sgemm_with_mempool_small_blocks();
+static void test_sgemm_with_mempool_translation();
+static void test_sgemm_with_mempool_services();
 
 int setup_suite_sgemm_with_mempool() {
     srand(0xDEADBEEF);
@@ -745,6 +800,9 @@ void suite_sgemm_with_mempool() {
 
     CU_add_test(suite, "ones", test_sgemm_with_mempool_ones);
     CU_add_test(suite, "randoms", test_sgemm_with_mempool_randoms);
+    CU_add_test(suite, "small blocks", test_sgemm_with_mempool_small_blocks);
+    CU_add_test(suite, "address translation", test_sgemm_with_mempool_translation);
+    CU_add_test(suite, "calloc, realloc and stats", test_sgemm_with_mempool_services);
 }
 
 static void test_sgemm_with_mempool_ones() {
@@ -855,3 +913,1765 @@ void test_sgemm_with_mempool_randoms() {
     free(A_ref);
     mkl_free(pool);
 }
+
+static void test_sgemm_with_mempool_small_blocks() {
+    // Many small operands, each its own mkl_malloc, so they share pool slabs.
+    enum {n_problems = 64};
+    float *A[n_problems], *B[n_problems], *C[n_problems], *C_orig[n_problems];
+    int M[n_problems], N[n_problems], K[n_problems];
+    float alpha[n_problems], beta[n_problems];
+    int round, p, i;
+    for (round = 0; round < 2; ++round) {
+        for (p = 0; p < n_problems; ++p) {
+            M[p] = 16 + rand() % 64;
+            N[p] = 16 + rand() % 64;
+            K[p] = 2 + rand() % 64;
+            alpha[p] = rand_float_in_range(-1.0, 1.0);
+            beta[p] = rand_float_in_range(-1.0, 1.0);
+            A[p] = mkl_malloc(M[p]*K[p]*sizeof(float), 64);
+            B[p] = mkl_malloc_randoms(K[p], N[p]);
+            C[p] = mkl_malloc(M[p]*N[p]*sizeof(float), 64);
+            CU_ASSERT_EQUAL((uintptr_t) A[p] % 64, 0);
+            CU_ASSERT_EQUAL((uintptr_t) B[p] % 4096, 0);
+            CU_ASSERT_EQUAL((uintptr_t) C[p] % 64, 0);
+            C_orig[p] = malloc(M[p]*N[p]*sizeof(float));
+            for (i = 0; i < M[p] * K[p]; ++i) A[p][i] = rand_float_in_range(-1.0, 1.0);
+            for (i = 0; i < M[p] * N[p]; ++i) C_orig[p][i] = C[p][i] = rand_float_in_range(-1.0, 1.0);
+        }
+        for (p = 0; p < n_problems; ++p)
+            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M[p], N[p], K[p],
+                        alpha[p], A[p], K[p], B[p], N[p], beta[p], C[p], N[p]);
+        for (p = 0; p < n_problems; ++p) {
+            CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(CblasNoTrans, CblasNoTrans,
+                        M[p], N[p], K[p], alpha[p], A[p], B[p], beta[p], C_orig[p], C[p]),
+                    0, 0.001);
+        }
+        // Free in an order different from allocation.
+        for (i = 0; i < n_problems; ++i) {
+            p = (i * 37) % n_problems;
+            free(C_orig[p]);
+            mkl_free(C[p]);
+            mkl_free(B[p]);
+            mkl_free(A[p]);
+        }
+        mkl_free_buffers();
+    }
+}
+
+static void test_sgemm_with_mempool_translation() {
+    // Interior pointers translate by their offset; unknown ones fail softly.
+    const int n = 100000;
+    float* pool = mkl_malloc(n*sizeof(float), 4096);
+    float* small = mkl_malloc(100*sizeof(float), 64);
+    float* host = malloc(n*sizeof(float));
+    uint32_t base, gpu;
+    CU_ASSERT_EQUAL(get_ptr_gpu_from_ptr_cpu_checked(host, &gpu), -1);
+    CU_ASSERT_EQUAL(gpu, 0);
+    if (get_ptr_gpu_from_ptr_cpu_checked(pool, &base) == 0) {
+        CU_ASSERT_EQUAL(get_ptr_gpu_from_ptr_cpu_checked(pool + n - 1, &gpu), 0);
+        CU_ASSERT_EQUAL(gpu, base + (n - 1) * sizeof(float));
+        CU_ASSERT_EQUAL(get_ptr_gpu_from_ptr_cpu(pool + 12345), base + 12345 * sizeof(float));
+        CU_ASSERT_EQUAL(get_ptr_gpu_from_ptr_cpu_checked(small, &base), 0);
+        CU_ASSERT_EQUAL(get_ptr_gpu_from_ptr_cpu_checked(small + 99, &gpu), 0);
+        CU_ASSERT_EQUAL(gpu, base + 99 * sizeof(float));
+    }
+    free(host);
+    mkl_free(small);
+    mkl_free(pool);
+}
+
+static void test_sgemm_with_mempool_services() {
+    // Large enough for mkl_calloc to zero it on QPU, with an odd tail.
+    const size_t n = 3 * 1024 * 1024 / sizeof(float) + 123;
+    int buffers_before, buffers;
+    const MKL_INT64 bytes_before = mkl_mem_stat(&buffers_before);
+    MKL_INT64 bytes, peak;
+    size_t i;
+    int zero = 1, kept = 1;
+
+    mkl_peak_mem_usage(MKL_PEAK_MEM_ENABLE);
+    float* x = mkl_malloc(n*sizeof(float), 4096);
+    for (i = 0; i < n; ++i) x[i] = 1;
+    mkl_free(x);
+    float* z = mkl_calloc(n, sizeof(float), 4096);
+    for (i = 0; i < n; ++i) zero &= z[i] == 0;
+    CU_ASSERT(zero);
+    bytes = mkl_mem_stat(&buffers);
+    CU_ASSERT_EQUAL(buffers, buffers_before + 1);
+    CU_ASSERT(bytes >= bytes_before + (MKL_INT64) (n*sizeof(float)));
+
+    float* small = mkl_malloc(100*sizeof(float), 64);
+    for (i = 0; i < 100; ++i) small[i] = i;
+    small = mkl_realloc(small, 100000*sizeof(float));
+    for (i = 0; i < 100; ++i) kept &= small[i] == i;
+    small = mkl_realloc(small, 50*sizeof(float));
+    for (i = 0; i < 50; ++i) kept &= small[i] == i;
+    CU_ASSERT(kept);
+    CU_ASSERT_EQUAL((uintptr_t) small % 64, 0);
+
+    peak = mkl_peak_mem_usage(MKL_PEAK_MEM);
+    CU_ASSERT(peak >= bytes + (MKL_INT64) (100000*sizeof(float)));
+    mkl_free(small);
+    mkl_free(z);
+    CU_ASSERT_EQUAL(mkl_mem_stat(&buffers), bytes_before);
+    CU_ASSERT_EQUAL(buffers, buffers_before);
+    CU_ASSERT_EQUAL(mkl_peak_mem_usage(MKL_PEAK_MEM_DISABLE), peak);
+    CU_ASSERT_EQUAL(mkl_peak_mem_usage(MKL_PEAK_MEM), -1);
+}
+
+static void test_sgemm_layouts_randoms();
+static void test_sgemm_layouts_fortran();
+static void test_sgemm_layouts_malloc();
+static void test_sgemm_layouts_window();
+static void test_sgemm_layouts_beta_zero();
+
+int setup_suite_sgemm_layouts() {
+    srand(0xDEADBEEF);
+    return 0;
+}
+
+int teardown_suite_sgemm_layouts() {
+    return 0;
+}
+
+void suite_sgemm_layouts() {
+    CU_pSuite suite = CU_add_suite("sgemm layouts", setup_suite_sgemm_layouts, teardown_suite_sgemm_layouts);
+
+    CU_add_test(suite, "randoms", test_sgemm_layouts_randoms);
+    CU_add_test(suite, "fortran ABI", test_sgemm_layouts_fortran);
+    CU_add_test(suite, "malloc arrays", test_sgemm_layouts_malloc);
+    CU_add_test(suite, "streaming window", test_sgemm_layouts_window);
+    CU_add_test(suite, "beta = 0 ignores C", test_sgemm_layouts_beta_zero);
+}
+
+void test_sgemm_layouts_randoms() {
+    const CBLAS_LAYOUT layouts[] = {CblasRowMajor, CblasColMajor};
+    const CBLAS_TRANSPOSE transes[] = {CblasNoTrans, CblasTrans};
+    int l, ta, tb;
+    for (l = 0; l < 2; ++l) {
+        for (ta = 0; ta < 2; ++ta) {
+            for (tb = 0; tb < 2; ++tb) {
+                const CBLAS_LAYOUT layout = layouts[l];
+                const CBLAS_TRANSPOSE transa = transes[ta];
+                const CBLAS_TRANSPOSE transb = transes[tb];
+                const int M = rand_int_in_range(1, 300);
+                const int N = rand_int_in_range(1, 300);
+                const int K = rand_int_in_range(2, 300);
+                // Whether op(A) and op(B) are stored row by row, and the rows and columns as stored.
+                const int a_by_rows = (layout == CblasRowMajor) == (transa == CblasNoTrans);
+                const int b_by_rows = (layout == CblasRowMajor) == (transb == CblasNoTrans);
+                const int a_rows = a_by_rows ? M : K, a_cols = a_by_rows ? K : M;
+                const int b_rows = b_by_rows ? K : N, b_cols = b_by_rows ? N : K;
+                const int c_rows = layout == CblasRowMajor ? M : N;
+                const int c_cols = layout == CblasRowMajor ? N : M;
+                const int lda = a_cols + 3, ldb = b_cols + 5, ldc = c_cols + 7;
+                float* A = mkl_malloc_randoms(a_rows, lda);
+                float* B = mkl_malloc_randoms(b_rows, ldb);
+                float* C = mkl_malloc_randoms(c_rows, ldc);
+                float* C_ref = malloc(c_rows*ldc*sizeof(float));
+                const float alpha = rand_float_in_range(-1.0, 1.0);
+                const float beta = rand_float_in_range(-1.0, 1.0);
+                int i, j, k;
+                memcpy(C_ref, C, c_rows*ldc*sizeof(float));
+                cblas_sgemm(layout, transa, transb, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+                // Element (i, j) of a matrix is at i * rs + j * cs.
+                const int c_rs = layout == CblasRowMajor ? ldc : 1, c_cs = layout == CblasRowMajor ? 1 : ldc;
+                const int a_rs = a_by_rows ? lda : 1, a_cs = a_by_rows ? 1 : lda;
+                const int b_rs = b_by_rows ? ldb : 1, b_cs = b_by_rows ? 1 : ldb;
+                float maximum_abs_error = 0;
+#pragma omp parallel for private(i, j, k) reduction(max: maximum_abs_error)
+                for (i = 0; i < M; ++i) {
+                    for (j = 0; j < N; ++j) {
+                        float acc = 0;
+                        for (k = 0; k < K; ++k)
+                            acc += A[i*a_rs+k*a_cs] * B[k*b_rs+j*b_cs];
+                        const float ref = alpha * acc + beta * C_ref[i*c_rs+j*c_cs];
+                        if (maximum_abs_error < fabsf(ref - C[i*c_rs+j*c_cs]))
+                            maximum_abs_error = fabsf(ref - C[i*c_rs+j*c_cs]);
+                    }
+                }
+                CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+                free(C_ref);
+                mkl_free(C);
+                mkl_free(B);
+                mkl_free(A);
+            }
+        }
+    }
+}
+
+void test_sgemm_layouts_fortran() {
+    // Column-major C = A^T B from both mkl_malloc and malloc memory.
+    const int M = 100;
+    const int N = 300;
+    const int K = 200;
+    const float alpha = rand_float_in_range(-1.0, 1.0);
+    const float beta = rand_float_in_range(-1.0, 1.0);
+    int from_malloc;
+    for (from_malloc = 0; from_malloc < 2; ++from_malloc) {
+        float* A = mkl_malloc_randoms(M, K);
+        float* B = mkl_malloc_randoms(N, K);
+        float* C = mkl_malloc_randoms(N, M);
+        float* C_ref = malloc(M*N*sizeof(float));
+        float* a = A;
+        float* b = B;
+        float* c = C;
+        int i, j, k;
+        memcpy(C_ref, C, M*N*sizeof(float));
+        if (from_malloc) {
+            a = malloc(M*K*sizeof(float));
+            b = malloc(K*N*sizeof(float));
+            c = malloc(M*N*sizeof(float));
+            memcpy(a, A, M*K*sizeof(float));
+            memcpy(b, B, K*N*sizeof(float));
+            memcpy(c, C, M*N*sizeof(float));
+        }
+        sgemm_("T", "N", &M, &N, &K, &alpha, a, &K, b, &K, &beta, c, &M);
+        float maximum_abs_error = 0;
+#pragma omp parallel for private(i, j, k) reduction(max: maximum_abs_error)
+        for (i = 0; i < M; ++i) {
+            for (j = 0; j < N; ++j) {
+                float acc = 0;
+                for (k = 0; k < K; ++k) acc += A[i*K+k] * B[j*K+k];
+                const float ref = alpha * acc + beta * C_ref[j*M+i];
+                if (maximum_abs_error < fabsf(ref - c[j*M+i]))
+                    maximum_abs_error = fabsf(ref - c[j*M+i]);
+            }
+        }
+        CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+        if (from_malloc) {
+            free(c);
+            free(b);
+            free(a);
+        }
+        free(C_ref);
+        mkl_free(C);
+        mkl_free(B);
+        mkl_free(A);
+    }
+}
+
+void test_sgemm_layouts_malloc() {
+    // A and C are not from mkl_malloc, so QPU gets them through bounce buffers.
+    const int M = 1000;
+    const int N = 200;
+    const int K = 300;
+    float* A = malloc(M*K*sizeof(float));
+    float* B = mkl_malloc_randoms(K, N);
+    float* C = malloc(M*N*sizeof(float));
+    float* C_ref = malloc(M*N*sizeof(float));
+    const float alpha = rand_float_in_range(-1.0, 1.0);
+    const float beta = rand_float_in_range(-1.0, 1.0);
+    int i, j, k;
+    for (i = 0; i < M * K; ++i) A[i] = rand_float_in_range(-1.0, 1.0);
+    for (i = 0; i < M * N; ++i) C_ref[i] = C[i] = rand_float_in_range(-1.0, 1.0);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, alpha, A, K, B, N, beta, C, N);
+    float maximum_abs_error = 0;
+#pragma omp parallel for private(i, j, k) reduction(max: maximum_abs_error)
+    for (i = 0; i < M; ++i) {
+        for (j = 0; j < N; ++j) {
+            float acc = 0;
+            for (k = 0; k < K; ++k) acc += A[i*K+k] * B[k*N+j];
+            const float ref = alpha * acc + beta * C_ref[i*N+j];
+            if (maximum_abs_error < fabsf(ref - C[i*N+j]))
+                maximum_abs_error = fabsf(ref - C[i*N+j]);
+        }
+    }
+    CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+    free(C_ref);
+    free(C);
+    mkl_free(B);
+    free(A);
+}
+
+void test_sgemm_layouts_window() {
+    // B is far larger than the window, so it streams in blocks of k and columns.
+    const int M = 300;
+    const int N = 500;
+    const int K = 700;
+    const size_t window = qmkl_sgemm_get_window();
+    float* A = malloc(M*K*sizeof(float));
+    float* B = malloc(N*K*sizeof(float));
+    float* C = malloc(M*N*sizeof(float));
+    float* C_orig = malloc(M*N*sizeof(float));
+    const float alpha = rand_float_in_range(-1.0, 1.0);
+    const float beta = rand_float_in_range(-1.0, 1.0);
+    int i;
+    for (i = 0; i < M * K; ++i) A[i] = rand_float_in_range(-1.0, 1.0);
+    for (i = 0; i < N * K; ++i) B[i] = rand_float_in_range(-1.0, 1.0);
+    for (i = 0; i < M * N; ++i) C_orig[i] = C[i] = rand_float_in_range(-1.0, 1.0);
+    qmkl_sgemm_set_window(64 * 1024);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, M, N, K, alpha, A, K, B, K, beta, C, N);
+    qmkl_sgemm_set_window(window);
+    CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(CblasNoTrans, CblasTrans, M, N, K,
+                alpha, A, B, beta, C_orig, C), 0, 0.001);
+    free(C_orig);
+    free(C);
+    free(B);
+    free(A);
+}
+
+void test_sgemm_layouts_beta_zero() {
+    // C starts as NaN, from mkl_malloc and (streamed) from malloc; BLAS must not read it.
+    const CBLAS_TRANSPOSE transes[] = {CblasNoTrans, CblasTrans};
+    const int M = 200;
+    const int N = 300;
+    const int K = 150;
+    float* A = mkl_malloc(M*K*sizeof(float), 4096);
+    float* B = mkl_malloc(N*K*sizeof(float), 4096);
+    float* C_gpu = mkl_malloc(M*N*sizeof(float), 4096);
+    float* C_host = malloc(M*N*sizeof(float));
+    float* zeros = calloc(M*N, sizeof(float));
+    const float alpha = rand_float_in_range(-1.0, 1.0);
+    int i, ta, tb, nan_left = 0;
+    for (i = 0; i < M * K; ++i) A[i] = rand_float_in_range(-1.0, 1.0);
+    for (i = 0; i < N * K; ++i) B[i] = rand_float_in_range(-1.0, 1.0);
+    for (ta = 0; ta < 2; ++ta) {
+        for (tb = 0; tb < 2; ++tb) {
+            const int lda = transes[ta] == CblasNoTrans ? K : M;
+            const int ldb = transes[tb] == CblasNoTrans ? N : K;
+            for (i = 0; i < M * N; ++i) C_gpu[i] = C_host[i] = NAN;
+            cblas_sgemm(CblasRowMajor, transes[ta], transes[tb], M, N, K,
+                        alpha, A, lda, B, ldb, 0, C_gpu, N);
+            cblas_sgemm(CblasRowMajor, transes[ta], transes[tb], M, N, K,
+                        alpha, A, lda, B, ldb, 0, C_host, N);
+            CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(transes[ta], transes[tb], M, N, K,
+                        alpha, A, B, 0, zeros, C_gpu), 0, 0.001);
+            CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(transes[ta], transes[tb], M, N, K,
+                        alpha, A, B, 0, zeros, C_host), 0, 0.001);
+            // The error above passes over NaN.
+            for (i = 0; i < M * N; ++i) nan_left |= isnan(C_gpu[i]) || isnan(C_host[i]);
+        }
+    }
+    CU_ASSERT(!nan_left);
+    free(zeros);
+    free(C_host);
+    mkl_free(C_gpu);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+static void test_sgemm_plan_randoms();
+static void test_sgemm_plan_benchmark();
+
+int setup_suite_sgemm_plan() {
+    srand(0xDEADBEEF);
+    return 0;
+}
+
+int teardown_suite_sgemm_plan() {
+    return 0;
+}
+
+void suite_sgemm_plan() {
+    CU_pSuite suite = CU_add_suite("sgemm plan", setup_suite_sgemm_plan, teardown_suite_sgemm_plan);
+
+    CU_add_test(suite, "randoms", test_sgemm_plan_randoms);
+    CU_add_test(suite, "benchmark", test_sgemm_plan_benchmark);
+}
+
+void test_sgemm_plan_randoms() {
+    const int M = 96;
+    const int N = 3072;
+    const int K = 363;
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K, N);
+    float* C = mkl_malloc_randoms(M, N);
+    float* C_ref = malloc(M*N*sizeof(float));
+    const float alpha = rand_float_in_range(-1.0, 1.0);
+    const float beta = rand_float_in_range(-1.0, 1.0);
+    qmkl_sgemm_plan_t plan = qmkl_sgemm_plan_create(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, alpha, A, K, B, N, beta, C, N);
+    int iter;
+    // The same plan sees new contents of A, B and C on each execution.
+    for (iter = 0; iter < 3; ++iter) {
+        int i, j, k;
+        for (i = 0; i < M * K; ++i) A[i] = rand_float_in_range(-1.0, 1.0);
+        for (i = 0; i < K * N; ++i) B[i] = rand_float_in_range(-1.0, 1.0);
+        for (i = 0; i < M * N; ++i) C_ref[i] = C[i] = rand_float_in_range(-1.0, 1.0);
+        qmkl_sgemm_plan_execute(plan);
+#pragma omp parallel for private(i, j, k)
+        for (i = 0; i < M; ++i) {
+            for (j = 0; j < N; ++j) {
+                float acc = 0;
+                for (k = 0; k < K; ++k) acc += A[i*K+k] * B[k*N+j];
+                C_ref[i*N+j] = alpha * acc + beta * C_ref[i*N+j];
+            }
+        }
+        float maximum_abs_error = 0;
+#pragma omp parallel for private(i, j) reduction(max: maximum_abs_error)
+        for (i = 0; i < M; ++i) {
+            for (j = 0; j < N; ++j) {
+                if (maximum_abs_error < fabsf(C_ref[i*N+j] - C[i*N+j]))
+                    maximum_abs_error = fabsf(C_ref[i*N+j] - C[i*N+j]);
+            }
+        }
+        CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+    }
+    qmkl_sgemm_plan_destroy(plan);
+    free(C_ref);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+void test_sgemm_plan_benchmark() {
+    const int M = 16;
+    const int N = 64;
+    const int K = 64;
+    const int n_iter = 1000;
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K, N);
+    float* C = mkl_malloc_randoms(M, N);
+    qmkl_sgemm_plan_t plan = qmkl_sgemm_plan_create(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1, A, K, B, N, 0, C, N);
+    int i;
+    printf("\nRNN: %dx%d * %dx%d, %d times\n", M, K, K, N, n_iter);
+    {
+        double start = get_time();
+        for (i = 0; i < n_iter; ++i)
+            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1, A, K, B, N, 0, C, N);
+        double elapsed_time = get_time() - start;
+        printf("cblas_sgemm: %9.6lf [usec/call]\n", elapsed_time / n_iter * 1e6);
+    }
+    {
+        double start = get_time();
+        for (i = 0; i < n_iter; ++i)
+            qmkl_sgemm_plan_execute(plan);
+        double elapsed_time = get_time() - start;
+        printf("plan:        %9.6lf [usec/call]\n", elapsed_time / n_iter * 1e6);
+    }
+    qmkl_sgemm_plan_destroy(plan);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+static void test_sgemm_batch_randoms();
+static void test_sgemm_batch_strided_randoms();
+static void test_sgemm_batch_benchmark();
+
+int setup_suite_sgemm_batch() {
+    srand(0xDEADBEEF);
+    return 0;
+}
+
+int teardown_suite_sgemm_batch() {
+    return 0;
+}
+
+void suite_sgemm_batch() {
+    CU_pSuite suite = CU_add_suite("sgemm batch", setup_suite_sgemm_batch, teardown_suite_sgemm_batch);
+
+    CU_add_test(suite, "randoms", test_sgemm_batch_randoms);
+    CU_add_test(suite, "strided randoms", test_sgemm_batch_strided_randoms);
+    CU_add_test(suite, "benchmark", test_sgemm_batch_benchmark);
+}
+
+void test_sgemm_batch_randoms() {
+    // Groups of different shapes and transposes, more problems than QPUs.
+    const int group_count = 4;
+    const MKL_INT group_size[] = {5, 1, 9, 3};
+    const CBLAS_TRANSPOSE transa[] = {CblasNoTrans, CblasNoTrans, CblasTrans, CblasTrans};
+    const CBLAS_TRANSPOSE transb[] = {CblasNoTrans, CblasTrans, CblasNoTrans, CblasTrans};
+    MKL_INT m[4], n[4], k[4], lda[4], ldb[4], ldc[4];
+    float alpha[4], beta[4];
+    const float* A[18];
+    const float* B[18];
+    float* C[18];
+    float* C_orig[18];
+    int g, i, j;
+    for (g = 0; g < group_count; ++g) {
+        m[g] = rand_int_in_range(1, 200);
+        n[g] = rand_int_in_range(1, 200);
+        k[g] = rand_int_in_range(2, 200);
+        lda[g] = transa[g] == CblasNoTrans ? k[g] : m[g];
+        ldb[g] = transb[g] == CblasNoTrans ? n[g] : k[g];
+        ldc[g] = n[g];
+        alpha[g] = rand_float_in_range(-1.0, 1.0);
+        beta[g] = rand_float_in_range(-1.0, 1.0);
+    }
+    for (g = 0, j = 0; g < group_count; ++g) {
+        for (i = 0; i < group_size[g]; ++i, ++j) {
+            A[j] = mkl_malloc_randoms(m[g], k[g]);
+            B[j] = mkl_malloc_randoms(k[g], n[g]);
+            C[j] = mkl_malloc_randoms(m[g], n[g]);
+            C_orig[j] = malloc(m[g]*n[g]*sizeof(float));
+            memcpy(C_orig[j], C[j], m[g]*n[g]*sizeof(float));
+        }
+    }
+    cblas_sgemm_batch(CblasRowMajor, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, group_count, group_size);
+    for (g = 0, j = 0; g < group_count; ++g) {
+        for (i = 0; i < group_size[g]; ++i, ++j) {
+            const float maximum_abs_error = sgemm_ref_max_abs_error(transa[g], transb[g], m[g], n[g], k[g],
+                                                                    alpha[g], A[j], B[j], beta[g], C_orig[j], C[j]);
+            CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+            free(C_orig[j]);
+            mkl_free(C[j]);
+            mkl_free((float*) B[j]);
+            mkl_free((float*) A[j]);
+        }
+    }
+}
+
+void test_sgemm_batch_strided_randoms() {
+    const int M = 32;
+    const int N = 64;
+    const int K = 48;
+    const int batch_size = 30;
+    float* A = mkl_malloc_randoms(batch_size * M, K);
+    float* B = mkl_malloc_randoms(batch_size * K, N);
+    float* C = mkl_malloc_randoms(batch_size * M, N);
+    float* C_orig = malloc(batch_size*M*N*sizeof(float));
+    const float alpha = rand_float_in_range(-1.0, 1.0);
+    const float beta = rand_float_in_range(-1.0, 1.0);
+    int i;
+    memcpy(C_orig, C, batch_size*M*N*sizeof(float));
+    cblas_sgemm_batch_strided(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K,
+                              alpha, A, K, M*K, B, N, K*N, beta, C, N, M*N, batch_size);
+    for (i = 0; i < batch_size; ++i) {
+        const float maximum_abs_error = sgemm_ref_max_abs_error(CblasNoTrans, CblasNoTrans, M, N, K, alpha,
+                                                                A + i*M*K, B + i*K*N, beta,
+                                                                C_orig + i*M*N, C + i*M*N);
+        CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+    }
+    free(C_orig);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+void test_sgemm_batch_benchmark() {
+    const int M = 16;
+    const int N = 64;
+    const int K = 64;
+    const int batch_size = 48;
+    const int n_iter = 100;
+    float* A = mkl_malloc_randoms(batch_size * M, K);
+    float* B = mkl_malloc_randoms(batch_size * K, N);
+    float* C = mkl_malloc_randoms(batch_size * M, N);
+    int i, iter;
+    printf("\nRNN: %dx%d * %dx%d, %d problems, %d times\n", M, K, K, N, batch_size, n_iter);
+    {
+        double start = get_time();
+        for (iter = 0; iter < n_iter; ++iter)
+            for (i = 0; i < batch_size; ++i)
+                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1,
+                            A + i*M*K, K, B + i*K*N, N, 0, C + i*M*N, N);
+        double elapsed_time = get_time() - start;
+        printf("cblas_sgemm loop:          %9.6lf [usec/problem]\n", elapsed_time / n_iter / batch_size * 1e6);
+    }
+    {
+        double start = get_time();
+        for (iter = 0; iter < n_iter; ++iter)
+            cblas_sgemm_batch_strided(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1,
+                                      A, K, M*K, B, N, K*N, 0, C, N, M*N, batch_size);
+        double elapsed_time = get_time() - start;
+        printf("cblas_sgemm_batch_strided: %9.6lf [usec/problem]\n", elapsed_time / n_iter / batch_size * 1e6);
+    }
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+static void test_sgemm_pack_randoms();
+static void test_sgemm_pack_uncached();
+static void test_sgemm_pack_mismatch();
+static void test_sgemm_pack_benchmark();
+
+int setup_suite_sgemm_pack() {
+    srand(0xDEADBEEF);
+    return 0;
+}
+
+int teardown_suite_sgemm_pack() {
+    return 0;
+}
+
+void suite_sgemm_pack() {
+    CU_pSuite suite = CU_add_suite("sgemm pack", setup_suite_sgemm_pack, teardown_suite_sgemm_pack);
+
+    CU_add_test(suite, "randoms", test_sgemm_pack_randoms);
+    CU_add_test(suite, "uncached C", test_sgemm_pack_uncached);
+    CU_add_test(suite, "mismatched shape", test_sgemm_pack_mismatch);
+    CU_add_test(suite, "benchmark", test_sgemm_pack_benchmark);
+}
+
+void test_sgemm_pack_randoms() {
+    // A, B or both packed, each from either transpose.
+    const int cases[][3] = {
+        {CblasNoTrans, CblasPacked, CblasNoTrans},
+        {CblasNoTrans, CblasPacked, CblasTrans},
+        {CblasTrans, CblasPacked, CblasNoTrans},
+        {CblasPacked, CblasNoTrans, CblasNoTrans},
+        {CblasPacked, CblasTrans, CblasTrans},
+        {CblasPacked, CblasPacked, CblasTrans},
+    };
+    int t;
+    for (t = 0; t < (int) (sizeof(cases) / sizeof(cases[0])); ++t) {
+        const int M = rand_int_in_range(1, 200);
+        const int N = rand_int_in_range(1, 200);
+        const int K = rand_int_in_range(2, 200);
+        // The transpose of the source of the packed operands.
+        const CBLAS_TRANSPOSE transa = cases[t][0] == CblasPacked ? (CBLAS_TRANSPOSE) cases[t][2] : (CBLAS_TRANSPOSE) cases[t][0];
+        const CBLAS_TRANSPOSE transb = cases[t][1] == CblasPacked ? (CBLAS_TRANSPOSE) cases[t][2] : (CBLAS_TRANSPOSE) cases[t][1];
+        const int lda = transa == CblasNoTrans ? K : M;
+        const int ldb = transb == CblasNoTrans ? N : K;
+        float* A = mkl_malloc_randoms(M, K);
+        float* B = mkl_malloc_randoms(K, N);
+        float* C = mkl_malloc_randoms(M, N);
+        float* C_orig = malloc(M*N*sizeof(float));
+        const float alpha = rand_float_in_range(-1.0, 1.0);
+        const float beta = rand_float_in_range(-1.0, 1.0);
+        float* A_packed = NULL;
+        float* B_packed = NULL;
+        memcpy(C_orig, C, M*N*sizeof(float));
+        if (cases[t][0] == CblasPacked) {
+            A_packed = mkl_malloc(cblas_sgemm_pack_get_size(CblasAMatrix, M, N, K), 64);
+            cblas_sgemm_pack(CblasRowMajor, CblasAMatrix, transa, M, N, K, alpha, A, lda, A_packed);
+        }
+        if (cases[t][1] == CblasPacked) {
+            B_packed = mkl_malloc(cblas_sgemm_pack_get_size(CblasBMatrix, M, N, K), 64);
+            // alpha is applied once when both are packed.
+            cblas_sgemm_pack(CblasRowMajor, CblasBMatrix, transb, M, N, K, A_packed ? 1 : alpha, B, ldb, B_packed);
+        }
+        cblas_sgemm_compute(CblasRowMajor, cases[t][0], cases[t][1], M, N, K,
+                            A_packed ? A_packed : A, lda, B_packed ? B_packed : B, ldb, beta, C, N);
+        const float maximum_abs_error = sgemm_ref_max_abs_error(transa, transb, M, N, K, alpha,
+                                                                A, B, beta, C_orig, C);
+        CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+        if (B_packed) mkl_free(B_packed);
+        if (A_packed) mkl_free(A_packed);
+        free(C_orig);
+        mkl_free(C);
+        mkl_free(B);
+        mkl_free(A);
+    }
+}
+
+void test_sgemm_pack_uncached() {
+    // QPU writes C, which the CPU reads without any cache operation.
+    const enum qmkl_backend backend = qmkl_get_backend();
+    const int M = 48;
+    const int N = 130;
+    const int K = 70;
+    const float alpha = 0.5, beta = -1.0;
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K, N);
+    float* C = qmkl_malloc_flags(M*N*sizeof(float), 4096, QMKL_MEM_UNCACHED);
+    float* C_orig = malloc(M*N*sizeof(float));
+    float* B_packed = mkl_malloc(cblas_sgemm_pack_get_size(CblasBMatrix, M, N, K), 64);
+    int i;
+    for (i = 0; i < M*N; ++i)
+        C_orig[i] = C[i] = rand_float_in_range(-1.0, 1.0);
+    qmkl_set_backend(QMKL_BACKEND_QPU);
+    cblas_sgemm_pack(CblasRowMajor, CblasBMatrix, CblasNoTrans, M, N, K, alpha, B, N, B_packed);
+    cblas_sgemm_compute(CblasRowMajor, CblasNoTrans, CblasPacked, M, N, K, A, K, B_packed, N, beta, C, N);
+    qmkl_set_backend(backend);
+    const float maximum_abs_error = sgemm_ref_max_abs_error(CblasNoTrans, CblasNoTrans, M, N, K, alpha,
+                                                            A, B, beta, C_orig, C);
+    CU_ASSERT_DOUBLE_EQUAL(maximum_abs_error, 0, 0.001);
+    mkl_free(B_packed);
+    free(C_orig);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+void test_sgemm_pack_mismatch() {
+    // An operand packed for another shape is reported and C is left as is.
+    const int M = 16;
+    const int N = 64;
+    const int K = 8;
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K + 1, N);
+    float* C = mkl_malloc_randoms(M, N);
+    float* C_orig = malloc(M*N*sizeof(float));
+    float* B_packed = mkl_malloc(cblas_sgemm_pack_get_size(CblasBMatrix, M, N, K + 1), 64);
+    memcpy(C_orig, C, M*N*sizeof(float));
+    cblas_sgemm_pack(CblasRowMajor, CblasBMatrix, CblasNoTrans, M, N, K + 1, 1, B, N, B_packed);
+    cblas_sgemm_compute(CblasRowMajor, CblasNoTrans, CblasPacked, M, N, K, A, K, B_packed, N, 0, C, N);
+    CU_ASSERT_EQUAL(memcmp(C, C_orig, M*N*sizeof(float)), 0);
+    cblas_sgemm_compute(CblasColMajor, CblasPacked, CblasNoTrans, N, M, K, B_packed, N, A, K, 0, C, N);
+    CU_ASSERT_EQUAL(memcmp(C, C_orig, M*N*sizeof(float)), 0);
+    mkl_free(B_packed);
+    free(C_orig);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+void test_sgemm_pack_benchmark() {
+    const int M = 96;
+    const int N = 1024;
+    const int K = 363;
+    const int n_iter = 100;
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K, N);
+    float* C = mkl_malloc_randoms(M, N);
+    float* B_packed = mkl_malloc(cblas_sgemm_pack_get_size(CblasBMatrix, M, N, K), 64);
+    int i;
+    cblas_sgemm_pack(CblasRowMajor, CblasBMatrix, CblasNoTrans, M, N, K, 1, B, N, B_packed);
+    printf("\nRNN: %dx%d * %dx%d, %d times\n", M, K, K, N, n_iter);
+    {
+        double start = get_time();
+        for (i = 0; i < n_iter; ++i)
+            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1, A, K, B, N, 0, C, N);
+        double elapsed_time = get_time() - start;
+        printf("cblas_sgemm:         %9.6lf [usec/call]\n", elapsed_time / n_iter * 1e6);
+    }
+    {
+        double start = get_time();
+        for (i = 0; i < n_iter; ++i)
+            cblas_sgemm_compute(CblasRowMajor, CblasNoTrans, CblasPacked, M, N, K, A, K, B_packed, N, 0, C, N);
+        double elapsed_time = get_time() - start;
+        printf("cblas_sgemm_compute: %9.6lf [usec/call]\n", elapsed_time / n_iter * 1e6);
+    }
+    mkl_free(B_packed);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+}
+
+static void test_sgemm_async_randoms();
+static void test_sgemm_async_vsAbs();
+static void test_sgemm_async_dependencies();
+static void test_sgemm_async_kernels();
+
+int setup_suite_sgemm_async() {
+    srand(0xDEADBEEF);
+    return 0;
+}
+
+int teardown_suite_sgemm_async() {
+    return 0;
+}
+
+void suite_sgemm_async() {
+    CU_pSuite suite = CU_add_suite("sgemm async", setup_suite_sgemm_async, teardown_suite_sgemm_async);
+
+    CU_add_test(suite, "randoms", test_sgemm_async_randoms);
+    CU_add_test(suite, "vsAbs", test_sgemm_async_vsAbs);
+    CU_add_test(suite, "dependencies", test_sgemm_async_dependencies);
+    CU_add_test(suite, "kernels", test_sgemm_async_kernels);
+}
+
+static void count_completion(qmkl_request_t request, void *arg) {
+    (void) request;
+    __atomic_add_fetch((int*) arg, 1, __ATOMIC_RELAXED);
+}
+
+void test_sgemm_async_randoms() {
+    // More requests than the queue holds, released by wait, test and after wait_all.
+    enum { n_requests = 40 };
+    const int M = 100;
+    const int N = 150;
+    const int K = 80;
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K, N);
+    float* C[n_requests];
+    float* C_orig[n_requests];
+    float alpha[n_requests], beta[n_requests];
+    qmkl_request_t requests[n_requests];
+    int i, completed = 0;
+    for (i = 0; i < n_requests; ++i) {
+        C[i] = i % 2 ? mkl_malloc_randoms(M, N) : malloc(M*N*sizeof(float));
+        if (i % 2 == 0) {
+            int j;
+            for (j = 0; j < M * N; ++j) C[i][j] = rand_float_in_range(-1.0, 1.0);
+        }
+        C_orig[i] = malloc(M*N*sizeof(float));
+        memcpy(C_orig[i], C[i], M*N*sizeof(float));
+        alpha[i] = rand_float_in_range(-1.0, 1.0);
+        beta[i] = rand_float_in_range(-1.0, 1.0);
+        requests[i] = cblas_sgemm_async(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K,
+                                        alpha[i], A, K, B, N, beta[i], C[i], N);
+        qmkl_request_on_complete(requests[i], count_completion, &completed);
+    }
+    for (i = 0; i < n_requests / 2; ++i)
+        qmkl_wait(requests[i]);
+    qmkl_wait_all();
+    CU_ASSERT_EQUAL(completed, n_requests);
+    for (i = n_requests / 2; i < n_requests; ++i)
+        CU_ASSERT(qmkl_test(requests[i]));
+    for (i = 0; i < n_requests; ++i) {
+        CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(CblasNoTrans, CblasNoTrans, M, N, K,
+                    alpha[i], A, B, beta[i], C_orig[i], C[i]), 0, 0.001);
+        free(C_orig[i]);
+        if (i % 2)
+            mkl_free(C[i]);
+        else
+            free(C[i]);
+    }
+    mkl_free(B);
+    mkl_free(A);
+}
+
+void test_sgemm_async_vsAbs() {
+    // Host work overlaps the call; the result is checked once it completes.
+    const int n = 768 * 64;
+    float* a = mkl_malloc_randoms(1, n);
+    float* y = mkl_malloc(n*sizeof(float), 4096);
+    float* host = malloc(n*sizeof(float));
+    qmkl_request_t request = vsAbs_async(n, a, y);
+    int i, ok = 1;
+    for (i = 0; i < n; ++i) host[i] = fabsf(a[i]);
+    while (!qmkl_test(request))
+        ;
+    for (i = 0; i < n; ++i) ok &= y[i] == host[i];
+    CU_ASSERT(ok);
+    free(host);
+    mkl_free(y);
+    mkl_free(a);
+}
+
+static void sgemm_async_chain(const int async, const int N, float* const* X,
+                              const float* A, const float* B) {
+    // Runs of requests that the submission thread may coalesce, with some
+    // reading or writing what an earlier one of the run writes.
+    qmkl_request_t requests[9];
+    int n = 0, i;
+#define CALL(layout, transa, alpha, a, b, beta, c) \
+    if (async) \
+        requests[n++] = cblas_sgemm_async(layout, transa, CblasNoTrans, N, N, N, \
+                                          alpha, a, N, b, N, beta, c, N); \
+    else \
+        cblas_sgemm(layout, transa, CblasNoTrans, N, N, N, alpha, a, N, b, N, beta, c, N)
+    CALL(CblasRowMajor, CblasNoTrans, 1.0, X[4], X[4], 0.0, X[5]);
+    CALL(CblasRowMajor, CblasNoTrans, 1.0, A, B, 0.0, X[0]);
+    CALL(CblasRowMajor, CblasTrans, 0.5, A, B, 0.5, X[1]);
+    CALL(CblasRowMajor, CblasNoTrans, 1.0, X[0], B, 0.0, X[2]);
+    CALL(CblasRowMajor, CblasNoTrans, 0.1, X[1], X[1], 1.0, X[0]);
+    CALL(CblasColMajor, CblasNoTrans, 1.0, A, X[2], 0.0, X[3]);
+    if (async)
+        requests[n++] = vsAbs_async(N * N, X[3], X[1]);
+    else
+        vsAbs(N * N, X[3], X[1]);
+    CALL(CblasRowMajor, CblasNoTrans, 1.0, X[1], B, 0.0, X[2]);
+    CALL(CblasRowMajor, CblasTrans, 1.0, A, B, -1.0, X[3]);
+#undef CALL
+    for (i = 0; i < n; ++i)
+        qmkl_wait(requests[i]);
+}
+
+void test_sgemm_async_dependencies() {
+    // The first, larger request lets the others queue up behind it.
+    const int N = 96;
+    const int big = 384;
+    float* A = mkl_malloc_randoms(N, N);
+    float* B = mkl_malloc_randoms(N, N);
+    float* X[2][6];
+    float max_abs_error = 0;
+    int r, i, j;
+    for (r = 0; r < 2; ++r) {
+        for (i = 0; i < 4; ++i) {
+            X[r][i] = i == 3 ? malloc(N*N*sizeof(float)) : mkl_malloc(N*N*sizeof(float), 4096);
+            for (j = 0; j < N * N; ++j) X[r][i][j] = 1.0;
+        }
+        X[r][4] = mkl_malloc_randoms(big, big);
+        X[r][5] = mkl_malloc(big*big*sizeof(float), 4096);
+    }
+    for (r = 0; r < 2; ++r)
+        sgemm_async_chain(r, N, X[r], A, B);
+    for (i = 0; i < 4; ++i)
+        for (j = 0; j < N * N; ++j)
+            if (max_abs_error < fabsf(X[0][i][j] - X[1][i][j]) / (1 + fabsf(X[0][i][j])))
+                max_abs_error = fabsf(X[0][i][j] - X[1][i][j]) / (1 + fabsf(X[0][i][j]));
+    CU_ASSERT_DOUBLE_EQUAL(max_abs_error, 0, 0.001);
+    for (r = 0; r < 2; ++r) {
+        for (i = 0; i < 6; ++i) {
+            if (i == 3)
+                free(X[r][i]);
+            else
+                mkl_free(X[r][i]);
+        }
+    }
+    mkl_free(B);
+    mkl_free(A);
+}
+
+void test_sgemm_async_kernels() {
+    // The first, larger request lets an sgemm, a vsAbs and a scopy queue up
+    // behind it, which then share a launch on QPU.
+    const enum qmkl_backend backend = qmkl_get_backend();
+    const int big = 384;
+    const int N = 96;
+    const int n = 768 * 16;
+    float* X = mkl_malloc_randoms(big, big);
+    float* Y = mkl_malloc(big*big*sizeof(float), 4096);
+    float* A = mkl_malloc_randoms(N, N);
+    float* B = mkl_malloc_randoms(N, N);
+    float* C = mkl_malloc(N*N*sizeof(float), 4096);
+    float* zeros = calloc(big*big, sizeof(float));
+    float* a = mkl_malloc_randoms(1, n);
+    float* y_abs = mkl_malloc(n*sizeof(float), 4096);
+    float* y_copy = mkl_malloc(n*sizeof(float), 4096);
+    qmkl_request_t requests[4];
+    int i, ok_abs = 1, ok_copy = 1;
+    if (qmkl_backend_available(QMKL_BACKEND_QPU))
+        qmkl_set_backend(QMKL_BACKEND_QPU);
+    requests[0] = cblas_sgemm_async(CblasRowMajor, CblasNoTrans, CblasNoTrans, big, big, big,
+                                    1.0, X, big, X, big, 0.0, Y, big);
+    requests[1] = vsAbs_async(n, a, y_abs);
+    requests[2] = cblas_sgemm_async(CblasRowMajor, CblasNoTrans, CblasTrans, N, N, N,
+                                    1.0, A, N, B, N, 0.0, C, N);
+    requests[3] = cblas_scopy_async(n, a, 1, y_copy, 1);
+    for (i = 0; i < 4; ++i)
+        qmkl_wait(requests[i]);
+    qmkl_set_backend(backend);
+    for (i = 0; i < n; ++i) {
+        ok_abs &= y_abs[i] == fabsf(a[i]);
+        ok_copy &= y_copy[i] == a[i];
+    }
+    CU_ASSERT(ok_abs);
+    CU_ASSERT(ok_copy);
+    CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(CblasNoTrans, CblasTrans, N, N, N,
+                1.0, A, B, 0.0, zeros, C), 0, 0.001);
+    CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(CblasNoTrans, CblasNoTrans, big, big, big,
+                1.0, X, X, 0.0, zeros, Y), 0, 0.01);
+    mkl_free(y_copy);
+    mkl_free(y_abs);
+    mkl_free(a);
+    free(zeros);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+    mkl_free(Y);
+    mkl_free(X);
+}
+
+static void test_sgemm_threads_concurrent();
+
+int setup_suite_sgemm_threads() {
+    srand(0xDEADBEEF);
+    return 0;
+}
+
+int teardown_suite_sgemm_threads() {
+    return 0;
+}
+
+void suite_sgemm_threads() {
+    CU_pSuite suite = CU_add_suite("sgemm threads", setup_suite_sgemm_threads, teardown_suite_sgemm_threads);
+
+    CU_add_test(suite, "concurrent", test_sgemm_threads_concurrent);
+}
+
+struct sgemm_thread_args {
+    CBLAS_TRANSPOSE transa, transb;
+    int M, N, K, staged;
+    float alpha, beta;
+    const float *A, *B;
+    float *C[4], *C_orig;
+    float max_abs_error;
+};
+
+static void* sgemm_thread(void* arg) {
+    // Each thread makes its own calls and checks them, staged or in place.
+    struct sgemm_thread_args* t = arg;
+    const int lda = t->transa == CblasNoTrans ? t->K : t->M;
+    const int ldb = t->transb == CblasNoTrans ? t->N : t->K;
+    int i;
+    t->max_abs_error = 0;
+    for (i = 0; i < 4; ++i) {
+        float error;
+        memcpy(t->C[i], t->C_orig, t->M*t->N*sizeof(float));
+        cblas_sgemm(CblasRowMajor, t->transa, t->transb, t->M, t->N, t->K,
+                    t->alpha, t->A, lda, t->B, ldb, t->beta, t->C[i], t->N);
+        error = sgemm_ref_max_abs_error(t->transa, t->transb, t->M, t->N, t->K,
+                                        t->alpha, t->A, t->B, t->beta, t->C_orig, t->C[i]);
+        if (t->max_abs_error < error)
+            t->max_abs_error = error;
+    }
+    return NULL;
+}
+
+void test_sgemm_threads_concurrent() {
+    // Threads call at once, with an asynchronous vsAbs also running.
+    enum { n_threads = 4 };
+    const int n = 768 * 64;
+    struct sgemm_thread_args args[n_threads];
+    pthread_t threads[n_threads];
+    float* a = mkl_malloc_randoms(1, n);
+    float* y = mkl_malloc(n*sizeof(float), 4096);
+    qmkl_request_t request;
+    int i, j, ok = 1;
+    for (i = 0; i < n_threads; ++i) {
+        struct sgemm_thread_args* t = &args[i];
+        t->transa = i & 1 ? CblasTrans : CblasNoTrans;
+        t->transb = i & 2 ? CblasTrans : CblasNoTrans;
+        t->M = rand_int_in_range(64, 200);
+        t->N = rand_int_in_range(64, 200);
+        t->K = rand_int_in_range(2, 200);
+        t->staged = i == n_threads - 1;
+        t->alpha = rand_float_in_range(-1.0, 1.0);
+        t->beta = rand_float_in_range(-1.0, 1.0);
+        t->A = mkl_malloc_randoms(t->M, t->K);
+        t->B = mkl_malloc_randoms(t->K, t->N);
+        t->C_orig = mkl_malloc_randoms(t->M, t->N);
+        for (j = 0; j < 4; ++j)
+            t->C[j] = t->staged ? malloc(t->M*t->N*sizeof(float))
+                                : mkl_malloc(t->M*t->N*sizeof(float), 4096);
+    }
+    request = vsAbs_async(n, a, y);
+    for (i = 0; i < n_threads; ++i)
+        pthread_create(&threads[i], NULL, sgemm_thread, &args[i]);
+    for (i = 0; i < n_threads; ++i)
+        pthread_join(threads[i], NULL);
+    qmkl_wait(request);
+    for (i = 0; i < n; ++i) ok &= y[i] == fabsf(a[i]);
+    CU_ASSERT(ok);
+    for (i = 0; i < n_threads; ++i) {
+        struct sgemm_thread_args* t = &args[i];
+        CU_ASSERT_DOUBLE_EQUAL(t->max_abs_error, 0, 0.001);
+        for (j = 0; j < 4; ++j) {
+            if (t->staged)
+                free(t->C[j]);
+            else
+                mkl_free(t->C[j]);
+        }
+        mkl_free(t->C_orig);
+        mkl_free((float*) t->B);
+        mkl_free((float*) t->A);
+    }
+    mkl_free(y);
+    mkl_free(a);
+}
+
+static void test_sgemm_kernels_epilogues();
+static void test_sgemm_kernels_narrow();
+
+static enum qmkl_backend backend_before_kernels;
+
+int setup_suite_sgemm_kernels() {
+    srand(0xDEADBEEF);
+    // Small shapes would go to the CPU otherwise, as they all do without QPU.
+    backend_before_kernels = qmkl_get_backend();
+    if (!qmkl_backend_available(QMKL_BACKEND_QPU))
+        return 0;
+    return qmkl_set_backend(QMKL_BACKEND_QPU);
+}
+
+int teardown_suite_sgemm_kernels() {
+    return qmkl_set_backend(backend_before_kernels);
+}
+
+void suite_sgemm_kernels() {
+    CU_pSuite suite = CU_add_suite("sgemm kernels", setup_suite_sgemm_kernels, teardown_suite_sgemm_kernels);
+
+    CU_add_test(suite, "epilogues", test_sgemm_kernels_epilogues);
+    CU_add_test(suite, "narrow tiles", test_sgemm_kernels_narrow);
+}
+
+static float sgemm_kernels_check(const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+                                 const int M, const int N, const int K,
+                                 const float alpha, const float beta) {
+    // C is NaN for beta = 0, which no kernel may let through.
+    const int lda = transa == CblasNoTrans ? K : M;
+    const int ldb = transb == CblasNoTrans ? N : K;
+    float* A = mkl_malloc_randoms(transa == CblasNoTrans ? M : K, lda);
+    float* B = mkl_malloc_randoms(transb == CblasNoTrans ? K : N, ldb);
+    float* C = mkl_malloc_randoms(M, N);
+    float* C_orig = malloc(M*N*sizeof(float));
+    float error;
+    int i;
+    memcpy(C_orig, C, M*N*sizeof(float));
+    if (beta == 0)
+        for (i = 0; i < M * N; ++i) C[i] = NAN;
+    cblas_sgemm(CblasRowMajor, transa, transb, M, N, K, alpha, A, lda, B, ldb, beta, C, N);
+    error = sgemm_ref_max_abs_error(transa, transb, M, N, K, alpha, A, B, beta, C_orig, C);
+    for (i = 0; i < M * N; ++i)
+        if (isnan(C[i])) error = INFINITY;
+    free(C_orig);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+    return error;
+}
+
+void test_sgemm_kernels_epilogues() {
+    // Each of alpha * AB + beta * C, alpha * AB, AB and AB + C.
+    const CBLAS_TRANSPOSE transes[] = {CblasNoTrans, CblasTrans};
+    const float alphas[] = {rand_float_in_range(-1.0, 1.0), rand_float_in_range(-1.0, 1.0), 1, 1};
+    const float betas[] = {rand_float_in_range(-1.0, 1.0), 0, 0, 1};
+    int ta, tb, e;
+    for (ta = 0; ta < 2; ++ta) {
+        for (tb = 0; tb < 2; ++tb) {
+            for (e = 0; e < 4; ++e) {
+                const int M = rand_int_in_range(1, 200);
+                const int N = rand_int_in_range(1, 200);
+                const int K = rand_int_in_range(2, 200);
+                CU_ASSERT_DOUBLE_EQUAL(sgemm_kernels_check(transes[ta], transes[tb], M, N, K,
+                            alphas[e], betas[e]), 0, 0.001);
+            }
+        }
+    }
+}
+
+void test_sgemm_kernels_narrow() {
+    // C narrower than the kernel tile, in the dimension the tile is wide in.
+    const CBLAS_TRANSPOSE transes[] = {CblasNoTrans, CblasTrans};
+    int ta, tb, i;
+    for (ta = 0; ta < 2; ++ta) {
+        for (tb = 0; tb < 2; ++tb) {
+            for (i = 0; i < 3; ++i) {
+                const int tt = transes[ta] != CblasNoTrans && transes[tb] != CblasNoTrans;
+                const int narrow = rand_int_in_range(1, 32);
+                const int wide = rand_int_in_range(32, 300);
+                const int K = rand_int_in_range(2, 200);
+                const float alpha = i == 0 ? 1 : rand_float_in_range(-1.0, 1.0);
+                const float beta = i == 2 ? rand_float_in_range(-1.0, 1.0) : 0;
+                CU_ASSERT_DOUBLE_EQUAL(sgemm_kernels_check(transes[ta], transes[tb],
+                            tt ? narrow : wide, tt ? wide : narrow, K, alpha, beta), 0, 0.001);
+            }
+        }
+    }
+}
+
+static void test_sgemm_partition_coverage();
+static void test_sgemm_partition_balance();
+static void test_sgemm_partition_split_k();
+
+static const unsigned sgemm_partition_tiles[][2] = {{16, 64}, {16, 32}, {64, 16}, {32, 16}};
+
+int setup_suite_sgemm_partition() {
+    return 0;
+}
+
+int teardown_suite_sgemm_partition() {
+    return 0;
+}
+
+void suite_sgemm_partition() {
+    CU_pSuite suite = CU_add_suite("sgemm partition", setup_suite_sgemm_partition, teardown_suite_sgemm_partition);
+
+    CU_add_test(suite, "coverage", test_sgemm_partition_coverage);
+    CU_add_test(suite, "balance", test_sgemm_partition_balance);
+    CU_add_test(suite, "split k", test_sgemm_partition_split_k);
+}
+
+void test_sgemm_partition_coverage() {
+    // The blocks start on tiles and cover C once, on host only.
+    const unsigned lens[] = {1, 15, 16, 17, 40, 63, 64, 65, 100, 191, 300, 1000};
+    const int n_lens = sizeof(lens) / sizeof(lens[0]);
+    unsigned char* covered = malloc(1000 * 1000);
+    int t, a, b, ok = 1;
+    unsigned max_threads, th, i, rows, j, cols, x, y;
+    for (t = 0; t < 4; ++t) {
+        for (a = 0; a < n_lens; ++a) {
+            for (b = 0; b < n_lens; ++b) {
+                for (max_threads = 1; max_threads <= SGEMM_QPU_MAX_THREADS; ++max_threads) {
+                    const unsigned m = lens[a], n = lens[b];
+                    struct sgemm_partition part;
+                    unsigned n_threads;
+                    sgemm_partition(&part, m, n, 100, sgemm_partition_tiles[t][0],
+                                    sgemm_partition_tiles[t][1], max_threads, 0);
+                    n_threads = part.p_div * part.r_div;
+                    ok &= 1 <= n_threads && n_threads <= max_threads;
+                    memset(covered, 0, m * n);
+                    for (th = 0; th < n_threads; ++th) {
+                        sgemm_partition_block(&part, th, &i, &rows, &j, &cols);
+                        ok &= rows != 0 && cols != 0;
+                        ok &= i % part.tile_p == 0 && j % part.tile_r == 0;
+                        ok &= i + rows <= m && j + cols <= n;
+                        for (y = i; y < i + rows && y < m; ++y)
+                            for (x = j; x < j + cols && x < n; ++x)
+                                covered[y * n + x] ++;
+                    }
+                    for (x = 0; x < m * n; ++x) ok &= covered[x] == 1;
+                }
+            }
+        }
+    }
+    CU_ASSERT(ok);
+    free(covered);
+}
+
+// Largest block of the partition in tiles.
+static unsigned sgemm_partition_max_tiles(const struct sgemm_partition* part) {
+    unsigned i, rows, j, cols;
+    sgemm_partition_block(part, 0, &i, &rows, &j, &cols);
+    return ((rows + part->tile_p - 1) / part->tile_p) * ((cols + part->tile_r - 1) / part->tile_r);
+}
+
+void test_sgemm_partition_balance() {
+    // Blocks differ by at most a tile in each dimension, and no partition
+    // is slower than the split of the wide dimension into 6, 4, 3, 2 or 1
+    // and of the other one into the threads left that it replaced.
+    static const unsigned dws[] = {6, 4, 3, 2, 1};
+    int t, s, d, ok = 1, no_slower = 1;
+    unsigned th, i, rows, j, cols, rows0, cols0;
+    for (t = 0; t < 4; ++t) {
+        for (s = 0; s < 500; ++s) {
+            const unsigned m = rand_int_in_range(1, 1024), n = rand_int_in_range(1, 1024);
+            const unsigned max_threads = rand_int_in_range(1, SGEMM_QPU_MAX_THREADS);
+            const unsigned tp = sgemm_partition_tiles[t][0], tr = sgemm_partition_tiles[t][1];
+            const int wide_m = tp > tr;
+            const unsigned len_w = wide_m ? m : n, tile_w = wide_m ? tp : tr;
+            const unsigned len_h = wide_m ? n : m, tile_h = wide_m ? tr : tp;
+            struct sgemm_partition part, greedy;
+            unsigned dw, dh;
+            sgemm_partition(&part, m, n, 100, tp, tr, max_threads, 0);
+            sgemm_partition_block(&part, 0, &i, &rows0, &j, &cols0);
+            for (th = 1; th < part.p_div * part.r_div; ++th) {
+                sgemm_partition_block(&part, th, &i, &rows, &j, &cols);
+                ok &= rows <= rows0 && rows0 - rows < 2 * tp;
+                ok &= cols <= cols0 && cols0 - cols < 2 * tr;
+            }
+            for (d = 0; dws[d] != 1; ++d)
+                if (dws[d] <= max_threads && len_w >= dws[d] * tile_w)
+                    break;
+            dw = dws[d];
+            for (dh = max_threads / dw; 2 <= dh; --dh)
+                if (len_h >= dh * tile_h) break;
+            greedy = part;
+            greedy.p_div = wide_m ? dw : dh;
+            greedy.r_div = wide_m ? dh : dw;
+            no_slower &= sgemm_partition_cycles(&part) <= sgemm_partition_cycles(&greedy);
+        }
+    }
+    CU_ASSERT(ok);
+    CU_ASSERT(no_slower);
+
+    // 48 x 1000: 3 x 16 tiles of 16 x 64 go 4 a thread to all 12 threads.
+    {
+        struct sgemm_partition part;
+        sgemm_partition(&part, 48, 1000, 100, 16, 64, SGEMM_QPU_MAX_THREADS, 0);
+        CU_ASSERT_EQUAL(part.p_div * part.r_div, SGEMM_QPU_MAX_THREADS);
+        CU_ASSERT_EQUAL(sgemm_partition_max_tiles(&part), 4);
+    }
+}
+
+void test_sgemm_partition_split_k() {
+    // 16 x 100 has 2 tiles of 16 x 64: k in 6 slices feeds all 12 threads,
+    // which deal out k evenly.  C of 48 tiles is not split.
+    struct sgemm_partition part;
+    unsigned th, l, depth, next = 0;
+    int ok = 1;
+    sgemm_partition(&part, 16, 100, 4096, 16, 64, SGEMM_QPU_MAX_THREADS, 0);
+    CU_ASSERT_EQUAL(sgemm_partition_threads(&part), 2);
+    sgemm_partition(&part, 16, 100, 4096, 16, 64, SGEMM_QPU_MAX_THREADS, 1);
+    CU_ASSERT_EQUAL(sgemm_partition_threads(&part), SGEMM_QPU_MAX_THREADS);
+    CU_ASSERT_EQUAL(part.k_div, 6);
+    for (th = 0; th < sgemm_partition_threads(&part); th += part.p_div * part.r_div) {
+        CU_ASSERT_EQUAL(sgemm_partition_slice(&part, th, &l, &depth), th / 2);
+        ok &= l == next && (depth == 4096 / 6 || depth == 4096 / 6 + 1);
+        next = l + depth;
+    }
+    CU_ASSERT(ok);
+    CU_ASSERT_EQUAL(next, 4096);
+    sgemm_partition(&part, 48, 1000, 4096, 16, 64, SGEMM_QPU_MAX_THREADS, 1);
+    CU_ASSERT_EQUAL(part.k_div, 1);
+}
+
+static void test_sgemm_split_k_small_c();
+static void test_sgemm_split_k_concurrent();
+
+static enum qmkl_backend backend_before_split_k;
+
+int setup_suite_sgemm_split_k() {
+    srand(0xDEADBEEF);
+    backend_before_split_k = qmkl_get_backend();
+    if (!qmkl_backend_available(QMKL_BACKEND_QPU))
+        return 0;
+    return qmkl_set_backend(QMKL_BACKEND_QPU);
+}
+
+int teardown_suite_sgemm_split_k() {
+    return qmkl_set_backend(backend_before_split_k);
+}
+
+void suite_sgemm_split_k() {
+    CU_pSuite suite = CU_add_suite("sgemm split k", setup_suite_sgemm_split_k, teardown_suite_sgemm_split_k);
+
+    CU_add_test(suite, "small C", test_sgemm_split_k_small_c);
+    CU_add_test(suite, "concurrent", test_sgemm_split_k_concurrent);
+}
+
+void test_sgemm_split_k_small_c() {
+    // Fully-connected layers: a few rows of C, k in the thousands.
+    const CBLAS_TRANSPOSE transes[] = {CblasNoTrans, CblasTrans};
+    int ta, tb;
+    for (ta = 0; ta < 2; ++ta) {
+        for (tb = 0; tb < 2; ++tb) {
+            const int M = rand_int_in_range(1, 16);
+            const int N = rand_int_in_range(80, 120);
+            const int K = rand_int_in_range(1000, 3000);
+            const float alpha = rand_float_in_range(-1.0, 1.0);
+            const float beta = ta == tb ? 0 : rand_float_in_range(-1.0, 1.0);
+            CU_ASSERT_DOUBLE_EQUAL(sgemm_kernels_check(transes[ta], transes[tb],
+                        M, N, K, alpha, beta), 0, 0.01);
+        }
+    }
+}
+
+void test_sgemm_split_k_concurrent() {
+    // Threads split k at once, each summing in a scratch of its own.
+    enum { n_threads = 4 };
+    struct sgemm_thread_args args[n_threads];
+    pthread_t threads[n_threads];
+    int i, j;
+    for (i = 0; i < n_threads; ++i) {
+        struct sgemm_thread_args* t = &args[i];
+        t->transa = i & 1 ? CblasTrans : CblasNoTrans;
+        t->transb = i & 2 ? CblasTrans : CblasNoTrans;
+        t->M = rand_int_in_range(1, 16);
+        t->N = rand_int_in_range(80, 120);
+        t->K = rand_int_in_range(500, 1500);
+        t->staged = 0;
+        t->alpha = rand_float_in_range(-1.0, 1.0);
+        t->beta = rand_float_in_range(-1.0, 1.0);
+        t->A = mkl_malloc_randoms(t->M, t->K);
+        t->B = mkl_malloc_randoms(t->K, t->N);
+        t->C_orig = mkl_malloc_randoms(t->M, t->N);
+        for (j = 0; j < 4; ++j)
+            t->C[j] = mkl_malloc(t->M*t->N*sizeof(float), 4096);
+    }
+    for (i = 0; i < n_threads; ++i)
+        pthread_create(&threads[i], NULL, sgemm_thread, &args[i]);
+    for (i = 0; i < n_threads; ++i)
+        pthread_join(threads[i], NULL);
+    for (i = 0; i < n_threads; ++i) {
+        struct sgemm_thread_args* t = &args[i];
+        CU_ASSERT_DOUBLE_EQUAL(t->max_abs_error, 0, 0.01);
+        for (j = 0; j < 4; ++j)
+            mkl_free(t->C[j]);
+        mkl_free(t->C_orig);
+        mkl_free((float*) t->B);
+        mkl_free((float*) t->A);
+    }
+}
+
+static void test_sgemm_calibration_round_trip();
+static void test_sgemm_calibration_reload();
+
+static enum qmkl_backend backend_before_calibration;
+static char calibration_before[] = "/tmp/qmkl_sgemm_calibration_XXXXXX";
+
+int setup_suite_sgemm_calibration() {
+    // Keep the measured table to put back after the made-up ones.
+    const int fd = mkstemp(calibration_before);
+    if (fd < 0)
+        return -1;
+    close(fd);
+    backend_before_calibration = qmkl_get_backend();
+    if (qmkl_sgemm_calibration_save(calibration_before))
+        return -1;
+    if (!qmkl_backend_available(QMKL_BACKEND_AUTO))
+        return 0;
+    return qmkl_set_backend(QMKL_BACKEND_AUTO);
+}
+
+int teardown_suite_sgemm_calibration() {
+    const int ret = qmkl_sgemm_calibration_load(calibration_before);
+    unlink(calibration_before);
+    if (ret)
+        return ret;
+    return qmkl_set_backend(backend_before_calibration);
+}
+
+void suite_sgemm_calibration() {
+    CU_pSuite suite = CU_add_suite("sgemm calibration", setup_suite_sgemm_calibration, teardown_suite_sgemm_calibration);
+
+    CU_add_test(suite, "round trip", test_sgemm_calibration_round_trip);
+    CU_add_test(suite, "reload while predicting", test_sgemm_calibration_reload);
+}
+
+// A table in which the engine not favoured has a prohibitive overhead.
+static int sgemm_calibration_write(const char* path, const int favour_qpu) {
+    static const char* const variants[] = {"RNN", "RNT", "RTN", "RTT"};
+    FILE* fp = fopen(path, "w");
+    int v;
+    if (fp == NULL)
+        return -1;
+    for (v = 0; v < 4; ++v) {
+        fprintf(fp, "qpu %s %e 2e-10 5e-10\n", variants[v], favour_qpu ? 1e-3 : 1e3);
+        fprintf(fp, "cpu %s %e 1e-9 0\n", variants[v], favour_qpu ? 1e3 : 1e-4);
+    }
+    return fclose(fp);
+}
+
+static struct qmkl_sgemm_decision sgemm_calibration_call(const int M, const int N, const int K) {
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K, N);
+    float* C = mkl_malloc_randoms(M, N);
+    struct qmkl_sgemm_decision d;
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, M, N, K, 1, A, K, B, K, 0, C, N);
+    qmkl_sgemm_last_decision(&d);
+    mkl_free(C);
+    mkl_free(B);
+    mkl_free(A);
+    return d;
+}
+
+void test_sgemm_calibration_round_trip() {
+    // Loaded tables steer the decisions, which a save and load keeps.
+    char path[] = "/tmp/qmkl_sgemm_calibration_XXXXXX";
+    char saved[] = "/tmp/qmkl_sgemm_calibration_XXXXXX";
+    struct qmkl_sgemm_decision d, e;
+    FILE* fp;
+    // Without QPU, cblas_sgemm goes to the CPU without deciding.
+    if (!qmkl_backend_available(QMKL_BACKEND_AUTO))
+        return;
+    close(mkstemp(path));
+    close(mkstemp(saved));
+
+    CU_ASSERT_EQUAL(sgemm_calibration_write(path, 0), 0);
+    CU_ASSERT_EQUAL(qmkl_sgemm_calibration_load(path), 0);
+    d = sgemm_calibration_call(48, 80, 32);
+    CU_ASSERT_EQUAL(d.path, QMKL_SGEMM_PATH_CPU);
+    CU_ASSERT(d.transa == CblasNoTrans && d.transb == CblasTrans);
+    CU_ASSERT(d.m == 48 && d.n == 80 && d.k == 32);
+    CU_ASSERT(d.predicted_cpu < d.predicted_qpu);
+    CU_ASSERT(d.actual > 0);
+
+    CU_ASSERT_EQUAL(sgemm_calibration_write(path, 1), 0);
+    CU_ASSERT_EQUAL(qmkl_sgemm_calibration_load(path), 0);
+    d = sgemm_calibration_call(48, 80, 32);
+    CU_ASSERT_EQUAL(d.path, QMKL_SGEMM_PATH_QPU);
+    CU_ASSERT(d.predicted_qpu < d.predicted_cpu);
+
+    // Saved and loaded back, the table predicts the same times.
+    CU_ASSERT_EQUAL(qmkl_sgemm_calibration_save(saved), 0);
+    CU_ASSERT_EQUAL(sgemm_calibration_write(path, 0), 0);
+    CU_ASSERT_EQUAL(qmkl_sgemm_calibration_load(path), 0);
+    CU_ASSERT_EQUAL(qmkl_sgemm_calibration_load(saved), 0);
+    e = sgemm_calibration_call(48, 80, 32);
+    CU_ASSERT_EQUAL(e.path, QMKL_SGEMM_PATH_QPU);
+    CU_ASSERT_DOUBLE_EQUAL(e.predicted_qpu, d.predicted_qpu, d.predicted_qpu * 1e-6);
+    CU_ASSERT_DOUBLE_EQUAL(e.predicted_cpu, d.predicted_cpu, d.predicted_cpu * 1e-6);
+
+    // An incomplete table is refused and leaves the current one.
+    fp = fopen(path, "w");
+    fprintf(fp, "qpu RNN 1e3 0 0\n");
+    fclose(fp);
+    CU_ASSERT_EQUAL(qmkl_sgemm_calibration_load(path), -1);
+    e = sgemm_calibration_call(48, 80, 32);
+    CU_ASSERT_EQUAL(e.path, QMKL_SGEMM_PATH_QPU);
+
+    unlink(saved);
+    unlink(path);
+}
+
+// Each call decides on one of the tables loaded meanwhile by another thread.
+static void* sgemm_calibration_caller(void* arg) {
+    int* bad = arg;
+    int i;
+    for (i = 0; i < 8; ++i) {
+        const struct qmkl_sgemm_decision d = sgemm_calibration_call(48, 80, 32);
+        if (d.path != QMKL_SGEMM_PATH_QPU && d.path != QMKL_SGEMM_PATH_CPU)
+            ++*bad;
+    }
+    return NULL;
+}
+
+void test_sgemm_calibration_reload() {
+    char path[2][sizeof("/tmp/qmkl_sgemm_calibration_XXXXXX")] = {
+        "/tmp/qmkl_sgemm_calibration_XXXXXX", "/tmp/qmkl_sgemm_calibration_XXXXXX"
+    };
+    pthread_t threads[2];
+    int bad[2] = {0, 0};
+    int i;
+    if (!qmkl_backend_available(QMKL_BACKEND_AUTO))
+        return;
+    for (i = 0; i < 2; ++i) {
+        close(mkstemp(path[i]));
+        CU_ASSERT_EQUAL(sgemm_calibration_write(path[i], i), 0);
+    }
+
+    for (i = 0; i < 2; ++i)
+        pthread_create(&threads[i], NULL, sgemm_calibration_caller, &bad[i]);
+    for (i = 0; i < 32; ++i)
+        CU_ASSERT_EQUAL(qmkl_sgemm_calibration_load(path[i % 2]), 0);
+    for (i = 0; i < 2; ++i) {
+        pthread_join(threads[i], NULL);
+        CU_ASSERT_EQUAL(bad[i], 0);
+    }
+
+    for (i = 0; i < 2; ++i)
+        unlink(path[i]);
+}
+
+static void test_sgemm_hybrid_randoms();
+
+static enum qmkl_backend backend_before_hybrid;
+
+int setup_suite_sgemm_hybrid() {
+    srand(0xDEADBEEF);
+    backend_before_hybrid = qmkl_get_backend();
+    if (!qmkl_backend_available(QMKL_BACKEND_HYBRID))
+        return 0;
+    return qmkl_set_backend(QMKL_BACKEND_HYBRID);
+}
+
+int teardown_suite_sgemm_hybrid() {
+    return qmkl_set_backend(backend_before_hybrid);
+}
+
+void suite_sgemm_hybrid() {
+    CU_pSuite suite = CU_add_suite("sgemm hybrid", setup_suite_sgemm_hybrid, teardown_suite_sgemm_hybrid);
+
+    CU_add_test(suite, "randoms", test_sgemm_hybrid_randoms);
+}
+
+// Rows of the tile of the kernel QPU runs M x N of C in.
+static int sgemm_spec_tile_p(const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+                             const int M, const int N) {
+    unsigned tile_p, tile_r;
+    sgemm_qpu_tile(transa, transb, M, N, &tile_p, &tile_r);
+    return tile_p;
+}
+
+void test_sgemm_hybrid_randoms() {
+    // M a few tiles and a part, so that CPU takes a partial tile, into a padded C.
+    const CBLAS_TRANSPOSE transes[] = {CblasNoTrans, CblasTrans};
+    int ta, tb, i, j;
+    if (!qmkl_backend_available(QMKL_BACKEND_HYBRID))
+        return;
+    for (ta = 0; ta < 2; ++ta) {
+        for (tb = 0; tb < 2; ++tb) {
+            const int N = rand_int_in_range(1, 150);
+            const int tile = sgemm_spec_tile_p(transes[ta], transes[tb], 64 * 4, N);
+            const int M = tile * rand_int_in_range(2, 6) + rand_int_in_range(1, tile - 1);
+            const int K = rand_int_in_range(2, 150);
+            const int ldc = N + rand_int_in_range(1, 16);
+            const int lda = transes[ta] == CblasNoTrans ? K : M;
+            const int ldb = transes[tb] == CblasNoTrans ? N : K;
+            const float alpha = rand_float_in_range(-1.0, 1.0);
+            const float beta = ta == tb ? 0 : rand_float_in_range(-1.0, 1.0);
+            float* A = mkl_malloc_randoms(transes[ta] == CblasNoTrans ? M : K, lda);
+            float* B = mkl_malloc_randoms(transes[tb] == CblasNoTrans ? K : N, ldb);
+            float* C = mkl_malloc_randoms(M, ldc);
+            float* C_orig = malloc(M*ldc*sizeof(float));
+            float* C_packed = malloc(M*N*sizeof(float));
+            float* C_orig_packed = malloc(M*N*sizeof(float));
+            struct qmkl_sgemm_decision d;
+            int padding_kept = 1;
+            memcpy(C_orig, C, M*ldc*sizeof(float));
+
+            cblas_sgemm(CblasRowMajor, transes[ta], transes[tb], M, N, K, alpha, A, lda, B, ldb,
+                        beta, C, ldc);
+            qmkl_sgemm_last_decision(&d);
+            CU_ASSERT_EQUAL(d.path, QMKL_SGEMM_PATH_HYBRID);
+            CU_ASSERT(0 < d.m_qpu && d.m_qpu < M);
+            if (d.m_qpu > 0)
+                CU_ASSERT(d.m_qpu % sgemm_spec_tile_p(transes[ta], transes[tb], d.m_qpu, N) == 0);
+
+            for (i = 0; i < M; ++i) {
+                memcpy(C_packed + i*N, C + i*ldc, N*sizeof(float));
+                memcpy(C_orig_packed + i*N, C_orig + i*ldc, N*sizeof(float));
+                for (j = N; j < ldc; ++j)
+                    if (C[i*ldc+j] != C_orig[i*ldc+j]) padding_kept = 0;
+            }
+            CU_ASSERT(padding_kept);
+            CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(transes[ta], transes[tb], M, N, K,
+                                   alpha, A, B, beta, C_orig_packed, C_packed), 0, 0.001);
+
+            free(C_orig_packed);
+            free(C_packed);
+            free(C_orig);
+            mkl_free(C);
+            mkl_free(B);
+            mkl_free(A);
+        }
+    }
+}
+
+static void test_sgemm_gpu_only_calls();
+static void test_sgemm_gpu_only_batch();
+static void test_sgemm_gpu_only_async();
+
+static enum qmkl_backend backend_before_gpu_only;
+
+int setup_suite_sgemm_gpu_only() {
+    srand(0xDEADBEEF);
+    backend_before_gpu_only = qmkl_get_backend();
+    if (!qmkl_backend_available(QMKL_BACKEND_AUTO))
+        return 0;
+    return qmkl_set_backend(QMKL_BACKEND_AUTO);
+}
+
+int teardown_suite_sgemm_gpu_only() {
+    return qmkl_set_backend(backend_before_gpu_only);
+}
+
+void suite_sgemm_gpu_only() {
+    CU_pSuite suite = CU_add_suite("sgemm gpu only", setup_suite_sgemm_gpu_only, teardown_suite_sgemm_gpu_only);
+
+    CU_add_test(suite, "calls", test_sgemm_gpu_only_calls);
+    CU_add_test(suite, "batch", test_sgemm_gpu_only_batch);
+    CU_add_test(suite, "async", test_sgemm_gpu_only_async);
+}
+
+// GPU-only arrays are filled and read back by the QPU copy kernel, which
+// copies multiples of 4096 floats, at least 8192 of them.
+static int gpu_only_len(const int n) {
+    const int len = (n + 4095) / 4096 * 4096;
+    return len < 8192 ? 8192 : len;
+}
+
+static float* gpu_only_from(const float* x, const int n) {
+    const int len = gpu_only_len(n);
+    float* staged = mkl_malloc(len*sizeof(float), 4096);
+    float* g = qmkl_malloc_flags(len*sizeof(float), 4096, QMKL_MEM_GPU_ONLY);
+    memcpy(staged, x, n*sizeof(float));
+    cblas_scopy(len, staged, 1, g, 1);
+    mkl_free(staged);
+    return g;
+}
+
+static void gpu_only_to(float* y, const float* g, const int n) {
+    const int len = gpu_only_len(n);
+    float* staged = mkl_malloc(len*sizeof(float), 4096);
+    cblas_scopy(len, g, 1, staged, 1);
+    memcpy(y, staged, n*sizeof(float));
+    mkl_free(staged);
+}
+
+void test_sgemm_gpu_only_calls() {
+    // Shapes the CPU would take, k = 1 among them, stay on QPU with one
+    // GPU-only operand, which the emulator keeps the CPU out of.
+    const CBLAS_TRANSPOSE transes[] = {CblasNoTrans, CblasTrans};
+    struct qmkl_sgemm_decision d;
+    int ta, tb, g;
+    if (!qmkl_backend_available(QMKL_BACKEND_AUTO))
+        return;
+    for (ta = 0; ta < 2; ++ta) {
+        for (tb = 0; tb < 2; ++tb) {
+            for (g = 0; g < 3; ++g) {
+                const int M = rand_int_in_range(1, 40);
+                const int N = rand_int_in_range(1, 40);
+                const int K = g == 0 ? 1 : rand_int_in_range(1, 8);
+                const int lda = transes[ta] == CblasNoTrans ? K : M;
+                const int ldb = transes[tb] == CblasNoTrans ? N : K;
+                const float alpha = rand_float_in_range(-1.0, 1.0);
+                const float beta = rand_float_in_range(-1.0, 1.0);
+                float* A = mkl_malloc_randoms(M, K);
+                float* B = mkl_malloc_randoms(K, N);
+                float* C = mkl_malloc_randoms(M, N);
+                float* C_orig = malloc(M*N*sizeof(float));
+                float* A_gpu = g == 0 ? gpu_only_from(A, M*K) : A;
+                float* B_gpu = g == 1 ? gpu_only_from(B, K*N) : B;
+                float* C_gpu = g == 2 ? gpu_only_from(C, M*N) : C;
+                memcpy(C_orig, C, M*N*sizeof(float));
+                cblas_sgemm(CblasRowMajor, transes[ta], transes[tb], M, N, K, alpha,
+                            A_gpu, lda, B_gpu, ldb, beta, C_gpu, N);
+                qmkl_sgemm_last_decision(&d);
+                CU_ASSERT_EQUAL(d.path, QMKL_SGEMM_PATH_QPU);
+                if (g == 2)
+                    gpu_only_to(C, C_gpu, M*N);
+                CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(transes[ta], transes[tb], M, N, K,
+                                       alpha, A, B, beta, C_orig, C), 0, 0.001);
+                if (g == 0) mkl_free(A_gpu);
+                if (g == 1) mkl_free(B_gpu);
+                if (g == 2) mkl_free(C_gpu);
+                free(C_orig);
+                mkl_free(C);
+                mkl_free(B);
+                mkl_free(A);
+            }
+        }
+    }
+}
+
+void test_sgemm_gpu_only_batch() {
+    // Small problems with a GPU-only C, k = 1 with a GPU-only A, and k = 0
+    // with a GPU-only C, which is rejected and leaves C alone.
+    const int group_count = 3;
+    const MKL_INT group_size[] = {4, 3, 2};
+    const CBLAS_TRANSPOSE transa[] = {CblasNoTrans, CblasTrans, CblasNoTrans};
+    const CBLAS_TRANSPOSE transb[] = {CblasTrans, CblasNoTrans, CblasNoTrans};
+    MKL_INT m[3], n[3], k[3], lda[3], ldb[3], ldc[3];
+    float alpha[3], beta[3];
+    const float* A[9];
+    const float* B[9];
+    float* C[9];
+    const float* A_host[9];
+    float* C_host[9];
+    float* C_orig[9];
+    int g, i, j;
+    if (!qmkl_backend_available(QMKL_BACKEND_AUTO))
+        return;
+    for (g = 0; g < group_count; ++g) {
+        m[g] = rand_int_in_range(1, 40);
+        n[g] = rand_int_in_range(1, 40);
+        k[g] = g == 0 ? rand_int_in_range(2, 8) : g == 1 ? 1 : 0;
+        lda[g] = transa[g] == CblasNoTrans ? (k[g] ? k[g] : 1) : m[g];
+        ldb[g] = transb[g] == CblasNoTrans ? n[g] : k[g];
+        ldc[g] = n[g];
+        alpha[g] = rand_float_in_range(-1.0, 1.0);
+        beta[g] = rand_float_in_range(-1.0, 1.0);
+    }
+    for (g = 0, j = 0; g < group_count; ++g) {
+        for (i = 0; i < group_size[g]; ++i, ++j) {
+            A_host[j] = mkl_malloc_randoms(m[g], k[g] ? k[g] : 1);
+            B[j] = mkl_malloc_randoms(k[g] ? k[g] : 1, n[g]);
+            C_host[j] = mkl_malloc_randoms(m[g], n[g]);
+            C_orig[j] = malloc(m[g]*n[g]*sizeof(float));
+            memcpy(C_orig[j], C_host[j], m[g]*n[g]*sizeof(float));
+            A[j] = g == 1 ? gpu_only_from(A_host[j], m[g]*k[g]) : A_host[j];
+            C[j] = g == 1 ? C_host[j] : gpu_only_from(C_host[j], m[g]*n[g]);
+        }
+    }
+    cblas_sgemm_batch(CblasRowMajor, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, group_count, group_size);
+    for (g = 0, j = 0; g < group_count; ++g) {
+        for (i = 0; i < group_size[g]; ++i, ++j) {
+            if (g != 1) {
+                gpu_only_to(C_host[j], C[j], m[g]*n[g]);
+                mkl_free(C[j]);
+            } else
+                mkl_free((float*) A[j]);
+            if (g == 2) {
+                CU_ASSERT_EQUAL(memcmp(C_host[j], C_orig[j], m[g]*n[g]*sizeof(float)), 0);
+            } else {
+                CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(transa[g], transb[g], m[g], n[g], k[g],
+                                       alpha[g], A_host[j], B[j], beta[g], C_orig[j], C_host[j]), 0, 0.001);
+            }
+            free(C_orig[j]);
+            mkl_free(C_host[j]);
+            mkl_free((float*) B[j]);
+            mkl_free((float*) A_host[j]);
+        }
+    }
+}
+
+void test_sgemm_gpu_only_async() {
+    // Requests with a GPU-only C, run alone or coalesced into a batch.
+    const int n_requests = 8;
+    const int M = 24;
+    const int N = 40;
+    const int K = 16;
+    float* A = mkl_malloc_randoms(M, K);
+    float* B = mkl_malloc_randoms(K, N);
+    float* C[n_requests];
+    float* C_gpu[n_requests];
+    float* C_orig[n_requests];
+    float alpha[n_requests], beta[n_requests];
+    qmkl_request_t requests[n_requests];
+    int i;
+    if (!qmkl_backend_available(QMKL_BACKEND_AUTO)) {
+        mkl_free(B);
+        mkl_free(A);
+        return;
+    }
+    for (i = 0; i < n_requests; ++i) {
+        C[i] = mkl_malloc_randoms(M, N);
+        C_orig[i] = malloc(M*N*sizeof(float));
+        memcpy(C_orig[i], C[i], M*N*sizeof(float));
+        C_gpu[i] = gpu_only_from(C[i], M*N);
+        alpha[i] = rand_float_in_range(-1.0, 1.0);
+        beta[i] = rand_float_in_range(-1.0, 1.0);
+    }
+    for (i = 0; i < n_requests; ++i)
+        requests[i] = cblas_sgemm_async(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K,
+                                        alpha[i], A, K, B, N, beta[i], C_gpu[i], N);
+    for (i = 0; i < n_requests; ++i) {
+        qmkl_wait(requests[i]);
+        gpu_only_to(C[i], C_gpu[i], M*N);
+        CU_ASSERT_DOUBLE_EQUAL(sgemm_ref_max_abs_error(CblasNoTrans, CblasNoTrans, M, N, K,
+                    alpha[i], A, B, beta[i], C_orig[i], C[i]), 0, 0.001);
+        mkl_free(C_gpu[i]);
+        free(C_orig[i]);
+        mkl_free(C[i]);
+    }
+    mkl_free(B);
+    mkl_free(A);
+}
@@ -0,0 +1,390 @@
+# Copyright (c) 2016 Idein Inc. ( http://idein.jp/ )
+# All rights reserved.
+#
+# This software is licensed under a Modified (3-Clause) BSD License.
+# You should have received a copy of this license along with this
+# software. If not, contact the copyright holder above.
+
+# Static cycle and bandwidth estimate of assembled QPU kernels (.qhex).
+#
+# Decodes the instructions, takes every backward branch as a loop from its
+# target to its delay slots and reports, per loop, the issue slots of one
+# iteration, how many issue both an add and a mul op, the stalls and hazards
+# below and the FLOPs and bytes per cycle of one QPU.  Each loop is run three
+# times over a model of the TMU FIFOs and the VPM DMA, the first pass filling
+# them as the code before the loop would have, and the last one counted.
+#
+# Stalls (counted in cycles):
+#   - a TMU load signal before TMU_LATENCY cycles after its request;
+#   - a VPM DMA wait, or the start of the next DMA in the same direction,
+#     before the DMA is done: DMA_LATENCY cycles after it started, plus
+#     its length at DMA_WORDS_PER_CYCLE.
+# Hazards (counted, as they give wrong results rather than stalls):
+#   - a VPM read within VPM_READ_DELAY instructions of its read setup;
+#   - an r4 read within SFU_DELAY instructions of an SFU write.
+#
+# The latencies and the DMA rate are those of the emulator in src/emu/qpu.c,
+# so estimates and QMKL_EMU_STATS can be compared.
+#
+# Bytes are those moved to and from memory: a word per element for each
+# address written to TMU0_S or TMU1_S, and the length of the last VDR or VDW
+# setup for each DMA started.  Setups are decoded when loaded as immediates,
+# directly or through a register that is only ever loaded with one; DMA with
+# other setups is not counted.  Reads and writes of the VPM itself stay
+# within the QPU and are not counted either.
+#
+# The main loop of a kernel is the innermost one with the most FLOPs per
+# iteration, or with the most bytes if none computes.  With --baseline, the
+# FLOPs and bytes per cycle of the main loop of each kernel must be within
+# --tolerance percent of the values there, or this exits with 1; so does a
+# missing baseline or a kernel missing from it.  --update writes the current
+# values to the baseline instead.
+
+from __future__ import print_function
+
+import argparse
+import os
+import re
+import sys
+
+TMU_LATENCY = 9
+DMA_LATENCY = 16
+DMA_WORDS_PER_CYCLE = 4
+VPM_READ_DELAY = 3
+SFU_DELAY = 2
+LANES = 16
+
+SIG_LOAD_TMU0, SIG_LOAD_TMU1 = 10, 11
+SIG_SMALL_IMM, SIG_LOAD_IMM, SIG_BRANCH = 13, 14, 15
+
+FLOAT_ADD_OPS = (1, 2)    # fadd, fsub
+FLOAT_MUL_OPS = (1,)      # fmul
+MOV_ADD_OP = 21           # or, with both operands the same
+MOV_MUL_OP = 4            # v8min, likewise
+COND_NEVER = 0
+
+# Write addresses, and read address VPM_ADDR of the DMA waits.
+TMU_S = (56, 60)          # TMU0_S, TMU1_S
+VPM_SETUP = 49            # VPMVCD_RD_SETUP on A, VPMVCD_WR_SETUP on B
+VPM_ADDR = 50             # VPM_LD_ADDR on A, VPM_ST_ADDR on B
+
+
+class Instruction(object):
+
+    def __init__(self, pc, word):
+        self.pc = pc
+        self.sig = word >> 60
+        self.branch_target = None
+        self.add_op = self.mul_op = 0
+        self.reads = set()      # (file, raddr) of regfile reads
+        self.writes = set()     # (file, waddr) of writes
+        self.muxes = ()
+        self.imm = word & 0xffffffff
+        self.sources = {}       # (file, waddr) to the (file, raddr) moved
+
+        cond_add = (word >> 49) & 7
+        cond_mul = (word >> 46) & 7
+        ws = (word >> 44) & 1
+        waddr_add = (word >> 38) & 0x3f
+        waddr_mul = (word >> 32) & 0x3f
+        file_add, file_mul = ('B', 'A') if ws else ('A', 'B')
+
+        if self.sig == SIG_BRANCH:
+            imm = word & 0xffffffff
+            if imm >= 1 << 31:
+                imm -= 1 << 32
+            if (word >> 51) & 1 and not (word >> 50) & 1:
+                self.branch_target = pc + 4 + imm // 8
+            return
+
+        if cond_add != COND_NEVER:
+            self.writes.add((file_add, waddr_add))
+        if cond_mul != COND_NEVER:
+            self.writes.add((file_mul, waddr_mul))
+        if self.sig == SIG_LOAD_IMM:
+            return
+
+        self.add_op = (word >> 24) & 0x1f
+        self.mul_op = (word >> 29) & 7
+        raddr_a = (word >> 18) & 0x3f
+        raddr_b = (word >> 12) & 0x3f
+        muxes = []
+        if self.add_op:
+            muxes += [(word >> 9) & 7, (word >> 6) & 7]
+        if self.mul_op:
+            muxes += [(word >> 3) & 7, word & 7]
+        self.muxes = tuple(muxes)
+        if 6 in muxes:
+            self.reads.add(('A', raddr_a))
+        if 7 in muxes and self.sig != SIG_SMALL_IMM:
+            self.reads.add(('B', raddr_b))
+
+        regfile = {6: ('A', raddr_a)}
+        if self.sig != SIG_SMALL_IMM:
+            regfile[7] = ('B', raddr_b)
+        for cond, op, mov_op, dst, a, b in (
+                (cond_add, self.add_op, MOV_ADD_OP, (file_add, waddr_add),
+                 (word >> 9) & 7, (word >> 6) & 7),
+                (cond_mul, self.mul_op, MOV_MUL_OP, (file_mul, waddr_mul),
+                 (word >> 3) & 7, word & 7)):
+            if cond != COND_NEVER and op == mov_op and a == b \
+                    and a in regfile:
+                self.sources[dst] = regfile[a]
+
+    def writes_to(self, addrs, file=None):
+        return any(a in addrs and (file is None or f == file)
+                   for f, a in self.writes)
+
+    def reads_from(self, addrs, file=None):
+        return any(a in addrs and (file is None or f == file)
+                   for f, a in self.reads)
+
+    def flops(self):
+        return LANES * ((self.add_op in FLOAT_ADD_OPS)
+                        + (self.mul_op in FLOAT_MUL_OPS))
+
+    def tmu_bytes(self):
+        return 4 * LANES * sum(1 for f, a in self.writes if a in TMU_S)
+
+    def value(self, dst, constants):
+        # The value written to dst, if known statically.
+        if self.sig == SIG_LOAD_IMM:
+            return self.imm
+        return constants.get(self.sources.get(dst))
+
+
+def constants(code):
+    # The registers of the regfiles that are only ever loaded with one
+    # immediate, and that immediate.
+    values = {}
+    for ins in code:
+        for dst in ins.writes:
+            if dst[1] < 32:
+                v = ins.imm if ins.sig == SIG_LOAD_IMM else None
+                values[dst] = v if values.get(dst, v) == v else None
+    return values
+
+
+def dma_length(file, setup):
+    # Bytes of the DMA a VDR (on A) or VDW (on B) setup describes, or None
+    # if the setup is not one or is unknown.
+    if setup is None:
+        return None
+    if file == 'A':
+        modew = (setup >> 28) & 7
+        if not setup >> 31 or modew == 1:   # VPM read or VDR stride setup
+            return None
+        rows, cols = (setup >> 16) & 0xf or 16, (setup >> 20) & 0xf or 16
+    else:
+        modew = setup & 7
+        if setup >> 30 != 2:                # VPM write or VDW stride setup
+            return None
+        rows, cols = (setup >> 23) & 0x7f or 128, (setup >> 16) & 0x7f or 128
+    return rows * cols * (4 if modew == 0 else 2 if modew < 4 else 1)
+
+
+def parse_qhex(text):
+    text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+    text = re.sub(r'(//|#|;).*', '', text)
+    words = [int(w, 16) for w in re.findall(r'0x[0-9a-fA-F]+', text)]
+    if len(words) % 2:
+        raise ValueError('odd number of words')
+    return [Instruction(i, words[2 * i] | words[2 * i + 1] << 32)
+            for i in range(len(words) // 2)]
+
+
+class Loop(object):
+
+    def __init__(self, code, branch):
+        self.code = code
+        self.start = code[branch].branch_target
+        self.branch = branch
+        self.end = min(branch + 4, len(code))   # with the delay slots
+        self.body = code[self.start:self.end]
+        self.inner = False
+
+    def contains(self, other):
+        return (self.start <= other.start and other.end <= self.end
+                and self is not other)
+
+    def dma_setups(self, ins, dma_len, values):
+        for f in ('A', 'B'):
+            if ins.writes_to((VPM_SETUP,), f):
+                n = dma_length(f, ins.value((f, VPM_SETUP), values))
+                if n is not None:
+                    dma_len[f] = n
+
+    def estimate(self, values):
+        tmu = {SIG_LOAD_TMU0: [], SIG_LOAD_TMU1: []}
+        dma = {'A': None, 'B': None}
+        dma_len = {'A': 0, 'B': 0}
+        cycle = 0
+        for ins in self.code[:self.start]:
+            self.dma_setups(ins, dma_len, values)
+        for rep in range(3):
+            if rep == 2:
+                first = cycle
+                self.stall_tmu = self.stall_dma = 0
+                self.hazards = []
+                self.bytes = 0
+            last_rd_setup = last_sfu = None
+            for n, ins in enumerate(self.body):
+                counted = rep == 2
+                # Waits happen before the instruction issues.
+                for sig in (SIG_LOAD_TMU0, SIG_LOAD_TMU1):
+                    if ins.sig == sig:
+                        ready = tmu[sig].pop(0) if tmu[sig] else cycle
+                        if ready > cycle:
+                            if counted:
+                                self.stall_tmu += ready - cycle
+                            cycle = ready
+                for f in ('A', 'B'):
+                    if (ins.reads_from((VPM_ADDR,), f)
+                            or ins.writes_to((VPM_ADDR,), f)) \
+                            and dma[f] is not None:
+                        if dma[f] > cycle:
+                            if counted:
+                                self.stall_dma += dma[f] - cycle
+                            cycle = dma[f]
+                if ins.reads_from((48,)) and last_rd_setup is not None \
+                        and n - last_rd_setup < VPM_READ_DELAY and counted:
+                    self.hazards.append((ins.pc, 'VPM read right after '
+                                                 'its setup'))
+                if 4 in ins.muxes and last_sfu is not None \
+                        and n - last_sfu <= SFU_DELAY and counted:
+                    self.hazards.append((ins.pc, 'r4 read before the SFU '
+                                                 'result'))
+                # Effects.
+                if ins.writes_to(range(56, 60)):
+                    tmu[SIG_LOAD_TMU0].append(cycle + TMU_LATENCY)
+                if ins.writes_to(range(60, 64)):
+                    tmu[SIG_LOAD_TMU1].append(cycle + TMU_LATENCY)
+                self.dma_setups(ins, dma_len, values)
+                for f in ('A', 'B'):
+                    if ins.writes_to((VPM_ADDR,), f):
+                        dma[f] = cycle + DMA_LATENCY \
+                            + dma_len[f] // 4 // DMA_WORDS_PER_CYCLE
+                        if counted:
+                            self.bytes += dma_len[f]
+                if counted:
+                    self.bytes += ins.tmu_bytes()
+                if ins.writes_to((VPM_SETUP,), 'A'):
+                    last_rd_setup = n
+                if ins.writes_to(range(52, 56)):
+                    last_sfu = n
+                cycle += 1
+        self.cycles = cycle - first
+        self.slots = len(self.body)
+        alu = [i for i in self.body if i.sig < SIG_LOAD_IMM]
+        self.dual = sum(1 for i in alu if i.add_op and i.mul_op)
+        self.ops = sum((i.add_op != 0) + (i.mul_op != 0) for i in alu)
+        self.flops = sum(i.flops() for i in self.body)
+
+
+def analyze(code):
+    loops = [Loop(code, n) for n, ins in enumerate(code)
+             if ins.branch_target is not None and ins.branch_target <= n]
+    values = constants(code)
+    for loop in loops:
+        loop.inner = not any(loop.contains(other) for other in loops)
+        loop.estimate(values)
+    inner = [l for l in loops if l.inner]
+    main = max(inner, key=lambda l: (l.flops, l.bytes, l.slots)) \
+        if inner else None
+    return loops, main
+
+
+def report(name, code, loops, main, out):
+    print('{}: {} instructions, {} loops'.format(name, len(code), len(loops)),
+          file=out)
+    for loop in loops:
+        print('  loop 0x{:04x}-0x{:04x}{}{}'.format(
+            8 * loop.start, 8 * (loop.end - 1),
+            ' (inner)' if loop.inner else '',
+            ' (main)' if loop is main else ''), file=out)
+        print('    {} issue slots, {} dual-issue ({:.0%}), {} of {} ALU ops '
+              'used ({:.0%})'.format(
+                  loop.slots, loop.dual, float(loop.dual) / loop.slots,
+                  loop.ops, 2 * loop.slots, loop.ops / (2.0 * loop.slots)),
+              file=out)
+        print('    {} cycles: {} stalled on TMU, {} on DMA'.format(
+            loop.cycles, loop.stall_tmu, loop.stall_dma), file=out)
+        print('    {} FLOPs, {:.2f} per cycle; {} bytes, {:.2f} per cycle'
+              .format(loop.flops, float(loop.flops) / loop.cycles,
+                      loop.bytes, float(loop.bytes) / loop.cycles), file=out)
+        for pc, what in loop.hazards:
+            print('    hazard at 0x{:04x}: {}'.format(8 * pc, what),
+                  file=out)
+
+
+def read_baseline(path):
+    baseline = {}
+    with open(path) as f:
+        for line in f:
+            line = line.split('#', 1)[0].split()
+            if line:
+                baseline[line[0]] = (float(line[1]), float(line[2]))
+    return baseline
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Estimate cycles and bandwidth of QPU kernel loops.')
+    parser.add_argument('qhex', nargs='+')
+    parser.add_argument('--baseline',
+                        help='file of kernel, FLOPs and bytes per cycle')
+    parser.add_argument('--tolerance', type=float, default=5.0,
+                        help='allowed regression in percent (default 5)')
+    parser.add_argument('--update', action='store_true',
+                        help='write the current values to the baseline')
+    args = parser.parse_args()
+
+    baseline = {}
+    if args.baseline:
+        if os.path.exists(args.baseline):
+            baseline = read_baseline(args.baseline)
+        elif not args.update:
+            print('{}: no such baseline; write it with --update'
+                  .format(args.baseline), file=sys.stderr)
+            return 1
+    current = {}
+    failed = False
+
+    for path in args.qhex:
+        name = os.path.splitext(os.path.basename(path))[0]
+        with open(path) as f:
+            code = parse_qhex(f.read())
+        loops, main = analyze(code)
+        report(name, code, loops, main, sys.stdout)
+        if main is None:
+            continue
+        current[name] = (float(main.flops) / main.cycles,
+                         float(main.bytes) / main.cycles)
+        if args.update or not args.baseline:
+            continue
+        if name not in baseline:
+            print('{}: not in {}; add it with --update'
+                  .format(name, args.baseline), file=sys.stderr)
+            failed = True
+            continue
+        for what, now, then in zip(('FLOPs', 'bytes'), current[name],
+                                   baseline[name]):
+            if now < then * (1 - args.tolerance / 100):
+                print('{}: {} per cycle of the main loop regressed from '
+                      '{:.2f} to {:.2f}'.format(name, what, then, now),
+                      file=sys.stderr)
+                failed = True
+
+    if args.update and args.baseline:
+        baseline.update(current)
+        with open(args.baseline, 'w') as f:
+            print('# kernel  FLOPs/cycle  bytes/cycle (of the main loop, '
+                  'see tools/qpu_estimate.py)', file=f)
+            for name in sorted(baseline):
+                print('{} {:.2f} {:.2f}'.format(name, *baseline[name]),
+                      file=f)
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())